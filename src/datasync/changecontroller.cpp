@@ -4,8 +4,12 @@
 #include "exchangeengine_p.h"
 #include "synchelper_p.h"
 #include "changeemitter_p.h"
+#include "remoteconnector_p.h"
+
+#include <QtCore/QCryptographicHash>
 
 using namespace QtDataSync;
+using std::tie;
 
 #define QTDATASYNC_LOG QTDATASYNC_LOG_CONTROLLER
 
@@ -13,9 +17,11 @@ ChangeController::ChangeController(const Defaults &defaults, QObject *parent) :
 	Controller("change", defaults, parent),
 	_store(nullptr),
 	_emitter(nullptr),
+	_connectorSettings(nullptr),
 	_uploadingEnabled(false),
 	_uploadLimit(10), //good default
 	_activeUploads(),
+	_activeRequests(),
 	_changeEstimate(0)
 {}
 
@@ -25,6 +31,8 @@ void ChangeController::initialize(const QVariantHash &params)
 	Q_ASSERT_X(_store, Q_FUNC_INFO, "Missing parameter: store (LocalStore)");
 	_emitter = params.value(QStringLiteral("emitter")).value<ChangeEmitter*>();
 	Q_ASSERT_X(_emitter, Q_FUNC_INFO, "Missing parameter: emitter (ChangeEmitter)");
+	//needed to know the own device id for delta uploads
+	_connectorSettings = defaults().createSettings(this, QStringLiteral("connector"));
 
 	connect(_emitter, &ChangeEmitter::uploadNeeded,
 			this, &ChangeController::changeTriggered);
@@ -48,6 +56,7 @@ void ChangeController::clearUploads()
 	if(!_activeUploads.isEmpty())
 		logDebug() << "Finished uploading changes";
 	_activeUploads.clear();
+	_activeRequests.clear();
 	_changeEstimate = 0;
 }
 
@@ -67,6 +76,8 @@ void ChangeController::uploadDone(const QByteArray &key)
 	try {
 		auto info = _activeUploads.take(key);
 		_store->markUnchanged(info.key, info.version, info.isDelete);
+		if(!info.isDelete && defaults().property(Defaults::DeltaSync).toBool())
+			_store->storeSyncBase(info.key, info.version, info.data);
 		_changeEstimate--;
 		emit progressIncrement();
 		logDebug() << "Completed upload. Marked"
@@ -84,6 +95,11 @@ void ChangeController::uploadDone(const QByteArray &key)
 
 void ChangeController::deviceUploadDone(const QByteArray &key, const QUuid &deviceId)
 {
+	if(_activeRequests.remove({key, deviceId})) {
+		logDebug() << "Completed full data request for device" << deviceId;
+		return;
+	}
+
 	if(!_activeUploads.contains({key, deviceId})) {
 		logWarning() << "Unknown device key completed:" << key.toHex() << deviceId;
 		return;
@@ -107,6 +123,23 @@ void ChangeController::deviceUploadDone(const QByteArray &key, const QUuid &devi
 	}
 }
 
+void ChangeController::requestFullChange(const ObjectKey &key, quint64 version, const QUuid &deviceId)
+{
+	try {
+		SyncHelper::DeltaInfo request;
+		request.type = SyncHelper::DeltaInfo::FullRequest;
+		request.sourceDevice = _connectorSettings->value(RemoteConnector::keyDeviceId).toUuid();
+		//use a different id than the key itself, so the request does not collide with normal uploads
+		auto requestHash = QCryptographicHash::hash(key.hashed() + QByteArrayLiteral("/full"), QCryptographicHash::Sha3_256);
+		_activeRequests.insert({requestHash, deviceId});
+		emit uploadDeviceChange(requestHash, deviceId, SyncHelper::combine(key, version, request));
+		logDebug() << "Requested full data of" << key << "from device" << deviceId;
+	} catch(Exception &e) {
+		logCritical() << "Failed to request full data with error:" << e.what();
+		emit controllerError(tr("Failed to upload changes to server."));
+	}
+}
+
 void ChangeController::changeTriggered()
 {
 	if(_uploadingEnabled)
@@ -180,7 +213,9 @@ void ChangeController::uploadNext(bool emitStarted)
 				try {
 					auto json = _store->readJson(key, file);
 					if(deviceId.isNull()) {
-						emit uploadChange(keyHash, SyncHelper::combine(key, version, json));
+						if(defaults().property(Defaults::DeltaSync).toBool())
+							_activeUploads[key].data = json;
+						emit uploadChange(keyHash, combineUpload(key, version, json));
 						logDebug() << "Started upload of changed" << key
 								   << "( Active uploads:" << _activeUploads.size() << ")";
 					} else {
@@ -210,6 +245,33 @@ void ChangeController::uploadNext(bool emitStarted)
 	}
 }
 
+QByteArray ChangeController::combineUpload(const ObjectKey &key, quint64 version, const QJsonObject &data) const
+{
+	auto fullData = SyncHelper::combine(key, version, data);
+	if(!defaults().property(Defaults::DeltaSync).toBool())
+		return fullData;
+
+	SyncHelper::DeltaInfo delta;
+	delta.sourceDevice = _connectorSettings->value(RemoteConnector::keyDeviceId).toUuid();
+	if(delta.sourceDevice.isNull())
+		return fullData;
+
+	QJsonObject base;
+	tie(delta.baseVersion, delta.baseChecksum, base) = _store->loadSyncBase(key);
+	if(delta.baseVersion == 0 || delta.baseVersion >= version) //no base or base is not older
+		return fullData;
+
+	delta.type = SyncHelper::DeltaInfo::Patch;
+	delta.patch = SyncHelper::createDelta(base, data);
+	auto deltaData = SyncHelper::combine(key, version, delta);
+	if(deltaData.size() < fullData.size()) {
+		logDebug() << "Uploading" << key << "as delta to version" << delta.baseVersion
+				   << "( Saved" << (fullData.size() - deltaData.size()) << "bytes )";
+		return deltaData;
+	} else
+		return fullData;
+}
+
 
 
 ChangeController::ChangeInfo::ChangeInfo() :
@@ -4,6 +4,8 @@
 #include <QtCore/QObject>
 #include <QtCore/QMutex>
 #include <QtCore/QUuid>
+#include <QtCore/QSet>
+#include <QtCore/QSettings>
 
 #include "qtdatasync_global.h"
 #include "objectkey.h"
@@ -57,6 +59,7 @@ public Q_SLOTS:
 
 	void uploadDone(const QByteArray &key);
 	void deviceUploadDone(const QByteArray &key, const QUuid &deviceId);
+	void requestFullChange(const QtDataSync::ObjectKey &key, quint64 version, const QUuid &deviceId);
 
 Q_SIGNALS:
 	void uploadingChanged(bool uploading);
@@ -73,14 +76,19 @@ private:
 		ObjectKey key;
 		quint64 version;
 		bool isDelete;
+		QJsonObject data;
 	};
 
 	LocalStore *_store;
 	ChangeEmitter *_emitter;
+	QSettings *_connectorSettings;
 	bool _uploadingEnabled;
 	int _uploadLimit;
 	QHash<CachedObjectKey, UploadInfo> _activeUploads;
+	QSet<CachedObjectKey> _activeRequests;
 	quint32 _changeEstimate;
+
+	QByteArray combineUpload(const ObjectKey &key, quint64 version, const QJsonObject &data) const;
 };
 
 //not exported, just like the class
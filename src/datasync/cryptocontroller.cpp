@@ -5,6 +5,7 @@
 #include <QtCore/QCryptographicHash>
 #include <QtCore/QDataStream>
 #include <QtCore/QJsonDocument>
+#include <QtCore/QMutex>
 
 #include <cryptopp/eax.h>
 #include <cryptopp/gcm.h>
@@ -65,6 +66,36 @@ public:
 template <typename T>
 using GCM1 = GCM<T>;
 
+// keeps keyed cipher contexts around, so only the iv has to be changed per message
+// each context is used by one thread at a time, but contexts are shared between threads
+class CryptoController::CipherPool
+{
+public:
+	CipherPool(const CipherInfo &info);
+
+	QByteArray encrypt(const QByteArray &salt, const QByteArray &plain);
+	QByteArray decrypt(const QByteArray &salt, const QByteArray &cipher);
+
+private:
+	typedef QSharedPointer<AuthenticatedSymmetricCipher> Context;
+
+	const QSharedPointer<CipherScheme> _scheme;
+	const SecByteBlock _key;
+	QMutex _lock;
+	QVector<Context> _encryptors;
+	QVector<Context> _decryptors;
+
+	Context acquire(QVector<Context> &contexts, bool encryptor, const QByteArray &salt);
+	void release(QVector<Context> &contexts, const Context &context);
+};
+
+namespace {
+
+QByteArray runEncryption(AuthenticatedSymmetricCipher &enc, const QByteArray &plain);
+QByteArray runDecryption(AuthenticatedSymmetricCipher &dec, const QByteArray &cipher);
+
+}
+
 // ------------- KeyScheme class definitions -------------
 
 template <typename TScheme>
@@ -357,7 +388,7 @@ QByteArray CryptoController::serializeSignedMessage(const Message &message)
 tuple<quint32, QByteArray, QByteArray> CryptoController::encryptData(const QByteArray &plain)
 {
 	try {
-		auto info = getInfo(_localCipher);
+		const auto &info = getInfo(_localCipher);
 		QByteArray salt(info.scheme->ivLength(), Qt::Uninitialized);
 		_asymCrypto->rng().GenerateBlock(reinterpret_cast<byte*>(salt.data()), salt.size());
 
@@ -374,7 +405,7 @@ tuple<quint32, QByteArray, QByteArray> CryptoController::encryptData(const QByte
 QByteArray CryptoController::decryptData(quint32 keyIndex, const QByteArray &salt, const QByteArray &cipher) const
 {
 	try {
-		auto info = getInfo(keyIndex);
+		const auto &info = getInfo(keyIndex);
 		return decryptImpl(info, salt, cipher);
 	} catch(CppException &e) {
 		throw CryptoException(defaults(),
@@ -383,6 +414,53 @@ QByteArray CryptoController::decryptData(quint32 keyIndex, const QByteArray &sal
 	}
 }
 
+tuple<quint32, QByteArray, std::function<QByteArray()>> CryptoController::prepareEncryptData(const QByteArray &plain)
+{
+	try {
+		const auto &info = getInfo(_localCipher);
+		QByteArray salt(info.scheme->ivLength(), Qt::Uninitialized);
+		_asymCrypto->rng().GenerateBlock(reinterpret_cast<byte*>(salt.data()), salt.size());
+
+		auto defaults = this->defaults();
+		auto pool = info.pool;
+		return make_tuple(_localCipher, salt, [defaults, pool, salt, plain]() {
+			try {
+				return pool->encrypt(salt, plain);
+			} catch(CppException &e) {
+				throw CryptoException(defaults,
+									  QStringLiteral("Failed to encrypt data for upload"),
+									  e);
+			}
+		});
+	} catch(CppException &e) {
+		throw CryptoException(defaults(),
+							  QStringLiteral("Failed to encrypt data for upload"),
+							  e);
+	}
+}
+
+std::function<QByteArray()> CryptoController::prepareDecryptData(quint32 keyIndex, const QByteArray &salt, const QByteArray &cipher) const
+{
+	try {
+		const auto &info = getInfo(keyIndex);
+		auto defaults = this->defaults();
+		auto pool = info.pool;
+		return [defaults, pool, salt, cipher]() {
+			try {
+				return pool->decrypt(salt, cipher);
+			} catch(CppException &e) {
+				throw CryptoException(defaults,
+									  QStringLiteral("Failed to decrypt downloaded data"),
+									  e);
+			}
+		};
+	} catch(CppException &e) {
+		throw CryptoException(defaults(),
+							  QStringLiteral("Failed to decrypt downloaded data"),
+							  e);
+	}
+}
+
 QByteArray CryptoController::createCmac(const QByteArray &data) const
 {
 	return createCmac(_localCipher, data);
@@ -833,7 +911,10 @@ const CryptoController::CipherInfo &CryptoController::getInfo(quint32 keyIndex)
 		logDebug() << "Loaded stored exchange key for index" << keyIndex;
 	}
 
-	return _loadedChiphers[keyIndex];
+	auto &info = _loadedChiphers[keyIndex];
+	if(!info.pool)
+		info.pool.reset(new CipherPool(info));
+	return info;
 }
 
 void CryptoController::storeCipherKey(quint32 keyIndex) const
@@ -900,36 +981,79 @@ void CryptoController::verifyCmacImpl(const CryptoController::CipherInfo &info,
 	); // QByteArraySource
 }
 
-QByteArray CryptoController::encryptImpl(const CryptoController::CipherInfo &info, const QByteArray &salt, const QByteArray &plain) const
+QByteArray CryptoController::encryptImpl(const CryptoController::CipherInfo &info, const QByteArray &salt, const QByteArray &plain)
 {
+	if(info.pool)
+		return info.pool->encrypt(salt, plain);
+
 	auto enc = info.scheme->encryptor();
 	enc->SetKeyWithIV(info.key.data(), info.key.size(),
 					  reinterpret_cast<const byte*>(salt.constData()), salt.size());
-
-	QByteArray cipher;
-	QByteArraySource(plain, true,
-		new AuthenticatedEncryptionFilter(*enc,
-			new QByteArraySink(cipher)
-		) // AuthenticatedEncryptionFilter
-	); // QByteArraySource
-	return cipher;
+	return runEncryption(*enc, plain);
 }
 
-QByteArray CryptoController::decryptImpl(const CryptoController::CipherInfo &info, const QByteArray &salt, const QByteArray &cipher) const
+QByteArray CryptoController::decryptImpl(const CryptoController::CipherInfo &info, const QByteArray &salt, const QByteArray &cipher)
 {
+	if(info.pool)
+		return info.pool->decrypt(salt, cipher);
+
 	auto dec = info.scheme->decryptor();
 	dec->SetKeyWithIV(info.key.data(), info.key.size(),
 					  reinterpret_cast<const byte*>(salt.constData()), salt.size());
+	return runDecryption(*dec, cipher);
+}
 
-	QByteArray plain;
-	QByteArraySource(cipher, true,
-		new AuthenticatedDecryptionFilter(*dec,
-			new QByteArraySink(plain)
-		) // AuthenticatedDecryptionFilter
-	); // QByteArraySource
+// ------------- CipherPool Implementation -------------
+
+CryptoController::CipherPool::CipherPool(const CipherInfo &info) :
+	_scheme(info.scheme),
+	_key(info.key),
+	_lock(),
+	_encryptors(),
+	_decryptors()
+{}
+
+QByteArray CryptoController::CipherPool::encrypt(const QByteArray &salt, const QByteArray &plain)
+{
+	auto enc = acquire(_encryptors, true, salt);
+	auto cipher = runEncryption(*enc, plain);
+	release(_encryptors, enc); //only reached on success, broken contexts are simply dropped
+	return cipher;
+}
+
+QByteArray CryptoController::CipherPool::decrypt(const QByteArray &salt, const QByteArray &cipher)
+{
+	auto dec = acquire(_decryptors, false, salt);
+	auto plain = runDecryption(*dec, cipher);
+	release(_decryptors, dec);
 	return plain;
 }
 
+CryptoController::CipherPool::Context CryptoController::CipherPool::acquire(QVector<Context> &contexts, bool encryptor, const QByteArray &salt)
+{
+	Context context;
+	{
+		QMutexLocker _(&_lock);
+		if(!contexts.isEmpty())
+			context = contexts.takeLast();
+	}
+
+	if(context) //key schedule was done already, only the iv changes
+		context->Resynchronize(reinterpret_cast<const byte*>(salt.constData()), salt.size());
+	else {
+		context = encryptor ? _scheme->encryptor() : _scheme->decryptor();
+		context->SetKeyWithIV(_key.data(), _key.size(),
+							  reinterpret_cast<const byte*>(salt.constData()), salt.size());
+	}
+	return context;
+}
+
+void CryptoController::CipherPool::release(QVector<Context> &contexts, const Context &context)
+{
+	QMutexLocker _(&_lock);
+	contexts.append(context);
+}
+
 // ------------- ClientCrypto Implementation -------------
 
 ClientCrypto::ClientCrypto(QObject *parent) :
@@ -1383,4 +1507,26 @@ KeyStore *ExtendedFactory::createInstance(const QString &key, const Defaults &de
 		return nullptr;
 }
 
+QByteArray runEncryption(AuthenticatedSymmetricCipher &enc, const QByteArray &plain)
+{
+	QByteArray cipher;
+	QByteArraySource(plain, true,
+		new AuthenticatedEncryptionFilter(enc,
+			new QByteArraySink(cipher)
+		) // AuthenticatedEncryptionFilter
+	); // QByteArraySource
+	return cipher;
+}
+
+QByteArray runDecryption(AuthenticatedSymmetricCipher &dec, const QByteArray &cipher)
+{
+	QByteArray plain;
+	QByteArraySource(cipher, true,
+		new AuthenticatedDecryptionFilter(dec,
+			new QByteArraySink(plain)
+		) // AuthenticatedDecryptionFilter
+	); // QByteArraySource
+	return plain;
+}
+
 }
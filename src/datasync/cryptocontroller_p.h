@@ -2,6 +2,7 @@
 #define QTDATASYNC_CRYPTOCONTROLLER_P_H
 
 #include <tuple>
+#include <functional>
 
 #include <QtCore/QObject>
 #include <QtCore/QUuid>
@@ -89,6 +90,9 @@ public:
 	//used for transport encryption of actual data
 	std::tuple<quint32, QByteArray, QByteArray> encryptData(const QByteArray &data); //(keyIndex, salt, data)
 	QByteArray decryptData(quint32 keyIndex, const QByteArray &salt, const QByteArray &cipher) const;
+	//same as above, but returns jobs that can be run on any thread. Must be prepared on the controllers thread
+	std::tuple<quint32, QByteArray, std::function<QByteArray()>> prepareEncryptData(const QByteArray &data); //(keyIndex, salt, job)
+	std::function<QByteArray()> prepareDecryptData(quint32 keyIndex, const QByteArray &salt, const QByteArray &cipher) const;
 
 	// cmac generation for verification of key updates etc.
 	QByteArray createCmac(const QByteArray &data) const;
@@ -137,9 +141,11 @@ Q_SIGNALS:
 
 private:
 	//dont export private classes
+	class CipherPool;
 	struct CipherInfo {
 		QSharedPointer<CipherScheme> scheme;
 		CryptoPP::SecByteBlock key;
+		QSharedPointer<CipherPool> pool; //only for loaded keys
 	};
 
 	static const byte PwPurpose;
@@ -178,8 +184,8 @@ private:
 
 	QByteArray createCmacImpl(const CipherInfo &info, const QByteArray &data) const;
 	void verifyCmacImpl(const CipherInfo &info, const QByteArray &data, const QByteArray &mac) const;
-	QByteArray encryptImpl(const CipherInfo &info, const QByteArray &salt, const QByteArray &plain) const;
-	QByteArray decryptImpl(const CipherInfo &info, const QByteArray &salt, const QByteArray &cipher) const;
+	static QByteArray encryptImpl(const CipherInfo &info, const QByteArray &salt, const QByteArray &plain);
+	static QByteArray decryptImpl(const CipherInfo &info, const QByteArray &salt, const QByteArray &cipher);
 };
 
 class Q_DATASYNC_EXPORT ClientCrypto : public AsymmetricCrypto
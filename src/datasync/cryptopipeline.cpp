@@ -0,0 +1,158 @@
+#include "cryptopipeline_p.h"
+
+#include <QtCore/QRunnable>
+
+using namespace QtDataSync;
+
+namespace {
+
+class CryptoRunnable : public QRunnable
+{
+public:
+	typedef std::function<void(const QByteArray &, const QSharedPointer<Exception> &)> Callback;
+
+	CryptoRunnable(const CryptoPipeline::Job &job, const Callback &callback);
+
+	void run() override;
+
+private:
+	const CryptoPipeline::Job _job;
+	const Callback _callback;
+};
+
+QSharedPointer<Exception> runJob(const CryptoPipeline::Job &job, QByteArray &result);
+
+}
+
+CryptoPipeline::CryptoPipeline(int threadCount, QObject *parent) :
+	QObject(parent),
+	_pool(nullptr),
+	_generation(0),
+	_nextIndex(0),
+	_slots()
+{
+	if(threadCount > 0) {
+		_pool = new QThreadPool(this);
+		_pool->setMaxThreadCount(threadCount);
+	}
+}
+
+CryptoPipeline::~CryptoPipeline()
+{
+	//running jobs post their results to this object, so they must be done before it is gone
+	if(_pool) {
+		_pool->clear();
+		_pool->waitForDone();
+	}
+}
+
+int CryptoPipeline::threadCount() const
+{
+	return _pool ? _pool->maxThreadCount() : 0;
+}
+
+bool CryptoPipeline::isIdle() const
+{
+	return _slots.isEmpty();
+}
+
+void CryptoPipeline::enqueue(const Job &job, const ResultHandler &onResult, const ErrorHandler &onError)
+{
+	auto index = _nextIndex++;
+	Slot slot;
+	slot.onResult = onResult;
+	slot.onError = onError;
+	_slots.insert(index, slot);
+
+	if(_pool) {
+		auto generation = _generation;
+		_pool->start(new CryptoRunnable(job, [this, generation, index](const QByteArray &result, const QSharedPointer<Exception> &error) {
+			QMetaObject::invokeMethod(this, "complete", Qt::QueuedConnection,
+									  Q_ARG(quint64, generation),
+									  Q_ARG(quint64, index),
+									  Q_ARG(QByteArray, result),
+									  Q_ARG(QSharedPointer<QtDataSync::Exception>, error));
+		}));
+	} else {
+		QByteArray result;
+		auto error = runJob(job, result);
+		complete(_generation, index, result, error);
+	}
+}
+
+void CryptoPipeline::enqueue(const Step &step)
+{
+	Slot slot;
+	slot.ready = true;
+	slot.step = step;
+	_slots.insert(_nextIndex++, slot);
+	flush();
+}
+
+void CryptoPipeline::reset()
+{
+	_generation++;
+	_slots.clear();
+	if(_pool)
+		_pool->clear();
+}
+
+void CryptoPipeline::complete(quint64 generation, quint64 index, const QByteArray &result, const QSharedPointer<Exception> &error)
+{
+	if(generation != _generation)
+		return;
+
+	auto it = _slots.find(index);
+	if(it == _slots.end())
+		return;
+	it->ready = true;
+	it->result = result;
+	it->error = error;
+	flush();
+}
+
+void CryptoPipeline::flush()
+{
+	//handlers may enqueue or reset, so always take the slot out before calling them
+	while(!_slots.isEmpty() && _slots.first().ready) {
+		auto slot = _slots.take(_slots.firstKey());
+		if(slot.step)
+			slot.step();
+		else if(slot.error)
+			slot.onError(*slot.error);
+		else
+			slot.onResult(slot.result);
+	}
+}
+
+
+
+namespace {
+
+CryptoRunnable::CryptoRunnable(const CryptoPipeline::Job &job, const Callback &callback) :
+	_job(job),
+	_callback(callback)
+{
+	setAutoDelete(true);
+}
+
+void CryptoRunnable::run()
+{
+	QByteArray result;
+	auto error = runJob(_job, result);
+	_callback(result, error);
+}
+
+QSharedPointer<Exception> runJob(const CryptoPipeline::Job &job, QByteArray &result)
+{
+	try {
+		result = job();
+		return {};
+	} catch(Exception &e) {
+		return QSharedPointer<Exception>(static_cast<Exception*>(e.clone()));
+	} catch(std::exception &e) {
+		return QSharedPointer<Exception>::create(QString(), QString::fromUtf8(e.what()));
+	}
+}
+
+}
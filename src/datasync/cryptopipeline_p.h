@@ -0,0 +1,64 @@
+#ifndef QTDATASYNC_CRYPTOPIPELINE_P_H
+#define QTDATASYNC_CRYPTOPIPELINE_P_H
+
+#include <functional>
+
+#include <QtCore/QObject>
+#include <QtCore/QMap>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QThreadPool>
+
+#include "qtdatasync_global.h"
+#include "exception.h"
+
+namespace QtDataSync {
+
+//runs crypto jobs on a thread pool, but reports the results in order on the thread of the pipeline
+class Q_DATASYNC_EXPORT CryptoPipeline : public QObject
+{
+	Q_OBJECT
+
+public:
+	typedef std::function<QByteArray()> Job;
+	typedef std::function<void(const QByteArray &)> ResultHandler;
+	typedef std::function<void(const Exception &)> ErrorHandler;
+	typedef std::function<void()> Step;
+
+	//threadCount 0 means all jobs are run synchronously
+	explicit CryptoPipeline(int threadCount, QObject *parent = nullptr);
+	~CryptoPipeline() override;
+
+	int threadCount() const;
+	bool isIdle() const;
+
+	//runs the job, the handlers are called after all previously enqueued handlers and steps
+	void enqueue(const Job &job, const ResultHandler &onResult, const ErrorHandler &onError);
+	//runs the step after all previously enqueued handlers and steps
+	void enqueue(const Step &step);
+	//drops all pending results. Jobs that are already running are discarded once completed
+	void reset();
+
+private:
+	struct Slot {
+		bool ready = false;
+		QByteArray result;
+		QSharedPointer<Exception> error;
+		ResultHandler onResult;
+		ErrorHandler onError;
+		Step step;
+	};
+
+	QThreadPool *_pool;
+	quint64 _generation;
+	quint64 _nextIndex;
+	QMap<quint64, Slot> _slots;
+
+	Q_INVOKABLE void complete(quint64 generation, quint64 index, const QByteArray &result, const QSharedPointer<QtDataSync::Exception> &error);
+	void flush();
+};
+
+}
+
+Q_DECLARE_METATYPE(QSharedPointer<QtDataSync::Exception>)
+
+#endif // QTDATASYNC_CRYPTOPIPELINE_P_H
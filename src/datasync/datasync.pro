@@ -41,7 +41,8 @@ HEADERS += \
     migrationhelper.h \
     migrationhelper_p.h \
     remoteconfig.h \
-    remoteconfig_p.h
+    remoteconfig_p.h \
+    cryptopipeline_p.h
 
 SOURCES += \
 	localstore.cpp \
@@ -71,7 +72,8 @@ SOURCES += \
 	emitteradapter.cpp \
 	changeemitter.cpp \
     migrationhelper.cpp \
-    remoteconfig.cpp
+    remoteconfig.cpp \
+    cryptopipeline.cpp
 
 STATECHARTS += \
 	connectorstatemachine.scxml
@@ -74,7 +74,9 @@ public:
 		CryptScheme, //!< @copybrief Setup::encryptionScheme
 		CryptKeyParam, //!< @copybrief Setup::encryptionKeyParam
 		SymScheme, //!< @copybrief Setup::cipherScheme
-		SymKeyParam //!< @copybrief Setup::cipherKeySize
+		SymKeyParam, //!< @copybrief Setup::cipherKeySize
+		DeltaSync, //!< @copybrief Setup::deltaSync
+		CryptoThreads //!< @copybrief Setup::cryptoThreads
 	};
 	Q_ENUM(PropertyKey)
 
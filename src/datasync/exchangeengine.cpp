@@ -106,6 +106,8 @@ void ExchangeEngine::initialize()
 		connectController(_syncController);
 		connect(_syncController, &SyncController::syncDone,
 				_remoteConnector, &RemoteConnector::downloadDone);
+		connect(_syncController, &SyncController::fullChangeRequired,
+				_changeController, &ChangeController::requestFullChange);
 
 		//remote controller
 		connectController(_remoteConnector);
@@ -12,6 +12,7 @@
 
 #include <QtSql/QSqlQuery>
 #include <QtSql/QSqlError>
+#include <QtSql/QSqlRecord>
 
 using namespace QtDataSync;
 using std::function;
@@ -21,6 +22,9 @@ using std::make_tuple;
 #define QTDATASYNC_LOG _logger
 #define SCOPE_ASSERT() Q_ASSERT_X(scope.d->database.isValid(), Q_FUNC_INFO, "Cannot use SyncScope after committing it")
 
+const SyncHelper::ChecksumType LocalStore::LocalChecksum = SyncHelper::Blake2Checksum;
+const int LocalStore::DatabaseVersion = 2;
+
 LocalStore::LocalStore(const Defaults &defaults, QObject *parent) :
 	QObject(parent),
 	_defaults(defaults),
@@ -43,7 +47,9 @@ LocalStore::LocalStore(const Defaults &defaults, QObject *parent) :
 										   "	Version		INTEGER NOT NULL,"
 										   "	File		TEXT,"
 										   "	Checksum	BLOB,"
+										   "	ChecksumType	INTEGER NOT NULL DEFAULT 0,"
 										   "	Changed		INTEGER NOT NULL DEFAULT 1,"
+										   "	ChangeSeq	INTEGER,"
 										   "	PRIMARY KEY(Type, Id)"
 										   ") WITHOUT ROWID;"));
 		if(!createQuery.exec()) {
@@ -72,6 +78,28 @@ LocalStore::LocalStore(const Defaults &defaults, QObject *parent) :
 		}
 		logDebug() << "Created DeviceUploads table";
 	}
+
+	if(!_database->tables().contains(QStringLiteral("SyncBases"))) {
+		QSqlQuery createQuery(_database);
+		createQuery.prepare(QStringLiteral("CREATE TABLE IF NOT EXISTS SyncBases ( "
+										   "	Type		TEXT NOT NULL, "
+										   "	Id			TEXT NOT NULL, "
+										   "	Version		INTEGER NOT NULL, "
+										   "	Checksum	BLOB NOT NULL, "
+										   "	Data		BLOB NOT NULL, "
+										   "	PRIMARY KEY(Type, Id), "
+										   "	FOREIGN KEY(Type, Id) REFERENCES DataIndex ON DELETE CASCADE "
+										   ") WITHOUT ROWID;"));
+		if(!createQuery.exec()) {
+			throw LocalStoreException(_defaults,
+									  QByteArrayLiteral("any"),
+									  createQuery.executedQuery().simplified(),
+									  createQuery.lastError().text());
+		}
+		logDebug() << "Created SyncBases table";
+	}
+
+	upgradeDatabase();
 }
 
 LocalStore::~LocalStore() {}
@@ -427,16 +455,14 @@ void LocalStore::reset(bool keepData)
 quint32 LocalStore::changeCount() const
 {
 	QSqlQuery countQuery(_database);
-	countQuery.prepare(QStringLiteral("SELECT Sum(rows) FROM ( "
-									  "		SELECT Count(*) AS rows FROM DataIndex "
-									  "		WHERE Changed = 1"
-									  "		UNION ALL"
-									  "		SELECT Count(*) AS rows FROM DataIndex "
-									  "		INNER JOIN DeviceUploads "
+	//changed entries are counted by triggers, device uploads only exist temporarily after adding devices
+	countQuery.prepare(QStringLiteral("SELECT Pending + ( "
+									  "		SELECT Count(*) FROM DeviceUploads "
+									  "		INNER JOIN DataIndex "
 									  "		ON DataIndex.Type = DeviceUploads.Type "
 									  "		AND DataIndex.Id = DeviceUploads.Id "
 									  "		WHERE NOT (DataIndex.Changed = 1 AND File IS NULL)"
-									  ")"));
+									  ") FROM ChangeTracking WHERE Id = 0"));
 	exec(countQuery);
 
 	if(countQuery.first())
@@ -451,7 +477,7 @@ void LocalStore::loadChanges(int limit, const function<bool(ObjectKey, quint64,
 
 	try {
 		QSqlQuery readChangesQuery(_database);
-		readChangesQuery.prepare(QStringLiteral("SELECT Type, Id, Version, File FROM DataIndex WHERE Changed = 1 LIMIT ?"));
+		readChangesQuery.prepare(QStringLiteral("SELECT Type, Id, Version, File FROM DataIndex WHERE Changed = 1 ORDER BY ChangeSeq LIMIT ?"));
 		readChangesQuery.addBindValue(limit);
 		exec(readChangesQuery);
 
@@ -513,17 +539,27 @@ void LocalStore::removeDeviceChange(const ObjectKey &key, const QUuid &deviceId)
 	exec(rmDeviceQuery);
 }
 
+tuple<quint64, QByteArray, QJsonObject> LocalStore::loadSyncBase(const ObjectKey &key) const
+{
+	return loadSyncBaseImpl(_database, key);
+}
+
+void LocalStore::storeSyncBase(const ObjectKey &key, quint64 version, const QJsonObject &data)
+{
+	storeSyncBaseImpl(_database, key, version, data);
+}
+
 LocalStore::SyncScope LocalStore::startSync(const ObjectKey &key) const
 {
 	return SyncScope(_defaults, key, const_cast<LocalStore*>(this));
 }
 
-tuple<LocalStore::ChangeType, quint64, QString, QByteArray> LocalStore::loadChangeInfo(SyncScope &scope) const
+tuple<LocalStore::ChangeType, quint64, QString, QByteArray, SyncHelper::ChecksumType> LocalStore::loadChangeInfo(SyncScope &scope) const
 {
 	SCOPE_ASSERT();
 
 	QSqlQuery loadChangeQuery(scope.d->database);
-	loadChangeQuery.prepare(QStringLiteral("SELECT Version, File, Checksum FROM DataIndex WHERE Type = ? AND Id = ?"));
+	loadChangeQuery.prepare(QStringLiteral("SELECT Version, File, Checksum, ChecksumType FROM DataIndex WHERE Type = ? AND Id = ?"));
 	loadChangeQuery.addBindValue(scope.d->key.typeName);
 	loadChangeQuery.addBindValue(scope.d->key.id);
 	exec(loadChangeQuery);
@@ -532,12 +568,13 @@ tuple<LocalStore::ChangeType, quint64, QString, QByteArray> LocalStore::loadChan
 		auto version = loadChangeQuery.value(0).toULongLong();
 		auto file = loadChangeQuery.value(1).toString();
 		auto checksum = loadChangeQuery.value(2).toByteArray();
+		auto checksumType = static_cast<SyncHelper::ChecksumType>(loadChangeQuery.value(3).toInt());
 		if(file.isNull())
-			return make_tuple(ExistsDeleted, version, QString(), QByteArray());
+			return make_tuple(ExistsDeleted, version, QString(), QByteArray(), LocalChecksum);
 		else
-			return make_tuple(Exists, version, file, checksum);
+			return make_tuple(Exists, version, file, checksum, checksumType);
 	} else
-		return make_tuple(NoExists, 0, QString(), QByteArray());
+		return make_tuple(NoExists, 0, QString(), QByteArray(), LocalChecksum);
 }
 
 void LocalStore::updateVersion(SyncScope &scope, quint64 oldVersion, quint64 newVersion, bool changed)
@@ -562,11 +599,11 @@ void LocalStore::updateVersion(SyncScope &scope, quint64 oldVersion, quint64 new
 	}
 }
 
-void LocalStore::storeChanged(SyncScope &scope, quint64 version, const QString &fileName, const QJsonObject &data, bool changed, LocalStore::ChangeType localState)
+void LocalStore::storeChanged(SyncScope &scope, quint64 version, const QString &fileName, const QJsonObject &data, bool changed, LocalStore::ChangeType localState, const QByteArray &checksum)
 {
 	SCOPE_ASSERT();
 	Q_ASSERT_X(!scope.d->afterCommit, Q_FUNC_INFO, "Only 1 after commit action can be defined");
-	scope.d->afterCommit = storeChangedImpl(scope.d->database, scope.d->key, version, fileName, data, changed, localState != NoExists);
+	scope.d->afterCommit = storeChangedImpl(scope.d->database, scope.d->key, version, fileName, data, changed, localState != NoExists, checksum);
 }
 
 void LocalStore::storeDeleted(SyncScope &scope, quint64 version, bool changed, ChangeType localState)
@@ -647,6 +684,28 @@ void LocalStore::markUnchanged(SyncScope &scope, quint64 oldVersion, bool isDele
 	markUnchangedImpl(scope.d->database, scope.d->key, oldVersion, isDelete);
 }
 
+tuple<quint64, QByteArray, QJsonObject> LocalStore::loadSyncBase(SyncScope &scope) const
+{
+	SCOPE_ASSERT();
+	return loadSyncBaseImpl(scope.d->database, scope.d->key);
+}
+
+void LocalStore::storeSyncBase(SyncScope &scope, quint64 version, const QJsonObject &data)
+{
+	SCOPE_ASSERT();
+	storeSyncBaseImpl(scope.d->database, scope.d->key, version, data);
+}
+
+void LocalStore::removeSyncBase(SyncScope &scope)
+{
+	SCOPE_ASSERT();
+	QSqlQuery removeQuery(scope.d->database);
+	removeQuery.prepare(QStringLiteral("DELETE FROM SyncBases WHERE Type = ? AND Id = ?"));
+	removeQuery.addBindValue(scope.d->key.typeName);
+	removeQuery.addBindValue(scope.d->key.id);
+	exec(removeQuery, scope.d->key);
+}
+
 void LocalStore::commitSync(SyncScope &scope) const
 {
 	SCOPE_ASSERT();
@@ -698,6 +757,92 @@ QString LocalStore::filePath(const ObjectKey &key, const QString &baseName) cons
 	return filePath(typeDirectory(key), baseName);
 }
 
+void LocalStore::upgradeDatabase()
+{
+	QSqlQuery versionQuery(_database);
+	versionQuery.prepare(QStringLiteral("PRAGMA user_version"));
+	exec(versionQuery);
+	if(versionQuery.first() && versionQuery.value(0).toInt() >= DatabaseVersion)
+		return;
+
+	beginWriteTransaction(ObjectKey{"any"}, true);
+	try {
+		//check again, another store might have upgraded it already
+		exec(versionQuery);
+		auto version = versionQuery.first() ? versionQuery.value(0).toInt() : 0;
+		if(version < DatabaseVersion) {
+			// version 1: type of the checksum in the DataIndex (0 is the old sha3 checksum)
+			if(version < 1 && !_database->record(QStringLiteral("DataIndex")).contains(QStringLiteral("ChecksumType"))) {
+				QSqlQuery alterQuery(_database);
+				alterQuery.prepare(QStringLiteral("ALTER TABLE DataIndex ADD COLUMN ChecksumType INTEGER NOT NULL DEFAULT 0"));
+				exec(alterQuery);
+			}
+
+			// version 2: change sequence, partial index on changed entries and an incremental change counter
+			if(version < 2) {
+				if(!_database->record(QStringLiteral("DataIndex")).contains(QStringLiteral("ChangeSeq"))) {
+					QSqlQuery alterQuery(_database);
+					alterQuery.prepare(QStringLiteral("ALTER TABLE DataIndex ADD COLUMN ChangeSeq INTEGER"));
+					exec(alterQuery);
+				}
+
+				const QStringList statements {
+					QStringLiteral("CREATE INDEX IF NOT EXISTS DataIndexChanges ON DataIndex (ChangeSeq) WHERE Changed = 1"),
+					QStringLiteral("CREATE TABLE IF NOT EXISTS ChangeTracking ( "
+								   "	Id			INTEGER PRIMARY KEY CHECK(Id = 0), "
+								   "	Sequence	INTEGER NOT NULL, "
+								   "	Pending		INTEGER NOT NULL "
+								   ")"),
+					QStringLiteral("INSERT OR REPLACE INTO ChangeTracking (Id, Sequence, Pending) "
+								   "SELECT 0, IFNULL(MAX(ChangeSeq), 0), COUNT(*) FROM DataIndex WHERE Changed = 1"),
+					//newly changed or changed again: assign the next sequence number
+					QStringLiteral("CREATE TRIGGER IF NOT EXISTS DataIndexChangedInsert AFTER INSERT ON DataIndex "
+								   "WHEN NEW.Changed = 1 "
+								   "BEGIN "
+								   "	UPDATE ChangeTracking SET Sequence = Sequence + 1, Pending = Pending + 1 WHERE Id = 0; "
+								   "	UPDATE DataIndex SET ChangeSeq = (SELECT Sequence FROM ChangeTracking WHERE Id = 0) "
+								   "	WHERE Type = NEW.Type AND Id = NEW.Id; "
+								   "END"),
+					QStringLiteral("CREATE TRIGGER IF NOT EXISTS DataIndexChangedUpdate AFTER UPDATE OF Changed, Version ON DataIndex "
+								   "WHEN NEW.Changed = 1 "
+								   "BEGIN "
+								   "	UPDATE ChangeTracking SET Sequence = Sequence + 1, Pending = Pending + (OLD.Changed != 1) WHERE Id = 0; "
+								   "	UPDATE DataIndex SET ChangeSeq = (SELECT Sequence FROM ChangeTracking WHERE Id = 0) "
+								   "	WHERE Type = NEW.Type AND Id = NEW.Id; "
+								   "END"),
+					//no longer changed: only update the counter
+					QStringLiteral("CREATE TRIGGER IF NOT EXISTS DataIndexUnchangedUpdate AFTER UPDATE OF Changed ON DataIndex "
+								   "WHEN OLD.Changed = 1 AND NEW.Changed != 1 "
+								   "BEGIN "
+								   "	UPDATE ChangeTracking SET Pending = Pending - 1 WHERE Id = 0; "
+								   "END"),
+					QStringLiteral("CREATE TRIGGER IF NOT EXISTS DataIndexChangedDelete AFTER DELETE ON DataIndex "
+								   "WHEN OLD.Changed = 1 "
+								   "BEGIN "
+								   "	UPDATE ChangeTracking SET Pending = Pending - 1 WHERE Id = 0; "
+								   "END")
+				};
+				for(const auto &statement : statements) {
+					QSqlQuery upgradeQuery(_database);
+					upgradeQuery.prepare(statement);
+					exec(upgradeQuery);
+				}
+			}
+
+			QSqlQuery updateVersionQuery(_database);
+			updateVersionQuery.prepare(QStringLiteral("PRAGMA user_version = %1").arg(DatabaseVersion));
+			exec(updateVersionQuery);
+			logDebug() << "Upgraded store database from version" << version << "to" << DatabaseVersion;
+		}
+
+		if(!_database->commit())
+			throw LocalStoreException(_defaults, QByteArrayLiteral("<any>"), _database->databaseName(), _database->lastError().text());
+	} catch(...) {
+		_database->rollback();
+		throw;
+	}
+}
+
 void LocalStore::beginReadTransaction(const ObjectKey &key) const
 {
 	if(!_database->transaction())
@@ -726,7 +871,7 @@ void LocalStore::exec(QSqlQuery &query, const ObjectKey &key) const
 	}
 }
 
-function<void()> LocalStore::storeChangedImpl(const DatabaseRef &db, const ObjectKey &key, quint64 version, const QString &fileName, const QJsonObject &data, bool changed, bool existing)
+function<void()> LocalStore::storeChangedImpl(const DatabaseRef &db, const ObjectKey &key, quint64 version, const QString &fileName, const QJsonObject &data, bool changed, bool existing, const QByteArray &checksum)
 {
 	auto tableDir = typeDirectory(key);
 	QScopedPointer<QFileDevice> device;
@@ -765,24 +910,27 @@ function<void()> LocalStore::storeChangedImpl(const DatabaseRef &db, const Objec
 
 	//save key in database
 	QFileInfo info(device->fileName());
+	auto localChecksum = checksum.isNull() ? SyncHelper::jsonHash(data, LocalChecksum) : checksum;
 	if(existing) {
 		QSqlQuery updateQuery(db);
-		updateQuery.prepare(QStringLiteral("UPDATE DataIndex SET Version = ?, File = ?, Checksum = ?, Changed = ? WHERE Type = ? AND Id = ?"));
+		updateQuery.prepare(QStringLiteral("UPDATE DataIndex SET Version = ?, File = ?, Checksum = ?, ChecksumType = ?, Changed = ? WHERE Type = ? AND Id = ?"));
 		updateQuery.addBindValue(version);
 		updateQuery.addBindValue(tableDir.relativeFilePath(info.completeBaseName())); //still update file, in case it was set to NULL
-		updateQuery.addBindValue(SyncHelper::jsonHash(data));
+		updateQuery.addBindValue(localChecksum);
+		updateQuery.addBindValue(static_cast<int>(LocalChecksum));
 		updateQuery.addBindValue(changed);
 		updateQuery.addBindValue(key.typeName);
 		updateQuery.addBindValue(key.id);
 		exec(updateQuery, key);
 	} else {
 		QSqlQuery insertQuery(db);
-		insertQuery.prepare(QStringLiteral("INSERT INTO DataIndex (Type, Id, Version, File, Checksum, Changed) VALUES(?, ?, ?, ?, ?, ?)"));
+		insertQuery.prepare(QStringLiteral("INSERT INTO DataIndex (Type, Id, Version, File, Checksum, ChecksumType, Changed) VALUES(?, ?, ?, ?, ?, ?, ?)"));
 		insertQuery.addBindValue(key.typeName);
 		insertQuery.addBindValue(key.id);
 		insertQuery.addBindValue(version);
 		insertQuery.addBindValue(tableDir.relativeFilePath(info.completeBaseName()));
-		insertQuery.addBindValue(SyncHelper::jsonHash(data));
+		insertQuery.addBindValue(localChecksum);
+		insertQuery.addBindValue(static_cast<int>(LocalChecksum));
 		insertQuery.addBindValue(changed);
 		exec(insertQuery, key);
 	}
@@ -813,6 +961,45 @@ void LocalStore::markUnchangedImpl(const DatabaseRef &db, const ObjectKey &key,
 	exec(completeQuery);
 }
 
+tuple<quint64, QByteArray, QJsonObject> LocalStore::loadSyncBaseImpl(const DatabaseRef &db, const ObjectKey &key) const
+{
+	QSqlQuery loadQuery(db);
+	loadQuery.prepare(QStringLiteral("SELECT Version, Checksum, Data FROM SyncBases WHERE Type = ? AND Id = ?"));
+	loadQuery.addBindValue(key.typeName);
+	loadQuery.addBindValue(key.id);
+	exec(loadQuery, key);
+
+	if(loadQuery.first()) {
+		auto doc = QJsonDocument::fromBinaryData(loadQuery.value(2).toByteArray());
+		if(doc.isObject())
+			return make_tuple(loadQuery.value(0).toULongLong(), loadQuery.value(1).toByteArray(), doc.object());
+		else
+			logWarning() << "Ignoring invalid sync base for" << key;
+	}
+	return make_tuple(0ull, QByteArray(), QJsonObject());
+}
+
+void LocalStore::storeSyncBaseImpl(const DatabaseRef &db, const ObjectKey &key, quint64 version, const QJsonObject &data)
+{
+	//only stored if the dataset itself exists, and never replaces a newer base
+	QSqlQuery storeQuery(db);
+	storeQuery.prepare(QStringLiteral("INSERT OR REPLACE INTO SyncBases (Type, Id, Version, Checksum, Data) "
+									  "SELECT Type, Id, ?, ?, ? FROM DataIndex "
+									  "WHERE Type = ? AND Id = ? AND NOT EXISTS ( "
+									  "		SELECT 1 FROM SyncBases "
+									  "		WHERE Type = ? AND Id = ? AND Version > ? "
+									  ")"));
+	storeQuery.addBindValue(version);
+	storeQuery.addBindValue(SyncHelper::jsonHash(data));
+	storeQuery.addBindValue(QJsonDocument(data).toBinaryData());
+	storeQuery.addBindValue(key.typeName);
+	storeQuery.addBindValue(key.id);
+	storeQuery.addBindValue(key.typeName);
+	storeQuery.addBindValue(key.id);
+	storeQuery.addBindValue(version);
+	exec(storeQuery, key);
+}
+
 // ------------- SyncScope -------------
 
 LocalStore::SyncScope::SyncScope(const Defaults &defaults, const ObjectKey &key, LocalStore *owner) :
@@ -17,6 +17,7 @@
 #include "logger.h"
 #include "exception.h"
 #include "datastore.h"
+#include "synchelper_p.h"
 
 namespace QtDataSync {
 
@@ -32,6 +33,9 @@ public:
 	};
 	Q_ENUM(ChangeType)
 
+	//checksum algorithm used for new entries in the DataIndex
+	static const SyncHelper::ChecksumType LocalChecksum;
+
 	class Q_DATASYNC_EXPORT SyncScope {
 		friend class LocalStore;
 		Q_DISABLE_COPY(SyncScope)
@@ -77,10 +81,12 @@ public:
 	void loadChanges(int limit, const std::function<bool(ObjectKey, quint64, QString, QUuid)> &visitor) const; //(key, version, file, device)
 	void markUnchanged(const ObjectKey &key, quint64 version, bool isDelete);
 	void removeDeviceChange(const ObjectKey &key, const QUuid &deviceId);
+	std::tuple<quint64, QByteArray, QJsonObject> loadSyncBase(const ObjectKey &key) const; //(version, checksum, data)
+	void storeSyncBase(const ObjectKey &key, quint64 version, const QJsonObject &data);
 
 	// sync access
 	SyncScope startSync(const ObjectKey &key) const;
-	std::tuple<QtDataSync::LocalStore::ChangeType, quint64, QString, QByteArray> loadChangeInfo(SyncScope &scope) const; //(changetype, version, filename, checksum)
+	std::tuple<QtDataSync::LocalStore::ChangeType, quint64, QString, QByteArray, QtDataSync::SyncHelper::ChecksumType> loadChangeInfo(SyncScope &scope) const; //(changetype, version, filename, checksum, checksumtype)
 	void updateVersion(SyncScope &scope,
 					   quint64 oldVersion,
 					   quint64 newVersion,
@@ -90,7 +96,8 @@ public:
 					  const QString &filePath,
 					  const QJsonObject &data,
 					  bool changed,
-					  ChangeType localState);
+					  ChangeType localState,
+					  const QByteArray &checksum = {}); //checksum of type LocalChecksum, if already known
 	void storeDeleted(SyncScope &scope,
 					  quint64 version,
 					  bool changed,
@@ -98,6 +105,11 @@ public:
 	void markUnchanged(SyncScope &scope,
 					   quint64 oldVersion,
 					   bool isDelete);
+	std::tuple<quint64, QByteArray, QJsonObject> loadSyncBase(SyncScope &scope) const; //(version, checksum, data)
+	void storeSyncBase(SyncScope &scope,
+					   quint64 version,
+					   const QJsonObject &data);
+	void removeSyncBase(SyncScope &scope);
 	void commitSync(SyncScope &scope) const;
 
 	void prepareAccountAdded(const QUuid &deviceId);
@@ -108,11 +120,15 @@ Q_SIGNALS:
 	void dataResetted();
 
 private:
+	static const int DatabaseVersion;
+
 	Defaults _defaults;
 	Logger *_logger;
 	EmitterAdapter *_emitter;
 	DatabaseRef _database;
 
+	void upgradeDatabase();
+
 	QDir typeDirectory(const ObjectKey &key) const;
 	QString filePath(const QDir &typeDir, const QString &baseName) const;
 	QString filePath(const ObjectKey &key, const QString &baseName) const;
@@ -127,11 +143,18 @@ private:
 																 const QString &filePath,
 																 const QJsonObject &data,
 																 bool changed,
-																 bool existing);
+																 bool existing,
+																 const QByteArray &checksum = {});
 	void markUnchangedImpl(const DatabaseRef &db,
 						   const ObjectKey &key,
 						   quint64 version,
 						   bool isDelete);
+	std::tuple<quint64, QByteArray, QJsonObject> loadSyncBaseImpl(const DatabaseRef &db,
+																 const ObjectKey &key) const;
+	void storeSyncBaseImpl(const DatabaseRef &db,
+						   const ObjectKey &key,
+						   quint64 version,
+						   const QJsonObject &data);
 };
 
 }
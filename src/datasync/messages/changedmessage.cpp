@@ -44,3 +44,16 @@ const QMetaObject *ChangedAckMessage::getMetaObject() const
 {
 	return &staticMetaObject;
 }
+
+
+
+const QVersionNumber ChangedAckBatchMessage::MinimumVersion(3);
+
+ChangedAckBatchMessage::ChangedAckBatchMessage(const QList<quint64> &dataIndexes) :
+	dataIndexes(dataIndexes)
+{}
+
+const QMetaObject *ChangedAckBatchMessage::getMetaObject() const
+{
+	return &staticMetaObject;
+}
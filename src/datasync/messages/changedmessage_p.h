@@ -1,6 +1,8 @@
 #ifndef QTDATASYNC_CHANGEDMESSAGE_P_H
 #define QTDATASYNC_CHANGEDMESSAGE_P_H
 
+#include <QtCore/QVersionNumber>
+
 #include "message_p.h"
 
 namespace QtDataSync {
@@ -67,11 +69,29 @@ protected:
 	const QMetaObject *getMetaObject() const override;
 };
 
+class Q_DATASYNC_EXPORT ChangedAckBatchMessage : public Message
+{
+	Q_GADGET
+
+	Q_PROPERTY(QList<quint64> dataIndexes MEMBER dataIndexes)
+
+public:
+	static const QVersionNumber MinimumVersion;
+
+	ChangedAckBatchMessage(const QList<quint64> &dataIndexes = {});
+
+	QList<quint64> dataIndexes;
+
+protected:
+	const QMetaObject *getMetaObject() const override;
+};
+
 }
 
 Q_DECLARE_METATYPE(QtDataSync::ChangedMessage)
 Q_DECLARE_METATYPE(QtDataSync::ChangedInfoMessage)
 Q_DECLARE_METATYPE(QtDataSync::LastChangedMessage)
 Q_DECLARE_METATYPE(QtDataSync::ChangedAckMessage)
+Q_DECLARE_METATYPE(QtDataSync::ChangedAckBatchMessage)
 
 #endif // QTDATASYNC_CHANGEDMESSAGE_P_H
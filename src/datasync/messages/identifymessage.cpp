@@ -5,7 +5,7 @@ using namespace QtDataSync;
 using byte = CryptoPP::byte;
 #endif
 
-const QVersionNumber InitMessage::CurrentVersion(1); //NOTE update accordingly
+const QVersionNumber InitMessage::CurrentVersion(3); //NOTE update accordingly
 const QVersionNumber InitMessage::CompatVersion(1);
 
 InitMessage::InitMessage() :
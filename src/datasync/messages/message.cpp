@@ -28,6 +28,8 @@ void Message::registerTypes()
 
 	qRegisterMetaType<Utf8String>();
 	qRegisterMetaTypeStreamOperators<Utf8String>();
+	qRegisterMetaType<QList<quint64>>();
+	qRegisterMetaTypeStreamOperators<QList<quint64>>();
 	REGISTER_LIST(QtDataSync::DevicesMessage::DeviceInfo);
 	REGISTER_LIST(QtDataSync::DeviceKeysMessage::DeviceKey);
 	REGISTER_LIST(QtDataSync::NewKeyMessage::KeyUpdate);
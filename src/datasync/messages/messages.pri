@@ -19,7 +19,8 @@ HEADERS += \
     $$PWD/macupdatemessage_p.h \
     $$PWD/keychangemessage_p.h \
     $$PWD/devicekeysmessage_p.h \
-    $$PWD/newkeymessage_p.h
+    $$PWD/newkeymessage_p.h \
+    $$PWD/resumemessage_p.h
 
 SOURCES += \
 	$$PWD/message.cpp \
@@ -42,6 +43,7 @@ SOURCES += \
     $$PWD/macupdatemessage.cpp \
     $$PWD/keychangemessage.cpp \
     $$PWD/devicekeysmessage.cpp \
-    $$PWD/newkeymessage.cpp
+    $$PWD/newkeymessage.cpp \
+    $$PWD/resumemessage.cpp
 
 INCLUDEPATH += $$PWD
@@ -0,0 +1,66 @@
+#include "resumemessage_p.h"
+
+#include <cryptopp/hmac.h>
+#include <cryptopp/sha3.h>
+
+using namespace QtDataSync;
+#if CRYPTOPP_VERSION >= 600
+using byte = CryptoPP::byte;
+#endif
+
+const QVersionNumber ResumeMessage::MinimumVersion(2);
+
+ResumeMessage::ResumeMessage(const QUuid &deviceId, const QString &deviceName, const QByteArray &nonce, const QByteArray &ticket) :
+	InitMessage(nonce),
+	deviceId(deviceId),
+	deviceName(deviceName),
+	ticket(ticket),
+	mac()
+{}
+
+QByteArray ResumeMessage::signatureData() const
+{
+	// nonce, deviceId, deviceName, ticket
+	return nonce +
+			deviceId.toRfc4122() +
+			deviceName.toUtf8() +
+			ticket;
+}
+
+void ResumeMessage::sign(const QByteArray &secret)
+{
+	CryptoPP::HMAC<CryptoPP::SHA3_256> hmac(reinterpret_cast<const byte*>(secret.constData()), secret.size());
+	auto data = signatureData();
+	mac.resize(static_cast<int>(hmac.DigestSize()));
+	hmac.CalculateDigest(reinterpret_cast<byte*>(mac.data()),
+						 reinterpret_cast<const byte*>(data.constData()),
+						 data.size());
+}
+
+bool ResumeMessage::verify(const QByteArray &secret) const
+{
+	CryptoPP::HMAC<CryptoPP::SHA3_256> hmac(reinterpret_cast<const byte*>(secret.constData()), secret.size());
+	if(mac.size() != static_cast<int>(hmac.DigestSize()))
+		return false;
+	auto data = signatureData();
+	return hmac.VerifyDigest(reinterpret_cast<const byte*>(mac.constData()),
+							 reinterpret_cast<const byte*>(data.constData()),
+							 data.size());
+}
+
+const QMetaObject *ResumeMessage::getMetaObject() const
+{
+	return &staticMetaObject;
+}
+
+
+
+ResumeTicketMessage::ResumeTicketMessage(const QByteArray &ticket, const QByteArray &secret) :
+	ticket(ticket),
+	secret(secret)
+{}
+
+const QMetaObject *ResumeTicketMessage::getMetaObject() const
+{
+	return &staticMetaObject;
+}
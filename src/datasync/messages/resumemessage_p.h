@@ -0,0 +1,61 @@
+#ifndef QTDATASYNC_RESUMEMESSAGE_P_H
+#define QTDATASYNC_RESUMEMESSAGE_P_H
+
+#include <QtCore/QUuid>
+#include <QtCore/QVersionNumber>
+
+#include "message_p.h"
+#include "identifymessage_p.h"
+
+namespace QtDataSync {
+
+class Q_DATASYNC_EXPORT ResumeMessage : public InitMessage
+{
+	Q_GADGET
+
+	Q_PROPERTY(QUuid deviceId MEMBER deviceId)
+	Q_PROPERTY(QtDataSync::Utf8String deviceName MEMBER deviceName)
+	Q_PROPERTY(QByteArray ticket MEMBER ticket)
+	Q_PROPERTY(QByteArray mac MEMBER mac)
+
+public:
+	static const QVersionNumber MinimumVersion;
+
+	ResumeMessage(const QUuid &deviceId = {}, const QString &deviceName = {}, const QByteArray &nonce = {}, const QByteArray &ticket = {});
+
+	QUuid deviceId;
+	Utf8String deviceName;
+	QByteArray ticket;
+	QByteArray mac;
+
+	QByteArray signatureData() const;
+	void sign(const QByteArray &secret);
+	bool verify(const QByteArray &secret) const;
+
+protected:
+	const QMetaObject *getMetaObject() const override;
+};
+
+class Q_DATASYNC_EXPORT ResumeTicketMessage : public Message
+{
+	Q_GADGET
+
+	Q_PROPERTY(QByteArray ticket MEMBER ticket)
+	Q_PROPERTY(QByteArray secret MEMBER secret)
+
+public:
+	ResumeTicketMessage(const QByteArray &ticket = {}, const QByteArray &secret = {});
+
+	QByteArray ticket;
+	QByteArray secret; //encrypted with the devices public encryption key
+
+protected:
+	const QMetaObject *getMetaObject() const override;
+};
+
+}
+
+Q_DECLARE_METATYPE(QtDataSync::ResumeMessage)
+Q_DECLARE_METATYPE(QtDataSync::ResumeTicketMessage)
+
+#endif // QTDATASYNC_RESUMEMESSAGE_P_H
@@ -269,7 +269,7 @@ void MigrationRunnable::run()
 					LocalStore::ChangeType type;
 					quint64 version;
 					QString fileName;
-					tie(type, version, fileName, std::ignore) = store.loadChangeInfo(scope);
+					tie(type, version, fileName, std::ignore, std::ignore) = store.loadChangeInfo(scope);
 					if(type != LocalStore::NoExists && !_flags.testFlag(MigrationHelper::MigrateOverwriteData)) {
 						logDebug() << "Skipping" << key << "as it would overwrite existing data";
 						migrationProgress();
@@ -287,7 +287,7 @@ void MigrationRunnable::run()
 						auto scope = store.startSync(key);
 						LocalStore::ChangeType type;
 						quint64 version;
-						tie(type, version, std::ignore, std::ignore) = store.loadChangeInfo(scope);
+						tie(type, version, std::ignore, std::ignore, std::ignore) = store.loadChangeInfo(scope);
 						if(type != LocalStore::NoExists && !_flags.testFlag(MigrationHelper::MigrateOverwriteData)) {
 							logDebug() << "Skipping" << key << "as it would overwrite existing data";
 							migrationProgress();
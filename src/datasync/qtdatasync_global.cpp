@@ -1,6 +1,7 @@
 #include "qtdatasync_global.h"
 #include "objectkey.h"
 #include "changecontroller_p.h"
+#include "cryptopipeline_p.h"
 
 #include "threadedserver_p.h"
 #include "threadedclient_p.h"
@@ -16,6 +17,7 @@ void setupQtDataSync()
 {
 	qRegisterMetaType<QtDataSync::ObjectKey>();
 	qRegisterMetaType<QtDataSync::ChangeController::ChangeInfo>();
+	qRegisterMetaType<QSharedPointer<QtDataSync::Exception>>();
 	qRegisterMetaTypeStreamOperators<QtDataSync::ObjectKey>();
 
 	qRegisterRemoteObjectsServer<QtDataSync::ThreadedServer>(QtDataSync::ThreadedServer::UrlScheme());
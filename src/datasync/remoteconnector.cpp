@@ -3,6 +3,7 @@
 #include "setup_p.h"
 
 #include <QtCore/QSysInfo>
+#include <QtCore/QThread>
 
 #include "registermessage_p.h"
 #include "loginmessage_p.h"
@@ -59,13 +60,21 @@ const QVector<seconds> RemoteConnector::Timeouts = {
 RemoteConnector::RemoteConnector(const Defaults &defaults, QObject *parent) :
 	Controller("connector", defaults, parent),
 	_cryptoController(new CryptoController(defaults, this)),
+	_cryptoPipeline(nullptr),
+	_queuedSends(0),
 	_socket(nullptr),
 	_pingTimer(nullptr),
 	_awaitingPing(false),
 	_stateMachine(nullptr),
 	_retryIndex(0),
 	_expectChanges(false),
+	_ackTimer(nullptr),
+	_batchAcks(false),
+	_pendingAcks(),
 	_deviceId(),
+	_resumeTicket(),
+	_resumeSecret(),
+	_resuming(false),
 	_deviceCache(),
 	_exportsCache(),
 	_activeProofs()
@@ -80,6 +89,13 @@ void RemoteConnector::initialize(const QVariantHash &params)
 {
 	_cryptoController->initialize(params);
 
+	//setup crypto workers
+	auto cryptoThreads = defaults().property(Defaults::CryptoThreads).toInt();
+	if(cryptoThreads < 0)
+		cryptoThreads = QThread::idealThreadCount();
+	_cryptoPipeline = new CryptoPipeline(cryptoThreads, this);
+	logDebug() << "Using" << _cryptoPipeline->threadCount() << "threads for data encryption";
+
 	//setup keepalive timer
 	_pingTimer = new QTimer(this);
 	_pingTimer->setInterval(sValue(keyRemoteKeepaliveTimeout).toInt());
@@ -87,6 +103,13 @@ void RemoteConnector::initialize(const QVariantHash &params)
 	connect(_pingTimer, &QTimer::timeout,
 			this, &RemoteConnector::ping);
 
+	//acks of downloads that are completed at once are sent together
+	_ackTimer = new QTimer(this);
+	_ackTimer->setInterval(0);
+	_ackTimer->setSingleShot(true);
+	connect(_ackTimer, &QTimer::timeout,
+			this, &RemoteConnector::sendAcks);
+
 	//setup SM
 	_stateMachine = new ConnectorStateMachine(this);
 	_stateMachine->connectToState(QStringLiteral("Connecting"),
@@ -331,8 +354,18 @@ void RemoteConnector::uploadData(const QByteArray &key, const QByteArray &change
 
 	try {
 		ChangeMessage message(key);
-		tie(message.keyIndex, message.salt, message.data) = _cryptoController->encryptData(changeData);
-		sendMessage(message);
+		CryptoPipeline::Job job;
+		tie(message.keyIndex, message.salt, job) = _cryptoController->prepareEncryptData(changeData);
+		_queuedSends++;
+		_cryptoPipeline->enqueue(job, [this, message](const QByteArray &cipher) mutable {
+			_queuedSends--;
+			message.data = cipher;
+			//already in order, as it is called by the pipeline
+			_socket->sendBinaryMessage(message.serialize());
+		}, [this](const Exception &e) {
+			_queuedSends--;
+			onError({ErrorMessage::ClientError, e.qWhat()}, Message::messageName<ChangeMessage>());
+		});
 	} catch(Exception &e) {
 		onError({ErrorMessage::ClientError, e.qWhat()}, Message::messageName<ChangeMessage>());
 	}
@@ -347,8 +380,18 @@ void RemoteConnector::uploadDeviceData(const QByteArray &key, const QUuid &devic
 
 	try {
 		DeviceChangeMessage message(key, deviceId);
-		tie(message.keyIndex, message.salt, message.data) = _cryptoController->encryptData(changeData);
-		sendMessage(message);
+		CryptoPipeline::Job job;
+		tie(message.keyIndex, message.salt, job) = _cryptoController->prepareEncryptData(changeData);
+		_queuedSends++;
+		_cryptoPipeline->enqueue(job, [this, message](const QByteArray &cipher) mutable {
+			_queuedSends--;
+			message.data = cipher;
+			//already in order, as it is called by the pipeline
+			_socket->sendBinaryMessage(message.serialize());
+		}, [this](const Exception &e) {
+			_queuedSends--;
+			onError({ErrorMessage::ClientError, e.qWhat()}, Message::messageName<DeviceChangeMessage>());
+		});
 	} catch(Exception &e) {
 		onError({ErrorMessage::ClientError, e.qWhat()}, Message::messageName<DeviceChangeMessage>());
 	}
@@ -362,8 +405,13 @@ void RemoteConnector::downloadDone(const quint64 key)
 	}
 
 	try {
-		ChangedAckMessage message(key);
-		sendMessage(message);
+		if(_batchAcks) {
+			_pendingAcks.append(key);
+			_ackTimer->start();
+		} else {
+			ChangedAckMessage message(key);
+			sendMessage(message);
+		}
 		emit progressIncrement();
 		beginOp(minutes(5), false);
 	} catch(Exception &e) {
@@ -456,6 +504,8 @@ void RemoteConnector::binaryMessageReceived(const QByteArray &message)
 			onAccount(Message::deserializeMessage<AccountMessage>(stream));
 		else if(Message::isType<WelcomeMessage>(name))
 			onWelcome(Message::deserializeMessage<WelcomeMessage>(stream));
+		else if(Message::isType<ResumeTicketMessage>(name))
+			onResumeTicket(Message::deserializeMessage<ResumeTicketMessage>(stream));
 		else if(Message::isType<GrantMessage>(name))
 			onGrant(Message::deserializeMessage<GrantMessage>(stream));
 		else if(Message::isType<ChangeAckMessage>(name))
@@ -543,6 +593,20 @@ void RemoteConnector::ping()
 	}
 }
 
+void RemoteConnector::sendAcks()
+{
+	if(_pendingAcks.isEmpty())
+		return;
+
+	try {
+		ChangedAckBatchMessage message(_pendingAcks);
+		sendMessage(message);
+		_pendingAcks.clear();
+	} catch(Exception &e) {
+		onError({ErrorMessage::ClientError, e.qWhat()}, Message::messageName<ChangedAckBatchMessage>());
+	}
+}
+
 void RemoteConnector::doConnect()
 {
 	emit remoteEvent(RemoteConnecting);
@@ -664,6 +728,16 @@ void RemoteConnector::onEntryIdleState()
 
 void RemoteConnector::onExitActiveState()
 {
+	_resuming = false;
+	//results are meaningless without the connection, and nothing can be sent anymore
+	if(_queuedSends > 0) {
+		logWarning() << "Discarding" << _queuedSends
+					 << "uploads and messages that were not sent before the connection was lost";
+	}
+	_queuedSends = 0;
+	_cryptoPipeline->reset();
+	_ackTimer->stop();
+	_pendingAcks.clear(); //the server sends them again
 	clearCaches(false);
 	endOp(); //disconnected -> whatever operation was going on is now done
 	emit remoteEvent(RemoteDisconnected);
@@ -671,12 +745,27 @@ void RemoteConnector::onExitActiveState()
 
 void RemoteConnector::sendMessage(const Message &message)
 {
-	_socket->sendBinaryMessage(message.serialize());
+	sendData(message.serialize());
 }
 
 void RemoteConnector::sendSignedMessage(const Message &message)
 {
-	_socket->sendBinaryMessage(_cryptoController->serializeSignedMessage(message));
+	sendData(_cryptoController->serializeSignedMessage(message));
+}
+
+void RemoteConnector::sendData(const QByteArray &data)
+{
+	//only queued behind uploads that are still encrypted (and messages waiting for them), so no message can overtake them
+	//without any, messages do not have to wait for downloaded changes to be decrypted
+	if(_queuedSends == 0)
+		_socket->sendBinaryMessage(data);
+	else {
+		_queuedSends++;
+		_cryptoPipeline->enqueue([this, data]() {
+			_queuedSends--;
+			_socket->sendBinaryMessage(data);
+		});
+	}
 }
 
 bool RemoteConnector::isIdle() const
@@ -737,6 +826,8 @@ bool RemoteConnector::loadIdentity()
 		auto nId = sValue(keyDeviceId).toUuid();
 		if(nId != _deviceId || nId.isNull()) { //only if new id is null or id has changed
 			_deviceId = nId;
+			_resumeTicket.clear();
+			_resumeSecret.clear();
 			_cryptoController->clearKeyMaterial();
 			_cryptoController->acquireStore(!_deviceId.isNull());
 
@@ -900,13 +991,35 @@ void RemoteConnector::onIdentify(const IdentifyMessage &message)
 	// allow connecting too, because possible event order: [Connecting] -> connected -> onIdentify -> [Connected] -> ...
 	// instead of the "clean" order: [Connecting] -> connected -> [Connected] -> onIdentify -> ...
 	// can happen when the message is received before the connected event has been sent
+	// while resuming, the server sends another identify message if it rejected the ticket
 	if(!_stateMachine->isActive(QStringLiteral("Connected")) &&
-	   !_stateMachine->isActive(QStringLiteral("Connecting"))) {
+	   !_stateMachine->isActive(QStringLiteral("Connecting")) &&
+	   !(_resuming && _stateMachine->isActive(QStringLiteral("LoggingIn")))) {
 		logWarning() << "Unexpected IdentifyMessage";
 		triggerError(true);
 	} else {
 		emit updateUploadLimit(message.uploadLimit);
-		if(!_deviceId.isNull()) {
+		_batchAcks = message.protocolVersion >= ChangedAckBatchMessage::MinimumVersion;
+		if(_resuming) {
+			logDebug() << "Session ticket was rejected. Falling back to a full login";
+			_resuming = false;
+			_resumeTicket.clear();
+			_resumeSecret.clear();
+		}
+
+		if(!_deviceId.isNull() &&
+		   !_resumeTicket.isEmpty() &&
+		   message.protocolVersion >= ResumeMessage::MinimumVersion) {
+			ResumeMessage msg(_deviceId,
+							  sValue(keyDeviceName).toString(),
+							  message.nonce,
+							  _resumeTicket);
+			msg.sign(_resumeSecret);
+			sendMessage(msg);
+			_resuming = true;
+			_stateMachine->submitEvent(QStringLiteral("awaitLogin"));
+			logDebug() << "Sent resume message for device id" << _deviceId;
+		} else if(!_deviceId.isNull()) {
 			LoginMessage msg(_deviceId,
 							 sValue(keyDeviceName).toString(),
 							 message.nonce);
@@ -982,7 +1095,8 @@ void RemoteConnector::onWelcome(const WelcomeMessage &message)
 		logWarning() << "Unexpected WelcomeMessage";
 		triggerError(true);
 	} else {
-		logDebug() << "Login successful";
+		logDebug() << (_resuming ? "Session resumed" : "Login successful");
+		_resuming = false;
 		// reset retry index only after successfuly account creation or login
 		_expectChanges = message.hasChanges;
 		_stateMachine->submitEvent(QStringLiteral("account"));
@@ -1006,6 +1120,18 @@ void RemoteConnector::onWelcome(const WelcomeMessage &message)
 	}
 }
 
+void RemoteConnector::onResumeTicket(const ResumeTicketMessage &message)
+{
+	if(_deviceId.isNull()) {
+		logWarning() << "Unexpected ResumeTicketMessage";
+		triggerError(true);
+	} else {
+		_resumeSecret = _cryptoController->crypto()->decrypt(message.secret);
+		_resumeTicket = message.ticket;
+		logDebug() << "Received session ticket for the next reconnect";
+	}
+}
+
 void RemoteConnector::onGrant(const GrantMessage &message)
 {
 	if(!_stateMachine->isActive(QStringLiteral("Granting"))) {
@@ -1037,21 +1163,29 @@ void RemoteConnector::onDeviceChangeAck(const DeviceChangeAckMessage &message)
 void RemoteConnector::onChanged(const ChangedMessage &message)
 {
 	if(checkIdle(message)) {
-		auto data = _cryptoController->decryptData(message.keyIndex,
-												   message.salt,
-												   message.data);
-		beginOp();//start download timeout
-		emit downloadData(message.dataIndex, data);
+		auto job = _cryptoController->prepareDecryptData(message.keyIndex,
+														 message.salt,
+														 message.data);
+		auto dataIndex = message.dataIndex;
+		_cryptoPipeline->enqueue(job, [this, dataIndex](const QByteArray &data) {
+			beginOp();//start download timeout
+			emit downloadData(dataIndex, data);
+		}, [this](const Exception &e) {
+			onError({ErrorMessage::ClientError, e.qWhat()}, Message::messageName<ChangedMessage>());
+		});
 	}
 }
 
 void RemoteConnector::onChangedInfo(const ChangedInfoMessage &message)
 {
 	if(checkIdle(message)) {
-		logDebug() << "Started downloading, estimated changes:" << message.changeEstimate;
-		//emit event to enter downloading state
-		emit remoteEvent(RemoteReadyWithChanges);
-		emit progressAdded(message.changeEstimate);
+		auto changeEstimate = message.changeEstimate;
+		_cryptoPipeline->enqueue([this, changeEstimate]() {
+			logDebug() << "Started downloading, estimated changes:" << changeEstimate;
+			//emit event to enter downloading state
+			emit remoteEvent(RemoteReadyWithChanges);
+			emit progressAdded(changeEstimate);
+		});
 		//parse as usual
 		onChanged(message);
 	}
@@ -1062,9 +1196,12 @@ void RemoteConnector::onLastChanged(const LastChangedMessage &message)
 	Q_UNUSED(message)
 
 	if(checkIdle(message)) {
-		logDebug() << "Completed downloading changes";
-		endOp(); //downloads done
-		emit remoteEvent(RemoteReady); //back to normal
+		//must not be handled before all downloaded changes have been decrypted and passed on
+		_cryptoPipeline->enqueue([this]() {
+			logDebug() << "Completed downloading changes";
+			endOp(); //downloads done
+			emit remoteEvent(RemoteReady); //back to normal
+		});
 	}
 }
 
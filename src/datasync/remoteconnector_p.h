@@ -13,6 +13,7 @@
 #include "controller_p.h"
 #include "defaults.h"
 #include "cryptocontroller_p.h"
+#include "cryptopipeline_p.h"
 #include "accountmanager.h"
 
 #include "errormessage_p.h"
@@ -29,6 +30,7 @@
 #include "macupdatemessage_p.h"
 #include "devicekeysmessage_p.h"
 #include "newkeymessage_p.h"
+#include "resumemessage_p.h"
 
 class ConnectorStateMachine;
 
@@ -141,6 +143,7 @@ private Q_SLOTS:
 	void error(QAbstractSocket::SocketError error);
 	void sslErrors(const QList<QSslError> &errors);
 	void ping();
+	void sendAcks();
 
 	//statemachine
 	void doConnect();
@@ -153,6 +156,8 @@ private:
 	static const QVector<std::chrono::seconds> Timeouts;
 
 	CryptoController *_cryptoController;
+	CryptoPipeline *_cryptoPipeline;
+	int _queuedSends; //uploads and messages that wait in the pipeline
 
 	QWebSocket *_socket;
 
@@ -163,13 +168,21 @@ private:
 	int _retryIndex;
 	bool _expectChanges;
 
+	QTimer *_ackTimer;
+	bool _batchAcks;
+	QList<quint64> _pendingAcks;
+
 	QUuid _deviceId;
+	QByteArray _resumeTicket;
+	QByteArray _resumeSecret;
+	bool _resuming;
 	QList<DeviceInfo> _deviceCache;
 	QHash<QByteArray, CryptoPP::SecByteBlock> _exportsCache;
 	QHash<QUuid, QSharedPointer<AsymmetricCryptoInfo>> _activeProofs;
 
 	void sendMessage(const Message &message);
 	void sendSignedMessage(const Message &message);
+	void sendData(const QByteArray &data);
 
 	bool isIdle() const;
 	bool checkIdle(const Message &message);
@@ -191,6 +204,7 @@ private:
 	void onIdentify(const IdentifyMessage &message);
 	void onAccount(const AccountMessage &message, bool checkState = true);
 	void onWelcome(const WelcomeMessage &message);
+	void onResumeTicket(const ResumeTicketMessage &message);
 	void onGrant(const GrantMessage &message);
 	void onChangeAck(const ChangeAckMessage &message);
 	void onDeviceChangeAck(const DeviceChangeAckMessage &message);
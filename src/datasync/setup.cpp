@@ -183,6 +183,16 @@ qint32 Setup::cipherKeySize() const
 	return d->properties.value(Defaults::SymKeyParam).toUInt();
 }
 
+bool Setup::deltaSync() const
+{
+	return d->properties.value(Defaults::DeltaSync).toBool();
+}
+
+int Setup::cryptoThreads() const
+{
+	return d->properties.value(Defaults::CryptoThreads).toInt();
+}
+
 Setup &Setup::setLocalDir(QString localDir)
 {
 	d->localDir = localDir;
@@ -286,6 +296,18 @@ Setup &Setup::setCipherKeySize(qint32 cipherKeySize)
 	return *this;
 }
 
+Setup &Setup::setDeltaSync(bool deltaSync)
+{
+	d->properties.insert(Defaults::DeltaSync, deltaSync);
+	return *this;
+}
+
+Setup &Setup::setCryptoThreads(int cryptoThreads)
+{
+	d->properties.insert(Defaults::CryptoThreads, cryptoThreads);
+	return *this;
+}
+
 Setup &Setup::resetLocalDir()
 {
 	d->localDir = SetupPrivate::DefaultLocalDir;
@@ -386,6 +408,18 @@ Setup &Setup::resetCipherKeySize()
 	return *this;
 }
 
+Setup &Setup::resetDeltaSync()
+{
+	d->properties.insert(Defaults::DeltaSync, false);
+	return *this;
+}
+
+Setup &Setup::resetCryptoThreads()
+{
+	d->properties.insert(Defaults::CryptoThreads, -1);
+	return *this;
+}
+
 void Setup::create(const QString &name)
 {
 	QMutexLocker _(&SetupPrivate::setupMutex);
@@ -550,7 +584,9 @@ SetupPrivate::SetupPrivate() :
 		{Defaults::SslConfiguration, QVariant::fromValue(QSslConfiguration::defaultConfiguration())},
 		{Defaults::SignScheme, Setup::RSA_PSS_SHA3_512},
 		{Defaults::CryptScheme, Setup::RSA_OAEP_SHA3_512},
-		{Defaults::SymScheme, Setup::AES_EAX}
+		{Defaults::SymScheme, Setup::AES_EAX},
+		{Defaults::DeltaSync, false},
+		{Defaults::CryptoThreads, -1}
 	}),
 	fatalErrorHandler()
 {}
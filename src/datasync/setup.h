@@ -94,6 +94,10 @@ class Q_DATASYNC_EXPORT Setup
 	Q_PROPERTY(CipherScheme cipherScheme READ cipherScheme WRITE setCipherScheme RESET resetCipherScheme)
 	//! The size in bytes for the secret exchange key (which is symmetric)
 	Q_PROPERTY(qint32 cipherKeySize READ cipherKeySize WRITE setCipherKeySize RESET resetCipherKeySize)
+	//! Specify whether changes should be uploaded as deltas to the last synchronized version
+	Q_PROPERTY(bool deltaSync READ deltaSync WRITE setDeltaSync RESET resetDeltaSync)
+	//! The number of worker threads used to encrypt and decrypt synchronized data
+	Q_PROPERTY(int cryptoThreads READ cryptoThreads WRITE setCryptoThreads RESET resetCryptoThreads)
 
 public:
 	//! Typedef of an error handler function. See Setup::fatalErrorHandler
@@ -214,6 +218,10 @@ public:
 	CipherScheme cipherScheme() const;
 	//! @readAcFn{Setup::cipherKeySize}
 	qint32 cipherKeySize() const;
+	//! @readAcFn{Setup::deltaSync}
+	bool deltaSync() const;
+	//! @readAcFn{Setup::cryptoThreads}
+	int cryptoThreads() const;
 
 	//! @writeAcFn{Setup::localDir}
 	Setup &setLocalDir(QString localDir);
@@ -249,6 +257,10 @@ public:
 	Setup &setCipherScheme(CipherScheme cipherScheme);
 	//! @writeAcFn{Setup::cipherKeySize}
 	Setup &setCipherKeySize(qint32 cipherKeySize);
+	//! @writeAcFn{Setup::deltaSync}
+	Setup &setDeltaSync(bool deltaSync);
+	//! @writeAcFn{Setup::cryptoThreads}
+	Setup &setCryptoThreads(int cryptoThreads);
 
 	//! @resetAcFn{Setup::localDir}
 	Setup &resetLocalDir();
@@ -284,6 +296,10 @@ public:
 	Setup &resetCipherScheme();
 	//! @resetAcFn{Setup::cipherKeySize}
 	Setup &resetCipherKeySize();
+	//! @resetAcFn{Setup::deltaSync}
+	Setup &resetDeltaSync();
+	//! @resetAcFn{Setup::cryptoThreads}
+	Setup &resetCryptoThreads();
 
 	//! Creates a datasync instance from this setup with the given name
 	void create(const QString &name = DefaultSetup);
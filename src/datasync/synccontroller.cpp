@@ -34,17 +34,61 @@ void SyncController::syncChange(quint64 key, const QByteArray &changeData)
 		ObjectKey objKey;
 		quint64 remoteVersion;
 		QJsonObject remoteData;
-		tie(remoteDeleted, objKey, remoteVersion, remoteData) = SyncHelper::extract(changeData);
+		SyncHelper::DeltaInfo delta;
+		tie(remoteDeleted, objKey, remoteVersion, remoteData) = SyncHelper::extract(changeData, delta);
 
 		auto scope = _store->startSync(objKey);
 		LocalStore::ChangeType localState;
 		quint64 localVersion;
 		QString localFileName;
 		QByteArray localChecksum;
-		tie(localState, localVersion, localFileName, localChecksum) = _store->loadChangeInfo(scope);
+		SyncHelper::ChecksumType localChecksumType;
+		tie(localState, localVersion, localFileName, localChecksum, localChecksumType) = _store->loadChangeInfo(scope);
+
+		if(delta.type == SyncHelper::DeltaInfo::FullRequest) {
+			//another device could not apply a delta: drop the base and mark changed to reupload the full data
+			if(localState != LocalStore::NoExists && localVersion >= remoteVersion) {
+				_store->removeSyncBase(scope);
+				_store->updateVersion(scope, localVersion, localVersion, true);
+				logDebug() << "Reuploading full data of" << objKey
+						   << "as requested by device" << delta.sourceDevice;
+			}
+			_store->commitSync(scope);
+			emit syncDone(key);
+			return;
+		} else if(delta.type == SyncHelper::DeltaInfo::Patch &&
+				  (localState == LocalStore::NoExists || localVersion <= remoteVersion)) { //only needed if the remote data is actually used
+			//find the base: either the stored sync base or the current local data
+			//the sync base is checked first, as its canonical checksum is stored with it
+			QJsonObject baseData;
+			quint64 baseVersion;
+			QByteArray baseChecksum;
+			tie(baseVersion, baseChecksum, baseData) = _store->loadSyncBase(scope);
+			auto hasBase = (baseVersion == delta.baseVersion && baseChecksum == delta.baseChecksum);
+			if(!hasBase && localState == LocalStore::Exists && localVersion == delta.baseVersion) {
+				if(localChecksumType == SyncHelper::Sha3Checksum) {
+					hasBase = (localChecksum == delta.baseChecksum);
+					if(hasBase)
+						baseData = _store->readJson(objKey, localFileName);
+				} else {
+					baseData = _store->readJson(objKey, localFileName);
+					hasBase = (SyncHelper::jsonHash(baseData) == delta.baseChecksum);
+				}
+			}
+
+			if(!hasBase || !SyncHelper::applyDelta(baseData, delta.patch)) {
+				logDebug() << "Missing base version" << delta.baseVersion << "for delta of" << objKey
+						   << "- requesting full data from device" << delta.sourceDevice;
+				emit fullChangeRequired(objKey, remoteVersion, delta.sourceDevice);
+				emit syncDone(key); //scope is rolled back, the local data stays untouched until the full data arrives
+				return;
+			}
+			remoteData = baseData;
+		}
 
 		const char *syncActionStr = "invalid";
 		const char *syncActionRes = "invalid";
+		auto storeBase = false; //remember the remote data as base for deltas
 
 		switch (localState) {
 		case LocalStore::Exists:
@@ -75,29 +119,45 @@ void SyncController::syncChange(quint64 key, const QByteArray &changeData)
 				if(localVersion < remoteVersion) {
 					_store->storeChanged(scope, remoteVersion, localFileName, remoteData, false, localState); //simply update the local data
 					syncActionRes = "remote";
+					storeBase = true;
 				} else if(localVersion == remoteVersion) {
-					auto remoteChecksum = SyncHelper::jsonHash(remoteData);
+					//the canonical hash is calculated from the same serialized data, for the tie-breaker below
+					QByteArray remoteCanonical;
+					auto remoteChecksum = SyncHelper::jsonHash(remoteData, localChecksumType, remoteCanonical);
 					if(localChecksum != remoteChecksum) { //conflict!
+						QJsonObject localData;
 						QJsonObject resolvedData;
 						auto resolver = defaults().conflictResolver();
 						if(resolver) {
-							auto localData = _store->readJson(objKey, localFileName);
+							localData = _store->readJson(objKey, localFileName);
 							resolvedData = resolver->resolveConflict(QMetaType::type(objKey.typeName.constData()), localData, remoteData);
 						}
-						//deterministic alg the chooses 1 dataset no matter which one is local
+
+						//deterministic alg the chooses 1 dataset no matter which one is local -> needs the canonical hash
+						//only local data stored with a local checksum must be hashed again for it
+						auto localCanonical = localChecksum;
+						if(resolvedData.isEmpty() && localChecksumType != SyncHelper::Sha3Checksum) {
+							if(localData.isEmpty())
+								localData = _store->readJson(objKey, localFileName);
+							localCanonical = SyncHelper::jsonHash(localData);
+						}
+
 						if(!resolvedData.isEmpty()) {
 							_store->storeChanged(scope, localVersion + 1ull, localFileName, resolvedData, true, localState); //store as "v2 + 1"
 							syncActionRes = "merged";
-						} else if(localChecksum > remoteChecksum) {
+						} else if(localCanonical > remoteCanonical) {
 							_store->updateVersion(scope, localVersion, localVersion + 1ull, true); //keep as "v1 + 1"
 							syncActionRes = "local";
 						} else {
-							_store->storeChanged(scope, remoteVersion + 1ull, localFileName, remoteData, true, localState); //store as "v2 + 1"
+							_store->storeChanged(scope, remoteVersion + 1ull, localFileName, remoteData, true, localState,
+												 localChecksumType == LocalStore::LocalChecksum ? remoteChecksum : QByteArray()); //store as "v2 + 1"
 							syncActionRes = "remote";
+							storeBase = true;
 						}
 					} else {//(localChecksum == remoteChecksum): mark unchanged, if it was changed, because same data does not need another upload
 						_store->markUnchanged(scope, localVersion, false);
 						syncActionRes = "identical";
+						storeBase = true;
 					}
 				} else //(localVersion > remoteVersion): do nothing
 					syncActionRes = "local";
@@ -118,11 +178,13 @@ void SyncController::syncChange(quint64 key, const QByteArray &changeData)
 				if(localVersion < remoteVersion) {
 					_store->storeChanged(scope, remoteVersion, localFileName, remoteData, false, localState); //simply update the local data
 					syncActionRes = "remote";
+					storeBase = true;
 				} else if(localVersion == remoteVersion) {
 					switch (static_cast<Setup::SyncPolicy>(defaults().property(Defaults::ConflictPolicy).toInt())) {
 					case Setup::PreferChanged:
 						_store->storeChanged(scope, remoteVersion + 1ull, localFileName, remoteData, true, localState); //store as "v2 + 1"
 						syncActionRes = "remote";
+						storeBase = true;
 						break;
 					case Setup::PreferDeleted:
 						_store->updateVersion(scope, localVersion, localVersion + 1ull, true); //keep as "v1 + 1"
@@ -148,6 +210,7 @@ void SyncController::syncChange(quint64 key, const QByteArray &changeData)
 				syncActionRes = "remote";
 				//no additional info, simply take it (See exchange.txt)
 				_store->storeChanged(scope, remoteVersion, localFileName, remoteData, false, localState);
+				storeBase = true;
 			}
 			break;
 		default:
@@ -159,6 +222,8 @@ void SyncController::syncChange(quint64 key, const QByteArray &changeData)
 							 << " with action(" << syncActionStr << "), result is data of: "
 							 << syncActionRes;
 
+		if(storeBase && defaults().property(Defaults::DeltaSync).toBool())
+			_store->storeSyncBase(scope, remoteVersion, remoteData);
 		_store->commitSync(scope);
 		emit syncDone(key);
 	} catch (QException &e) {
@@ -22,6 +22,7 @@ public Q_SLOTS:
 
 Q_SIGNALS:
 	void syncDone(quint64 key);
+	void fullChangeRequired(const QtDataSync::ObjectKey &key, quint64 version, const QUuid &deviceId);
 
 private:
 	LocalStore *_store;
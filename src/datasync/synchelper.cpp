@@ -6,22 +6,45 @@
 #include <QtCore/QJsonDocument>
 #include <QtCore/QJsonArray>
 
+#include <cryptopp/blake2.h>
+
 #include "message_p.h"
+#include "exception.h"
 
 using namespace QtDataSync;
 using namespace QtDataSync::SyncHelper;
 using std::tuple;
 using std::make_tuple;
+#if CRYPTOPP_VERSION >= 600
+using byte = CryptoPP::byte;
+#endif
 
 namespace {
-void hashNext(QCryptographicHash &hash, const QJsonValue &value);
+QByteArray hashBuffer(const QByteArray &buffer, ChecksumType type);
+void hashNext(QByteArray &buffer, const QJsonValue &value);
+void diffNext(QJsonArray &patch, const QString &path, const QJsonObject &base, const QJsonObject &target);
+bool applyNext(QJsonObject &object, QStringList path, const QString &op, const QJsonValue &value);
+QString escapePointer(QString key);
+QString unescapePointer(QString key);
+}
+
+QByteArray SyncHelper::jsonHash(const QJsonObject &object, ChecksumType type)
+{
+	//collect all data first, hashing a single buffer is much faster than many small updates
+	QByteArray buffer;
+	buffer.reserve(1024);
+	hashNext(buffer, object);
+	return hashBuffer(buffer, type);
 }
 
-QByteArray SyncHelper::jsonHash(const QJsonObject &object)
+QByteArray SyncHelper::jsonHash(const QJsonObject &object, ChecksumType type, QByteArray &canonical)
 {
-	QCryptographicHash hash(QCryptographicHash::Sha3_256);
-	hashNext(hash, object);
-	return hash.result();
+	QByteArray buffer;
+	buffer.reserve(1024);
+	hashNext(buffer, object);
+	auto checksum = hashBuffer(buffer, type);
+	canonical = type == Sha3Checksum ? checksum : hashBuffer(buffer, Sha3Checksum);
+	return checksum;
 }
 
 QByteArray SyncHelper::combine(const ObjectKey &key, quint64 version, const QJsonObject &data)
@@ -54,7 +77,41 @@ QByteArray SyncHelper::combine(const ObjectKey &key, quint64 version)
 	return out;
 }
 
+QByteArray SyncHelper::combine(const ObjectKey &key, quint64 version, const DeltaInfo &delta)
+{
+	Q_ASSERT_X(delta.type != DeltaInfo::NoDelta, Q_FUNC_INFO, "Cannot combine a delta of type NoDelta");
+
+	QByteArray out;
+	QDataStream stream(&out, QIODevice::WriteOnly | QIODevice::Unbuffered);
+	Message::setupStream(stream);
+
+	stream << key
+		   << version
+		   << QByteArray("") //empty, but not null: marks the data as delta
+		   << static_cast<quint8>(delta.type)
+		   << delta.sourceDevice;
+	if(delta.type == DeltaInfo::Patch) {
+		stream << delta.baseVersion
+			   << delta.baseChecksum
+			   << QJsonDocument(delta.patch).toJson(QJsonDocument::Compact);
+	}
+
+	if(stream.status() != QDataStream::Ok)
+		throw DataStreamException(stream);
+	return out;
+}
+
 tuple<bool, ObjectKey, quint64, QJsonObject> SyncHelper::extract(const QByteArray &data)
+{
+	DeltaInfo delta;
+	auto res = extract(data, delta);
+	if(delta.type != DeltaInfo::NoDelta)
+		throw Exception(QString(), QStringLiteral("Expected full data, but got a delta change for %1:%2")
+						.arg(QString::fromUtf8(std::get<1>(res).typeName), std::get<1>(res).id));
+	return res;
+}
+
+tuple<bool, ObjectKey, quint64, QJsonObject> SyncHelper::extract(const QByteArray &data, DeltaInfo &delta)
 {
 	ObjectKey key;
 	quint64 version;
@@ -69,9 +126,39 @@ tuple<bool, ObjectKey, quint64, QJsonObject> SyncHelper::extract(const QByteArra
 		   >> jData;
 
 	QJsonObject obj;
+	delta = DeltaInfo{};
 	if(jData.isNull())
 		stream.commitTransaction();
-	else {
+	else if(jData.isEmpty()) {
+		quint8 type;
+		stream >> type
+			   >> delta.sourceDevice;
+		delta.type = static_cast<DeltaInfo::Type>(type);
+		switch (delta.type) {
+		case DeltaInfo::Patch:
+		{
+			QByteArray pData;
+			stream >> delta.baseVersion
+				   >> delta.baseChecksum
+				   >> pData;
+			QJsonParseError error;
+			auto doc = QJsonDocument::fromJson(pData, &error);
+			if(error.error != QJsonParseError::NoError || !doc.isArray())
+				stream.abortTransaction();
+			else {
+				delta.patch = doc.array();
+				stream.commitTransaction();
+			}
+			break;
+		}
+		case DeltaInfo::FullRequest:
+			stream.commitTransaction();
+			break;
+		default:
+			stream.abortTransaction();
+			break;
+		}
+	} else {
 		QJsonParseError error;
 		auto doc = QJsonDocument::fromJson(jData, &error);
 		if(error.error != QJsonParseError::NoError || !doc.isObject())
@@ -88,26 +175,72 @@ tuple<bool, ObjectKey, quint64, QJsonObject> SyncHelper::extract(const QByteArra
 	return make_tuple(jData.isNull(), key, version, obj);
 }
 
+QJsonArray SyncHelper::createDelta(const QJsonObject &base, const QJsonObject &target)
+{
+	QJsonArray patch;
+	diffNext(patch, QString(), base, target);
+	return patch;
+}
+
+bool SyncHelper::applyDelta(QJsonObject &object, const QJsonArray &patch)
+{
+	auto result = object;
+	for(auto opValue : patch) {
+		auto opObj = opValue.toObject();
+		auto path = opObj.value(QStringLiteral("path")).toString().split(QLatin1Char('/'));
+		if(path.size() < 2 || !path.takeFirst().isEmpty()) //pointer must start with a "/"
+			return false;
+		for(auto &elem : path)
+			elem = unescapePointer(elem);
+		if(!applyNext(result, path,
+					  opObj.value(QStringLiteral("op")).toString(),
+					  opObj.value(QStringLiteral("value"))))
+			return false;
+	}
+	object = result;
+	return true;
+}
+
 namespace {
 
-void hashNext(QCryptographicHash &hash, const QJsonValue &value)
+QByteArray hashBuffer(const QByteArray &buffer, ChecksumType type)
+{
+	switch (type) {
+	case Sha3Checksum:
+		return QCryptographicHash::hash(buffer, QCryptographicHash::Sha3_256);
+	case Blake2Checksum:
+	{
+		CryptoPP::BLAKE2b hash(false, 32);
+		QByteArray result(static_cast<int>(hash.DigestSize()), Qt::Uninitialized);
+		hash.CalculateDigest(reinterpret_cast<byte*>(result.data()),
+							 reinterpret_cast<const byte*>(buffer.constData()),
+							 static_cast<size_t>(buffer.size()));
+		return result;
+	}
+	default:
+		Q_UNREACHABLE();
+		return {};
+	}
+}
+
+void hashNext(QByteArray &buffer, const QJsonValue &value)
 {
 	switch (value.type()) {
 	case QJsonValue::Null:
-		hash.addData("null");
+		buffer.append("null");
 		break;
 	case QJsonValue::Bool:
-		hash.addData(value.toBool() ? "true" : "false");
+		buffer.append(value.toBool() ? "true" : "false");
 		break;
 	case QJsonValue::Double:
-		hash.addData(QByteArray::number(value.toDouble(), 'g', QLocale::FloatingPointShortest));
+		buffer.append(QByteArray::number(value.toDouble(), 'g', QLocale::FloatingPointShortest));
 		break;
 	case QJsonValue::String:
-		hash.addData(value.toString().toUtf8());
+		buffer.append(value.toString().toUtf8());
 		break;
 	case QJsonValue::Array:
 		for(auto v : value.toArray())
-			hashNext(hash, v);
+			hashNext(buffer, v);
 		break;
 	case QJsonValue::Object:
 	{
@@ -122,8 +255,8 @@ void hashNext(QCryptographicHash &hash, const QJsonValue &value)
 				Q_ASSERT(pKey < it.key());
 			pKey = it.key();
 #endif
-			hash.addData(it.key().toUtf8());
-			hashNext(hash, it.value());
+			buffer.append(it.key().toUtf8());
+			hashNext(buffer, it.value());
 		}
 		break;
 	}
@@ -135,4 +268,85 @@ void hashNext(QCryptographicHash &hash, const QJsonValue &value)
 	}
 }
 
+void diffNext(QJsonArray &patch, const QString &path, const QJsonObject &base, const QJsonObject &target)
+{
+	//both objects are sorted by key, so a simple merge walk is enough
+	auto bIt = base.begin();
+	auto tIt = target.begin();
+	while(bIt != base.end() || tIt != target.end()) {
+		if(tIt == target.end() || (bIt != base.end() && bIt.key() < tIt.key())) {
+			patch.append(QJsonObject {
+							 {QStringLiteral("op"), QStringLiteral("remove")},
+							 {QStringLiteral("path"), path + QLatin1Char('/') + escapePointer(bIt.key())}
+						 });
+			bIt++;
+		} else if(bIt == base.end() || tIt.key() < bIt.key()) {
+			patch.append(QJsonObject {
+							 {QStringLiteral("op"), QStringLiteral("add")},
+							 {QStringLiteral("path"), path + QLatin1Char('/') + escapePointer(tIt.key())},
+							 {QStringLiteral("value"), tIt.value()}
+						 });
+			tIt++;
+		} else {
+			auto bValue = bIt.value();
+			auto tValue = tIt.value();
+			if(bValue != tValue) {
+				auto subPath = path + QLatin1Char('/') + escapePointer(tIt.key());
+				if(bValue.isObject() && tValue.isObject())
+					diffNext(patch, subPath, bValue.toObject(), tValue.toObject());
+				else { //arrays and primitives are always replaced as a whole
+					patch.append(QJsonObject {
+									 {QStringLiteral("op"), QStringLiteral("replace")},
+									 {QStringLiteral("path"), subPath},
+									 {QStringLiteral("value"), tValue}
+								 });
+				}
+			}
+			bIt++;
+			tIt++;
+		}
+	}
+}
+
+bool applyNext(QJsonObject &object, QStringList path, const QString &op, const QJsonValue &value)
+{
+	auto key = path.takeFirst();
+	if(path.isEmpty()) {
+		if(op == QStringLiteral("add"))
+			object.insert(key, value);
+		else if(op == QStringLiteral("replace")) {
+			if(!object.contains(key))
+				return false;
+			object.insert(key, value);
+		} else if(op == QStringLiteral("remove")) {
+			if(!object.contains(key))
+				return false;
+			object.remove(key);
+		} else
+			return false;
+		return true;
+	} else {
+		auto child = object.value(key);
+		if(!child.isObject())
+			return false;
+		auto childObj = child.toObject();
+		if(!applyNext(childObj, path, op, value))
+			return false;
+		object.insert(key, childObj);
+		return true;
+	}
+}
+
+QString escapePointer(QString key)
+{
+	return key.replace(QLatin1Char('~'), QStringLiteral("~0"))
+			.replace(QLatin1Char('/'), QStringLiteral("~1"));
+}
+
+QString unescapePointer(QString key)
+{
+	return key.replace(QStringLiteral("~1"), QStringLiteral("/"))
+			.replace(QStringLiteral("~0"), QStringLiteral("~"));
+}
+
 }
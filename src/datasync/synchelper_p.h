@@ -4,6 +4,8 @@
 #include <tuple>
 
 #include <QtCore/QJsonObject>
+#include <QtCore/QJsonArray>
+#include <QtCore/QUuid>
 
 #include "qtdatasync_global.h"
 #include "objectkey.h"
@@ -13,11 +15,36 @@ namespace QtDataSync {
 namespace SyncHelper {
 
 //exports are needed for tests
-Q_DATASYNC_EXPORT QByteArray jsonHash(const QJsonObject &object);
+enum ChecksumType : quint8 {
+	Sha3Checksum = 0x00, //canonical hash, must be the same on all devices
+	Blake2Checksum = 0x01 //faster hash, only used for local checksums
+};
+
+struct Q_DATASYNC_EXPORT DeltaInfo {
+	enum Type : quint8 {
+		NoDelta = 0x00,
+		Patch = 0x01,
+		FullRequest = 0x02
+	};
+
+	Type type = NoDelta;
+	quint64 baseVersion = 0;
+	QByteArray baseChecksum;
+	QUuid sourceDevice;
+	QJsonArray patch;
+};
+
+Q_DATASYNC_EXPORT QByteArray jsonHash(const QJsonObject &object, ChecksumType type = Sha3Checksum);
+Q_DATASYNC_EXPORT QByteArray jsonHash(const QJsonObject &object, ChecksumType type, QByteArray &canonical); //also returns the canonical hash, from the same data
 
 Q_DATASYNC_EXPORT QByteArray combine(const ObjectKey &key, quint64 version, const QJsonObject &data);
 Q_DATASYNC_EXPORT QByteArray combine(const ObjectKey &key, quint64 version);
+Q_DATASYNC_EXPORT QByteArray combine(const ObjectKey &key, quint64 version, const DeltaInfo &delta);
 Q_DATASYNC_EXPORT std::tuple<bool, ObjectKey, quint64, QJsonObject> extract(const QByteArray &data); // (deleted, key, version, data)
+Q_DATASYNC_EXPORT std::tuple<bool, ObjectKey, quint64, QJsonObject> extract(const QByteArray &data, DeltaInfo &delta); // (deleted, key, version, data)
+
+Q_DATASYNC_EXPORT QJsonArray createDelta(const QJsonObject &base, const QJsonObject &target);
+Q_DATASYNC_EXPORT bool applyDelta(QJsonObject &object, const QJsonArray &patch);
 
 }
 
@@ -1,5 +1,7 @@
 include(../tests.pri)
 
+QT += network sql
+
 TARGET = tst_appserver
 
 SOURCES += \
@@ -8,7 +10,23 @@ SOURCES += \
 BUILD_BIN_DIR = $$shadowed($$dirname(_QMAKE_CONF_))/bin
 DEFINES += BUILD_BIN_DIR=\\\"$$BUILD_BIN_DIR/\\\"
 
-!include(./setup.pri): SETUP_FILE = $$PWD/qdsapp.conf
+!include(./setup.pri) {
+	sqlite_test: SETUP_FILE = $$PWD/qdsapp_sqlite.conf
+	else:quota_slack_test: SETUP_FILE = $$PWD/qdsapp_slack.conf
+	else:partitions_test: SETUP_FILE = $$PWD/qdsapp_partitions.conf
+	else: SETUP_FILE = $$PWD/qdsapp.conf
+}
 
 DISTFILES += $$SETUP_FILE
 DEFINES += SETUP_FILE=\\\"$$SETUP_FILE\\\"
+
+# a second server on the same database, to test the routing between them
+!sqlite_test:!quota_slack_test {
+	CLUSTER_FILE = $$PWD/qdsapp_cluster.conf
+	DISTFILES += $$CLUSTER_FILE
+	DEFINES += CLUSTER_FILE=\\\"$$CLUSTER_FILE\\\"
+	# and one with a tiny send buffer, to test pausing downloads
+	PAUSED_FILE = $$PWD/qdsapp_paused.conf
+	DISTFILES += $$PAUSED_FILE
+	DEFINES += PAUSED_FILE=\\\"$$PAUSED_FILE\\\"
+}
@@ -2,6 +2,10 @@
 #include <QtTest>
 #include <QCoreApplication>
 #include <QProcess>
+#include <QTcpSocket>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
 #include <testlib.h>
 #include <mockclient.h>
 
@@ -30,6 +34,7 @@
 #include <QtDataSync/private/newkeymessage_p.h>
 #include <QtDataSync/private/devicesmessage_p.h>
 #include <QtDataSync/private/removemessage_p.h>
+#include <QtDataSync/private/resumemessage_p.h>
 
 using namespace QtDataSync;
 
@@ -53,6 +58,8 @@ private Q_SLOTS:
 	void testInvalidLoginSignature();
 	void testInvalidLoginDevId();
 	void testLogin();
+	void testResume();
+	void testInvalidResume();
 
 	void testAddDevice();
 	void testInvalidAccessNonce();
@@ -65,7 +72,12 @@ private Q_SLOTS:
 
 	void testChangeUpload();
 	void testChangeDownloadOnLogin();
+	void testChangeDownloadPaused();
+	void testChangeDownloadPrefetchCleared();
+	void testChangeBlob();
 	void testLiveChanges();
+	void testLiveChangesBatchAck();
+	void testLiveChangesWindow();
 	void testSyncCommand();
 	void testDeviceUploading();
 
@@ -79,6 +91,9 @@ private Q_SLOTS:
 	void testKeyChangeNoAck();
 
 	void testListAndRemoveDevices();
+	void testClusterAddDevice();
+	void testQuotaOtherDeviceRemoved();
+	void testQuotaLimit();
 
 	void testUnexpectedMessage_data();
 	void testUnexpectedMessage();
@@ -89,7 +104,10 @@ private Q_SLOTS:
 	void testPingMessages();
 #endif
 
+	void testMetrics();
+
 	void testRemoveSelf();
+	void testCleanup();
 	void testStop();
 
 private:
@@ -99,17 +117,23 @@ private:
 	QString devName;
 	QUuid devId;
 	ClientCrypto *crypto;
+	QByteArray resumeTicket;
+	QByteArray resumeSecret;
 
 	MockClient *partner;
 	QString partnerName;
 	QUuid partnerDevId;
 	ClientCrypto *partnerCrypto;
 
-	void testAddDevice(MockClient *&partner, QUuid &partnerDevId, bool keepPartner = false);
+	void testAddDevice(MockClient *&partner, QUuid &partnerDevId, bool keepPartner = false, quint16 port = 14242);
 
 	void clean(bool disconnect = true);
 	void clean(MockClient *&client, bool disconnect = true);
 
+	QByteArray requestMetrics(const QByteArray &path, quint16 port = 14243);
+	double metricValue(const QByteArray &metric, quint16 port = 14243);
+	QSqlDatabase openDatabase();
+
 	template <typename TMessage, typename... Args>
 	inline QSharedPointer<Message> create(Args... args);
 	template <typename TMessage, typename... Args>
@@ -442,6 +466,129 @@ void TestAppServer::testLogin()
 			ok = true;
 		}));
 
+		//wait for the session ticket
+		QVERIFY(client->waitForReply<ResumeTicketMessage>([&](ResumeTicketMessage message, bool &ok) {
+			QVERIFY(!message.ticket.isEmpty());
+			QVERIFY(!message.secret.isEmpty());
+			resumeTicket = message.ticket;
+			resumeSecret = crypto->decrypt(message.secret);
+			ok = true;
+		}));
+
+		//keep session active
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
+void TestAppServer::testResume()
+{
+	try {
+		QVERIFY(client);
+		clean(client);
+
+		//establish connection
+		client = new MockClient(this);
+		QVERIFY(client->waitForConnected());
+
+		//wait for identify message
+		QByteArray mNonce;
+		QVERIFY(client->waitForReply<IdentifyMessage>([&](IdentifyMessage message, bool &ok) {
+			QVERIFY(message.nonce.size() >= InitMessage::NonceSize);
+			QCOMPARE(message.protocolVersion, InitMessage::CurrentVersion);
+			mNonce = message.nonce;
+			ok = true;
+		}));
+
+		//resume the session with the ticket from the login
+		ResumeMessage msg {
+			devId,
+			devName,
+			mNonce,
+			resumeTicket
+		};
+		msg.sign(resumeSecret);
+		client->send(msg);
+
+		//wait for the account message, but no new ticket
+		QVERIFY(client->waitForReply<WelcomeMessage>([&](WelcomeMessage message, bool &ok) {
+			QVERIFY(!message.hasChanges);
+			QCOMPARE(message.keyIndex, 0u);
+			QVERIFY(message.key.isNull());
+			ok = true;
+		}));
+		QVERIFY(client->waitForNothing());
+
+		//keep session active
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
+void TestAppServer::testInvalidResume()
+{
+	try {
+		QVERIFY(client);
+		clean(client);
+
+		//establish connection
+		client = new MockClient(this);
+		QVERIFY(client->waitForConnected());
+
+		//wait for identify message
+		QByteArray mNonce;
+		QVERIFY(client->waitForReply<IdentifyMessage>([&](IdentifyMessage message, bool &ok) {
+			mNonce = message.nonce;
+			ok = true;
+		}));
+
+		//send a resume message with a wrong secret
+		ResumeMessage msg {
+			devId,
+			devName,
+			mNonce,
+			resumeTicket
+		};
+		msg.sign("invalid secret");
+		client->send(msg);
+
+		//server must request a full login with a new nonce
+		QVERIFY(client->waitForReply<IdentifyMessage>([&](IdentifyMessage message, bool &ok) {
+			QVERIFY(message.nonce != mNonce);
+			mNonce = message.nonce;
+			ok = true;
+		}));
+
+		//a ticket for another device must be rejected as well
+		msg = ResumeMessage {
+			QUuid::createUuid(),
+			devName,
+			mNonce,
+			resumeTicket
+		};
+		msg.sign(resumeSecret);
+		client->send(msg);
+		QVERIFY(client->waitForReply<IdentifyMessage>([&](IdentifyMessage message, bool &ok) {
+			mNonce = message.nonce;
+			ok = true;
+		}));
+
+		//full login still works
+		client->sendSigned(LoginMessage {
+							   devId,
+							   devName,
+							   mNonce
+						   }, crypto);
+		QVERIFY(client->waitForReply<WelcomeMessage>([&](WelcomeMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+		QVERIFY(client->waitForReply<ResumeTicketMessage>([&](ResumeTicketMessage message, bool &ok) {
+			resumeTicket = message.ticket;
+			resumeSecret = crypto->decrypt(message.secret);
+			ok = true;
+		}));
+
 		//keep session active
 	} catch(std::exception &e) {
 		QFAIL(e.what());
@@ -453,7 +600,7 @@ void TestAppServer::testAddDevice()
 	testAddDevice(partner, partnerDevId);
 }
 
-void TestAppServer::testAddDevice(MockClient *&partner, QUuid &partnerDevId, bool keepPartner) //not executed as test
+void TestAppServer::testAddDevice(MockClient *&partner, QUuid &partnerDevId, bool keepPartner, quint16 port) //not executed as test
 {
 	QByteArray pNonce = "partner_nonce";
 	QByteArray macscheme = "macscheme";
@@ -467,7 +614,7 @@ void TestAppServer::testAddDevice(MockClient *&partner, QUuid &partnerDevId, boo
 		QVERIFY(client);
 		//establish connection
 		partner = new MockClient(this);
-		QVERIFY(partner->waitForConnected());
+		QVERIFY(partner->waitForConnected(port));
 
 		//wait for identify message
 		QByteArray mNonce;
@@ -1056,6 +1203,10 @@ void TestAppServer::testChangeDownloadOnLogin()
 			QVERIFY(message.cmac.isNull());
 			ok = true;
 		}));
+		QVERIFY(partner->waitForReply<ResumeTicketMessage>([&](ResumeTicketMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
 
 		//wait for change info message
 		quint64 dataId1 = 0;
@@ -1093,6 +1244,286 @@ void TestAppServer::testChangeDownloadOnLogin()
 	}
 }
 
+void TestAppServer::testChangeDownloadPaused()
+{
+#ifndef PAUSED_FILE
+	QSKIP("A second server is only supported with PostgreSQL");
+#else
+	const quint32 count = 3;
+	quint32 keyIndex = 0;
+	QByteArray salt = "salt";
+	QByteArray data(1024, 'p'); //more than the send buffer of the paused server
+
+	//start a second server on the same database, with a tiny send buffer
+	QProcess node;
+	node.setProgram(server->program());
+	node.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+	auto env = QProcessEnvironment::systemEnvironment();
+	env.insert(QStringLiteral("QDSAPP_CONFIG_FILE"), QStringLiteral(PAUSED_FILE));
+	node.setProcessEnvironment(env);
+	node.start();
+	QVERIFY(node.waitForStarted(5000));
+	QVERIFY(!node.waitForFinished(5000));
+
+	try {
+		QVERIFY(client);
+		QVERIFY(partner);
+		clean(partner);
+		auto pauses = metricValue("qdsapp_send_paused_total", 14247);
+
+		//send uploads while the partner is offline
+		for(quint32 i = 0; i < count; i++) {
+			ChangeMessage changeMsg { "pauseId" + QByteArray::number(i) };
+			changeMsg.keyIndex = keyIndex;
+			changeMsg.salt = salt;
+			changeMsg.data = data;
+			client->send(changeMsg);
+			QVERIFY(client->waitForReply<ChangeAckMessage>([&](ChangeAckMessage message, bool &ok) {
+				QCOMPARE(message.dataId, changeMsg.dataId);
+				ok = true;
+			}));
+		}
+
+		//login the partner again, on the second server
+		partner = new MockClient(this);
+		QVERIFY(partner->waitForConnected(14246));
+		QByteArray mNonce;
+		QVERIFY(partner->waitForReply<IdentifyMessage>([&](IdentifyMessage message, bool &ok) {
+			mNonce = message.nonce;
+			ok = true;
+		}));
+		partner->sendSigned(LoginMessage {
+							   partnerDevId,
+							   partnerName,
+							   mNonce
+						   }, partnerCrypto);
+
+		//the welcome and the ticket exceed the send buffer, so the download waits until they were sent
+		QVERIFY(partner->waitForReply<WelcomeMessage>([&](WelcomeMessage message, bool &ok) {
+			QVERIFY(message.hasChanges);
+			ok = true;
+		}));
+		QVERIFY(partner->waitForReply<ResumeTicketMessage>([&](ResumeTicketMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+
+		//once resumed, every change is downloaded exactly once
+		QList<quint64> dataIds;
+		QVERIFY(partner->waitForReply<ChangedInfoMessage>([&](ChangedInfoMessage message, bool &ok) {
+			QCOMPARE(message.changeEstimate, count);
+			QCOMPARE(message.data, data);
+			dataIds.append(message.dataIndex);
+			ok = true;
+		}));
+		for(quint32 i = 1; i < count; i++) {
+			QVERIFY(partner->waitForReply<ChangedMessage>([&](ChangedMessage message, bool &ok) {
+				QCOMPARE(message.data, data);
+				QVERIFY(!dataIds.contains(message.dataIndex));
+				dataIds.append(message.dataIndex);
+				ok = true;
+			}));
+		}
+
+		partner->send(ChangedAckBatchMessage { dataIds });
+		QVERIFY(partner->waitForReply<LastChangedMessage>([&](LastChangedMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+		QVERIFY(metricValue("qdsapp_send_paused_total", 14247) > pauses);
+
+		//move the partner back to the first server
+		clean(partner);
+		partner = new MockClient(this);
+		QVERIFY(partner->waitForConnected());
+		QVERIFY(partner->waitForReply<IdentifyMessage>([&](IdentifyMessage message, bool &ok) {
+			mNonce = message.nonce;
+			ok = true;
+		}));
+		partner->sendSigned(LoginMessage {
+							   partnerDevId,
+							   partnerName,
+							   mNonce
+						   }, partnerCrypto);
+		QVERIFY(partner->waitForReply<WelcomeMessage>([&](WelcomeMessage message, bool &ok) {
+			QVERIFY(!message.hasChanges);
+			ok = true;
+		}));
+		QVERIFY(partner->waitForReply<ResumeTicketMessage>([&](ResumeTicketMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+
+	node.kill();
+	QVERIFY(node.waitForFinished(5000));
+#endif
+}
+
+void TestAppServer::testChangeDownloadPrefetchCleared()
+{
+	const quint32 count = 30; //more than one download window, but loaded in one prefetch
+	quint32 keyIndex = 0;
+	QByteArray salt = "salt";
+	QByteArray data = "data";
+
+	try {
+		QVERIFY(client);
+		QVERIFY(partner);
+		clean(partner);
+
+		//add a device that gets removed while the partner downloads
+		MockClient *removedPartner = nullptr;
+		QUuid removedPartnerDevId;
+		testAddDevice(removedPartner, removedPartnerDevId);
+		QVERIFY(!removedPartner);
+
+		for(quint32 i = 0; i < count; i++) {
+			ChangeMessage changeMsg { "prefetchId" + QByteArray::number(i) };
+			changeMsg.keyIndex = keyIndex;
+			changeMsg.salt = salt;
+			changeMsg.data = data;
+			client->send(changeMsg);
+			QVERIFY(client->waitForReply<ChangeAckMessage>([&](ChangeAckMessage message, bool &ok) {
+				QCOMPARE(message.dataId, changeMsg.dataId);
+				ok = true;
+			}));
+		}
+
+		//login the partner again
+		partner = new MockClient(this);
+		QVERIFY(partner->waitForConnected());
+		QByteArray mNonce;
+		QVERIFY(partner->waitForReply<IdentifyMessage>([&](IdentifyMessage message, bool &ok) {
+			mNonce = message.nonce;
+			ok = true;
+		}));
+		partner->sendSigned(LoginMessage {
+							   partnerDevId,
+							   partnerName,
+							   mNonce
+						   }, partnerCrypto);
+		QVERIFY(partner->waitForReply<WelcomeMessage>([&](WelcomeMessage message, bool &ok) {
+			QVERIFY(message.hasChanges);
+			ok = true;
+		}));
+		QVERIFY(partner->waitForReply<ResumeTicketMessage>([&](ResumeTicketMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+
+		//the first window is sent, the rest stays prefetched
+		QList<quint64> dataIds;
+		QVERIFY(partner->waitForReply<ChangedInfoMessage>([&](ChangedInfoMessage message, bool &ok) {
+			QCOMPARE(message.changeEstimate, count);
+			dataIds.append(message.dataIndex);
+			ok = true;
+		}));
+		for(auto i = 1; i < 20; i++) { //downloads/limit
+			QVERIFY(partner->waitForReply<ChangedMessage>([&](ChangedMessage message, bool &ok) {
+				QVERIFY(!dataIds.contains(message.dataIndex));
+				dataIds.append(message.dataIndex);
+				ok = true;
+			}));
+		}
+
+		//removing a device discards the prefetched changes
+		partner->send(RemoveMessage {removedPartnerDevId});
+		QVERIFY(partner->waitForReply<RemoveAckMessage>([&](RemoveAckMessage message, bool &ok) {
+			QCOMPARE(message.deviceId, removedPartnerDevId);
+			ok = true;
+		}));
+
+		//the remaining ones are loaded again, and none is sent twice
+		partner->send(ChangedAckBatchMessage { dataIds });
+		for(auto i = dataIds.size(); i < static_cast<int>(count); i++) {
+			QVERIFY(partner->waitForReply<ChangedMessage>([&](ChangedMessage message, bool &ok) {
+				QVERIFY(!dataIds.contains(message.dataIndex));
+				dataIds.append(message.dataIndex);
+				ok = true;
+			}));
+		}
+		partner->send(ChangedAckBatchMessage { dataIds.mid(20) });
+		QVERIFY(partner->waitForReply<LastChangedMessage>([&](LastChangedMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
+void TestAppServer::testChangeBlob()
+{
+	QSettings config(QStringLiteral(SETUP_FILE), QSettings::IniFormat);
+	if(config.value(QStringLiteral("blobs/path")).toString().isEmpty())
+		QSKIP("Blobs are not enabled for this server");
+	QByteArray dataId = "blobId";
+	quint32 keyIndex = 0;
+	QByteArray salt = "salt";
+	QByteArray data(2 * config.value(QStringLiteral("blobs/threshold"), 65536).toInt(), 'b');
+
+	auto db = openDatabase();
+	QVERIFY2(db.isOpen(), qUtf8Printable(db.lastError().text()));
+	auto value = [&](const QString &query, const QVariantList &args) {
+		QSqlQuery valueQuery(db);
+		if(!valueQuery.prepare(query))
+			return QVariant();
+		for(const auto &arg : args)
+			valueQuery.addBindValue(arg);
+		if(!valueQuery.exec() || !valueQuery.first())
+			return QVariant();
+		return valueQuery.value(0);
+	};
+	auto quotaQuery = QStringLiteral("SELECT quota FROM users WHERE id = (SELECT userid FROM devices WHERE id = ?)");
+
+	try {
+		QVERIFY(client);
+		QVERIFY(partner);
+		auto quota = value(quotaQuery, {devId});
+		QVERIFY(quota.isValid());
+
+		//upload data that is stored as blob
+		ChangeMessage changeMsg { dataId };
+		changeMsg.keyIndex = keyIndex;
+		changeMsg.salt = salt;
+		changeMsg.data = data;
+		client->send(changeMsg);
+		QVERIFY(client->waitForReply<ChangeAckMessage>([&](ChangeAckMessage message, bool &ok) {
+			QCOMPARE(message.dataId, dataId);
+			ok = true;
+		}));
+
+		//only the reference is in the database, but the quota counts the full size
+		auto blobQuery = QStringLiteral("SELECT blob IS NOT NULL AND octet_length(data) = 0 FROM datachanges WHERE deviceid = ? AND dataid = ?");
+		auto isBlob = value(blobQuery, {devId, dataId}).toBool();
+		QVERIFY(isBlob);
+		QCOMPARE(value(quotaQuery, {devId}).toLongLong(), quota.toLongLong() + data.size());
+
+		//the partner downloads the full data
+		quint64 dataIndex = 0;
+		QVERIFY(partner->waitForReply<ChangedInfoMessage>([&](ChangedInfoMessage message, bool &ok) {
+			QCOMPARE(message.changeEstimate, 1u);
+			QCOMPARE(message.salt, salt);
+			QCOMPARE(message.data, data);
+			dataIndex = message.dataIndex;
+			ok = true;
+		}));
+		partner->send(ChangedAckMessage { dataIndex });
+		QVERIFY(partner->waitForReply<LastChangedMessage>([&](LastChangedMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+
+		//once delivered, the quota is freed again
+		QCOMPARE(value(quotaQuery, {devId}).toLongLong(), quota.toLongLong());
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
 void TestAppServer::testLiveChanges()
 {
 	QByteArray dataId1 = "dataId3";
@@ -1139,6 +1570,104 @@ void TestAppServer::testLiveChanges()
 	}
 }
 
+void TestAppServer::testLiveChangesBatchAck()
+{
+	QByteArray dataId1 = "batchAckId";
+	quint32 keyIndex = 0;
+	QByteArray salt = "salt";
+	QByteArray data = "data";
+
+	try {
+		QVERIFY(client);
+		QVERIFY(partner);
+
+		//send an upload
+		ChangeMessage changeMsg { dataId1 };
+		changeMsg.keyIndex = keyIndex;
+		changeMsg.salt = salt;
+		changeMsg.data = data;
+		client->send(changeMsg);
+
+		//wait for ack
+		QVERIFY(client->waitForReply<ChangeAckMessage>([&](ChangeAckMessage message, bool &ok) {
+			QCOMPARE(message.dataId, dataId1);
+			ok = true;
+		}));
+
+		//wait for change info message
+		quint64 dataId2 = 0;
+		QVERIFY(partner->waitForReply<ChangedInfoMessage>([&](ChangedInfoMessage message, bool &ok) {
+			QCOMPARE(message.changeEstimate, 1u);
+			QCOMPARE(message.keyIndex, keyIndex);
+			QCOMPARE(message.salt, salt);
+			QCOMPARE(message.data, data);
+			dataId2 = message.dataIndex;
+			ok = true;
+		}));
+
+		//send the ack as batch
+		partner->send(ChangedAckBatchMessage { {dataId2} });
+		QVERIFY(partner->waitForReply<LastChangedMessage>([&](LastChangedMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
+void TestAppServer::testLiveChangesWindow()
+{
+	const quint32 count = 3;
+	quint32 keyIndex = 0;
+	QByteArray salt = "salt";
+	QByteArray data = "data";
+
+	try {
+		QVERIFY(client);
+		QVERIFY(partner);
+		auto wakeups = metricValue("qdsapp_livesync_wakeups_total");
+
+		//send several uploads within the livesync window
+		for(quint32 i = 0; i < count; i++) {
+			ChangeMessage changeMsg { "windowId" + QByteArray::number(i) };
+			changeMsg.keyIndex = keyIndex;
+			changeMsg.salt = salt;
+			changeMsg.data = data;
+			client->send(changeMsg);
+		}
+		for(quint32 i = 0; i < count; i++) {
+			QVERIFY(client->waitForReply<ChangeAckMessage>([&](ChangeAckMessage message, bool &ok) {
+				QCOMPARE(message.dataId, "windowId" + QByteArray::number(i));
+				ok = true;
+			}));
+		}
+
+		//the partner is woken up once, and gets all changes in one download
+		QList<quint64> dataIds;
+		QVERIFY(partner->waitForReply<ChangedInfoMessage>([&](ChangedInfoMessage message, bool &ok) {
+			QCOMPARE(message.changeEstimate, count);
+			dataIds.append(message.dataIndex);
+			ok = true;
+		}));
+		for(quint32 i = 1; i < count; i++) {
+			QVERIFY(partner->waitForReply<ChangedMessage>([&](ChangedMessage message, bool &ok) {
+				dataIds.append(message.dataIndex);
+				ok = true;
+			}));
+		}
+
+		partner->send(ChangedAckBatchMessage { dataIds });
+		QVERIFY(partner->waitForReply<LastChangedMessage>([&](LastChangedMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+		QCOMPARE(metricValue("qdsapp_livesync_wakeups_total"), wakeups + 1);
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
 void TestAppServer::testSyncCommand()
 {
 	try {
@@ -1291,6 +1820,10 @@ void TestAppServer::testChangeKey()
 			QCOMPARE(message.cmac, cmac);
 			ok = true;
 		}));
+		QVERIFY(partner->waitForReply<ResumeTicketMessage>([&](ResumeTicketMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
 
 		//update the mac accordingly
 		partner->send(MacUpdateMessage { nextIndex, partnerName.toUtf8() });
@@ -1328,6 +1861,10 @@ void TestAppServer::testChangeKey()
 			QVERIFY(message.cmac.isNull());
 			ok = true;
 		}));
+		QVERIFY(partner->waitForReply<ResumeTicketMessage>([&](ResumeTicketMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
 	} catch(std::exception &e) {
 		QFAIL(e.what());
 	}
@@ -1529,6 +2066,10 @@ void TestAppServer::testKeyChangeNoAck()
 			QCOMPARE(message.cmac, cmac);
 			ok = true;
 		}));
+		QVERIFY(partner->waitForReply<ResumeTicketMessage>([&](ResumeTicketMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
 
 		//do NOT send the mac, but reconnect
 		clean(partner);
@@ -1559,6 +2100,10 @@ void TestAppServer::testKeyChangeNoAck()
 			QCOMPARE(message.cmac, cmac);
 			ok = true;
 		}));
+		QVERIFY(partner->waitForReply<ResumeTicketMessage>([&](ResumeTicketMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
 
 		//update the mac accordingly
 		partner->send(MacUpdateMessage { nextIndex, partnerName.toUtf8() });
@@ -1651,6 +2196,216 @@ void TestAppServer::testListAndRemoveDevices()
 	}
 }
 
+void TestAppServer::testClusterAddDevice()
+{
+#ifndef CLUSTER_FILE
+	QSKIP("Clustering is only supported with PostgreSQL");
+#else
+	//start a second server on the same database
+	QProcess node;
+	node.setProgram(server->program());
+	node.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+	auto env = QProcessEnvironment::systemEnvironment();
+	env.insert(QStringLiteral("QDSAPP_CONFIG_FILE"), QStringLiteral(CLUSTER_FILE));
+	node.setProcessEnvironment(env);
+	node.start();
+	QVERIFY(node.waitForStarted(5000));
+	QVERIFY(!node.waitForFinished(5000));
+
+	try {
+		QVERIFY(client);
+
+		//add a partner via the second server, while the client is connected to the first one
+		MockClient *nodePartner = nullptr;
+		QUuid nodePartnerDevId;
+		testAddDevice(nodePartner, nodePartnerDevId, true, 14245);
+		QVERIFY(nodePartner);
+
+		//remove the partner, which must disconnect it from the second server
+		client->send(RemoveMessage {nodePartnerDevId});
+		QVERIFY(client->waitForReply<RemoveAckMessage>([&](RemoveAckMessage message, bool &ok) {
+			QCOMPARE(message.deviceId, nodePartnerDevId);
+			ok = true;
+		}));
+		clean(nodePartner, false);
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+
+	node.kill();
+	QVERIFY(node.waitForFinished(5000));
+#endif
+}
+
+void TestAppServer::testQuotaOtherDeviceRemoved()
+{
+	QSettings config(QStringLiteral(SETUP_FILE), QSettings::IniFormat);
+	auto limit = config.value(QStringLiteral("quota/limit"), 10485760).toInt();
+	QByteArray data(limit / 4, 'r');
+
+	try {
+		QVERIFY(client);
+
+		//add an offline partner, so the uploads are kept
+		MockClient *quotaPartner = nullptr;
+		QUuid quotaPartnerDevId;
+		testAddDevice(quotaPartner, quotaPartnerDevId);
+		QVERIFY(!quotaPartner);
+
+		//fill 3/4 of the quota
+		ChangeMessage changeMsg { "ledgerId" };
+		changeMsg.keyIndex = 0;
+		changeMsg.salt = "salt";
+		changeMsg.data = data;
+		for(auto i = 0; i < 3; i++) {
+			changeMsg.dataId = "ledgerId" + QByteArray::number(i);
+			client->send(changeMsg);
+			QVERIFY(client->waitForReply<ChangeAckMessage>([&](ChangeAckMessage message, bool &ok) {
+				QCOMPARE(message.dataId, changeMsg.dataId);
+				ok = true;
+			}));
+		}
+
+		//the partner downloads them, which frees the quota of the client's uploads
+		quotaPartner = new MockClient(this);
+		QVERIFY(quotaPartner->waitForConnected());
+		QByteArray mNonce;
+		QVERIFY(quotaPartner->waitForReply<IdentifyMessage>([&](IdentifyMessage message, bool &ok) {
+			mNonce = message.nonce;
+			ok = true;
+		}));
+		quotaPartner->sendSigned(LoginMessage {
+									 quotaPartnerDevId,
+									 partnerName,
+									 mNonce
+								 }, partnerCrypto);
+		QVERIFY(quotaPartner->waitForReply<WelcomeMessage>([&](WelcomeMessage message, bool &ok) {
+			QVERIFY(message.hasChanges);
+			ok = true;
+		}));
+		QVERIFY(quotaPartner->waitForReply<ResumeTicketMessage>([&](ResumeTicketMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+		QList<quint64> dataIds;
+		QVERIFY(quotaPartner->waitForReply<ChangedInfoMessage>([&](ChangedInfoMessage message, bool &ok) {
+			dataIds.append(message.dataIndex);
+			ok = true;
+		}));
+		for(auto i = 1; i < 3; i++) {
+			QVERIFY(quotaPartner->waitForReply<ChangedMessage>([&](ChangedMessage message, bool &ok) {
+				dataIds.append(message.dataIndex);
+				ok = true;
+			}));
+		}
+		quotaPartner->send(ChangedAckBatchMessage { dataIds });
+		QVERIFY(quotaPartner->waitForReply<LastChangedMessage>([&](LastChangedMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+
+		//with a quota ledger, the freed space is not folded into the account yet - the upload must still fit
+		changeMsg.dataId = "ledgerId3";
+		changeMsg.data = QByteArray(limit / 2, 'r');
+		quotaPartner->send(changeMsg);
+		QVERIFY(quotaPartner->waitForReply<ChangeAckMessage>([&](ChangeAckMessage message, bool &ok) {
+			QCOMPARE(message.dataId, changeMsg.dataId);
+			ok = true;
+		}));
+
+		//the client gets it live
+		QVERIFY(client->waitForReply<ChangedInfoMessage>([&](ChangedInfoMessage message, bool &ok) {
+			QCOMPARE(message.changeEstimate, 1u);
+			QCOMPARE(message.data, changeMsg.data);
+			client->send(ChangedAckMessage { message.dataIndex });
+			ok = true;
+		}));
+		QVERIFY(client->waitForReply<LastChangedMessage>([&](LastChangedMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+
+		//remove the partner again
+		client->send(RemoveMessage {quotaPartnerDevId});
+		QVERIFY(client->waitForReply<RemoveAckMessage>([&](RemoveAckMessage message, bool &ok) {
+			QCOMPARE(message.deviceId, quotaPartnerDevId);
+			ok = true;
+		}));
+		clean(quotaPartner, false);
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
+void TestAppServer::testQuotaLimit()
+{
+	QSettings config(QStringLiteral(SETUP_FILE), QSettings::IniFormat);
+	auto limit = config.value(QStringLiteral("quota/limit"), 10485760).toInt();
+	QByteArray data(limit / 4, 'q');
+
+	try {
+		QVERIFY(client);
+
+		//add an offline partner, so the uploads are kept
+		MockClient *quotaPartner = nullptr;
+		QUuid quotaPartnerDevId;
+		testAddDevice(quotaPartner, quotaPartnerDevId);
+		QVERIFY(!quotaPartner);
+
+		//the first 3 fit into the quota
+		ChangeMessage changeMsg { "quotaId" };
+		changeMsg.keyIndex = 0;
+		changeMsg.salt = "salt";
+		changeMsg.data = data;
+		for(auto i = 0; i < 3; i++) {
+			changeMsg.dataId = "quotaId" + QByteArray::number(i);
+			client->send(changeMsg);
+			QVERIFY(client->waitForReply<ChangeAckMessage>([&](ChangeAckMessage message, bool &ok) {
+				QCOMPARE(message.dataId, changeMsg.dataId);
+				ok = true;
+			}));
+		}
+
+		//the 4th exceeds it
+		changeMsg.dataId = "quotaId3";
+		client->send(changeMsg);
+		QVERIFY(client->waitForError(ErrorMessage::QuotaHitError));
+		clean(client);
+
+		//login again
+		client = new MockClient(this);
+		QVERIFY(client->waitForConnected());
+		QByteArray mNonce;
+		QVERIFY(client->waitForReply<IdentifyMessage>([&](IdentifyMessage message, bool &ok) {
+			mNonce = message.nonce;
+			ok = true;
+		}));
+		client->sendSigned(LoginMessage {
+							   devId,
+							   devName,
+							   mNonce
+						   }, crypto);
+		QVERIFY(client->waitForReply<WelcomeMessage>([&](WelcomeMessage message, bool &ok) {
+			QVERIFY(!message.hasChanges);
+			ok = true;
+		}));
+		QVERIFY(client->waitForReply<ResumeTicketMessage>([&](ResumeTicketMessage message, bool &ok) {
+			resumeTicket = message.ticket;
+			resumeSecret = crypto->decrypt(message.secret);
+			ok = true;
+		}));
+
+		//remove the partner again
+		client->send(RemoveMessage {quotaPartnerDevId});
+		QVERIFY(client->waitForReply<RemoveAckMessage>([&](RemoveAckMessage message, bool &ok) {
+			QCOMPARE(message.deviceId, quotaPartnerDevId);
+			ok = true;
+		}));
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
 void TestAppServer::testUnexpectedMessage_data()
 {
 	QTest::addColumn<QSharedPointer<Message>>("message");
@@ -1678,6 +2433,9 @@ void TestAppServer::testUnexpectedMessage_data()
 	QTest::newRow("ChangedAckMessage") << create<ChangedAckMessage>(42ull)
 									   << false
 									   << false;
+	QTest::newRow("ChangedAckBatchMessage") << create<ChangedAckBatchMessage>(QList<quint64>{42ull})
+											<< false
+											<< false;
 	QTest::newRow("ListDevicesMessage") << create<ListDevicesMessage>()
 										<< false
 										<< false;
@@ -1771,6 +2529,19 @@ void TestAppServer::testBrokenMessage()
 	}
 }
 
+void TestAppServer::testMetrics()
+{
+	auto reply = requestMetrics("/metrics");
+	QVERIFY(reply.startsWith("HTTP/1.1 200 OK\r\n"));
+	QVERIFY(reply.contains("\nqdsapp_connections_active "));
+	QVERIFY(reply.contains("\nqdsapp_clients_active "));
+	QVERIFY(reply.contains("\nqdsapp_message_duration_seconds_count{type=\"Login\"} "));
+	QVERIFY(reply.contains("\nqdsapp_database_duration_seconds_bucket{operation=\"addChange\",le=\"+Inf\"} "));
+
+	reply = requestMetrics("/other");
+	QVERIFY(reply.startsWith("HTTP/1.1 404 Not Found\r\n"));
+}
+
 void TestAppServer::testRemoveSelf()
 {
 	try {
@@ -1818,6 +2589,90 @@ void TestAppServer::testRemoveSelf()
 	}
 }
 
+void TestAppServer::testCleanup()
+{
+#ifndef Q_OS_UNIX
+	QSKIP("The cleanup can only be triggered via a signal on unix");
+#else
+	auto db = openDatabase();
+	QVERIFY2(db.isOpen(), qUtf8Printable(db.lastError().text()));
+	auto isSqlite = (db.driverName() == QStringLiteral("QSQLITE"));
+
+	try {
+		//an account that was not used for longer than the cleanup interval
+		testRegister();
+		auto inactiveDevId = devId;
+		QSqlQuery backdateQuery(db);
+		QVERIFY(backdateQuery.prepare(isSqlite ?
+										  QStringLiteral("UPDATE devices SET lastlogin = date('now', '-1000 days') WHERE id = ?") :
+										  QStringLiteral("UPDATE devices SET lastlogin = current_date - 1000 WHERE id = ?")));
+		backdateQuery.addBindValue(inactiveDevId);
+		QVERIFY2(backdateQuery.exec(), qUtf8Printable(backdateQuery.lastError().text()));
+		QCOMPARE(backdateQuery.numRowsAffected(), 1);
+
+		//an account with a device that a running cleanup already marked
+		testRegister();
+		auto markedDevId = devId;
+		QSqlQuery markQuery(db);
+		QVERIFY(markQuery.prepare(isSqlite ?
+									  QStringLiteral("UPDATE devices SET lastlogin = '0000-00-00' WHERE id = ?") :
+									  QStringLiteral("UPDATE devices SET lastlogin = '-infinity' WHERE id = ?")));
+		markQuery.addBindValue(markedDevId);
+		QVERIFY2(markQuery.exec(), qUtf8Printable(markQuery.lastError().text()));
+		QCOMPARE(markQuery.numRowsAffected(), 1);
+
+		//the marked device cannot log in anymore
+		client = new MockClient(this);
+		QVERIFY(client->waitForConnected());
+		QByteArray mNonce;
+		QVERIFY(client->waitForReply<IdentifyMessage>([&](IdentifyMessage message, bool &ok) {
+			mNonce = message.nonce;
+			ok = true;
+		}));
+		client->sendSigned(LoginMessage {
+							   markedDevId,
+							   devName,
+							   mNonce
+						   }, crypto);
+		QVERIFY(client->waitForError(ErrorMessage::AuthenticationError));
+		clean(client);
+
+		QSqlQuery usersQuery(db);
+		QVariantList devIds {inactiveDevId, markedDevId};
+		QVERIFY(usersQuery.prepare(QStringLiteral("SELECT userid FROM devices WHERE id = ? OR id = ?")));
+		usersQuery.addBindValue(inactiveDevId);
+		usersQuery.addBindValue(markedDevId);
+		QVERIFY2(usersQuery.exec(), qUtf8Printable(usersQuery.lastError().text()));
+		QVariantList userIds;
+		while(usersQuery.next())
+			userIds.append(usersQuery.value(0));
+		QCOMPARE(userIds.size(), 2);
+
+		auto count = [&](const QString &query, const QVariantList &ids) {
+			QSqlQuery countQuery(db);
+			if(!countQuery.prepare(query))
+				return -1;
+			for(const auto &id : ids)
+				countQuery.addBindValue(id);
+			if(!countQuery.exec() || !countQuery.first())
+				return -1;
+			return countQuery.value(0).toInt();
+		};
+
+		//run the cleanup, which removes both devices, their accounts and with them the quota
+		QCOMPARE(kill(static_cast<pid_t>(server->processId()), SIGUSR1), 0);
+		QTRY_COMPARE_WITH_TIMEOUT(count(QStringLiteral("SELECT COUNT(*) FROM devices WHERE id = ? OR id = ?"), devIds), 0, 10000);
+		QTRY_COMPARE_WITH_TIMEOUT(count(QStringLiteral("SELECT COUNT(*) FROM users WHERE id = ? OR id = ?"), userIds), 0, 10000);
+		if(db.tables().contains(QStringLiteral("quotaledger"))) {
+			QCOMPARE(count(QStringLiteral("SELECT COUNT(*) FROM quotaledger WHERE userid = ? OR userid = ?"),
+						   userIds), 0);
+		}
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+#endif
+}
+
 void TestAppServer::testStop()
 {
 	//send a signal to stop
@@ -1848,6 +2703,49 @@ void TestAppServer::clean(MockClient *&client, bool disconnect)
 	client = nullptr;
 }
 
+QByteArray TestAppServer::requestMetrics(const QByteArray &path, quint16 port)
+{
+	QTcpSocket socket;
+	socket.connectToHost(QStringLiteral("localhost"), port);
+	if(!socket.waitForConnected(5000))
+		return QByteArray();
+	socket.write("GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n");
+	while(socket.state() == QAbstractSocket::ConnectedState && socket.waitForReadyRead(5000));
+	return socket.readAll();
+}
+
+double TestAppServer::metricValue(const QByteArray &metric, quint16 port)
+{
+	//metrics that were never changed are not reported yet
+	auto reply = requestMetrics("/metrics", port);
+	auto index = reply.indexOf("\n" + metric + " ");
+	if(index == -1)
+		return 0;
+	index += metric.size() + 2;
+	return reply.mid(index, reply.indexOf('\n', index) - index).toDouble();
+}
+
+QSqlDatabase TestAppServer::openDatabase()
+{
+	//the same database as the server, to prepare and verify what clients cannot see
+	QSettings config(QStringLiteral(SETUP_FILE), QSettings::IniFormat);
+	auto driver = config.value(QStringLiteral("database/driver"), QStringLiteral("QPSQL")).toString();
+	if(QSqlDatabase::contains(QStringLiteral("tst_appserver")))
+		return QSqlDatabase::database(QStringLiteral("tst_appserver"));
+	auto db = QSqlDatabase::addDatabase(driver, QStringLiteral("tst_appserver"));
+	db.setDatabaseName(config.value(QStringLiteral("database/name")).toString());
+	if(driver == QStringLiteral("QSQLITE")) //the server writes at the same time
+		db.setConnectOptions(QStringLiteral("QSQLITE_BUSY_TIMEOUT=30000"));
+	else {
+		db.setHostName(config.value(QStringLiteral("database/host")).toString());
+		db.setPort(config.value(QStringLiteral("database/port")).toInt());
+		db.setUserName(config.value(QStringLiteral("database/username")).toString());
+		db.setPassword(config.value(QStringLiteral("database/password")).toString());
+	}
+	db.open();
+	return db;
+}
+
 template<typename TMessage, typename... Args>
 inline QSharedPointer<Message> TestAppServer::create(Args... args)
 {
@@ -0,0 +1,6 @@
+include(../tests.pri)
+
+TARGET = tst_cryptopipeline
+
+SOURCES += \
+		tst_cryptopipeline.cpp
@@ -0,0 +1,150 @@
+#include <QString>
+#include <QtTest>
+#include <QCoreApplication>
+#include <QtDataSync/private/cryptopipeline_p.h>
+using namespace QtDataSync;
+
+class TestCryptoPipeline : public QObject
+{
+	Q_OBJECT
+
+private Q_SLOTS:
+	void testOrder_data();
+	void testOrder();
+	void testErrors_data();
+	void testErrors();
+	void testReset_data();
+	void testReset();
+
+private:
+	void addThreadData();
+	//jobs that were enqueued first take the longest, so they complete last
+	static CryptoPipeline::Job delayedJob(int index, int count);
+};
+
+void TestCryptoPipeline::testOrder_data()
+{
+	addThreadData();
+}
+
+void TestCryptoPipeline::testOrder()
+{
+	QFETCH(int, threads);
+
+	const auto count = 20;
+	CryptoPipeline pipeline(threads);
+	QByteArrayList results;
+	for(auto i = 0; i < count; i++) {
+		pipeline.enqueue(delayedJob(i, count), [&](const QByteArray &result) {
+			results.append(result);
+		}, [](const Exception &e) {
+			QFAIL(e.what());
+		});
+		//steps must wait for all previous jobs
+		if(i % 5 == 4) {
+			pipeline.enqueue([&, i]() {
+				results.append("step" + QByteArray::number(i));
+			});
+		}
+	}
+
+	QTRY_VERIFY(pipeline.isIdle());
+	QByteArrayList expected;
+	for(auto i = 0; i < count; i++) {
+		expected.append(QByteArray::number(i));
+		if(i % 5 == 4)
+			expected.append("step" + QByteArray::number(i));
+	}
+	QCOMPARE(results, expected);
+}
+
+void TestCryptoPipeline::testErrors_data()
+{
+	addThreadData();
+}
+
+void TestCryptoPipeline::testErrors()
+{
+	QFETCH(int, threads);
+
+	CryptoPipeline pipeline(threads);
+	QByteArrayList results;
+	pipeline.enqueue(delayedJob(0, 3), [&](const QByteArray &result) {
+		results.append(result);
+	}, [&](const Exception &) {
+		results.append("error0");
+	});
+	pipeline.enqueue([]() -> QByteArray {
+		throw Exception(QString(), QStringLiteral("failed"));
+	}, [&](const QByteArray &result) {
+		results.append(result);
+	}, [&](const Exception &e) {
+		QCOMPARE(e.message(), QStringLiteral("failed"));
+		results.append("error1");
+	});
+	pipeline.enqueue(delayedJob(2, 3), [&](const QByteArray &result) {
+		results.append(result);
+	}, [&](const Exception &) {
+		results.append("error2");
+	});
+
+	QTRY_VERIFY(pipeline.isIdle());
+	QCOMPARE(results, QByteArrayList({"0", "error1", "2"}));
+}
+
+void TestCryptoPipeline::testReset_data()
+{
+	addThreadData();
+}
+
+void TestCryptoPipeline::testReset()
+{
+	QFETCH(int, threads);
+
+	CryptoPipeline pipeline(threads);
+	QByteArrayList results;
+	auto onResult = [&](const QByteArray &result) {
+		results.append(result);
+	};
+	auto onError = [](const Exception &e) {
+		QFAIL(e.what());
+	};
+
+	//without threads, jobs complete immediately and cannot be dropped
+	pipeline.enqueue(delayedJob(0, 2), onResult, onError);
+	pipeline.enqueue([&]() {
+		results.append("step");
+	});
+	pipeline.reset();
+	QVERIFY(pipeline.isIdle());
+
+	//jobs of the previous generation are discarded once they complete
+	pipeline.enqueue(delayedJob(1, 2), onResult, onError);
+	QTRY_VERIFY(pipeline.isIdle());
+	QTest::qWait(200);
+	if(threads == 0)
+		QCOMPARE(results, QByteArrayList({"0", "step", "1"}));
+	else
+		QCOMPARE(results, QByteArrayList({"1"}));
+}
+
+void TestCryptoPipeline::addThreadData()
+{
+	QTest::addColumn<int>("threads");
+
+	QTest::newRow("inline") << 0;
+	QTest::newRow("single") << 1;
+	QTest::newRow("pool") << 4;
+}
+
+CryptoPipeline::Job TestCryptoPipeline::delayedJob(int index, int count)
+{
+	return [index, count]() {
+		QThread::msleep(static_cast<unsigned long>((count - index) * 5));
+		return QByteArray::number(index);
+	};
+}
+
+QTEST_MAIN(TestCryptoPipeline)
+
+#include "tst_cryptopipeline.moc"
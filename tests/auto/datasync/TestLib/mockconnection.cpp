@@ -51,6 +51,11 @@ void MockConnection::close()
 	_socket->close();
 }
 
+bool MockConnection::hasPendingReply() const
+{
+	return !_msgSpy.isEmpty();
+}
+
 bool MockConnection::waitForNothing()
 {
 	return _msgSpy.isEmpty() &&
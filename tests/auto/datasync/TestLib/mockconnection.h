@@ -24,6 +24,7 @@ public:
 	void close();
 	//server does not need signed sending
 
+	bool hasPendingReply() const;
 	bool waitForNothing();
 	bool waitForPing();
 	template <typename TMessage>
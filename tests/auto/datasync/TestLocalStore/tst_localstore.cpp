@@ -280,6 +280,13 @@ void TestLocalStore::testChangeLoading()
 			}();
 			return true;
 		});
+		//verify changes are loaded in the order they happened
+		QList<ObjectKey> order;
+		store->loadChanges(10, [&](ObjectKey k, quint64, QString, QUuid) {
+			order.append(k);
+			return true;
+		});
+		QCOMPARE(order, (QList<ObjectKey> {TestLib::generateKey(42), TestLib::generateKey(13)}));
 	} catch(QException &e) {
 		QFAIL(e.what());
 	}
@@ -390,7 +397,8 @@ void TestLocalStore::testInfoLoading()
 			QCOMPARE(std::get<0>(info), LocalStore::Exists);
 			QCOMPARE(std::get<1>(info), 1ull);
 			QVERIFY(!std::get<2>(info).isNull());
-			QVERIFY(!std::get<3>(info).isNull());
+			QCOMPARE(std::get<3>(info), SyncHelper::jsonHash(TestLib::generateDataJson(42), LocalStore::LocalChecksum));
+			QCOMPARE(std::get<4>(info), LocalStore::LocalChecksum);
 			store->commitSync(scope);
 		}
 		{
@@ -20,6 +20,7 @@
 #include <QtDataSync/private/proofmessage_p.h>
 #include <QtDataSync/private/registermessage_p.h>
 #include <QtDataSync/private/removemessage_p.h>
+#include <QtDataSync/private/resumemessage_p.h>
 #include <QtDataSync/private/syncmessage_p.h>
 #include <QtDataSync/private/welcomemessage_p.h>
 #include <QtDataSync/private/cryptocontroller_p.h>
@@ -42,6 +43,8 @@ private Q_SLOTS:
 	void testSignedSerialization_data();
 	void testSignedSerialization();
 
+	void testResumeMac();
+
 private:
 	ClientCrypto *crypto;
 
@@ -173,6 +176,28 @@ void TestMessages::testSignedSerialization()
 	delete resultMessage;
 }
 
+void TestMessages::testResumeMac()
+{
+	ResumeMessage msg(QUuid::createUuid(),
+					  QStringLiteral("devName"),
+					  QByteArray(InitMessage::NonceSize, 'x'),
+					  "ticket");
+	msg.sign("secret");
+	QVERIFY(!msg.mac.isEmpty());
+	QVERIFY(msg.verify("secret"));
+	QVERIFY(!msg.verify("other secret"));
+
+	auto copy = msg;
+	copy.ticket = "other ticket";
+	QVERIFY(!copy.verify("secret"));
+	copy = msg;
+	copy.nonce = QByteArray(InitMessage::NonceSize, 'y');
+	QVERIFY(!copy.verify("secret"));
+	copy = msg;
+	copy.mac.chop(1);
+	QVERIFY(!copy.verify("secret"));
+}
+
 void TestMessages::addSignedData()
 {
 	QTest::addColumn<QByteArray>("name");
@@ -279,6 +304,23 @@ void TestMessages::addAllData()
 		msg.cmac = "cmac";
 		return msg;
 	});
+	addData<ResumeMessage>([&]() {
+		ResumeMessage msg(QUuid::createUuid(),
+						  QStringLiteral("devName"),
+						  QByteArray(InitMessage::NonceSize, 'x'),
+						  "ticket");
+		msg.sign("secret");
+		return msg;
+	});
+	addData<ResumeMessage>([&]() {
+		return ResumeMessage(QUuid::createUuid(),
+							 QStringLiteral("devName"),
+							 QByteArray(3, 'x'),
+							 "ticket");
+	}, false);
+	addData<ResumeTicketMessage>([&]() {
+		return ResumeTicketMessage("ticket", "encrypted_secret");
+	});
 	addData<MacUpdateMessage>([&]() {
 		return MacUpdateMessage(42, "cmac");
 	});
@@ -326,6 +368,9 @@ void TestMessages::addAllData()
 	addData<ChangedAckMessage>([&]() {
 		return ChangedAckMessage(77);
 	});
+	addData<ChangedAckBatchMessage>([&]() {
+		return ChangedAckBatchMessage({77, 78, 1000});
+	});
 
 	addData<ProofMessage>([&]() {
 		AccessMessage msg(QStringLiteral("devName"),
@@ -453,8 +453,8 @@ void TestRemoteConnector::testDownloading()
 
 		//complete the change
 		remote->downloadDone(infoMsg.dataIndex);
-		QVERIFY(connection->waitForReply<ChangedAckMessage>([&](ChangedAckMessage message, bool &ok) {
-			QCOMPARE(message.dataIndex, infoMsg.dataIndex);
+		QVERIFY(connection->waitForReply<ChangedAckBatchMessage>([&](ChangedAckBatchMessage message, bool &ok) {
+			QCOMPARE(message.dataIndexes, QList<quint64>{infoMsg.dataIndex});
 			ok = true;
 		}));
 		QCOMPARE(progIncSpy.size(), 1);
@@ -475,8 +475,8 @@ void TestRemoteConnector::testDownloading()
 
 		//complete the change
 		remote->downloadDone(changeMsg.dataIndex);
-		QVERIFY(connection->waitForReply<ChangedAckMessage>([&](ChangedAckMessage message, bool &ok) {
-			QCOMPARE(message.dataIndex, changeMsg.dataIndex);
+		QVERIFY(connection->waitForReply<ChangedAckBatchMessage>([&](ChangedAckBatchMessage message, bool &ok) {
+			QCOMPARE(message.dataIndexes, QList<quint64>{changeMsg.dataIndex});
 			ok = true;
 		}));
 		QCOMPARE(progIncSpy.size(), 2);
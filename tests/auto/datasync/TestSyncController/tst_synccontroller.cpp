@@ -27,6 +27,9 @@ private Q_SLOTS:
 	void testResolver_data();
 	void testResolver();
 
+	void testDelta();
+	void testFullRequest();
+
 private:
 	LocalStore *store;
 	SyncController *controller;
@@ -466,7 +469,7 @@ void TestSyncController::testSyncOperation()
 			if(resultState == LocalStore::Exists) {
 				auto tJson = store->readJson(key, std::get<2>(info));
 				QCOMPARE(tJson, resultData);
-				QCOMPARE(std::get<3>(info), SyncHelper::jsonHash(resultData));
+				QCOMPARE(std::get<3>(info), SyncHelper::jsonHash(resultData, std::get<4>(info)));
 			}
 			store->commitSync(scope);
 		}
@@ -550,7 +553,7 @@ void TestSyncController::testResolver()
 			QCOMPARE(std::get<1>(info), version + 1ull);
 			auto tJson = store->readJson(key, std::get<2>(info));
 			QCOMPARE(tJson, resultData);
-			QCOMPARE(std::get<3>(info), SyncHelper::jsonHash(resultData));
+			QCOMPARE(std::get<3>(info), SyncHelper::jsonHash(resultData, std::get<4>(info)));
 			store->commitSync(scope);
 		}
 
@@ -574,6 +577,134 @@ void TestSyncController::testResolver()
 	}
 }
 
+void TestSyncController::testDelta()
+{
+	QSignalSpy doneSpy(controller, &SyncController::syncDone);
+	QSignalSpy errorSpy(controller, &SyncController::controllerError);
+	QSignalSpy fullSpy(controller, &SyncController::fullChangeRequired);
+
+	auto key = TestLib::generateKey(20);
+	auto baseData = TestLib::generateDataJson(20, QStringLiteral("base"));
+	auto remoteData = baseData;
+	remoteData.insert(QStringLiteral("text"), QStringLiteral("changed"));
+	remoteData.remove(QStringLiteral("id"));
+	remoteData.insert(QStringLiteral("extra"), QJsonObject{{QStringLiteral("a/b~c"), 42}});
+	auto deviceId = QUuid::createUuid();
+
+	try {
+		store->reset(false);
+
+		//test the patch itself
+		auto patch = SyncHelper::createDelta(baseData, remoteData);
+		QCOMPARE(patch.size(), 3);
+		auto testData = baseData;
+		QVERIFY(SyncHelper::applyDelta(testData, patch));
+		QCOMPARE(testData, remoteData);
+
+		//step 1: setup the local store
+		{
+			auto scope = store->startSync(key);
+			store->storeChanged(scope, 1, QString(), baseData, false, LocalStore::NoExists);
+			store->commitSync(scope);
+		}
+
+		//step 2: sync a delta with a matching base
+		SyncHelper::DeltaInfo delta;
+		delta.type = SyncHelper::DeltaInfo::Patch;
+		delta.baseVersion = 1;
+		delta.baseChecksum = SyncHelper::jsonHash(baseData);
+		delta.sourceDevice = deviceId;
+		delta.patch = patch;
+		controller->syncChange(42ull, SyncHelper::combine(key, 2, delta));
+		if(!errorSpy.isEmpty())
+			QFAIL(errorSpy.takeFirst()[0].toString().toUtf8().constData());
+		QCOMPARE(doneSpy.size(), 1);
+		QCOMPARE(doneSpy.takeFirst()[0].toULongLong(), 42ull);
+		QVERIFY(fullSpy.isEmpty());
+		QCOMPARE(store->load(key), remoteData);
+
+		//step 3: sync a delta with an unknown base
+		delta.baseVersion = 3;
+		delta.patch = SyncHelper::createDelta(remoteData, baseData);
+		controller->syncChange(43ull, SyncHelper::combine(key, 4, delta));
+		if(!errorSpy.isEmpty())
+			QFAIL(errorSpy.takeFirst()[0].toString().toUtf8().constData());
+		QCOMPARE(doneSpy.size(), 1);
+		QCOMPARE(doneSpy.takeFirst()[0].toULongLong(), 43ull);
+		QCOMPARE(fullSpy.size(), 1);
+		auto request = fullSpy.takeFirst();
+		QCOMPARE(request[0].value<ObjectKey>(), key);
+		QCOMPARE(request[1].toULongLong(), 4ull);
+		QCOMPARE(request[2].toUuid(), deviceId);
+		QCOMPARE(store->load(key), remoteData);
+	} catch(QException &e) {
+		QFAIL(e.what());
+	}
+}
+
+void TestSyncController::testFullRequest()
+{
+	QSignalSpy doneSpy(controller, &SyncController::syncDone);
+	QSignalSpy errorSpy(controller, &SyncController::controllerError);
+	QSignalSpy fullSpy(controller, &SyncController::fullChangeRequired);
+
+	auto key = TestLib::generateKey(21);
+	auto localData = TestLib::generateDataJson(21, QStringLiteral("local"));
+	auto fullData = TestLib::generateDataJson(21, QStringLiteral("full"));
+	auto deviceId = QUuid::createUuid();
+
+	try {
+		store->reset(false);
+
+		//step 1: setup the local store, with the uploaded data as sync base
+		{
+			auto scope = store->startSync(key);
+			store->storeChanged(scope, 2, QString(), localData, false, LocalStore::NoExists);
+			store->commitSync(scope);
+		}
+		store->storeSyncBase(key, 2, localData);
+		QCOMPARE(std::get<0>(store->loadSyncBase(key)), 2ull);
+
+		//step 2: a request for the full data cannot be extracted as a normal change
+		SyncHelper::DeltaInfo delta;
+		delta.type = SyncHelper::DeltaInfo::FullRequest;
+		delta.sourceDevice = deviceId;
+		auto request = SyncHelper::combine(key, 2, delta);
+		QVERIFY_EXCEPTION_THROWN(SyncHelper::extract(request), Exception);
+
+		//step 3: sync the request, which drops the base and marks the data for a full upload
+		controller->syncChange(44ull, request);
+		if(!errorSpy.isEmpty())
+			QFAIL(errorSpy.takeFirst()[0].toString().toUtf8().constData());
+		QCOMPARE(doneSpy.size(), 1);
+		QCOMPARE(doneSpy.takeFirst()[0].toULongLong(), 44ull);
+		QVERIFY(fullSpy.isEmpty());
+		QCOMPARE(std::get<0>(store->loadSyncBase(key)), 0ull);
+		auto called = false;
+		store->loadChanges(1000, [key, &called](ObjectKey k, quint64 v, QString, QUuid) -> bool {
+			if(k == key) {
+				if (!QTest::qCompare(v, 2ull, "v", "2ull", __FILE__, __LINE__))
+					return false;
+				called = true;
+				return false;
+			} else
+				return true;
+		});
+		QVERIFY(called);
+		QCOMPARE(store->load(key), localData);
+
+		//step 4: the full data sent by the other device is applied
+		controller->syncChange(45ull, SyncHelper::combine(key, 3, fullData));
+		if(!errorSpy.isEmpty())
+			QFAIL(errorSpy.takeFirst()[0].toString().toUtf8().constData());
+		QCOMPARE(doneSpy.size(), 1);
+		QCOMPARE(doneSpy.takeFirst()[0].toULongLong(), 45ull);
+		QCOMPARE(store->load(key), fullData);
+	} catch(QException &e) {
+		QFAIL(e.what());
+	}
+}
+
 QTEST_MAIN(TestSyncController)
 
 #include "tst_synccontroller.moc"
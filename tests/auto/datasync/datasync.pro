@@ -7,6 +7,7 @@ SUBDIRS += \
 	TestDataTypeStore \
 	TestChangeController \
 	TestCryptoController \
+	TestCryptoPipeline \
 	TestSyncController \
 	TestRoThreadedBackend \
 	TestMessages \
@@ -0,0 +1,8 @@
+include(../benchmarks.pri)
+
+TARGET = tst_cryptobenchmark
+
+SOURCES += \
+	tst_cryptobenchmark.cpp
+
+DEFINES += PLUGIN_DIR=\\\"$$OUT_PWD/../../../../plugins/keystores/\\\"
@@ -0,0 +1,247 @@
+#include <QString>
+#include <QtTest>
+#include <QCoreApplication>
+#include <testlib.h>
+#include <QtDataSync/private/cryptocontroller_p.h>
+#include <QtDataSync/private/cryptopipeline_p.h>
+
+//fake private
+#define private public
+#include <QtDataSync/private/defaults_p.h>
+#undef private
+using namespace QtDataSync;
+
+// Measures how fast downloaded changes can be decrypted by the crypto pipeline, depending on the
+// number of worker threads, the per message costs of the symmetric crypto for small payloads and
+// the throughput of all cipher schemes.
+// The download workload can be configured via environment variables:
+//  - QDS_BENCH_COUNT: number of messages to decrypt (default 2000)
+//  - QDS_BENCH_SIZE: payload size of each message in bytes (default 4096)
+class CryptoBenchmark : public QObject
+{
+	Q_OBJECT
+
+private Q_SLOTS:
+	void initTestCase();
+	void cleanupTestCase();
+
+	void benchDownload_data();
+	void benchDownload();
+	void benchSmallMessages_data();
+	void benchSmallMessages();
+	void benchSchemes_data();
+	void benchSchemes();
+
+private:
+	struct CipherData {
+		quint32 keyIndex;
+		QByteArray salt;
+		QByteArray cipher;
+	};
+
+	CryptoController *controller;
+
+	int count;
+	int size;
+	QVector<CipherData> messages;
+
+	static int envInt(const char *name, int defaultValue);
+};
+
+void CryptoBenchmark::initTestCase()
+{
+#ifdef Q_OS_LINUX
+	if(!qgetenv("LD_PRELOAD").contains("Qt5DataSync"))
+		qWarning() << "No LD_PRELOAD set - this may fail on systems with multiple version of the modules";
+#endif
+	QVERIFY(qputenv("PLUGIN_KEYSTORES_PATH", PLUGIN_DIR));
+
+	count = envInt("QDS_BENCH_COUNT", 2000);
+	size = envInt("QDS_BENCH_SIZE", 4096);
+	QVERIFY(count > 0);
+	QVERIFY(size >= 0);
+
+	try {
+		TestLib::init();
+		Setup setup;
+		TestLib::setup(setup);
+		setup.create();
+
+		controller = new CryptoController(DefaultsPrivate::obtainDefaults(DefaultSetup), this);
+		controller->initialize({});
+		controller->acquireStore(false);
+		controller->createPrivateKeys("nonce");
+
+		//the encrypted messages are the same for all runs
+		messages.reserve(count);
+		for(auto i = 0; i < count; i++) {
+			CipherData data;
+			std::tie(data.keyIndex, data.salt, data.cipher) = controller->encryptData(QByteArray(size, static_cast<char>('a' + i % 26)));
+			messages.append(data);
+		}
+	} catch(QException &e) {
+		QFAIL(e.what());
+	}
+}
+
+void CryptoBenchmark::cleanupTestCase()
+{
+	controller->finalize();
+	delete controller;
+	controller = nullptr;
+	Setup::removeSetup(DefaultSetup, true);
+}
+
+void CryptoBenchmark::benchDownload_data()
+{
+	QTest::addColumn<int>("threads");
+
+	QTest::newRow("inline") << 0;
+	auto ideal = QThread::idealThreadCount();
+	for(auto threads = 1; threads < ideal; threads *= 2)
+		QTest::newRow(qUtf8Printable(QStringLiteral("threads_%1").arg(threads))) << threads;
+	QTest::newRow(qUtf8Printable(QStringLiteral("threads_%1").arg(ideal))) << ideal;
+}
+
+void CryptoBenchmark::benchDownload()
+{
+	QFETCH(int, threads);
+
+	try {
+		CryptoPipeline pipeline(threads);
+		QEventLoop loop;
+		auto received = 0;
+		auto inOrder = true;
+		auto errors = 0;
+
+		QElapsedTimer timer;
+		timer.start();
+		for(auto i = 0; i < count; i++) {
+			const auto &data = messages[i];
+			pipeline.enqueue(controller->prepareDecryptData(data.keyIndex, data.salt, data.cipher),
+							 [&, i](const QByteArray &plain) {
+				inOrder = inOrder && received == i && plain.size() == size;
+				received++;
+			}, [&](const Exception &) {
+				errors++;
+			});
+		}
+		pipeline.enqueue([&]() {
+			loop.quit();
+		});
+		if(!pipeline.isIdle())
+			loop.exec();
+		auto elapsed = timer.nsecsElapsed();
+
+		QCOMPARE(errors, 0);
+		QCOMPARE(received, count);
+		QVERIFY(inOrder);
+
+		auto secs = elapsed / 1000000000.0;
+		QTest::setBenchmarkResult(elapsed / 1000000.0, QTest::WalltimeMilliseconds);
+		qInfo().noquote() << "download with" << threads << "threads -"
+						  << count / secs << "messages/s,"
+						  << ((static_cast<qint64>(count) * size) / (1024.0 * 1024.0)) / secs << "MB/s";
+	} catch(QException &e) {
+		QFAIL(e.what());
+	}
+}
+
+void CryptoBenchmark::benchSmallMessages_data()
+{
+	QTest::addColumn<int>("size");
+	QTest::addColumn<bool>("reuse");
+
+	for(auto size : {16, 64, 256, 1024}) {
+		QTest::newRow(qUtf8Printable(QStringLiteral("%1_reused").arg(size))) << size << true;
+		QTest::newRow(qUtf8Printable(QStringLiteral("%1_fresh").arg(size))) << size << false;
+	}
+}
+
+void CryptoBenchmark::benchSmallMessages()
+{
+	QFETCH(int, size);
+	QFETCH(bool, reuse);
+
+	QByteArray message(size, 'x');
+	try {
+		if(reuse) {
+			//exchange keys keep their keyed cipher contexts around
+			QBENCHMARK {
+				quint32 keyIndex;
+				QByteArray salt;
+				QByteArray cipher;
+				std::tie(keyIndex, salt, cipher) = controller->encryptData(message);
+				controller->decryptData(keyIndex, salt, cipher);
+			}
+		} else {
+			//export keys set up a new cipher context per message, as all operations did before
+			QByteArray scheme;
+			QByteArray salt;
+			CryptoPP::SecByteBlock key;
+			std::tie(scheme, salt, key) = controller->generateExportKey(QStringLiteral("benchmark"));
+			QBENCHMARK {
+				auto cipher = controller->exportEncrypt(scheme, salt, key, message);
+				controller->importDecrypt(scheme, salt, key, cipher);
+			}
+		}
+	} catch(QException &e) {
+		QFAIL(e.what());
+	}
+}
+
+void CryptoBenchmark::benchSchemes_data()
+{
+	QTest::addColumn<Setup::CipherScheme>("scheme");
+	QTest::addColumn<int>("size");
+
+	auto schemeEnum = QMetaEnum::fromType<Setup::CipherScheme>();
+	for(auto i = 0; i < schemeEnum.keyCount(); i++) {
+		auto scheme = static_cast<Setup::CipherScheme>(schemeEnum.value(i));
+		for(auto size : {256, 4096, 65536}) {
+			QTest::newRow(qUtf8Printable(QStringLiteral("%1_%2")
+										 .arg(QString::fromUtf8(schemeEnum.key(i)))
+										 .arg(size)))
+					<< scheme
+					<< size;
+		}
+	}
+}
+
+void CryptoBenchmark::benchSchemes()
+{
+	QFETCH(Setup::CipherScheme, scheme);
+	QFETCH(int, size);
+
+	QByteArray message(size, 'x');
+	try {
+		//switch the exchange key to one of the given scheme
+		auto dPriv = DefaultsPrivate::obtainDefaults(DefaultSetup);
+		dPriv->properties.insert(Defaults::SymScheme, scheme);
+		quint32 keyIndex;
+		QByteArray name;
+		std::tie(keyIndex, name) = controller->generateNextKey();
+		controller->activateNextKey(keyIndex);
+		QCOMPARE(controller->keyIndex(), keyIndex);
+
+		QBENCHMARK {
+			QByteArray salt;
+			QByteArray cipher;
+			std::tie(keyIndex, salt, cipher) = controller->encryptData(message);
+			controller->decryptData(keyIndex, salt, cipher);
+		}
+	} catch(QException &e) {
+		QFAIL(e.what());
+	}
+}
+
+int CryptoBenchmark::envInt(const char *name, int defaultValue)
+{
+	auto ok = false;
+	auto value = qEnvironmentVariableIntValue(name, &ok);
+	return ok ? value : defaultValue;
+}
+
+QTEST_MAIN(CryptoBenchmark)
+
+#include "tst_cryptobenchmark.moc"
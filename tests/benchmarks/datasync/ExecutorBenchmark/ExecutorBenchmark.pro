@@ -0,0 +1,19 @@
+TEMPLATE = app
+
+QT = core testlib
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = tst_executorbenchmark
+
+# the executor is part of the appserver, so it is compiled in directly
+APPSERVER_DIR = $$PWD/../../../../tools/appserver
+INCLUDEPATH += $$APPSERVER_DIR
+
+HEADERS += \
+	$$APPSERVER_DIR/strandexecutor.h
+
+SOURCES += \
+	tst_executorbenchmark.cpp \
+	$$APPSERVER_DIR/strandexecutor.cpp
@@ -0,0 +1,156 @@
+#include <QString>
+#include <QtTest>
+#include <QCoreApplication>
+#include <strandexecutor.h>
+
+// Measures how many tasks per second the strand executor of the appserver can dispatch, depending
+// on the number of worker threads, the number of strands (one per connected client) and the number
+// of threads that enqueue the tasks. Every task checks that it runs in the order it was enqueued.
+// The workload can be configured via environment variables:
+//  - QDS_BENCH_COUNT: total number of tasks per run (default 1000000)
+class ExecutorBenchmark : public QObject
+{
+	Q_OBJECT
+
+private Q_SLOTS:
+	void initTestCase();
+
+	void benchDispatch_data();
+	void benchDispatch();
+
+private:
+	class Producer : public QThread
+	{
+	public:
+		Producer(const std::function<void()> &fn);
+
+	protected:
+		void run() override;
+
+	private:
+		const std::function<void()> _fn;
+	};
+
+	int count;
+
+	static int envInt(const char *name, int defaultValue);
+};
+
+void ExecutorBenchmark::initTestCase()
+{
+	count = envInt("QDS_BENCH_COUNT", 1000000);
+	QVERIFY(count > 0);
+}
+
+void ExecutorBenchmark::benchDispatch_data()
+{
+	QTest::addColumn<int>("threads");
+	QTest::addColumn<int>("strands");
+	QTest::addColumn<int>("producers");
+
+	auto ideal = QThread::idealThreadCount();
+	for(auto threads : {1, ideal}) {
+		for(auto strands : {1, 100, 10000}) {
+			for(auto producers : {1, 4}) {
+				QTest::newRow(qUtf8Printable(QStringLiteral("threads_%1_strands_%2_producers_%3")
+											 .arg(threads)
+											 .arg(strands)
+											 .arg(producers)))
+						<< threads
+						<< strands
+						<< producers;
+			}
+		}
+		if(ideal == 1)
+			break;
+	}
+}
+
+void ExecutorBenchmark::benchDispatch()
+{
+	QFETCH(int, threads);
+	QFETCH(int, strands);
+	QFETCH(int, producers);
+
+	StrandExecutor executor(threads);
+	QVector<QSharedPointer<StrandExecutor::Strand>> strandList;
+	strandList.reserve(strands);
+	for(auto i = 0; i < strands; i++)
+		strandList.append(executor.createStrand());
+
+	//every producer owns a slice of the strands, so the order per strand is known
+	auto perStrand = qMax(1, count / strands);
+	auto total = perStrand * strands;
+	QVector<int> next(strands, 0);
+	QAtomicInt outOfOrder(0);
+	QAtomicInt remaining(total);
+	QMutex doneMutex;
+	QWaitCondition doneCondition;
+
+	auto produce = [&](int offset) {
+		for(auto i = 0; i < perStrand; i++) {
+			for(auto s = offset; s < strands; s += producers) {
+				strandList[s]->enqueue([&, s, i]() {
+					if(next[s]++ != i)
+						outOfOrder.ref();
+					if(!remaining.deref()) {
+						QMutexLocker lock(&doneMutex);
+						doneCondition.wakeAll();
+					}
+				});
+			}
+		}
+	};
+
+	QElapsedTimer timer;
+	timer.start();
+	{
+		QMutexLocker lock(&doneMutex);
+		QList<Producer*> producerThreads;
+		for(auto p = 1; p < producers; p++) {
+			auto producer = new Producer([&, p]() {
+				produce(p);
+			});
+			producer->start();
+			producerThreads.append(producer);
+		}
+		produce(0);
+		while(remaining.load() > 0)
+			doneCondition.wait(&doneMutex);
+		for(auto producer : producerThreads)
+			producer->wait();
+		qDeleteAll(producerThreads);
+	}
+	auto elapsed = timer.nsecsElapsed();
+
+	QCOMPARE(outOfOrder.load(), 0);
+	QCOMPARE(remaining.load(), 0);
+	for(auto s = 0; s < strands; s++)
+		QCOMPARE(next[s], perStrand);
+
+	auto secs = elapsed / 1000000000.0;
+	QTest::setBenchmarkResult(elapsed / 1000000.0, QTest::WalltimeMilliseconds);
+	qInfo().noquote() << "dispatch with" << threads << "threads," << strands << "strands and"
+					  << producers << "producers -" << total / secs << "tasks/s";
+}
+
+int ExecutorBenchmark::envInt(const char *name, int defaultValue)
+{
+	auto ok = false;
+	auto value = qEnvironmentVariableIntValue(name, &ok);
+	return ok ? value : defaultValue;
+}
+
+ExecutorBenchmark::Producer::Producer(const std::function<void()> &fn) :
+	QThread(),
+	_fn(fn)
+{}
+
+void ExecutorBenchmark::Producer::run()
+{
+	_fn();
+}
+
+QTEST_MAIN(ExecutorBenchmark)
+
+#include "tst_executorbenchmark.moc"
@@ -0,0 +1,25 @@
+include(../benchmarks.pri)
+
+QT += network websockets sql
+
+TARGET = qdsloadgen
+
+HEADERS += \
+	loadoptions.h \
+	loadstats.h \
+	loadclient.h \
+	loadgenerator.h
+
+SOURCES += \
+	main.cpp \
+	loadstats.cpp \
+	loadclient.cpp \
+	loadgenerator.cpp
+
+BUILD_BIN_DIR = $$shadowed($$dirname(_QMAKE_CONF_))/bin
+DEFINES += BUILD_BIN_DIR=\\\"$$BUILD_BIN_DIR/\\\"
+
+!include(./setup.pri): SETUP_FILE = $$PWD/qdsapp.conf
+
+DISTFILES += $$SETUP_FILE
+DEFINES += SETUP_FILE=\\\"$$SETUP_FILE\\\"
@@ -0,0 +1,283 @@
+#include "loadclient.h"
+
+#include <QtCore/QtEndian>
+
+#include <QtDataSync/private/loginmessage_p.h>
+#include <QtDataSync/private/welcomemessage_p.h>
+#include <QtDataSync/private/resumemessage_p.h>
+#include <QtDataSync/private/syncmessage_p.h>
+
+using namespace QtDataSync;
+
+const QByteArray LoadClient::RunTag = QUuid::createUuid().toRfc4122().left(8);
+
+LoadClient::LoadClient(const QUuid &deviceId, const QUrl &url, const LoadOptions &options, ClientCrypto *crypto, LoadStats *stats, std::mt19937 *rng, QObject *parent) :
+	QObject(parent),
+	_deviceId(deviceId),
+	_url(url),
+	_options(options),
+	_crypto(crypto),
+	_stats(stats),
+	_rng(rng),
+	_socket(new QWebSocket(QString(), QWebSocketProtocol::VersionLatest, this)),
+	_thinkTimer(new QTimer(this)),
+	_state(Stopped),
+	_stateSince(0),
+	_ticket(),
+	_secret(),
+	_resuming(false),
+	_uploadLimit(1),
+	_queuedUploads(0),
+	_activeUploads(),
+	_pendingAcks()
+{
+	_thinkTimer->setSingleShot(true);
+	connect(_thinkTimer, &QTimer::timeout,
+			this, &LoadClient::think);
+
+	connect(_socket, &QWebSocket::connected,
+			this, &LoadClient::connected);
+	connect(_socket, &QWebSocket::disconnected,
+			this, &LoadClient::disconnected);
+	connect(_socket, &QWebSocket::binaryMessageReceived,
+			this, &LoadClient::binaryMessageReceived);
+}
+
+bool LoadClient::isOnline() const
+{
+	return _state == Online;
+}
+
+void LoadClient::start()
+{
+	if(_state == Stopped)
+		open();
+}
+
+void LoadClient::stop()
+{
+	_state = Stopped;
+	_thinkTimer->stop();
+	_socket->close();
+}
+
+void LoadClient::reconnect()
+{
+	if(_state == Stopped)
+		return;
+
+	_stats->add(LoadStats::Reconnects);
+	//set to stopped first, so the disconnect is not counted as lost connection
+	_state = Stopped;
+	_socket->abort();
+	open();
+}
+
+void LoadClient::connected()
+{
+	_state = Authenticating;
+}
+
+void LoadClient::disconnected()
+{
+	//ignore the disconnect of a previous connection, that is reported late
+	if(_state == Stopped || _socket->state() != QAbstractSocket::UnconnectedState)
+		return;
+
+	//the connection was lost or closed by the server: try again after a short delay
+	_stats->add(LoadStats::Disconnects);
+	_state = Stopped;
+	_thinkTimer->stop();
+	std::uniform_int_distribution<int> backoff{500, 1500};
+	QTimer::singleShot(backoff(*_rng), this, [this]() {
+		if(_state == Stopped)
+			open();
+	});
+}
+
+void LoadClient::binaryMessageReceived(const QByteArray &message)
+{
+	if(message == Message::PingMessage)
+		return;
+
+	try {
+		QByteArray name;
+		QDataStream stream(message);
+		Message::setupStream(stream);
+		stream.startTransaction();
+		stream >> name;
+		if(!stream.commitTransaction())
+			throw DataStreamException(stream);
+
+		if(Message::isType<IdentifyMessage>(name))
+			onIdentify(Message::deserializeMessage<IdentifyMessage>(stream));
+		else if(Message::isType<WelcomeMessage>(name))
+			onWelcome();
+		else if(Message::isType<ResumeTicketMessage>(name)) {
+			auto ticket = Message::deserializeMessage<ResumeTicketMessage>(stream);
+			_ticket = ticket.ticket;
+			_secret = _crypto->decrypt(ticket.secret);
+		} else if(Message::isType<ChangedMessage>(name))
+			onChanged(Message::deserializeMessage<ChangedMessage>(stream));
+		else if(Message::isType<ChangedInfoMessage>(name))
+			onChanged(Message::deserializeMessage<ChangedInfoMessage>(stream));
+		else if(Message::isType<LastChangedMessage>(name))
+			return; //nothing pending anymore
+		else if(Message::isType<ChangeAckMessage>(name))
+			onChangeAck(Message::deserializeMessage<ChangeAckMessage>(stream));
+		else if(Message::isType<ErrorMessage>(name))
+			onError(Message::deserializeMessage<ErrorMessage>(stream));
+		else
+			qDebug() << "Ignoring unexpected message" << name;
+	} catch(std::exception &e) {
+		qWarning() << "Device" << _deviceId << "received invalid message:" << e.what();
+		_stats->add(LoadStats::Errors);
+	}
+}
+
+void LoadClient::think()
+{
+	if(_state != Online)
+		return;
+
+	std::uniform_real_distribution<double> action;
+	auto choice = action(*_rng);
+	if(choice < _options.reconnectRatio) {
+		reconnect();
+		return;
+	} else if(action(*_rng) < _options.uploadRatio) {
+		_queuedUploads += _options.batchSize;
+		sendUploads();
+	} else {
+		_socket->sendBinaryMessage(SyncMessage().serialize());
+		_stats->add(LoadStats::SyncRequests);
+	}
+	scheduleThink();
+}
+
+void LoadClient::flushAcks()
+{
+	if(_pendingAcks.isEmpty() || _state != Online)
+		return;
+	_socket->sendBinaryMessage(ChangedAckBatchMessage{_pendingAcks}.serialize());
+	_pendingAcks.clear();
+}
+
+void LoadClient::open()
+{
+	_state = Connecting;
+	_stateSince = _stats->now();
+	_resuming = false;
+	_activeUploads.clear();
+	_pendingAcks.clear();
+	_socket->open(_url);
+}
+
+void LoadClient::onIdentify(const IdentifyMessage &message)
+{
+	if(_state != Authenticating)
+		return;
+
+	//a second identify message means the ticket was rejected
+	if(_resuming) {
+		_ticket.clear();
+		_secret.clear();
+	} else
+		_stats->record(LoadStats::Connect, _stats->now() - _stateSince);
+	_uploadLimit = qMax(message.uploadLimit, 1u);
+	_stateSince = _stats->now();
+
+	auto deviceName = QStringLiteral("load-") + _deviceId.toString();
+	_resuming = _options.resume && !_ticket.isEmpty();
+	if(_resuming) {
+		ResumeMessage resume {
+			_deviceId,
+			deviceName,
+			message.nonce,
+			_ticket
+		};
+		resume.sign(_secret);
+		_socket->sendBinaryMessage(resume.serialize());
+	} else {
+		LoginMessage login {
+			_deviceId,
+			deviceName,
+			message.nonce
+		};
+		_socket->sendBinaryMessage(login.serializeSigned(_crypto->privateSignKey(), _crypto->rng(), _crypto));
+	}
+}
+
+void LoadClient::onWelcome()
+{
+	_stats->record(_resuming ? LoadStats::Resume : LoadStats::Login,
+				   _stats->now() - _stateSince);
+	_resuming = false;
+	_state = Online;
+	sendUploads();
+	scheduleThink();
+}
+
+void LoadClient::onChanged(const ChangedMessage &message)
+{
+	_stats->add(LoadStats::DownloadedChanges);
+	_stats->add(LoadStats::DownloadedBytes, static_cast<quint64>(message.data.size()));
+	//only changes of this run contain a comparable timestamp
+	if(message.data.startsWith(RunTag) && message.data.size() >= RunTag.size() + 8) {
+		auto uploaded = qFromBigEndian<qint64>(message.data.constData() + RunTag.size());
+		_stats->record(LoadStats::Download, _stats->now() - uploaded);
+	}
+
+	//ack all changes that arrived at once with a single message, like the library does
+	if(_pendingAcks.isEmpty())
+		QMetaObject::invokeMethod(this, "flushAcks", Qt::QueuedConnection);
+	_pendingAcks.append(message.dataIndex);
+}
+
+void LoadClient::onChangeAck(const ChangeAckMessage &message)
+{
+	auto sent = _activeUploads.take(message.dataId);
+	if(sent == 0)
+		return;
+	_stats->record(LoadStats::Upload, _stats->now() - sent);
+	_stats->add(LoadStats::UploadedChanges);
+	sendUploads();
+}
+
+void LoadClient::onError(const ErrorMessage &message)
+{
+	qWarning() << "Device" << _deviceId << "received error:" << message;
+	_stats->add(LoadStats::Errors);
+}
+
+void LoadClient::scheduleThink()
+{
+	std::exponential_distribution<double> thinkTime{1.0 / qMax(_options.thinkTime, 1)};
+	_thinkTimer->start(qMin(static_cast<int>(thinkTime(*_rng)), _options.thinkTime * 10));
+}
+
+void LoadClient::sendUploads()
+{
+	if(_state != Online)
+		return;
+
+	std::uniform_int_distribution<int> dataset{0, qMax(_options.datasets, 1) - 1};
+	std::uniform_int_distribution<int> size{_options.minSize, qMax(_options.minSize, _options.maxSize)};
+	while(_queuedUploads > 0 && static_cast<quint32>(_activeUploads.size()) < _uploadLimit) {
+		//skip datasets that are already being uploaded, as their acks could not be told apart
+		ChangeMessage message { "load-" + QByteArray::number(dataset(*_rng)) };
+		_queuedUploads--;
+		if(_activeUploads.contains(message.dataId))
+			continue;
+
+		message.keyIndex = 0;
+		message.salt = "salt";
+		message.data = RunTag;
+		message.data.resize(qMax(size(*_rng), RunTag.size() + 8));
+		auto now = _stats->now();
+		qToBigEndian<qint64>(now, message.data.data() + RunTag.size());
+		_socket->sendBinaryMessage(message.serialize());
+		_stats->add(LoadStats::UploadedBytes, static_cast<quint64>(message.data.size()));
+		_activeUploads.insert(message.dataId, now);
+	}
+}
@@ -0,0 +1,95 @@
+#ifndef LOADCLIENT_H
+#define LOADCLIENT_H
+
+#include <random>
+
+#include <QtCore/QObject>
+#include <QtCore/QHash>
+#include <QtCore/QTimer>
+#include <QtCore/QUuid>
+#include <QtCore/QUrl>
+
+#include <QtWebSockets/QWebSocket>
+
+#include <QtDataSync/private/cryptocontroller_p.h>
+#include <QtDataSync/private/identifymessage_p.h>
+#include <QtDataSync/private/changemessage_p.h>
+#include <QtDataSync/private/changedmessage_p.h>
+#include <QtDataSync/private/errormessage_p.h>
+
+#include "loadoptions.h"
+#include "loadstats.h"
+
+//! A simulated device, that logs in and then randomly uploads changes or requests downloads
+//! Unlike the MockClient, it is completely event driven, so thousands of them can run in one thread
+class LoadClient : public QObject
+{
+	Q_OBJECT
+
+public:
+	explicit LoadClient(const QUuid &deviceId,
+						const QUrl &url,
+						const LoadOptions &options,
+						QtDataSync::ClientCrypto *crypto,
+						LoadStats *stats,
+						std::mt19937 *rng,
+						QObject *parent = nullptr);
+
+	bool isOnline() const;
+
+	void start();
+	void stop();
+	//! Drops the connection and connects again immediately, with a session ticket if possible
+	void reconnect();
+
+	//! Marks the start of data that was uploaded within this run
+	static const QByteArray RunTag;
+
+private Q_SLOTS:
+	void connected();
+	void disconnected();
+	void binaryMessageReceived(const QByteArray &message);
+	void think();
+	void flushAcks();
+
+private:
+	enum State {
+		Stopped,
+		Connecting,
+		Authenticating,
+		Online
+	};
+
+	const QUuid _deviceId;
+	const QUrl _url;
+	const LoadOptions &_options;
+	QtDataSync::ClientCrypto *_crypto;
+	LoadStats *_stats;
+	std::mt19937 *_rng;
+
+	QWebSocket *_socket;
+	QTimer *_thinkTimer;
+	State _state;
+	qint64 _stateSince;
+
+	QByteArray _ticket;
+	QByteArray _secret;
+	bool _resuming;
+
+	quint32 _uploadLimit;
+	int _queuedUploads;
+	QHash<QByteArray, qint64> _activeUploads;
+	QList<quint64> _pendingAcks;
+
+	void open();
+	void onIdentify(const QtDataSync::IdentifyMessage &message);
+	void onWelcome();
+	void onChanged(const QtDataSync::ChangedMessage &message);
+	void onChangeAck(const QtDataSync::ChangeAckMessage &message);
+	void onError(const QtDataSync::ErrorMessage &message);
+
+	void scheduleThink();
+	void sendUploads();
+};
+
+#endif // LOADCLIENT_H
@@ -0,0 +1,348 @@
+#include "loadgenerator.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
+
+#include <QtNetwork/QHostAddress>
+
+#include <QtSql/QSqlQuery>
+#include <QtSql/QSqlError>
+
+#include <mockclient.h>
+
+#ifdef Q_OS_WIN
+#include <qt_windows.h>
+#endif
+
+#include <QtDataSync/private/registermessage_p.h>
+#include <QtDataSync/private/accountmessage_p.h>
+
+using namespace QtDataSync;
+
+LoadGenerator::LoadGenerator(const LoadOptions &options, QObject *parent) :
+	QObject(parent),
+	_options(options),
+	_config(nullptr),
+	_server(nullptr),
+	_db(),
+	_url(),
+	_rng(std::random_device{}()),
+	_stats(),
+	_crypto(nullptr),
+	_accounts(),
+	_clients(),
+	_started(0),
+	_rampTimer(new QTimer(this)),
+	_stormTimer(new QTimer(this)),
+	_progressTimer(new QTimer(this)),
+	_measureStart(0),
+	_lastUploads(0),
+	_lastDownloads(0)
+{
+	_rampTimer->setInterval(10);
+	connect(_rampTimer, &QTimer::timeout,
+			this, &LoadGenerator::rampUp);
+	_stormTimer->setInterval(_options.stormInterval * 1000);
+	connect(_stormTimer, &QTimer::timeout,
+			this, &LoadGenerator::storm);
+	_progressTimer->setInterval(5000);
+	connect(_progressTimer, &QTimer::timeout,
+			this, &LoadGenerator::progress);
+}
+
+bool LoadGenerator::setup()
+{
+	_config = new QSettings(_options.configPath, QSettings::IniFormat, this);
+	if(_config->status() != QSettings::NoError || !QFile::exists(_options.configPath)) {
+		qCritical() << "Unable to read configuration file" << _options.configPath;
+		return false;
+	}
+
+	_url.setScheme(QStringLiteral("ws"));
+	_url.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+	_url.setPort(_config->value(QStringLiteral("server/port"), 4242).toInt());
+
+	if(_options.startServer && !startServer())
+		return false;
+	if(!openDatabase())
+		return false;
+
+	try {
+		//all devices share one key, to not spend the setup on key generation
+		qInfo() << "Generating device keys...";
+		_crypto = new ClientCrypto(this);
+		_crypto->generate(Setup::RSA_PSS_SHA3_512, 2048,
+						  Setup::RSA_OAEP_SHA3_512, 2048);
+	} catch(std::exception &e) {
+		qCritical() << "Failed to generate keys:" << e.what();
+		return false;
+	}
+
+	//the first device of every account registers, the others are copied in the database
+	qInfo() << "Creating" << _options.accounts << "accounts with"
+			<< _options.devices << "devices each...";
+	for(auto i = 0; i < _options.accounts; i++) {
+		auto accountId = registerAccount();
+		if(accountId.isNull())
+			return false;
+		_accounts.append(accountId);
+
+		QList<QUuid> deviceIds {accountId};
+		if(!addDevices(accountId, deviceIds))
+			return false;
+		for(const auto &deviceId : deviceIds)
+			_clients.append(new LoadClient(deviceId, _url, _options, _crypto, &_stats, &_rng, this));
+	}
+
+	//connect the devices in random order, so that accounts fill up evenly
+	std::shuffle(_clients.begin(), _clients.end(), _rng);
+	return true;
+}
+
+void LoadGenerator::start()
+{
+	qInfo() << "Connecting" << _clients.size() << "devices within"
+			<< _options.rampUp << "seconds...";
+	_measureStart = _stats.now();
+	_rampTimer->start();
+	_progressTimer->start();
+}
+
+void LoadGenerator::rampUp()
+{
+	//start as many devices as should be connected by now
+	auto elapsed = (_stats.now() - _measureStart) / 1000000;
+	auto rampTime = qMax(_options.rampUp * 1000ll, 1ll);
+	auto target = static_cast<int>(qMin<qint64>(_clients.size(), (_clients.size() * elapsed) / rampTime + 1));
+	for(; _started < target; _started++)
+		_clients[_started]->start();
+	if(_started < _clients.size())
+		return;
+
+	_rampTimer->stop();
+	qInfo() << "All devices started. Results of the ramp up:";
+	for(const auto &line : _stats.report(_stats.now() - _measureStart))
+		qInfo().noquote() << line;
+
+	qInfo() << "Running workload for" << _options.duration << "seconds...";
+	_stats.reset();
+	_measureStart = _stats.now();
+	_lastUploads = 0;
+	_lastDownloads = 0;
+	if(_options.stormInterval > 0)
+		_stormTimer->start();
+	QTimer::singleShot(_options.duration * 1000, this, &LoadGenerator::finish);
+}
+
+void LoadGenerator::storm()
+{
+	//drop many connections at once, as it happens if a network or the server goes down
+	std::uniform_real_distribution<double> dist;
+	auto count = 0;
+	for(auto client : _clients) {
+		if(client->isOnline() && dist(_rng) < _options.stormRatio) {
+			client->reconnect();
+			count++;
+		}
+	}
+	qInfo() << "Reconnect storm of" << count << "devices";
+}
+
+void LoadGenerator::progress()
+{
+	auto online = 0;
+	for(auto client : _clients) {
+		if(client->isOnline())
+			online++;
+	}
+
+	auto uploads = _stats.value(LoadStats::UploadedChanges);
+	auto downloads = _stats.value(LoadStats::DownloadedChanges);
+	auto secs = _progressTimer->interval() / 1000.0;
+	qInfo().noquote() << QStringLiteral("online: %1/%2, uploads: %3/s, downloads: %4/s, errors: %5")
+						 .arg(online)
+						 .arg(_clients.size())
+						 .arg((uploads - qMin(_lastUploads, uploads)) / secs, 0, 'f', 1)
+						 .arg((downloads - qMin(_lastDownloads, downloads)) / secs, 0, 'f', 1)
+						 .arg(_stats.value(LoadStats::Errors));
+	_lastUploads = uploads;
+	_lastDownloads = downloads;
+}
+
+void LoadGenerator::finish()
+{
+	auto elapsed = _stats.now() - _measureStart;
+	_stormTimer->stop();
+	_progressTimer->stop();
+	for(auto client : _clients)
+		client->stop();
+
+	qInfo() << "Results of" << _clients.size() << "devices in" << _accounts.size() << "accounts:";
+	for(const auto &line : _stats.report(elapsed))
+		qInfo().noquote() << line;
+
+	if(!_options.keepAccounts)
+		removeAccounts();
+	_db.close();
+	stopServer();
+	emit finished(_stats.value(LoadStats::Errors) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+bool LoadGenerator::startServer()
+{
+#ifdef Q_OS_UNIX
+	QString binPath { QStringLiteral(BUILD_BIN_DIR "qdsappd") };
+#elif Q_OS_WIN
+	QString binPath { QStringLiteral(BUILD_BIN_DIR "qdsappsvc") };
+#else
+	QString binPath { QStringLiteral(BUILD_BIN_DIR "qdsapp") };
+#endif
+	if(!QFile::exists(binPath)) {
+		qCritical() << "Unable to find the appserver at" << binPath;
+		return false;
+	}
+
+	auto env = QProcessEnvironment::systemEnvironment();
+	env.insert(QStringLiteral("QDSAPP_CONFIG_FILE"), _options.configPath);
+	_server = new QProcess(this);
+	_server->setProgram(binPath);
+	_server->setProcessEnvironment(env);
+	_server->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+	_server->start();
+	if(!_server->waitForStarted(5000) || _server->waitForFinished(5000)) {
+		qCritical() << "Failed to start the appserver:" << _server->errorString();
+		return false;
+	}
+	return true;
+}
+
+void LoadGenerator::stopServer()
+{
+	if(!_server)
+		return;
+
+	//send a signal to stop
+#ifdef Q_OS_UNIX
+	_server->terminate(); //same as kill(SIGTERM)
+#elif Q_OS_WIN
+	GenerateConsoleCtrlEvent(CTRL_BREAK_EVENT, _server->processId());
+#endif
+	if(!_server->waitForFinished(5000))
+		qWarning() << "The appserver did not stop in time";
+	_server->close();
+}
+
+bool LoadGenerator::openDatabase()
+{
+	auto driver = _config->value(QStringLiteral("database/driver"), QStringLiteral("QPSQL")).toString();
+	_db = QSqlDatabase::addDatabase(driver, QStringLiteral("loadgenerator"));
+	_db.setDatabaseName(_config->value(QStringLiteral("database/name")).toString());
+	if(driver == QStringLiteral("QSQLITE")) //the server writes at the same time
+		_db.setConnectOptions(QStringLiteral("QSQLITE_BUSY_TIMEOUT=30000"));
+	else {
+		_db.setHostName(_config->value(QStringLiteral("database/host")).toString());
+		_db.setPort(_config->value(QStringLiteral("database/port")).toInt());
+		_db.setUserName(_config->value(QStringLiteral("database/username")).toString());
+		_db.setPassword(_config->value(QStringLiteral("database/password")).toString());
+	}
+
+	if(!_db.open()) {
+		qCritical() << "Failed to open database:" << _db.lastError().text();
+		return false;
+	}
+	if(driver == QStringLiteral("QSQLITE")) {
+		QSqlQuery foreignKeys(_db);
+		if(!foreignKeys.exec(QStringLiteral("PRAGMA foreign_keys = ON"))) {
+			qCritical() << "Failed to setup database:" << foreignKeys.lastError().text();
+			return false;
+		}
+	}
+	return true;
+}
+
+QUuid LoadGenerator::registerAccount()
+{
+	QUuid deviceId;
+	[&]() {
+		auto client = new MockClient(this);
+		QVERIFY(client->waitForConnected(static_cast<quint16>(_url.port())));
+		QByteArray mNonce;
+		QVERIFY(client->waitForReply<IdentifyMessage>([&](IdentifyMessage message, bool &ok) {
+			mNonce = message.nonce;
+			ok = true;
+		}));
+		client->sendSigned(RegisterMessage {
+							   QStringLiteral("load-account"),
+							   mNonce,
+							   _crypto->signKey(),
+							   _crypto->cryptKey(),
+							   _crypto,
+							   "cmac"
+						   }, _crypto);
+		QVERIFY(client->waitForReply<AccountMessage>([&](AccountMessage message, bool &ok) {
+			deviceId = message.deviceId;
+			ok = true;
+		}));
+		client->close();
+		QVERIFY(client->waitForDisconnect());
+		client->deleteLater();
+	}();
+
+	if(deviceId.isNull())
+		qCritical() << "Failed to register account" << _accounts.size() + 1;
+	return deviceId;
+}
+
+bool LoadGenerator::addDevices(const QUuid &accountId, QList<QUuid> &deviceIds)
+{
+	//the devices share the key of the account device, so they can log in with the same crypto
+	QSqlQuery insertDevice(_db);
+	if(!insertDevice.prepare(QStringLiteral("INSERT INTO devices "
+											"(id, userid, name, signscheme, signkey, cryptscheme, cryptkey, fingerprint) "
+											"SELECT ?, userid, 'load-device', signscheme, signkey, cryptscheme, cryptkey, fingerprint "
+											"FROM devices WHERE id = ?"))) {
+		qCritical() << "Failed to add devices:" << insertDevice.lastError().text();
+		return false;
+	}
+
+	for(auto i = 1; i < _options.devices; i++) {
+		auto deviceId = QUuid::createUuid();
+		insertDevice.addBindValue(deviceId);
+		insertDevice.addBindValue(accountId);
+		if(!insertDevice.exec()) {
+			qCritical() << "Failed to add devices:" << insertDevice.lastError().text();
+			return false;
+		}
+		deviceIds.append(deviceId);
+	}
+	return true;
+}
+
+void LoadGenerator::removeAccounts()
+{
+	qInfo() << "Removing" << _accounts.size() << "accounts...";
+	QSqlQuery userQuery(_db);
+	userQuery.prepare(QStringLiteral("SELECT userid FROM devices WHERE id = ?"));
+	QSqlQuery removeDevices(_db);
+	removeDevices.prepare(QStringLiteral("DELETE FROM devices WHERE userid = ?"));
+	QSqlQuery removeUser(_db);
+	removeUser.prepare(QStringLiteral("DELETE FROM users WHERE id = ?"));
+
+	for(const auto &accountId : qAsConst(_accounts)) {
+		userQuery.addBindValue(accountId);
+		if(!userQuery.exec() || !userQuery.first()) {
+			qWarning() << "Failed to find account of device" << accountId << userQuery.lastError().text();
+			continue;
+		}
+		auto userId = userQuery.value(0);
+		userQuery.finish();
+
+		removeDevices.addBindValue(userId);
+		removeUser.addBindValue(userId);
+		if(!removeDevices.exec() || !removeUser.exec())
+			qWarning() << "Failed to remove account of device" << accountId;
+	}
+}
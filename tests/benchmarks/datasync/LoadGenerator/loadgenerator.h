@@ -0,0 +1,64 @@
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <random>
+
+#include <QtCore/QObject>
+#include <QtCore/QProcess>
+#include <QtCore/QSettings>
+#include <QtCore/QTimer>
+
+#include <QtSql/QSqlDatabase>
+
+#include "loadclient.h"
+
+//! Sets up a fleet of accounts with several devices each and drives them against a running appserver
+class LoadGenerator : public QObject
+{
+	Q_OBJECT
+
+public:
+	explicit LoadGenerator(const LoadOptions &options, QObject *parent = nullptr);
+
+	bool setup();
+	void start();
+
+Q_SIGNALS:
+	void finished(int exitCode);
+
+private Q_SLOTS:
+	void rampUp();
+	void storm();
+	void progress();
+	void finish();
+
+private:
+	const LoadOptions _options;
+	QSettings *_config;
+	QProcess *_server;
+	QSqlDatabase _db;
+	QUrl _url;
+
+	std::mt19937 _rng;
+	LoadStats _stats;
+	QtDataSync::ClientCrypto *_crypto;
+	QList<QUuid> _accounts; //the first device of each account
+	QList<LoadClient*> _clients;
+	int _started;
+
+	QTimer *_rampTimer;
+	QTimer *_stormTimer;
+	QTimer *_progressTimer;
+	qint64 _measureStart;
+	quint64 _lastUploads;
+	quint64 _lastDownloads;
+
+	bool startServer();
+	void stopServer();
+	bool openDatabase();
+	QUuid registerAccount();
+	bool addDevices(const QUuid &accountId, QList<QUuid> &deviceIds);
+	void removeAccounts();
+};
+
+#endif // LOADGENERATOR_H
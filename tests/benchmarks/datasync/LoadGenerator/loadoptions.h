@@ -0,0 +1,31 @@
+#ifndef LOADOPTIONS_H
+#define LOADOPTIONS_H
+
+#include <QtCore/QString>
+
+//! The workload of a load generator run, as given on the command line
+struct LoadOptions
+{
+	QString configPath;
+	bool startServer = false;
+	bool keepAccounts = false;
+
+	int accounts = 100;
+	int devices = 5; //per account
+	int duration = 60; //in seconds
+	int rampUp = 10; //in seconds
+
+	double uploadRatio = 0.5; //of all actions, the rest are sync requests
+	int batchSize = 1; //changes per upload action
+	int minSize = 64; //in bytes
+	int maxSize = 4096; //in bytes
+	int datasets = 100; //distinct data ids per device
+	int thinkTime = 1000; //mean time between actions of a device, in ms
+
+	double reconnectRatio = 0.01; //of all actions
+	int stormInterval = 0; //in seconds, 0 to disable
+	double stormRatio = 0.5; //of all connected devices
+	bool resume = true;
+};
+
+#endif // LOADOPTIONS_H
@@ -0,0 +1,109 @@
+#include "loadstats.h"
+
+#include <algorithm>
+
+LoadStats::LoadStats() :
+	_clock(),
+	_samples(OperationCount),
+	_counters(CounterCount, 0)
+{
+	_clock.start();
+}
+
+qint64 LoadStats::now() const
+{
+	return _clock.nsecsElapsed();
+}
+
+void LoadStats::record(Operation operation, qint64 nsecs)
+{
+	_samples[operation].append(nsecs);
+}
+
+void LoadStats::add(Counter counter, quint64 value)
+{
+	_counters[counter] += value;
+}
+
+quint64 LoadStats::value(Counter counter) const
+{
+	return _counters[counter];
+}
+
+void LoadStats::reset()
+{
+	for(auto &samples : _samples)
+		samples.clear();
+	_counters.fill(0);
+}
+
+QStringList LoadStats::report(qint64 nsecs) const
+{
+	auto msecs = [](qint64 value) {
+		return QStringLiteral("%1").arg(value / 1000000.0, 10, 'f', 2);
+	};
+
+	QStringList lines;
+	lines.append(QStringLiteral("%1 %2 %3 %4 %5 %6")
+				 .arg(QStringLiteral("latency (ms)"), -14)
+				 .arg(QStringLiteral("count"), 10)
+				 .arg(QStringLiteral("p50"), 10)
+				 .arg(QStringLiteral("p90"), 10)
+				 .arg(QStringLiteral("p99"), 10)
+				 .arg(QStringLiteral("max"), 10));
+	for(auto i = 0; i < OperationCount; i++) {
+		auto samples = _samples[i];
+		if(samples.isEmpty())
+			continue;
+		std::sort(samples.begin(), samples.end());
+		auto percentile = [&](int p) {
+			return samples[(samples.size() - 1) * p / 100];
+		};
+		lines.append(QStringLiteral("%1 %2 %3 %4 %5 %6")
+					 .arg(operationName(static_cast<Operation>(i)), -14)
+					 .arg(samples.size(), 10)
+					 .arg(msecs(percentile(50)))
+					 .arg(msecs(percentile(90)))
+					 .arg(msecs(percentile(99)))
+					 .arg(msecs(samples.last())));
+	}
+
+	auto secs = qMax(nsecs / 1000000000.0, 0.001);
+	auto rate = [&](Counter counter) {
+		return QString::number(value(counter) / secs, 'f', 1);
+	};
+	auto kibRate = [&](Counter counter) {
+		return QString::number(value(counter) / secs / 1024.0, 'f', 1);
+	};
+	lines.append(QStringLiteral("uploads: %1 changes (%2/s, %3 KiB/s)")
+				 .arg(value(UploadedChanges))
+				 .arg(rate(UploadedChanges), kibRate(UploadedBytes)));
+	lines.append(QStringLiteral("downloads: %1 changes (%2/s, %3 KiB/s)")
+				 .arg(value(DownloadedChanges))
+				 .arg(rate(DownloadedChanges), kibRate(DownloadedBytes)));
+	lines.append(QStringLiteral("sync requests: %1, reconnects: %2, lost connections: %3, errors: %4")
+				 .arg(value(SyncRequests))
+				 .arg(value(Reconnects))
+				 .arg(value(Disconnects))
+				 .arg(value(Errors)));
+	return lines;
+}
+
+QString LoadStats::operationName(Operation operation)
+{
+	switch(operation) {
+	case Connect:
+		return QStringLiteral("connect");
+	case Login:
+		return QStringLiteral("login");
+	case Resume:
+		return QStringLiteral("resume");
+	case Upload:
+		return QStringLiteral("upload");
+	case Download:
+		return QStringLiteral("download");
+	default:
+		Q_UNREACHABLE();
+		return QString();
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef LOADSTATS_H
+#define LOADSTATS_H
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QVector>
+#include <QtCore/QStringList>
+
+//! Collects latency samples and counters of all simulated devices. Is not threadsafe
+class LoadStats
+{
+public:
+	enum Operation {
+		Connect, //socket opened until the identify message arrived
+		Login, //login sent until welcomed
+		Resume, //resume sent until welcomed
+		Upload, //change sent until acked
+		Download, //change uploaded by another device until it arrived
+		OperationCount
+	};
+
+	enum Counter {
+		UploadedChanges,
+		UploadedBytes,
+		DownloadedChanges,
+		DownloadedBytes,
+		SyncRequests,
+		Reconnects,
+		Disconnects,
+		Errors,
+		CounterCount
+	};
+
+	LoadStats();
+
+	//! The clock all timestamps are based on, including the ones sent within the data
+	qint64 now() const;
+
+	void record(Operation operation, qint64 nsecs);
+	void add(Counter counter, quint64 value = 1);
+	quint64 value(Counter counter) const;
+
+	//! Clears all samples and counters, i.e. after the ramp up
+	void reset();
+
+	QStringList report(qint64 nsecs) const;
+
+private:
+	QElapsedTimer _clock;
+	QVector<QVector<qint64>> _samples;
+	QVector<quint64> _counters;
+
+	static QString operationName(Operation operation);
+};
+
+#endif // LOADSTATS_H
@@ -0,0 +1,68 @@
+#include <QtCore/QCoreApplication>
+#include <QtCore/QCommandLineParser>
+
+#include "loadgenerator.h"
+
+// Simulates a fleet of devices against a local appserver, to reproduce production load before a
+// rollout. Every account has several devices, so every upload is fanned out to the others and
+// downloaded by them via live sync. Each device waits a random think time between its actions,
+// and then either uploads a batch of changes, requests a sync or reconnects. Reconnect storms
+// drop a part of all connections at once. The latencies are reported as percentiles, together
+// with the throughput of the server.
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName(QStringLiteral("qdsloadgen"));
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription(QStringLiteral("Synthetic client fleet for the QtDataSync appserver"));
+	parser.addHelpOption();
+	parser.addOptions({
+		{QStringLiteral("config"), QStringLiteral("The appserver <configuration> to find the server and the database with."), QStringLiteral("configuration"), QStringLiteral(SETUP_FILE)},
+		{QStringLiteral("start-server"), QStringLiteral("Start the appserver of the build with the configuration, instead of using a running one.")},
+		{QStringLiteral("keep"), QStringLiteral("Do not remove the accounts and their data after the run.")},
+		{QStringLiteral("accounts"), QStringLiteral("The <number> of accounts."), QStringLiteral("number"), QStringLiteral("100")},
+		{QStringLiteral("devices"), QStringLiteral("The <number> of devices per account."), QStringLiteral("number"), QStringLiteral("5")},
+		{QStringLiteral("duration"), QStringLiteral("The <seconds> to run the workload for, after all devices were started."), QStringLiteral("seconds"), QStringLiteral("60")},
+		{QStringLiteral("ramp-up"), QStringLiteral("The <seconds> to start all devices in."), QStringLiteral("seconds"), QStringLiteral("10")},
+		{QStringLiteral("upload-ratio"), QStringLiteral("The <ratio> of actions that upload changes. All others request a sync."), QStringLiteral("ratio"), QStringLiteral("0.5")},
+		{QStringLiteral("batch"), QStringLiteral("The <number> of changes uploaded per action."), QStringLiteral("number"), QStringLiteral("1")},
+		{QStringLiteral("min-size"), QStringLiteral("The minimum <bytes> of an uploaded change."), QStringLiteral("bytes"), QStringLiteral("64")},
+		{QStringLiteral("max-size"), QStringLiteral("The maximum <bytes> of an uploaded change."), QStringLiteral("bytes"), QStringLiteral("4096")},
+		{QStringLiteral("datasets"), QStringLiteral("The <number> of distinct datasets per device, that uploads replace."), QStringLiteral("number"), QStringLiteral("100")},
+		{QStringLiteral("think-time"), QStringLiteral("The mean <msecs> between two actions of a device."), QStringLiteral("msecs"), QStringLiteral("1000")},
+		{QStringLiteral("reconnect-ratio"), QStringLiteral("The <ratio> of actions that reconnect the device."), QStringLiteral("ratio"), QStringLiteral("0.01")},
+		{QStringLiteral("storm-interval"), QStringLiteral("The <seconds> between two reconnect storms. 0 disables them."), QStringLiteral("seconds"), QStringLiteral("0")},
+		{QStringLiteral("storm-ratio"), QStringLiteral("The <ratio> of connected devices that reconnect in a storm."), QStringLiteral("ratio"), QStringLiteral("0.5")},
+		{QStringLiteral("no-resume"), QStringLiteral("Always log in with a signature, instead of resuming with session tickets.")}
+	});
+	parser.process(app);
+
+	LoadOptions options;
+	options.configPath = parser.value(QStringLiteral("config"));
+	options.startServer = parser.isSet(QStringLiteral("start-server"));
+	options.keepAccounts = parser.isSet(QStringLiteral("keep"));
+	options.accounts = qMax(parser.value(QStringLiteral("accounts")).toInt(), 1);
+	options.devices = qMax(parser.value(QStringLiteral("devices")).toInt(), 1);
+	options.duration = qMax(parser.value(QStringLiteral("duration")).toInt(), 1);
+	options.rampUp = qMax(parser.value(QStringLiteral("ramp-up")).toInt(), 0);
+	options.uploadRatio = parser.value(QStringLiteral("upload-ratio")).toDouble();
+	options.batchSize = qMax(parser.value(QStringLiteral("batch")).toInt(), 1);
+	options.minSize = qMax(parser.value(QStringLiteral("min-size")).toInt(), 0);
+	options.maxSize = qMax(parser.value(QStringLiteral("max-size")).toInt(), options.minSize);
+	options.datasets = qMax(parser.value(QStringLiteral("datasets")).toInt(), 1);
+	options.thinkTime = qMax(parser.value(QStringLiteral("think-time")).toInt(), 1);
+	options.reconnectRatio = parser.value(QStringLiteral("reconnect-ratio")).toDouble();
+	options.stormInterval = qMax(parser.value(QStringLiteral("storm-interval")).toInt(), 0);
+	options.stormRatio = parser.value(QStringLiteral("storm-ratio")).toDouble();
+	options.resume = !parser.isSet(QStringLiteral("no-resume"));
+
+	LoadGenerator generator(options);
+	QObject::connect(&generator, &LoadGenerator::finished,
+					 &app, &QCoreApplication::exit,
+					 Qt::QueuedConnection);
+	if(!generator.setup())
+		return EXIT_FAILURE;
+	generator.start();
+	return app.exec();
+}
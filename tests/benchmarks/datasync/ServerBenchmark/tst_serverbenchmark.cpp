@@ -0,0 +1,679 @@
+#include <numeric>
+
+#include <QString>
+#include <QtTest>
+#include <QCoreApplication>
+#include <QProcess>
+#include <QtSql>
+#include <testlib.h>
+#include <mockclient.h>
+
+#ifdef Q_OS_WIN
+#include <qt_windows.h>
+#endif
+
+#include <QtDataSync/private/identifymessage_p.h>
+#include <QtDataSync/private/registermessage_p.h>
+#include <QtDataSync/private/accountmessage_p.h>
+#include <QtDataSync/private/loginmessage_p.h>
+#include <QtDataSync/private/welcomemessage_p.h>
+#include <QtDataSync/private/changedmessage_p.h>
+#include <QtDataSync/private/resumemessage_p.h>
+#include <QtDataSync/private/changemessage_p.h>
+
+using namespace QtDataSync;
+
+// Measures the download path of the appserver for a device with many pending changes. The changes
+// are inserted into the database directly and then downloaded with a mock client that acks every
+// change as soon as it arrives, either one by one or batched like the library does.
+// The upload path is measured with an account of several devices, to which every uploaded change
+// is fanned out. The client keeps a window of uploads in flight, and either uploads new data or
+// replaces a few datasets over and over.
+// The workload can be configured via environment variables:
+//  - QDS_BENCH_COUNT: number of pending changes (default 100000)
+//  - QDS_BENCH_SIZE: payload size of each change in bytes (default 64)
+//  - QDS_BENCH_ACK_WINDOW: the server/acks/window of the server (default: from the config). Set to
+//    0 to complete every ack on its own
+//  - QDS_BENCH_PREFETCH: the server/downloads/prefetch of the server (default: from the config). Set
+//    to 0 to load only as many changes as can be sent
+//  - QDS_BENCH_UPLOADS: number of uploaded changes (default 10000)
+//  - QDS_BENCH_DEVICES: number of devices of the account, including the uploading one (default 5)
+// The scaling benchmark fills the database with the changes of other accounts, and measures each
+// upload and download of the device at every step, to see if they depend on the total size:
+//  - QDS_BENCH_SCALE: comma separated numbers of changes of other accounts (default 0,1000000,10000000)
+//  - QDS_BENCH_ACCOUNTS: number of other accounts, with two devices each (default 1000)
+//  - QDS_BENCH_REQUESTS: number of uploads and downloads measured at each step (default 1000)
+//  - QDS_BENCH_PARTITIONS: the database/partitions of the server (default: from the config)
+class ServerBenchmark : public QObject
+{
+	Q_OBJECT
+
+private Q_SLOTS:
+	void initTestCase();
+	void cleanupTestCase();
+
+	void benchDownload_data();
+	void benchDownload();
+	void benchUpload_data();
+	void benchUpload();
+	void benchScaling_data();
+	void benchScaling();
+
+private:
+	QTemporaryDir tmpDir;
+	QProcess *server;
+	quint16 port;
+	QSqlDatabase db;
+
+	int count;
+	int size;
+	int uploads;
+	int requests;
+	bool partitioned;
+
+	ClientCrypto *crypto;
+	QUuid devId;
+	QList<QUuid> partnerIds;
+	QList<quint64> backgroundUsers;
+	QStringList backgroundUploaders;
+	QStringList backgroundReceivers;
+	qint64 backgroundChanges;
+
+	static int envInt(const char *name, int defaultValue);
+	static QString uuidArray(const QStringList &uuids);
+	bool insertChanges(int changeCount);
+	bool insertPartners(int partnerCount);
+	bool insertBackground(qint64 changeCount);
+	bool login(MockClient *client, bool expectChanges);
+};
+
+void ServerBenchmark::initTestCase()
+{
+#ifdef Q_OS_LINUX
+	if(!qgetenv("LD_PRELOAD").contains("Qt5DataSync"))
+		qWarning() << "No LD_PRELOAD set - this may fail on systems with multiple version of the modules";
+#endif
+
+	count = envInt("QDS_BENCH_COUNT", 100000);
+	size = envInt("QDS_BENCH_SIZE", 64);
+	uploads = envInt("QDS_BENCH_UPLOADS", 10000);
+	requests = envInt("QDS_BENCH_REQUESTS", 1000);
+	auto devices = envInt("QDS_BENCH_DEVICES", 5);
+	QVERIFY(count > 0);
+	QVERIFY(size >= 0);
+	QVERIFY(uploads > 0);
+	QVERIFY(requests > 0);
+	QVERIFY(devices > 1);
+	partitioned = false;
+	backgroundChanges = 0;
+
+	//use a copy of the config, to be able to adjust the server
+	QVERIFY(tmpDir.isValid());
+	auto confPath = tmpDir.filePath(QStringLiteral("qdsapp.conf"));
+	QVERIFY(QFile::copy(QStringLiteral(SETUP_FILE), confPath));
+	QSettings config{confPath, QSettings::IniFormat};
+	if(qEnvironmentVariableIsSet("QDS_BENCH_ACK_WINDOW"))
+		config.setValue(QStringLiteral("server/acks/window"), envInt("QDS_BENCH_ACK_WINDOW", 0));
+	if(qEnvironmentVariableIsSet("QDS_BENCH_PREFETCH"))
+		config.setValue(QStringLiteral("server/downloads/prefetch"), envInt("QDS_BENCH_PREFETCH", 0));
+	if(qEnvironmentVariableIsSet("QDS_BENCH_PARTITIONS"))
+		config.setValue(QStringLiteral("database/partitions"), envInt("QDS_BENCH_PARTITIONS", 0));
+	config.sync();
+	QCOMPARE(config.status(), QSettings::NoError);
+	qputenv("QDSAPP_CONFIG_FILE", confPath.toUtf8());
+	port = static_cast<quint16>(config.value(QStringLiteral("server/port")).toUInt());
+	QVERIFY(port != 0);
+
+	//direct database access to create the pending changes
+	db = QSqlDatabase::addDatabase(QStringLiteral("QPSQL"), QStringLiteral("benchmark"));
+	db.setDatabaseName(config.value(QStringLiteral("database/name")).toString());
+	db.setHostName(config.value(QStringLiteral("database/host")).toString());
+	db.setPort(config.value(QStringLiteral("database/port")).toInt());
+	db.setUserName(config.value(QStringLiteral("database/username")).toString());
+	db.setPassword(config.value(QStringLiteral("database/password")).toString());
+
+#ifdef Q_OS_UNIX
+	QString binPath { QStringLiteral(BUILD_BIN_DIR "qdsappd") };
+#elif Q_OS_WIN
+	QString binPath { QStringLiteral(BUILD_BIN_DIR "qdsappsvc") };
+#else
+	QString binPath { QStringLiteral(BUILD_BIN_DIR "qdsapp") };
+#endif
+	QVERIFY(QFile::exists(binPath));
+
+	server = new QProcess(this);
+	server->setProgram(binPath);
+	server->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+	server->start();
+	QVERIFY(server->waitForStarted(5000));
+	QVERIFY(!server->waitForFinished(5000));
+	QVERIFY2(db.open(), qUtf8Printable(db.lastError().text()));
+
+	try {
+		crypto = new ClientCrypto(this);
+		crypto->generate(Setup::RSA_PSS_SHA3_512, 2048,
+						 Setup::RSA_OAEP_SHA3_512, 2048);
+
+		//register the device that downloads the changes
+		auto client = new MockClient(this);
+		QVERIFY(client->waitForConnected(port));
+		QByteArray mNonce;
+		QVERIFY(client->waitForReply<IdentifyMessage>([&](IdentifyMessage message, bool &ok) {
+			mNonce = message.nonce;
+			ok = true;
+		}));
+		client->sendSigned(RegisterMessage {
+							   QStringLiteral("benchmark"),
+							   mNonce,
+							   crypto->signKey(),
+							   crypto->cryptKey(),
+							   crypto,
+							   "cmac"
+						   }, crypto);
+		QVERIFY(client->waitForReply<AccountMessage>([&](AccountMessage message, bool &ok) {
+			devId = message.deviceId;
+			ok = true;
+		}));
+		client->close();
+		QVERIFY(client->waitForDisconnect());
+		client->deleteLater();
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+
+	//the other devices of the account, that receive the uploads
+	QVERIFY(insertPartners(devices - 1));
+
+	//partitioned pending changes know the device of their data
+	QSqlQuery partitionQuery(db);
+	QVERIFY2(partitionQuery.exec(QStringLiteral("SELECT EXISTS(SELECT 1 FROM information_schema.columns "
+												"WHERE table_name = 'devicechanges' AND column_name = 'sourceid')")),
+			 qUtf8Printable(partitionQuery.lastError().text()));
+	QVERIFY(partitionQuery.first());
+	partitioned = partitionQuery.value(0).toBool();
+	qInfo() << "Running against" << (partitioned ? "partitioned" : "plain") << "change tables";
+}
+
+void ServerBenchmark::cleanupTestCase()
+{
+	//remove the other accounts, with all of their changes
+	if(!backgroundUploaders.isEmpty()) {
+		QSqlQuery removeDevices(db);
+		removeDevices.prepare(QStringLiteral("DELETE FROM devices WHERE id = ANY(?::UUID[])"));
+		removeDevices.addBindValue(uuidArray(backgroundUploaders + backgroundReceivers));
+		QVERIFY2(removeDevices.exec(), qUtf8Printable(removeDevices.lastError().text()));
+	}
+	if(!backgroundUsers.isEmpty()) {
+		QStringList userIds;
+		for(auto userId : backgroundUsers)
+			userIds.append(QString::number(userId));
+		QSqlQuery removeUsers(db);
+		removeUsers.prepare(QStringLiteral("DELETE FROM users WHERE id = ANY(?::BIGINT[])"));
+		removeUsers.addBindValue(QLatin1Char('{') + userIds.join(QLatin1Char(',')) + QLatin1Char('}'));
+		QVERIFY2(removeUsers.exec(), qUtf8Printable(removeUsers.lastError().text()));
+	}
+
+	//remove the device and the account again
+	if(!partnerIds.isEmpty()) {
+		QSqlQuery removePartners(db);
+		removePartners.prepare(QStringLiteral("DELETE FROM devices WHERE id = ?"));
+		for(const auto &partnerId : partnerIds) {
+			removePartners.addBindValue(partnerId);
+			QVERIFY2(removePartners.exec(), qUtf8Printable(removePartners.lastError().text()));
+		}
+	}
+	if(!devId.isNull()) {
+		QSqlQuery removeDevice(db);
+		removeDevice.prepare(QStringLiteral("DELETE FROM devices WHERE id = ? RETURNING userid"));
+		removeDevice.addBindValue(devId);
+		QVERIFY2(removeDevice.exec(), qUtf8Printable(removeDevice.lastError().text()));
+		if(removeDevice.first()) {
+			QSqlQuery removeUser(db);
+			removeUser.prepare(QStringLiteral("DELETE FROM users WHERE id = ?"));
+			removeUser.addBindValue(removeDevice.value(0));
+			QVERIFY2(removeUser.exec(), qUtf8Printable(removeUser.lastError().text()));
+		}
+	}
+	db.close();
+
+	//send a signal to stop
+#ifdef Q_OS_UNIX
+	server->terminate(); //same as kill(SIGTERM)
+#elif Q_OS_WIN
+	GenerateConsoleCtrlEvent(CTRL_BREAK_EVENT, server->processId());
+#endif
+	QVERIFY(server->waitForFinished(5000));
+	QCOMPARE(server->exitStatus(), QProcess::NormalExit);
+	QCOMPARE(server->exitCode(), 0);
+	server->close();
+}
+
+void ServerBenchmark::benchDownload_data()
+{
+	QTest::addColumn<bool>("batched");
+
+	QTest::newRow("single_acks") << false;
+	QTest::newRow("batched_acks") << true;
+}
+
+void ServerBenchmark::benchDownload()
+{
+	QFETCH(bool, batched);
+
+	QVERIFY(insertChanges(count));
+
+	try {
+		auto client = new MockClient(this);
+		QVERIFY(client->waitForConnected(port));
+
+		QElapsedTimer timer;
+		timer.start();
+		QVERIFY(login(client, true));
+
+		//download all changes, acking each one immediately or all that arrived at once
+		QSet<quint64> received;
+		auto duplicates = 0;
+		auto ackMessages = 0;
+		QList<quint64> pendingAcks;
+		auto handleChange = [&](const ChangedMessage &message) {
+			if(received.contains(message.dataIndex))
+				duplicates++;
+			received.insert(message.dataIndex);
+			if(batched) {
+				pendingAcks.append(message.dataIndex);
+				if(!client->hasPendingReply()) {
+					client->send(ChangedAckBatchMessage { pendingAcks });
+					pendingAcks.clear();
+					ackMessages++;
+				}
+			} else {
+				client->send(ChangedAckMessage { message.dataIndex });
+				ackMessages++;
+			}
+		};
+		QVERIFY(client->waitForReply<ChangedInfoMessage>([&](ChangedInfoMessage message, bool &ok) {
+			QCOMPARE(message.changeEstimate, static_cast<quint32>(count));
+			handleChange(message);
+			ok = true;
+		}));
+		for(auto i = 1; i < count; i++) {
+			QVERIFY(client->waitForReply<ChangedMessage>([&](ChangedMessage message, bool &ok) {
+				handleChange(message);
+				ok = true;
+			}));
+		}
+		QVERIFY(client->waitForReply<LastChangedMessage>([&](LastChangedMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+		auto elapsed = timer.nsecsElapsed();
+
+		QCOMPARE(duplicates, 0);
+		QCOMPARE(received.size(), count);
+
+		auto secs = elapsed / 1000000000.0;
+		QTest::setBenchmarkResult(elapsed / 1000000.0, QTest::WalltimeMilliseconds);
+		qInfo().noquote() << "download of" << count << "pending changes with"
+						  << ackMessages << "ack messages -"
+						  << count / secs << "acks/s";
+
+		client->close();
+		QVERIFY(client->waitForDisconnect());
+		client->deleteLater();
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
+void ServerBenchmark::benchUpload_data()
+{
+	QTest::addColumn<int>("datasets");
+
+	QTest::newRow("new_data") << 0;
+	QTest::newRow("same_data") << 10;
+}
+
+void ServerBenchmark::benchUpload()
+{
+	QFETCH(int, datasets);
+
+	//the number of uploads that are sent before waiting for their acks
+	const auto window = 100;
+	auto distinct = datasets > 0 ? qMin(datasets, uploads) : uploads;
+
+	try {
+		auto client = new MockClient(this);
+		QVERIFY(client->waitForConnected(port));
+		QVERIFY(login(client, false));
+
+		auto sent = 0;
+		auto sendNext = [&]() {
+			ChangeMessage message { "upload-" + QByteArray::number(sent % distinct) };
+			message.keyIndex = 0;
+			message.salt = "salt";
+			message.data = QByteArray(size, 'x');
+			client->send(message);
+			sent++;
+		};
+
+		QElapsedTimer timer;
+		timer.start();
+		while(sent < qMin(uploads, window))
+			sendNext();
+		for(auto i = 0; i < uploads; i++) {
+			QVERIFY(client->waitForReply<ChangeAckMessage>([&](ChangeAckMessage message, bool &ok) {
+				QVERIFY(message.dataId.startsWith("upload-"));
+				ok = true;
+			}));
+			if(sent < uploads)
+				sendNext();
+		}
+		auto elapsed = timer.nsecsElapsed();
+
+		client->close();
+		QVERIFY(client->waitForDisconnect());
+		client->deleteLater();
+
+		//every dataset must be pending exactly once for every other device
+		QSqlQuery countQuery(db);
+		countQuery.prepare(QStringLiteral("SELECT COUNT(*) FROM devicechanges "
+										  "INNER JOIN datachanges ON datachanges.id = devicechanges.dataid "
+										  "WHERE datachanges.deviceid = ?"));
+		countQuery.addBindValue(devId);
+		QVERIFY2(countQuery.exec(), qUtf8Printable(countQuery.lastError().text()));
+		QVERIFY(countQuery.first());
+		QCOMPARE(countQuery.value(0).toInt(), distinct * partnerIds.size());
+
+		QSqlQuery cleanupQuery(db);
+		cleanupQuery.prepare(QStringLiteral("DELETE FROM datachanges WHERE deviceid = ?"));
+		cleanupQuery.addBindValue(devId);
+		QVERIFY2(cleanupQuery.exec(), qUtf8Printable(cleanupQuery.lastError().text()));
+
+		auto secs = elapsed / 1000000000.0;
+		QTest::setBenchmarkResult(elapsed / 1000000.0, QTest::WalltimeMilliseconds);
+		qInfo().noquote() << "upload of" << uploads << "changes to" << distinct << "datasets for"
+						  << partnerIds.size() << "other devices -"
+						  << uploads / secs << "uploads/s";
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
+void ServerBenchmark::benchScaling_data()
+{
+	QTest::addColumn<qint64>("total");
+
+	auto scale = qgetenv("QDS_BENCH_SCALE");
+	if(scale.isEmpty())
+		scale = "0,1000000,10000000";
+	for(const auto &step : scale.split(',')) {
+		auto ok = false;
+		auto total = step.trimmed().toLongLong(&ok);
+		if(ok)
+			QTest::newRow(step.trimmed().constData()) << total;
+	}
+}
+
+void ServerBenchmark::benchScaling()
+{
+	QFETCH(qint64, total);
+
+	QVERIFY(insertBackground(total));
+
+	try {
+		//upload one change after the other, to measure the time of each request on it's own
+		auto client = new MockClient(this);
+		QVERIFY(client->waitForConnected(port));
+		QVERIFY(login(client, false));
+
+		QVector<qint64> latencies;
+		latencies.reserve(requests);
+		QElapsedTimer timer;
+		for(auto i = 0; i < requests; i++) {
+			ChangeMessage message { "scaling-" + QByteArray::number(i) };
+			message.keyIndex = 0;
+			message.salt = "salt";
+			message.data = QByteArray(size, 'x');
+			timer.start();
+			client->send(message);
+			QVERIFY(client->waitForReply<ChangeAckMessage>([&](ChangeAckMessage message, bool &ok) {
+				QVERIFY(message.dataId.startsWith("scaling-"));
+				ok = true;
+			}));
+			latencies.append(timer.nsecsElapsed());
+		}
+		client->close();
+		QVERIFY(client->waitForDisconnect());
+		client->deleteLater();
+
+		QSqlQuery cleanupQuery(db);
+		cleanupQuery.prepare(QStringLiteral("DELETE FROM datachanges WHERE deviceid = ?"));
+		cleanupQuery.addBindValue(devId);
+		QVERIFY2(cleanupQuery.exec(), qUtf8Printable(cleanupQuery.lastError().text()));
+
+		//download the same number of changes, with batched acks
+		QVERIFY(insertChanges(requests));
+		client = new MockClient(this);
+		QVERIFY(client->waitForConnected(port));
+		QVERIFY(login(client, true));
+
+		timer.start();
+		auto received = 0;
+		QList<quint64> pendingAcks;
+		auto handleChange = [&](const ChangedMessage &message) {
+			received++;
+			pendingAcks.append(message.dataIndex);
+			if(!client->hasPendingReply()) {
+				client->send(ChangedAckBatchMessage { pendingAcks });
+				pendingAcks.clear();
+			}
+		};
+		QVERIFY(client->waitForReply<ChangedInfoMessage>([&](ChangedInfoMessage message, bool &ok) {
+			handleChange(message);
+			ok = true;
+		}));
+		while(received < requests) {
+			QVERIFY(client->waitForReply<ChangedMessage>([&](ChangedMessage message, bool &ok) {
+				handleChange(message);
+				ok = true;
+			}));
+		}
+		QVERIFY(client->waitForReply<LastChangedMessage>([&](LastChangedMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+		auto downloadTime = timer.nsecsElapsed();
+		client->close();
+		QVERIFY(client->waitForDisconnect());
+		client->deleteLater();
+
+		std::sort(latencies.begin(), latencies.end());
+		auto percentile = [&](double p) {
+			return latencies[qMin(static_cast<int>(latencies.size() * p), latencies.size() - 1)] / 1000.0;
+		};
+		auto mean = std::accumulate(latencies.begin(), latencies.end(), 0.0) / latencies.size() / 1000.0;
+		QTest::setBenchmarkResult(mean / 1000.0, QTest::WalltimeMilliseconds);
+		qInfo().noquote() << "with" << total << "changes of other accounts - upload p50"
+						  << percentile(0.5) << "us, p99" << percentile(0.99) << "us, mean"
+						  << mean << "us - download" << downloadTime / 1000.0 / requests
+						  << "us per change";
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
+int ServerBenchmark::envInt(const char *name, int defaultValue)
+{
+	auto ok = false;
+	auto value = qEnvironmentVariableIntValue(name, &ok);
+	return ok ? value : defaultValue;
+}
+
+QString ServerBenchmark::uuidArray(const QStringList &uuids)
+{
+	return QLatin1Char('{') + uuids.join(QLatin1Char(',')) + QLatin1Char('}');
+}
+
+bool ServerBenchmark::insertChanges(int changeCount)
+{
+	auto ok = false;
+	[&]() {
+		QVERIFY(db.transaction());
+
+		//the changes are "uploaded" by the device itself, as the server does not check that
+		QSqlQuery insertData(db);
+		insertData.prepare(QStringLiteral("INSERT INTO datachanges (deviceid, dataid, keyid, salt, data) "
+										  "SELECT ?, convert_to('bench-' || g, 'UTF8'), 0, ?, ? "
+										  "FROM generate_series(1, ?) AS g"));
+		insertData.addBindValue(devId);
+		insertData.addBindValue(QByteArray("salt"));
+		insertData.addBindValue(QByteArray(size, 'x'));
+		insertData.addBindValue(changeCount);
+		QVERIFY2(insertData.exec(), qUtf8Printable(insertData.lastError().text()));
+
+		QSqlQuery insertDevice(db);
+		if(partitioned) {
+			insertDevice.prepare(QStringLiteral("INSERT INTO devicechanges (deviceid, dataid, sourceid) "
+												"SELECT deviceid, id, deviceid FROM datachanges "
+												"WHERE deviceid = ?"));
+		} else {
+			insertDevice.prepare(QStringLiteral("INSERT INTO devicechanges (deviceid, dataid) "
+												"SELECT deviceid, id FROM datachanges "
+												"WHERE deviceid = ?"));
+		}
+		insertDevice.addBindValue(devId);
+		QVERIFY2(insertDevice.exec(), qUtf8Printable(insertDevice.lastError().text()));
+
+		QVERIFY(db.commit());
+		ok = true;
+	}();
+	return ok;
+}
+
+bool ServerBenchmark::insertPartners(int partnerCount)
+{
+	auto ok = false;
+	[&]() {
+		//the partners never connect, so they do not need real keys
+		QSqlQuery insertDevice(db);
+		insertDevice.prepare(QStringLiteral("INSERT INTO devices "
+											"(id, userid, name, signscheme, signkey, cryptscheme, cryptkey, fingerprint) "
+											"VALUES(?, deviceUserId(?), 'partner', '', '', '', '', '')"));
+		for(auto i = 0; i < partnerCount; i++) {
+			auto partnerId = QUuid::createUuid();
+			insertDevice.addBindValue(partnerId);
+			insertDevice.addBindValue(devId);
+			QVERIFY2(insertDevice.exec(), qUtf8Printable(insertDevice.lastError().text()));
+			partnerIds.append(partnerId);
+		}
+		ok = true;
+	}();
+	return ok;
+}
+
+bool ServerBenchmark::insertBackground(qint64 changeCount)
+{
+	auto ok = false;
+	[&]() {
+		//accounts with one device that uploads, and one that has all of them pending
+		if(backgroundUsers.isEmpty()) {
+			auto accounts = envInt("QDS_BENCH_ACCOUNTS", 1000);
+			QVERIFY(accounts > 0);
+			QVERIFY(db.transaction());
+			QSqlQuery insertUser(db);
+			insertUser.prepare(QStringLiteral("INSERT INTO users DEFAULT VALUES RETURNING id"));
+			QSqlQuery insertDevice(db);
+			insertDevice.prepare(QStringLiteral("INSERT INTO devices "
+												"(id, userid, name, signscheme, signkey, cryptscheme, cryptkey, fingerprint) "
+												"VALUES(?, ?, 'background', '', '', '', '', '')"));
+			for(auto i = 0; i < accounts; i++) {
+				QVERIFY2(insertUser.exec(), qUtf8Printable(insertUser.lastError().text()));
+				QVERIFY(insertUser.first());
+				auto userId = insertUser.value(0).toULongLong();
+				backgroundUsers.append(userId);
+				for(auto list : {&backgroundUploaders, &backgroundReceivers}) {
+					auto deviceId = QUuid::createUuid();
+					insertDevice.addBindValue(deviceId);
+					insertDevice.addBindValue(userId);
+					QVERIFY2(insertDevice.exec(), qUtf8Printable(insertDevice.lastError().text()));
+					list->append(deviceId.toString().mid(1, 36)); //without the braces, as they delimit the array
+				}
+			}
+			QVERIFY(db.commit());
+		}
+
+		//in chunks, so every transaction stays reasonably small
+		const qint64 chunkSize = 1000000;
+		QElapsedTimer timer;
+		timer.start();
+		auto start = backgroundChanges;
+		while(backgroundChanges < changeCount) {
+			auto chunk = qMin(chunkSize, changeCount - backgroundChanges);
+			QSqlQuery insertChanges(db);
+			insertChanges.prepare(QStringLiteral("WITH inserted AS ( "
+												 "	INSERT INTO datachanges (deviceid, dataid, keyid, salt, data) "
+												 "	SELECT (?::UUID[])[1 + g % ?], convert_to('background-' || g, 'UTF8'), 0, ?, ? "
+												 "	FROM generate_series(?, ?) AS g "
+												 "	RETURNING id, deviceid "
+												 ") "
+												 "INSERT INTO devicechanges %1 "
+												 "SELECT pairs.receiver, inserted.id %2 FROM inserted "
+												 "INNER JOIN unnest(?::UUID[], ?::UUID[]) AS pairs(uploader, receiver) "
+												 "ON pairs.uploader = inserted.deviceid")
+								  .arg(partitioned ? QStringLiteral("(deviceid, dataid, sourceid)") : QStringLiteral("(deviceid, dataid)"),
+									   partitioned ? QStringLiteral(", inserted.deviceid") : QString()));
+			insertChanges.addBindValue(uuidArray(backgroundUploaders));
+			insertChanges.addBindValue(backgroundUploaders.size());
+			insertChanges.addBindValue(QByteArray("salt"));
+			insertChanges.addBindValue(QByteArray(size, 'x'));
+			insertChanges.addBindValue(backgroundChanges + 1);
+			insertChanges.addBindValue(backgroundChanges + chunk);
+			insertChanges.addBindValue(uuidArray(backgroundUploaders));
+			insertChanges.addBindValue(uuidArray(backgroundReceivers));
+			QVERIFY2(insertChanges.exec(), qUtf8Printable(insertChanges.lastError().text()));
+			backgroundChanges += chunk;
+		}
+		if(backgroundChanges > start) {
+			qInfo().noquote() << "inserted" << backgroundChanges - start << "changes of other accounts in"
+							  << timer.elapsed() / 1000.0 << "s";
+		}
+
+		//fresh statistics, as the server would have them after growing slowly
+		QSqlQuery analyzeQuery(db);
+		QVERIFY2(analyzeQuery.exec(QStringLiteral("ANALYZE datachanges, devicechanges")),
+				 qUtf8Printable(analyzeQuery.lastError().text()));
+		ok = true;
+	}();
+	return ok;
+}
+
+bool ServerBenchmark::login(MockClient *client, bool expectChanges)
+{
+	auto ok = false;
+	[&]() {
+		QByteArray mNonce;
+		QVERIFY(client->waitForReply<IdentifyMessage>([&](IdentifyMessage message, bool &ok) {
+			mNonce = message.nonce;
+			ok = true;
+		}));
+		client->sendSigned(LoginMessage {
+							   devId,
+							   QStringLiteral("benchmark"),
+							   mNonce
+						   }, crypto);
+		QVERIFY(client->waitForReply<WelcomeMessage>([&](WelcomeMessage message, bool &ok) {
+			QCOMPARE(message.hasChanges, expectChanges);
+			ok = true;
+		}));
+		QVERIFY(client->waitForReply<ResumeTicketMessage>([&](ResumeTicketMessage message, bool &ok) {
+			Q_UNUSED(message)
+			ok = true;
+		}));
+		ok = true;
+	}();
+	return ok;
+}
+
+QTEST_MAIN(ServerBenchmark)
+
+#include "tst_serverbenchmark.moc"
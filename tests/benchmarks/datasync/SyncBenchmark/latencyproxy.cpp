@@ -0,0 +1,70 @@
+#include "latencyproxy.h"
+
+LatencyProxy::LatencyProxy(quint16 targetPort, int latency, QObject *parent) :
+	QTcpServer(parent),
+	_targetPort(targetPort),
+	_latency(latency)
+{
+	connect(this, &QTcpServer::newConnection,
+			this, &LatencyProxy::newClient);
+}
+
+void LatencyProxy::newClient()
+{
+	while(hasPendingConnections()) {
+		auto client = nextPendingConnection();
+		auto upstream = new QTcpSocket(client);
+		new Pipe(client, upstream, _latency, client);
+		new Pipe(upstream, client, _latency, client);
+
+		connect(client, &QTcpSocket::disconnected,
+				upstream, &QTcpSocket::disconnectFromHost);
+		connect(upstream, &QTcpSocket::disconnected,
+				client, &QTcpSocket::disconnectFromHost);
+		connect(client, &QTcpSocket::disconnected,
+				client, &QTcpSocket::deleteLater);
+		upstream->connectToHost(QHostAddress::LocalHost, _targetPort);
+	}
+}
+
+
+
+LatencyProxy::Pipe::Pipe(QTcpSocket *source, QTcpSocket *target, int latency, QObject *parent) :
+	QObject(parent),
+	_source(source),
+	_target(target),
+	_latency(latency),
+	_clock(),
+	_timer(new QTimer(this)),
+	_chunks()
+{
+	_clock.start();
+	_timer->setSingleShot(true);
+	_timer->setTimerType(Qt::PreciseTimer);
+	connect(_timer, &QTimer::timeout,
+			this, &Pipe::flush);
+	connect(_source, &QTcpSocket::readyRead,
+			this, &Pipe::read);
+	//the upstream might not be connected yet
+	connect(_target, &QTcpSocket::connected,
+			this, &Pipe::flush);
+}
+
+void LatencyProxy::Pipe::read()
+{
+	_chunks.enqueue({_clock.elapsed() + _latency, _source->readAll()});
+	if(!_timer->isActive())
+		flush();
+}
+
+void LatencyProxy::Pipe::flush()
+{
+	if(!_target || _target->state() != QAbstractSocket::ConnectedState)
+		return;
+
+	auto now = _clock.elapsed();
+	while(!_chunks.isEmpty() && _chunks.head().deadline <= now)
+		_target->write(_chunks.dequeue().data);
+	if(!_chunks.isEmpty())
+		_timer->start(static_cast<int>(_chunks.head().deadline - now));
+}
@@ -0,0 +1,49 @@
+#ifndef LATENCYPROXY_H
+#define LATENCYPROXY_H
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QQueue>
+#include <QtCore/QPointer>
+#include <QtCore/QTimer>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+
+//! Forwards tcp connections to the server and delays every chunk by a fixed one-way latency
+class LatencyProxy : public QTcpServer
+{
+	Q_OBJECT
+
+public:
+	explicit LatencyProxy(quint16 targetPort, int latency, QObject *parent = nullptr);
+
+private Q_SLOTS:
+	void newClient();
+
+private:
+	class Pipe : public QObject
+	{
+	public:
+		Pipe(QTcpSocket *source, QTcpSocket *target, int latency, QObject *parent);
+
+	private:
+		struct Chunk {
+			qint64 deadline;
+			QByteArray data;
+		};
+
+		QPointer<QTcpSocket> _source;
+		QPointer<QTcpSocket> _target;
+		int _latency;
+		QElapsedTimer _clock;
+		QTimer *_timer;
+		QQueue<Chunk> _chunks;
+
+		void read();
+		void flush();
+	};
+
+	quint16 _targetPort;
+	int _latency;
+};
+
+#endif // LATENCYPROXY_H
@@ -0,0 +1,399 @@
+#include <QString>
+#include <QtTest>
+#include <QCoreApplication>
+#include <testlib.h>
+#include <testdata.h>
+#include "latencyproxy.h"
+using namespace QtDataSync;
+
+// Measures end to end sync throughput between two real setups and a local appserver.
+// The workload can be configured via environment variables:
+//  - QDS_BENCH_COUNT: number of objects per workload (default 500)
+//  - QDS_BENCH_SIZE: payload size of each object in bytes (default 1024)
+//  - QDS_BENCH_LATENCY: simulated one-way network latency in ms (default 0)
+//  - QDS_BENCH_OUTPUT: file to write the json results to (default: stdout)
+class SyncBenchmark : public QObject
+{
+	Q_OBJECT
+
+private Q_SLOTS:
+	void initTestCase();
+	void cleanupTestCase();
+
+	void benchInitialUpload();
+	void benchFullDownload();
+	void benchLiveSync();
+	void benchConflicts();
+
+Q_SIGNALS:
+	void unlock();
+
+private:
+	QProcess *server;
+	LatencyProxy *proxy;
+
+	int count;
+	int size;
+	int latency;
+	QJsonArray results;
+
+	AccountManager *acc1;
+	SyncManager *sync1;
+	DataTypeStore<TestData> *store1;
+
+	AccountManager *acc2;
+	SyncManager *sync2;
+	DataTypeStore<TestData> *store2;
+
+	static int envInt(const char *name, int defaultValue);
+	TestData generate(int index, char fill) const;
+	bool waitSynced(SyncManager *sync, int timeout);
+	bool converged() const;
+	void report(const QString &workload, int objects, qint64 bytes, qint64 nsecs);
+};
+
+void SyncBenchmark::initTestCase()
+{
+#ifdef Q_OS_LINUX
+	if(!qgetenv("LD_PRELOAD").contains("Qt5DataSync"))
+		qWarning() << "No LD_PRELOAD set - this may fail on systems with multiple version of the modules";
+#endif
+
+	count = envInt("QDS_BENCH_COUNT", 500);
+	size = envInt("QDS_BENCH_SIZE", 1024);
+	latency = envInt("QDS_BENCH_LATENCY", 0);
+	QVERIFY(count > 0);
+	QVERIFY(size >= 0);
+	QVERIFY(latency >= 0);
+
+	QByteArray confPath { SETUP_FILE };
+	QVERIFY(QFile::exists(QString::fromUtf8(confPath)));
+	qputenv("QDSAPP_CONFIG_FILE", confPath);
+	QSettings config{QString::fromUtf8(confPath), QSettings::IniFormat};
+	auto serverPort = static_cast<quint16>(config.value(QStringLiteral("server/port")).toUInt());
+	QVERIFY(serverPort != 0);
+
+#ifdef Q_OS_UNIX
+	QString binPath { QStringLiteral(BUILD_BIN_DIR "qdsappd") };
+#elif Q_OS_WIN
+	QString binPath { QStringLiteral(BUILD_BIN_DIR "qdsappsvc") };
+#else
+	QString binPath { QStringLiteral(BUILD_BIN_DIR "qdsapp") };
+#endif
+	QVERIFY(QFile::exists(binPath));
+
+	server = new QProcess(this);
+	server->setProgram(binPath);
+	server->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+	server->start();
+	QVERIFY(server->waitForStarted(5000));
+	QVERIFY(!server->waitForFinished(5000));
+
+	//route all traffic through the proxy if a latency is requested
+	QUrl remoteUrl;
+	remoteUrl.setScheme(QStringLiteral("ws"));
+	remoteUrl.setHost(QStringLiteral("localhost"));
+	if(latency > 0) {
+		proxy = new LatencyProxy(serverPort, latency, this);
+		QVERIFY(proxy->listen(QHostAddress::LocalHost));
+		remoteUrl.setPort(proxy->serverPort());
+	} else {
+		proxy = nullptr;
+		remoteUrl.setPort(serverPort);
+	}
+
+	try {
+		TestLib::init();
+		qRegisterMetaType<LoginRequest>();
+
+		{
+			QString setupName1 = QStringLiteral("bench1");
+			Setup setup1;
+			TestLib::setup(setup1);
+			setup1.setLocalDir(setup1.localDir() + QLatin1Char('/') + setupName1)
+					.setRemoteConfiguration(remoteUrl);
+			setup1.create(setupName1);
+
+			acc1 = new AccountManager(setupName1, this);
+			QVERIFY(acc1->replica()->waitForSource(5000));
+			sync1 = new SyncManager(setupName1, this);
+			QVERIFY(sync1->replica()->waitForSource(5000));
+			store1 = new DataTypeStore<TestData>(setupName1, this);
+		}
+
+		{
+			QString setupName2 = QStringLiteral("bench2");
+			Setup setup2;
+			TestLib::setup(setup2);
+			setup2.setLocalDir(setup2.localDir() + QLatin1Char('/') + setupName2)
+					.setRemoteConfiguration(remoteUrl);
+			setup2.create(setupName2);
+
+			acc2 = new AccountManager(setupName2, this);
+			QVERIFY(acc2->replica()->waitForSource(5000));
+			sync2 = new SyncManager(setupName2, this);
+			QVERIFY(sync2->replica()->waitForSource(5000));
+			store2 = new DataTypeStore<TestData>(setupName2, this);
+		}
+
+		//device 2 stays offline until the full download is measured
+		QSignalSpy enabledSpy(sync2, &SyncManager::syncEnabledChanged);
+		sync2->setSyncEnabled(false);
+		QVERIFY(enabledSpy.wait());
+		QVERIFY(waitSynced(sync1, 30000));
+	} catch(QException &e) {
+		QFAIL(e.what());
+	}
+}
+
+void SyncBenchmark::cleanupTestCase()
+{
+	QJsonObject report;
+	report[QStringLiteral("count")] = count;
+	report[QStringLiteral("size")] = size;
+	report[QStringLiteral("latency")] = latency;
+	report[QStringLiteral("results")] = results;
+	auto json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+
+	auto outPath = QString::fromLocal8Bit(qgetenv("QDS_BENCH_OUTPUT"));
+	if(outPath.isEmpty()) {
+		QFile out;
+		QVERIFY(out.open(stdout, QIODevice::WriteOnly));
+		out.write(json);
+	} else {
+		QFile out{outPath};
+		QVERIFY2(out.open(QIODevice::WriteOnly | QIODevice::Truncate), qUtf8Printable(out.errorString()));
+		out.write(json);
+	}
+
+	delete store1;
+	store1 = nullptr;
+	delete sync1;
+	sync1 = nullptr;
+	delete acc1;
+	acc1 = nullptr;
+	Setup::removeSetup(QStringLiteral("bench1"), true);
+
+	delete store2;
+	store2 = nullptr;
+	delete sync2;
+	sync2 = nullptr;
+	delete acc2;
+	acc2 = nullptr;
+	Setup::removeSetup(QStringLiteral("bench2"), true);
+
+	if(proxy)
+		proxy->close();
+
+	//send a signal to stop
+#ifdef Q_OS_UNIX
+	server->terminate(); //same as kill(SIGTERM)
+#elif Q_OS_WIN
+	GenerateConsoleCtrlEvent(CTRL_BREAK_EVENT, server->processId());
+#endif
+	QVERIFY(server->waitForFinished(5000));
+	QCOMPARE(server->exitStatus(), QProcess::NormalExit);
+	QCOMPARE(server->exitCode(), 0);
+	server->close();
+}
+
+void SyncBenchmark::benchInitialUpload()
+{
+	try {
+		QSignalSpy errorSpy(sync1, &SyncManager::lastErrorChanged);
+
+		qint64 bytes = 0;
+		QElapsedTimer timer;
+		timer.start();
+		for(auto i = 0; i < count; i++) {
+			auto data = generate(i, 'a');
+			bytes += data.text.size();
+			store1->save(data);
+		}
+		QVERIFY(waitSynced(sync1, 60000 + count * 100));
+		auto elapsed = timer.nsecsElapsed();
+
+		QCOMPARE(store1->count(), count);
+		QVERIFY(errorSpy.isEmpty());
+		report(QStringLiteral("initialUpload"), count, bytes, elapsed);
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
+void SyncBenchmark::benchFullDownload()
+{
+	try {
+		QSignalSpy error1Spy(acc1, &AccountManager::lastErrorChanged);
+		QSignalSpy error2Spy(acc2, &AccountManager::lastErrorChanged);
+		QSignalSpy enabledSpy(sync2, &SyncManager::syncEnabledChanged);
+		QSignalSpy requestSpy(acc1, &AccountManager::loginRequested);
+
+		sync2->setSyncEnabled(true);
+		QVERIFY(enabledSpy.wait());
+		QVERIFY(waitSynced(sync2, 30000));
+
+		acc1->exportAccount(false, [this](QJsonObject exp) {
+			acc2->importAccount(exp, [](bool ok, QString e) {
+				QVERIFY2(ok, qUtf8Printable(e));
+			}, true);
+		}, [](QString e) {
+			QFAIL(qUtf8Printable(e));
+		});
+		QVERIFY(requestSpy.wait());
+		auto request = requestSpy.takeFirst()[0].value<LoginRequest>();
+
+		//the download starts as soon as the device was accepted
+		QElapsedTimer timer;
+		timer.start();
+		request.accept();
+		QTRY_COMPARE_WITH_TIMEOUT(store2->count(), count, 60000 + count * 100);
+		QVERIFY(waitSynced(sync2, 30000));
+		auto elapsed = timer.nsecsElapsed();
+
+		qint64 bytes = 0;
+		for(const auto &data : store2->loadAll())
+			bytes += data.text.size();
+		QVERIFY(error1Spy.isEmpty());
+		QVERIFY(error2Spy.isEmpty());
+		report(QStringLiteral("fullDownload"), count, bytes, elapsed);
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
+void SyncBenchmark::benchLiveSync()
+{
+	try {
+		QSignalSpy error1Spy(sync1, &SyncManager::lastErrorChanged);
+		QSignalSpy error2Spy(sync2, &SyncManager::lastErrorChanged);
+		QSignalSpy dataSpy(store2, &DataTypeStoreBase::dataChanged);
+
+		qint64 bytes = 0;
+		QElapsedTimer timer;
+		timer.start();
+		for(auto i = 0; i < count; i++) {
+			auto data = generate(i, 'b');
+			bytes += data.text.size();
+			store1->save(data);
+			//let the event loop run so changes are synced one by one
+			QCoreApplication::processEvents();
+		}
+		while(dataSpy.size() < count)
+			QVERIFY(dataSpy.wait(30000));
+		auto elapsed = timer.nsecsElapsed();
+
+		QVERIFY(error1Spy.isEmpty());
+		QVERIFY(error2Spy.isEmpty());
+		report(QStringLiteral("liveSync"), count, bytes, elapsed);
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
+void SyncBenchmark::benchConflicts()
+{
+	try {
+		QSignalSpy error1Spy(sync1, &SyncManager::lastErrorChanged);
+		QSignalSpy error2Spy(sync2, &SyncManager::lastErrorChanged);
+		QSignalSpy enabled1Spy(sync1, &SyncManager::syncEnabledChanged);
+		QSignalSpy enabled2Spy(sync2, &SyncManager::syncEnabledChanged);
+
+		//modify the same objects on both devices while offline
+		sync1->setSyncEnabled(false);
+		QVERIFY(enabled1Spy.wait());
+		sync2->setSyncEnabled(false);
+		QVERIFY(enabled2Spy.wait());
+		enabled1Spy.clear();
+		enabled2Spy.clear();
+
+		qint64 bytes = 0;
+		for(auto i = 0; i < count; i++) {
+			auto data1 = generate(i, 'c');
+			auto data2 = generate(i, 'd');
+			bytes += data1.text.size() + data2.text.size();
+			store1->save(data1);
+			store2->save(data2);
+		}
+
+		QElapsedTimer timer;
+		timer.start();
+		sync1->setSyncEnabled(true);
+		sync2->setSyncEnabled(true);
+		if(enabled1Spy.isEmpty())
+			QVERIFY(enabled1Spy.wait());
+		if(enabled2Spy.isEmpty())
+			QVERIFY(enabled2Spy.wait());
+		//both devices have converged once all objects are equal
+		QTRY_VERIFY_WITH_TIMEOUT(converged(), 60000 + count * 200);
+		QVERIFY(waitSynced(sync1, 30000));
+		QVERIFY(waitSynced(sync2, 30000));
+		auto elapsed = timer.nsecsElapsed();
+
+		QVERIFY(error1Spy.isEmpty());
+		QVERIFY(error2Spy.isEmpty());
+		report(QStringLiteral("conflicts"), count * 2, bytes, elapsed);
+	} catch(std::exception &e) {
+		QFAIL(e.what());
+	}
+}
+
+int SyncBenchmark::envInt(const char *name, int defaultValue)
+{
+	auto ok = false;
+	auto value = qEnvironmentVariableIntValue(name, &ok);
+	return ok ? value : defaultValue;
+}
+
+TestData SyncBenchmark::generate(int index, char fill) const
+{
+	return {index, QString(size, QLatin1Char(fill))};
+}
+
+bool SyncBenchmark::waitSynced(SyncManager *sync, int timeout)
+{
+	QSignalSpy unlockSpy(this, &SyncBenchmark::unlock);
+	QSharedPointer<bool> synced = QSharedPointer<bool>::create(false);
+	sync->runOnSynchronized([this, synced](SyncManager::SyncState s) {
+		*synced = (s == SyncManager::Synchronized);
+		emit unlock();
+	}, false);
+	if(unlockSpy.isEmpty() && !unlockSpy.wait(timeout))
+		return false;
+	return *synced;
+}
+
+bool SyncBenchmark::converged() const
+{
+	if(store1->count() != store2->count())
+		return false;
+	try {
+		for(const auto &data : store1->loadAll()) {
+			if(!(store2->load(QString::number(data.id)) == data))
+				return false;
+		}
+		return true;
+	} catch(NoDataException &) {
+		return false;
+	}
+}
+
+void SyncBenchmark::report(const QString &workload, int objects, qint64 bytes, qint64 nsecs)
+{
+	auto secs = nsecs / 1000000000.0;
+	QJsonObject result;
+	result[QStringLiteral("workload")] = workload;
+	result[QStringLiteral("objects")] = objects;
+	result[QStringLiteral("bytes")] = bytes;
+	result[QStringLiteral("seconds")] = secs;
+	result[QStringLiteral("objectsPerSec")] = objects / secs;
+	result[QStringLiteral("mbPerSec")] = (bytes / (1024.0 * 1024.0)) / secs;
+	results.append(result);
+
+	QTest::setBenchmarkResult(nsecs / 1000000.0, QTest::WalltimeMilliseconds);
+	qInfo().noquote() << workload << "-" << objects / secs << "objects/s," << (bytes / (1024.0 * 1024.0)) / secs << "MB/s";
+}
+
+QTEST_MAIN(SyncBenchmark)
+
+#include "tst_syncbenchmark.moc"
@@ -0,0 +1,15 @@
+TEMPLATE = subdirs
+
+# all benchmarks link against the TestLib of the auto tests
+SUBDIRS += \
+	CryptoBenchmark
+
+# compiles the executor of the appserver directly
+SUBDIRS += \
+	ExecutorBenchmark
+
+# the sync and server benchmarks need a running appserver
+include_server_tests: SUBDIRS += \
+	SyncBenchmark \
+	ServerBenchmark \
+	LoadGenerator
@@ -2,4 +2,7 @@ TEMPLATE = subdirs
 
 CONFIG += no_docs_target
 
-SUBDIRS += auto
+SUBDIRS += auto \
+	benchmarks
+
+benchmarks.depends += auto
@@ -11,10 +11,15 @@
 
 using namespace std::chrono;
 
+//global, as clients and threads may still report metrics while the app is destroyed
+Q_GLOBAL_STATIC(Metrics, globalMetrics)
+
 App::App(int &argc, char **argv) :
 	QCoreApplication(argc, argv),
 	_config(nullptr),
 	_mainPool(nullptr),
+	_executor(nullptr),
+	_metricsServer(nullptr),
 	_connector(nullptr),
 	_database(nullptr)
 {
@@ -61,6 +66,16 @@ QThreadPool *App::threadPool() const
 	return _mainPool;
 }
 
+StrandExecutor *App::executor() const
+{
+	return _executor;
+}
+
+Metrics *App::metrics() const
+{
+	return globalMetrics;
+}
+
 QString App::absolutePath(const QString &path) const
 {
 	auto dir = QFileInfo(_config->fileName()).dir();
@@ -117,16 +132,27 @@ bool App::start(const QString &serviceName)
 
 	qDebug() << "Using configuration:" << _config->fileName();
 
+	_metricsServer = new MetricsServer(globalMetrics, this);
+
+	auto threadCount = _config->value(QStringLiteral("threads/count"),
+									  QThread::idealThreadCount()).toInt();
+	_executor = new StrandExecutor(threadCount, this);
+	globalMetrics->addGauge("qdsapp_executor_threads", "Number of threads that handle clients", [this](){
+		return _executor->threadCount();
+	});
+	globalMetrics->addGauge("qdsapp_executor_queued_strands", "Number of clients with tasks that wait for a free thread", [this](){
+		return _executor->queuedStrands();
+	});
 	_mainPool = new QThreadPool(this);
-	_mainPool->setMaxThreadCount(_config->value(QStringLiteral("threads/count"),
-											  QThread::idealThreadCount()).toInt());
+	_mainPool->setMaxThreadCount(threadCount);
 	auto timeoutMin = _config->value(QStringLiteral("threads/expire"), 10).toInt(); //in minutes
 	_mainPool->setExpiryTimeout(duration_cast<milliseconds>(minutes(timeoutMin)).count());
-	qDebug() << "Running with max" << _mainPool->maxThreadCount()
-			 << "threads and an expiry timeout of" << timeoutMin
+	qDebug() << "Running with" << _executor->threadCount()
+			 << "client threads and max" << _mainPool->maxThreadCount()
+			 << "background threads and an expiry timeout of" << timeoutMin
 			 << "minutes";
 
-	_database = new DatabaseController(this);
+	_database = DatabaseController::create(this);
 	_connector = new ClientConnector(_database, this);
 
 	connect(_database, &DatabaseController::databaseInitDone,
@@ -145,6 +171,7 @@ void App::stop()
 {
 	qDebug() << "Stopping server...";
 	_connector->disconnectAll();
+	_executor->stop();
 	_mainPool->clear();
 	_mainPool->waitForDone();
 	qDebug() << "Server stopped";
@@ -179,7 +206,7 @@ void App::processCommand(int code)
 
 void App::completeStartup(bool ok)
 {
-	if(!ok || !_connector->listen())
+	if(!ok || !_connector->listen() || !_metricsServer->listen())
 		qApp->exit();
 }
 
@@ -7,6 +7,9 @@
 
 #include "clientconnector.h"
 #include "databasecontroller.h"
+#include "strandexecutor.h"
+#include "metrics.h"
+#include "metricsserver.h"
 
 class App : public QCoreApplication
 {
@@ -23,6 +26,8 @@ public:
 
 	const QSettings *configuration() const;
 	QThreadPool *threadPool() const;
+	StrandExecutor *executor() const;
+	Metrics *metrics() const;
 	QString absolutePath(const QString &path) const;
 
 public Q_SLOTS://defined like that to be ready for service inclusion
@@ -40,6 +45,8 @@ private Q_SLOTS:
 private:
 	const QSettings *_config;
 	QThreadPool *_mainPool;
+	StrandExecutor *_executor;
+	MetricsServer *_metricsServer;
 	ClientConnector *_connector;
 	DatabaseController *_database;
 
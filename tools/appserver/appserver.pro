@@ -1,6 +1,6 @@
 TEMPLATE = app
 
-QT += websockets sql concurrent
+QT += network websockets sql concurrent
 QT -= gui
 
 CONFIG += c++11 console
@@ -29,14 +29,30 @@ HEADERS += \
 	app.h \
 	client.h \
 	databasecontroller.h \
-	singletaskqueue.h
+	databasepool.h \
+	postgrescontroller.h \
+	sqlitecontroller.h \
+	strandexecutor.h \
+	metrics.h \
+	metricsserver.h \
+	sessiontickets.h \
+	blobstore.h \
+	clusterbus.h
 
 SOURCES += \
 	clientconnector.cpp \
 	app.cpp \
 	client.cpp \
 	databasecontroller.cpp \
-	singletaskqueue.cpp
+	databasepool.cpp \
+	postgrescontroller.cpp \
+	sqlitecontroller.cpp \
+	strandexecutor.cpp \
+	metrics.cpp \
+	metricsserver.cpp \
+	sessiontickets.cpp \
+	blobstore.cpp \
+	clusterbus.cpp
 
 DISTFILES += \
 	docker_setup.conf \
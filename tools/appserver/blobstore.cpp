@@ -0,0 +1,123 @@
+#include "blobstore.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDirIterator>
+#include <QtCore/QFile>
+#include <QtCore/QSaveFile>
+#include <QtCore/QDebug>
+
+namespace {
+
+const auto KeyHash = QCryptographicHash::Sha3_256;
+const int KeyLength = 32;
+
+}
+
+BlobStore::BlobStore(const QString &path, qint64 threshold) :
+	_dir(path),
+	_threshold(path.isEmpty() ? -1 : threshold)
+{
+	if(isEnabled() && !_dir.mkpath(QStringLiteral(".")))
+		qWarning() << "Failed to create blob directory" << _dir.absolutePath();
+}
+
+bool BlobStore::isEnabled() const
+{
+	return _threshold >= 0;
+}
+
+bool BlobStore::shouldOffload(const QByteArray &data) const
+{
+	// a threshold of 0 only serves the blobs that were stored before
+	return _threshold > 0 && data.size() >= _threshold;
+}
+
+QByteArray BlobStore::store(const QByteArray &data) const
+{
+	auto key = QCryptographicHash::hash(data, KeyHash);
+	auto path = blobPath(key);
+
+	// identical data is only stored once, but touched so the sweep does not remove it
+	// if the sweep moved it away in the meantime, opening creates an empty file, which is replaced below
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+	if(QFile::exists(path)) {
+		QFile file(path);
+		if(file.open(QIODevice::ReadWrite) &&
+		   file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime) &&
+		   file.size() == data.size())
+			return key;
+	}
+#endif
+
+	if(!_dir.mkpath(QFileInfo(path).path())) {
+		qWarning() << "Failed to create blob directory for" << path;
+		return {};
+	}
+	QSaveFile file(path);
+	if(!file.open(QIODevice::WriteOnly) ||
+	   file.write(data) != data.size() ||
+	   !file.commit()) {
+		qWarning() << "Failed to store blob" << path
+				   << "with error:" << file.errorString();
+		return {};
+	}
+	return key;
+}
+
+QByteArray BlobStore::load(const QByteArray &key) const
+{
+	QFile file(blobPath(key));
+	if(!file.open(QIODevice::ReadOnly)) {
+		qWarning() << "Failed to load blob" << file.fileName()
+				   << "with error:" << file.errorString();
+		return {};
+	}
+	return file.readAll();
+}
+
+QList<QByteArray> BlobStore::keys(const QDateTime &storedBefore) const
+{
+	QList<QByteArray> keys;
+	if(!isEnabled())
+		return keys;
+
+	QDirIterator iterator(_dir.absolutePath(), QDir::Files, QDirIterator::Subdirectories);
+	while(iterator.hasNext()) {
+		iterator.next();
+		auto info = iterator.fileInfo();
+		// skips the temporary files of blobs that are stored right now
+		auto key = QByteArray::fromHex(info.fileName().toLatin1());
+		if(key.toHex() == info.fileName().toLatin1() &&
+		   key.size() == KeyLength &&
+		   info.lastModified() < storedBefore)
+			keys.append(key);
+	}
+	return keys;
+}
+
+bool BlobStore::remove(const QByteArray &key, const QDateTime &storedBefore) const
+{
+	auto path = blobPath(key);
+	QFileInfo info(path);
+	if(!info.exists() || info.lastModified() >= storedBefore)
+		return false;
+
+	// moved away first, so a store that touches the blob right now is either seen below or writes it again
+	auto trashPath = path + QStringLiteral(".removed");
+	if(!QFile::rename(path, trashPath))
+		return false;
+	QFileInfo trashInfo(trashPath);
+	if(trashInfo.lastModified() >= storedBefore) {
+		// stored again before it was moved - if it was written again in the meantime, that copy is kept
+		if(!QFile::rename(trashPath, path))
+			QFile::remove(trashPath);
+		return false;
+	}
+	return QFile::remove(trashPath);
+}
+
+QString BlobStore::blobPath(const QByteArray &key) const
+{
+	auto name = QString::fromLatin1(key.toHex());
+	return _dir.absoluteFilePath(name.left(2) + QLatin1Char('/') + name);
+}
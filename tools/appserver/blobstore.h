@@ -0,0 +1,32 @@
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+
+//! A content addressed directory for large change payloads, so the database only keeps a reference. Is threadsafe, as all methods are const
+class BlobStore
+{
+public:
+	explicit BlobStore(const QString &path, qint64 threshold);
+
+	bool isEnabled() const;
+	//! Returns true if the data is large enough to be stored outside of the database
+	bool shouldOffload(const QByteArray &data) const;
+
+	QByteArray store(const QByteArray &data) const; // returns the key, or an empty array on errors
+	QByteArray load(const QByteArray &key) const; // returns a null array if the blob does not exist
+	//! Lists the keys of all blobs that were not stored since the given time
+	QList<QByteArray> keys(const QDateTime &storedBefore) const;
+	//! Removes the blob, unless it was stored again since the given time
+	bool remove(const QByteArray &key, const QDateTime &storedBefore) const;
+
+private:
+	QDir _dir;
+	qint64 _threshold;
+
+	QString blobPath(const QByteArray &key) const;
+};
+
+#endif // BLOBSTORE_H
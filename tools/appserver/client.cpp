@@ -75,22 +75,84 @@ public:
 
 QThreadStorage<Client::Rng> Client::rngPool;
 
-Client::Client(DatabaseController *database, QWebSocket *websocket, QObject *parent) :
+namespace {
+
+Metrics::Histogram *messageLatency(const QByteArray &name)
+{
+	//only known messages, to not create a metric for everything a client sends
+	auto known = QMetaType::type(Message::typeName(name)) != QMetaType::UnknownType;
+	return qApp->metrics()->histogram("qdsapp_message_duration_seconds",
+									  "Duration of handling received messages",
+									  {{"type", known ? name : QByteArrayLiteral("unknown")}});
+}
+
+Metrics::Gauge *queuedBytes()
+{
+	//also used as the server wide total, to limit it
+	static auto queued = qApp->metrics()->gauge("qdsapp_send_queued_bytes",
+												"Number of bytes queued for sending to clients, that were not yet written to the network");
+	return queued;
+}
+
+}
+
+Q_GLOBAL_STATIC(SendResumer, sendResumer)
+
+void SendResumer::pause()
+{
+	_paused.ref();
+}
+
+void SendResumer::resume()
+{
+	_paused.deref();
+}
+
+void SendResumer::written(qint64 limit)
+{
+	//only resume once half of the budget was written, to not pause again right away
+	if(limit > 0 &&
+	   _paused.load() > 0 &&
+	   queuedBytes()->value() <= limit / 2)
+		emit resumed();
+}
+
+Client::Client(DatabaseController *database, const SessionTickets *tickets, QWebSocket *websocket, QObject *parent) :
 	QObject(parent),
 	_catStr(),
 	_logCat(new QLoggingCategory("client.unknown")),
 	_database(database),
+	_tickets(tickets),
 	_socket(websocket),
 	_idleTimer(nullptr),
+	_ackTimer(nullptr),
 	_uploadLimit(10),
 	_downLimit(20),
 	_downThreshold(10),
-	_queue(new SingleTaskQueue(qApp->threadPool(), this)),
+	_prefetchLimit(200),
+	_prefetchSize(1048576), //1MB
+	_sendBuffer(1048576), //1MB
+	_sendBufferTotal(268435456), //256MB
+	_pendingBytes(0),
+	_bufferedBytes(0),
+	_sendPaused(0),
+	_waitsForTotal(false),
+	_strand(qApp->executor()->createStrand()),
+	_prefetchStrand(qApp->executor()->createStrand()),
 	_state(Authenticating),
 	_deviceId(),
 	_loginNonce(),
 	_cachedChanges(0),
-	_activeDownloads()
+	_activeDownloads(),
+	_lastDownload(0),
+	_prefetched(),
+	_changeSize(1024),
+	_prefetchExhausted(false),
+	_prefetchQueued(false),
+	_prefetchEpoch(0),
+	_pendingAcks(),
+	_pausedForceUpdate(false),
+	_pausedSkipNoChanges(false)
 {
 	_socket->setParent(this);
 
@@ -102,10 +164,16 @@ Client::Client(DatabaseController *database, QWebSocket *websocket, QObject *par
 			this, &Client::error);
 	connect(_socket, &QWebSocket::sslErrors,
 			this, &Client::sslErrors);
+	connect(_socket, &QWebSocket::bytesWritten,
+			this, &Client::bytesWritten);
 
 	_uploadLimit = qApp->configuration()->value(QStringLiteral("server/uploads/limit"), _uploadLimit).toUInt();
 	_downLimit = qApp->configuration()->value(QStringLiteral("server/downloads/limit"), _downLimit).toUInt();
 	_downThreshold = qApp->configuration()->value(QStringLiteral("server/downloads/threshold"), _downThreshold).toUInt();
+	_prefetchLimit = qApp->configuration()->value(QStringLiteral("server/downloads/prefetch"), _prefetchLimit).toUInt();
+	_prefetchSize = qApp->configuration()->value(QStringLiteral("server/downloads/prefetchSize"), _prefetchSize).toLongLong();
+	_sendBuffer = qApp->configuration()->value(QStringLiteral("server/sendBuffer"), _sendBuffer).toLongLong();
+	_sendBufferTotal = qApp->configuration()->value(QStringLiteral("server/sendBuffer/total"), _sendBufferTotal).toLongLong();
 	auto idleTimeout = qApp->configuration()->value(QStringLiteral("server/idleTimeout"), 5).toInt();
 	if(idleTimeout > 0) {
 		_idleTimer = new QTimer(this);
@@ -116,15 +184,36 @@ Client::Client(DatabaseController *database, QWebSocket *websocket, QObject *par
 				this, &Client::timeout);
 		_idleTimer->start();
 	}
+	auto ackWindow = qApp->configuration()->value(QStringLiteral("server/acks/window"), 50).toInt();
+	if(ackWindow > 0) {
+		_ackTimer = new QTimer(this);
+		_ackTimer->setInterval(ackWindow);
+		_ackTimer->setTimerType(Qt::PreciseTimer);
+		_ackTimer->setSingleShot(true);
+		connect(_ackTimer, &QTimer::timeout,
+				this, &Client::ackTimeout);
+	}
 
 	run([this]() {
 		//initialize connection by sending indent message
-		auto msg = IdentifyMessage::createRandom(_uploadLimit, rngPool.localData());
-		_loginNonce = msg.nonce;
-		sendMessage(msg);
+		sendIdentify();
 	});
 }
 
+Client::~Client()
+{
+	//only blocks if destroyed without being closed first
+	_strand->close();
+	_prefetchStrand->close();
+	_strand->waitForDone();
+	_prefetchStrand->waitForDone();
+	//messages that were not sent anymore
+	queuedBytes()->sub(_pendingBytes.load() + _bufferedBytes.load());
+	if(_waitsForTotal)
+		sendResumer->resume();
+	sendResumer->written(_sendBufferTotal);
+}
+
 void Client::dropConnection()
 {
 	_socket->close();
@@ -205,7 +294,12 @@ void Client::binaryMessageReceived(const QByteArray &message)
 		return;
 	}
 
-	run([message, this]() {
+	QElapsedTimer waitTimer;
+	waitTimer.start();
+	run([message, waitTimer, this]() {
+		static auto waitLatency = qApp->metrics()->histogram("qdsapp_message_wait_seconds",
+															 "Time received messages wait until their client is free to handle them");
+		waitLatency->observe(waitTimer.nsecsElapsed());
 		if(_state == Error)
 			return;
 
@@ -218,10 +312,13 @@ void Client::binaryMessageReceived(const QByteArray &message)
 			if(!stream.commitTransaction())
 				throw DataStreamException(stream);
 
+			Metrics::Timer timer(messageLatency(name));
 			if(Message::isType<RegisterMessage>(name))
 				onRegister(Message::deserializeMessage<RegisterMessage>(stream), stream);
 			else if(Message::isType<LoginMessage>(name))
 				onLogin(Message::deserializeMessage<LoginMessage>(stream), stream);
+			else if(Message::isType<ResumeMessage>(name))
+				onResume(Message::deserializeMessage<ResumeMessage>(stream));
 			else if(Message::isType<AccessMessage>(name))
 				onAccess(Message::deserializeMessage<AccessMessage>(stream), stream);
 			else if(Message::isType<SyncMessage>(name))
@@ -232,6 +329,8 @@ void Client::binaryMessageReceived(const QByteArray &message)
 				onDeviceChange(Message::deserializeMessage<DeviceChangeMessage>(stream));
 			else if(Message::isType<ChangedAckMessage>(name))
 				onChangedAck(Message::deserializeMessage<ChangedAckMessage>(stream));
+			else if(Message::isType<ChangedAckBatchMessage>(name))
+				onChangedAckBatch(Message::deserializeMessage<ChangedAckBatchMessage>(stream));
 			else if(Message::isType<ListDevicesMessage>(name))
 				onListDevices(Message::deserializeMessage<ListDevicesMessage>(stream));
 			else if(Message::isType<RemoveMessage>(name))
@@ -287,20 +386,23 @@ void Client::sslErrors(const QList<QSslError> &errors)
 
 void Client::closeClient()
 {
-	if(_queue->clear()) {//save close -> delete only if no parallel stuff anymore (check every 5s)
-		qDebug() << "Client disconnected";
-		deleteLater();
-	} else {
-		auto destroyTimer = new QTimer(this);
-		destroyTimer->setTimerType(Qt::VeryCoarseTimer);
-		connect(destroyTimer, &QTimer::timeout, this, [this](){
-			if(_queue->isFinished()) {
-				qDebug() << "Client disconnected";
-				deleteLater();
+	//save close -> the connector deletes the client once the running task is done, all others are dropped
+	_strand->close([this]() {
+		//complete the acks of the current window, or the changes would be sent again after a reconnect
+		if(!_pendingAcks.isEmpty()) {
+			try {
+				_database->completeChanges(_deviceId, _pendingAcks);
+			} catch (DatabaseException &e) {
+				qWarning() << "Failed to complete the acks of a closed client with error:" << e.what();
 			}
+			_pendingAcks.clear();
+		}
+		//wait for a running prefetch as well, it still uses the client
+		_prefetchStrand->close([this]() {
+			qDebug() << "Client disconnected";
+			emit closed(_deviceId);
 		});
-		destroyTimer->start(scdtime(seconds(5)));
-	}
+	});
 }
 
 void Client::timeout()
@@ -310,9 +412,57 @@ void Client::timeout()
 	_socket->close();
 }
 
+void Client::ackTimeout()
+{
+	run([this]() {
+		if(_state == Idle)
+			completeAcks();
+	});
+}
+
+void Client::bytesWritten()
+{
+	updateBuffered();
+	if(_sendPaused.load())
+		checkResume();
+	sendResumer->written(_sendBufferTotal);
+}
+
+void Client::checkResume()
+{
+	if(!_sendPaused.load())
+		return;
+
+	//only resume once half of the budget was written, to not pause again right away
+	if(isSendBlocked(2)) {
+		//the own socket only reports its own writes, the server wide buffer is written by all clients
+		if(!_waitsForTotal && !isSendBlocked(2, false)) {
+			_waitsForTotal = true;
+			connect(sendResumer(), &SendResumer::resumed,
+					this, &Client::checkResume);
+			sendResumer->pause();
+			//in case the others wrote it before this client was registered
+			QMetaObject::invokeMethod(this, "checkResume", Qt::QueuedConnection);
+		}
+		return;
+	}
+
+	_sendPaused.store(0);
+	if(_waitsForTotal) {
+		_waitsForTotal = false;
+		disconnect(sendResumer(), &SendResumer::resumed,
+				   this, &Client::checkResume);
+		sendResumer->resume();
+	}
+	run([this]() {
+		if(_state == Idle)
+			triggerDownload(_pausedForceUpdate, _pausedSkipNoChanges);
+	});
+}
+
 void Client::run(const function<void ()> &fn)
 {
-	_queue->enqueue([fn, this]() {
+	_strand->enqueue([fn, this]() {
 		//TODO "log" (hashed) ip on error? to allow blocking???
 		try {
 			fn();
@@ -356,8 +506,23 @@ void Client::closeLater()
 
 void Client::sendMessage(const Message &message)
 {
+	auto data = message.serialize();
+	_pendingBytes.fetchAndAddOrdered(data.size());
+	queuedBytes()->add(data.size());
+	static auto sentBytes = qApp->metrics()->counter("qdsapp_sent_bytes_total",
+													 "Number of bytes of all messages sent to clients");
+	sentBytes->add(static_cast<quint64>(data.size()));
+	auto name = message.messageName();
+	auto sentCounter = _sentCounters.value(name);
+	if(!sentCounter) {
+		sentCounter = qApp->metrics()->counter("qdsapp_messages_sent_total",
+											   "Number of messages sent to clients",
+											   {{"type", name}});
+		_sentCounters.insert(name, sentCounter);
+	}
+	sentCounter->add();
 	QMetaObject::invokeMethod(this, "doSend", Qt::QueuedConnection,
-							  Q_ARG(QByteArray, message.serialize()));
+							  Q_ARG(QByteArray, data));
 }
 
 void Client::sendError(const ErrorMessage &message)
@@ -369,7 +534,28 @@ void Client::sendError(const ErrorMessage &message)
 
 void Client::doSend(const QByteArray &message)
 {
+	_pendingBytes.fetchAndSubOrdered(message.size());
+	queuedBytes()->sub(message.size());
 	_socket->sendBinaryMessage(message);
+	updateBuffered();
+}
+
+bool Client::isSendBlocked(qint64 divisor, bool total) const
+{
+	if(_sendBuffer > 0 &&
+	   _pendingBytes.load() + _bufferedBytes.load() > _sendBuffer / divisor)
+		return true;
+	if(total &&
+	   _sendBufferTotal > 0 &&
+	   queuedBytes()->value() > _sendBufferTotal / divisor)
+		return true;
+	return false;
+}
+
+void Client::updateBuffered()
+{
+	auto buffered = _socket->bytesToWrite();
+	queuedBytes()->add(buffered - _bufferedBytes.fetchAndStoreOrdered(buffered));
 }
 
 void Client::onRegister(const RegisterMessage &message, QDataStream &stream)
@@ -414,8 +600,9 @@ void Client::onLogin(const LoginMessage &message, QDataStream &stream)
 	_loginNonce.clear();
 
 	//load public key to verify signature
+	QScopedPointer<AsymmetricCryptoInfo> crypto;
 	try {
-		QScopedPointer<AsymmetricCryptoInfo> crypto(_database->loadCrypto(message.deviceId, rngPool.localData()));
+		crypto.reset(_database->loadCrypto(message.deviceId, rngPool.localData()));
 		if(!crypto)
 			throw ClientErrorException(ErrorMessage::AuthenticationError);
 		Message::verifySignature(stream, crypto->signatureKey(), crypto.data());
@@ -428,20 +615,33 @@ void Client::onLogin(const LoginMessage &message, QDataStream &stream)
 	_catStr = "client." + _deviceId.toByteArray();
 	_logCat.reset(new QLoggingCategory(_catStr.constData()));
 
-	_database->updateLogin(_deviceId, message.deviceName);
-	qDebug() << "Device successfully logged in";
+	//only clients that know about tickets can receive them
+	completeLogin(message.deviceName,
+				  message.protocolVersion >= ResumeMessage::MinimumVersion ? crypto.data() : nullptr);
+}
 
-	//load changecount early to find out if data changed
-	_cachedChanges = _database->changeCount(_deviceId);
-	WelcomeMessage reply(_cachedChanges > 0);
-	tie(reply.keyIndex, reply.scheme, reply.key, reply.cmac) = _database->loadKeyChanges(_deviceId);
-	sendMessage(reply);
-	_state = Idle;
-	emit connected(_deviceId);
+void Client::onResume(const ResumeMessage &message)
+{
+	if(_state != Authenticating)
+		throw UnexpectedException<ResumeMessage>();
+	if(_loginNonce != message.nonce)
+		throw MessageException("Invalid nonce in ResumeMessage");
+	_loginNonce.clear();
 
-	// send changed, always send info msg first, because count was preloaded (no force)
-	// in case of no changes, send nothing if no changes
-	triggerDownload(true, _cachedChanges == 0);
+	//verify ticket and proof of the session secret, without any database access
+	auto secret = _tickets->verify(message.ticket, message.deviceId);
+	if(secret.isEmpty() || !message.verify(secret)) {
+		//fall back to the full login in the same connection
+		qDebug() << "Rejected invalid or expired session ticket";
+		sendIdentify();
+		return;
+	}
+
+	_deviceId = message.deviceId;
+	_catStr = "client." + _deviceId.toByteArray();
+	_logCat.reset(new QLoggingCategory(_catStr.constData()));
+
+	completeLogin(message.deviceName);
 }
 
 void Client::onAccess(const AccessMessage &message, QDataStream &stream)
@@ -511,11 +711,13 @@ void Client::onDeviceChange(const DeviceChangeMessage &message)
 void Client::onChangedAck(const ChangedAckMessage &message)
 {
 	checkIdle(message);
+	queueAcks({message.dataIndex});
+}
 
-	_database->completeChange(_deviceId, message.dataIndex);
-	_activeDownloads.removeOne(message.dataIndex);
-	//trigger next download. method itself decides when and how etc.
-	triggerDownload();
+void Client::onChangedAckBatch(const ChangedAckBatchMessage &message)
+{
+	checkIdle(message);
+	queueAcks(message.dataIndexes);
 }
 
 void Client::onListDevices(const ListDevicesMessage &message)
@@ -535,6 +737,7 @@ void Client::onRemove(const RemoveMessage &message)
 	checkIdle(message);
 
 	_database->removeDevice(_deviceId, message.deviceId);
+	clearPrefetch(); //might contain changes of the removed device
 	sendMessage(RemoveAckMessage{message.deviceId});
 	if(_deviceId == message.deviceId) {
 		qDebug() << "Removed self from account";
@@ -617,6 +820,7 @@ void Client::onNewKey(const NewKeyMessage &message, QDataStream &stream)
 										  message.cmac,
 										  message.deviceKeys);
 	if(ok) {
+		clearPrefetch();
 		for(auto info : message.deviceKeys)
 			emit forceDisconnect(get<0>(info));
 		sendMessage(NewKeyAckMessage{message});
@@ -624,14 +828,98 @@ void Client::onNewKey(const NewKeyMessage &message, QDataStream &stream)
 		sendError(ErrorMessage::KeyIndexError);
 }
 
+void Client::sendIdentify()
+{
+	auto msg = IdentifyMessage::createRandom(_uploadLimit, rngPool.localData());
+	_loginNonce = msg.nonce;
+	sendMessage(msg);
+}
+
+void Client::completeLogin(const QString &deviceName, AsymmetricCryptoInfo *ticketCrypto)
+{
+	//the device might have been removed since the ticket was issued
+	if(!_database->updateLogin(_deviceId, deviceName))
+		throw ClientErrorException(ErrorMessage::AuthenticationError);
+	qDebug() << "Device successfully logged in";
+
+	//load changecount early to find out if data changed
+	_cachedChanges = _database->changeCount(_deviceId);
+	WelcomeMessage reply(_cachedChanges > 0);
+	tie(reply.keyIndex, reply.scheme, reply.key, reply.cmac) = _database->loadKeyChanges(_deviceId);
+	sendMessage(reply);
+	_state = Idle;
+	emit connected(_deviceId);
+
+	//hand out a ticket so the next reconnect can skip the signature based login
+	if(ticketCrypto && _tickets->isEnabled()) {
+		QByteArray ticket;
+		QByteArray secret;
+		tie(ticket, secret) = _tickets->issue(_deviceId);
+		sendMessage(ResumeTicketMessage {
+						ticket,
+						ticketCrypto->encrypt(rngPool.localData(), secret)
+					});
+	}
+
+	// send changed, always send info msg first, because count was preloaded (no force)
+	// in case of no changes, send nothing if no changes
+	triggerDownload(true, _cachedChanges == 0);
+}
+
+void Client::queueAcks(const QList<quint64> &dataIndexes)
+{
+	auto startWindow = _pendingAcks.isEmpty();
+	_pendingAcks.append(dataIndexes);
+	for(auto dataIndex : dataIndexes)
+		_activeDownloads.removeOne(dataIndex);
+
+	//complete at once if new downloads can be sent or all are done, otherwise wait for more acks
+	if(!_ackTimer ||
+	   _activeDownloads.isEmpty() ||
+	   _downLimit - _activeDownloads.size() >= _downThreshold)
+		completeAcks();
+	else if(startWindow)
+		QMetaObject::invokeMethod(_ackTimer, "start", Qt::QueuedConnection);
+}
+
+void Client::completeAcks()
+{
+	if(_pendingAcks.isEmpty())
+		return;
+
+	_database->completeChanges(_deviceId, _pendingAcks);
+	_pendingAcks.clear();
+	//trigger next download. method itself decides when and how etc.
+	triggerDownload();
+}
+
 void Client::triggerDownload(bool forceUpdate, bool skipNoChanges)
 {
+	//do not load more changes than the client can receive, they would only pile up in memory
+	if(isSendBlocked()) {
+		_pausedForceUpdate = _pausedForceUpdate || forceUpdate;
+		_pausedSkipNoChanges = skipNoChanges;
+		if(_sendPaused.testAndSetOrdered(0, 1)) {
+			static auto pauses = qApp->metrics()->counter("qdsapp_send_paused_total",
+														  "Number of times downloads were paused, because too much data was queued for a client or the server");
+			pauses->add();
+			qDebug() << "Pausing downloads until queued messages were sent";
+			QMetaObject::invokeMethod(this, "checkResume", Qt::QueuedConnection);
+		}
+		return;
+	}
+	forceUpdate = forceUpdate || _pausedForceUpdate;
+	_pausedForceUpdate = false;
+
 	auto updateChange = forceUpdate;
 
 	auto cnt = _downLimit - _activeDownloads.size();
 	if(cnt >= _downThreshold) {
-		auto changes = _database->loadNextChanges(_deviceId, cnt, _activeDownloads.size());
-		for(auto change : changes) {
+		//only query the database if the buffer cannot fill the window
+		if(static_cast<quint32>(_prefetched.size()) < cnt)
+			prefetchChanges(cnt - static_cast<quint32>(_prefetched.size()));
+		for(quint32 i = 0; i < cnt && !_prefetched.isEmpty(); i++) {
+			auto change = _prefetched.dequeue();
 			if(_cachedChanges == 0) {
 				updateChange = true;
 				_cachedChanges = _database->changeCount(_deviceId) - _activeDownloads.size();
@@ -650,6 +938,22 @@ void Client::triggerDownload(bool forceUpdate, bool skipNoChanges)
 			_activeDownloads.append(get<0>(change));
 			_cachedChanges--;
 		}
+
+		//load the next batch while this window is in flight
+		if(_prefetchLimit > 0 &&
+		   !_prefetchExhausted &&
+		   !_prefetchQueued &&
+		   static_cast<quint32>(_prefetched.size()) < _downLimit)
+			prefetchAsync(_downLimit - static_cast<quint32>(_prefetched.size()));
+	}
+
+	//ids are not commited in order, so a change below the last index can show up late. Once
+	//everything sent was acked, rescan from the start (cheap, as completed changes are deleted)
+	if(_activeDownloads.isEmpty() && _prefetched.isEmpty() && _lastDownload != 0) {
+		_lastDownload = 0;
+		_prefetchEpoch++;
+		triggerDownload(forceUpdate, skipNoChanges);
+		return;
 	}
 
 	if(_activeDownloads.isEmpty() && !skipNoChanges) {
@@ -658,6 +962,78 @@ void Client::triggerDownload(bool forceUpdate, bool skipNoChanges)
 	}
 }
 
+void Client::prefetchChanges(quint32 minCount)
+{
+	auto count = prefetchCount(minCount);
+	storePrefetch(_database->loadNextChanges(_deviceId, count, _lastDownload), count);
+}
+
+void Client::prefetchAsync(quint32 minCount)
+{
+	//the query runs on the prefetch strand, so acks and uploads of this client are not blocked by it
+	_prefetchQueued = true;
+	auto count = prefetchCount(minCount);
+	auto deviceId = _deviceId;
+	auto lastIndex = _lastDownload;
+	auto epoch = _prefetchEpoch;
+	_prefetchStrand->enqueue([this, deviceId, count, lastIndex, epoch]() {
+		QList<std::tuple<quint64, quint32, QByteArray, QByteArray>> changes;
+		auto ok = true;
+		try {
+			changes = _database->loadNextChanges(deviceId, count, lastIndex);
+		} catch (DatabaseException &e) {
+			qWarning() << "Failed to prefetch changes with error:" << e.what();
+			ok = false;
+		}
+
+		//back on the client strand, where the buffer may be modified
+		run([this, changes, count, lastIndex, epoch, ok]() {
+			_prefetchQueued = false;
+			//dropped if the buffer was cleared or loaded in the meantime, as it would be outdated or overlap
+			if(ok &&
+			   _state == Idle &&
+			   epoch == _prefetchEpoch &&
+			   lastIndex == _lastDownload)
+				storePrefetch(changes, count);
+		});
+	});
+}
+
+quint32 Client::prefetchCount(quint32 minCount) const
+{
+	//load as many changes as fit into the prefetch size, based on the size of the previous ones
+	if(_prefetchLimit > minCount) {
+		return static_cast<quint32>(qBound<qint64>(minCount,
+												   _prefetchSize / _changeSize,
+												   _prefetchLimit));
+	} else
+		return minCount;
+}
+
+void Client::storePrefetch(const QList<std::tuple<quint64, quint32, QByteArray, QByteArray>> &changes, quint32 count)
+{
+	qint64 size = 0;
+	for(const auto &change : changes) {
+		size += get<3>(change).size();
+		_lastDownload = get<0>(change);
+		_prefetched.enqueue(change);
+	}
+	if(!changes.isEmpty())
+		_changeSize = qMax<qint64>(size / changes.size(), 1);
+	_prefetchExhausted = static_cast<quint32>(changes.size()) < count;
+}
+
+void Client::clearPrefetch()
+{
+	//changes that were not sent yet are loaded again, to not send outdated data
+	if(!_prefetched.isEmpty()) {
+		_lastDownload = get<0>(_prefetched.head()) - 1;
+		_prefetched.clear();
+	}
+	_prefetchExhausted = false;
+	_prefetchEpoch++;
+}
+
 // ------------- Exceptions Implementation -------------
 
 MessageException::MessageException(const QByteArray &message) :
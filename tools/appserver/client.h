@@ -10,15 +10,19 @@
 #include <QtCore/QThreadStorage>
 #include <QtCore/QMutex>
 #include <QtCore/QHash>
+#include <QtCore/QQueue>
 #include <QtCore/QLoggingCategory>
 #include <QtCore/QTimer>
+#include <QtCore/QAtomicInteger>
 
 #include <QtWebSockets/QWebSocket>
 
 #include <cryptopp/osrng.h>
 
 #include "databasecontroller.h"
-#include "singletaskqueue.h"
+#include "strandexecutor.h"
+#include "metrics.h"
+#include "sessiontickets.h"
 
 #include "errormessage_p.h"
 #include "registermessage_p.h"
@@ -34,6 +38,24 @@
 #include "macupdatemessage_p.h"
 #include "keychangemessage_p.h"
 #include "newkeymessage_p.h"
+#include "resumemessage_p.h"
+
+//wakes up the clients that wait for the server wide send buffer, once the other clients wrote enough of it
+class SendResumer : public QObject
+{
+	Q_OBJECT
+
+public:
+	void pause();
+	void resume();
+	void written(qint64 limit);
+
+Q_SIGNALS:
+	void resumed();
+
+private:
+	QAtomicInt _paused;
+};
 
 class Client : public QObject
 {
@@ -48,7 +70,8 @@ public:
 	};
 	Q_ENUM(State)
 
-	explicit Client(DatabaseController *_database, QWebSocket *websocket, QObject *parent = nullptr);
+	explicit Client(DatabaseController *_database, const SessionTickets *tickets, QWebSocket *websocket, QObject *parent = nullptr);
+	~Client() override;
 
 public Q_SLOTS:
 	void dropConnection();
@@ -62,6 +85,7 @@ Q_SIGNALS:
 	void proofRequested(const QUuid &partner, const QtDataSync::ProofMessage &message);
 	void proofDone(const QUuid &partner, bool success, const QtDataSync::AcceptMessage& message = {});
 	void forceDisconnect(const QUuid &partner);
+	void closed(const QUuid &deviceId);
 
 private Q_SLOTS:
 	void binaryMessageReceived(const QByteArray &message);
@@ -69,6 +93,9 @@ private Q_SLOTS:
 	void sslErrors(const QList<QSslError> &errors);
 	void closeClient();
 	void timeout();
+	void ackTimeout();
+	void bytesWritten();
+	void checkResume();
 
 private:
 	//workaround because of alignment errors on msvc2015
@@ -91,16 +118,30 @@ private:
 
 	// "global" stuff
 	DatabaseController *_database; //is threadsafe
-	QWebSocket *_socket; //must only be accessed from the main thread
+	const SessionTickets *_tickets; //is threadsafe
+	QWebSocket *_socket; //must only be accessed from the thread of the client (an I/O thread)
 
 	// "constant" members, that wont change after the constructor
 	QTimer *_idleTimer;
+	QTimer *_ackTimer;
 	quint32 _uploadLimit;
 	quint32 _downLimit;
 	quint32 _downThreshold;
+	quint32 _prefetchLimit;
+	qint64 _prefetchSize;
+	qint64 _sendBuffer;
+	qint64 _sendBufferTotal;
+
+	//outbound bytes, that were queued for sending but not yet written to the network
+	QAtomicInteger<qint64> _pendingBytes; //serialized, but not yet passed to the socket
+	QAtomicInteger<qint64> _bufferedBytes; //buffered by the socket, updated on the thread of the client
+	QAtomicInt _sendPaused;
+	bool _waitsForTotal; //only accessed from the thread of the client
 
 	// thread safe task queue, ensures only 1 task per client is run at the same time
-	SingleTaskQueue *_queue;
+	QSharedPointer<StrandExecutor::Strand> _strand;
+	// second queue for prefetch queries, so they do not delay acks and uploads on the main one
+	QSharedPointer<StrandExecutor::Strand> _prefetchStrand;
 
 	//following members must only be accessed from within a task (to ensure thread safety)
 	State _state;
@@ -108,6 +149,16 @@ private:
 	QByteArray _loginNonce;
 	quint32 _cachedChanges;
 	QList<quint64> _activeDownloads;
+	quint64 _lastDownload; //of the changes loaded from the database, not the ones sent
+	QQueue<std::tuple<quint64, quint32, QByteArray, QByteArray>> _prefetched;
+	qint64 _changeSize;
+	bool _prefetchExhausted;
+	bool _prefetchQueued;
+	quint32 _prefetchEpoch; //changed whenever the prefetched changes are discarded
+	QList<quint64> _pendingAcks;
+	bool _pausedForceUpdate;
+	bool _pausedSkipNoChanges;
+	QHash<QByteArray, Metrics::Counter*> _sentCounters; //per message type, to not look them up for every message
 	//cached:
 	QtDataSync::AccessMessage _cachedAccessRequest;
 	QByteArray _cachedFingerPrint;
@@ -123,14 +174,18 @@ private:
 	void sendMessage(const QtDataSync::Message &message);
 	void sendError(const QtDataSync::ErrorMessage &message);
 	Q_INVOKABLE void doSend(const QByteArray &message);
+	bool isSendBlocked(qint64 divisor = 1, bool total = true) const;
+	void updateBuffered();
 
 	void onRegister(const QtDataSync::RegisterMessage &message, QDataStream &stream);
 	void onLogin(const QtDataSync::LoginMessage &message, QDataStream &stream);
+	void onResume(const QtDataSync::ResumeMessage &message);
 	void onAccess(const QtDataSync::AccessMessage &message, QDataStream &stream);
 	void onSync(const QtDataSync::SyncMessage &message);
 	void onChange(const QtDataSync::ChangeMessage &message);
 	void onDeviceChange(const QtDataSync::DeviceChangeMessage &message);
 	void onChangedAck(const QtDataSync::ChangedAckMessage &message);
+	void onChangedAckBatch(const QtDataSync::ChangedAckBatchMessage &message);
 	void onListDevices(const QtDataSync::ListDevicesMessage &message);
 	void onRemove(const QtDataSync::RemoveMessage &message);
 	void onAccept(const QtDataSync::AcceptMessage &message, QDataStream &stream);
@@ -139,7 +194,16 @@ private:
 	void onKeyChange(const QtDataSync::KeyChangeMessage &message);
 	void onNewKey(const QtDataSync::NewKeyMessage &message, QDataStream &stream);
 
+	void sendIdentify();
+	void completeLogin(const QString &deviceName, QtDataSync::AsymmetricCryptoInfo *ticketCrypto = nullptr);
+	void queueAcks(const QList<quint64> &dataIndexes);
+	void completeAcks();
 	void triggerDownload(bool forceUpdate = false, bool skipNoChanges = false);
+	void prefetchChanges(quint32 minCount);
+	void prefetchAsync(quint32 minCount);
+	quint32 prefetchCount(quint32 minCount) const;
+	void storePrefetch(const QList<std::tuple<quint64, quint32, QByteArray, QByteArray>> &changes, quint32 count);
+	void clearPrefetch();
 };
 
 #endif // CLIENT_H
@@ -1,6 +1,7 @@
 #include "clientconnector.h"
 #include <QFile>
 #include <QSslKey>
+#include <QTimer>
 #include <QWebSocket>
 #include <QWebSocketCorsAuthenticator>
 #include "app.h"
@@ -10,11 +11,24 @@ ClientConnector::ClientConnector(DatabaseController *database, QObject *parent)
 	database(database),
 	server(nullptr),
 	secret(),
-	clients()
+	tickets(),
+	ioThreads(),
+	nextIoThread(0),
+	clients(),
+	openClients(),
+	nextSerial(1),
+	cluster(new ClusterBus(database, this)),
+	clusterTimeout(qApp->configuration()->value(QStringLiteral("cluster/timeout"), 5000).toInt()),
+	remoteProofs(),
+	connectionCount(qApp->metrics()->counter("qdsapp_connections_total", "Number of accepted connections")),
+	activeConnections(qApp->metrics()->gauge("qdsapp_connections_active", "Number of open connections")),
+	wakeups(qApp->metrics()->counter("qdsapp_livesync_wakeups_total", "Number of connected clients woken up because of changes"))
 {
 	auto name = qApp->configuration()->value(QStringLiteral("server/name"), QCoreApplication::applicationName()).toString();
 	auto mode = qApp->configuration()->value(QStringLiteral("server/wss"), false).toBool() ? QWebSocketServer::SecureMode : QWebSocketServer::NonSecureMode;
 	secret = qApp->configuration()->value(QStringLiteral("server/secret")).toString();
+	CryptoPP::AutoSeededRandomPool rng;
+	tickets.reset(new SessionTickets(qApp->configuration(), rng));
 
 	server = new QWebSocketServer(name, mode, this);
 	connect(server, &QWebSocketServer::newConnection,
@@ -28,9 +42,45 @@ ClientConnector::ClientConnector(DatabaseController *database, QObject *parent)
 				this, &ClientConnector::verifySecret);
 	}
 
+	//the sockets are accepted on the main thread, but then handled by one of the I/O threads for their lifetime
+	auto ioCount = qApp->configuration()->value(QStringLiteral("threads/io"), QThread::idealThreadCount()).toInt();
+	for(auto i = 0; i < ioCount; i++) {
+		auto thread = new QThread(this);
+		thread->setObjectName(QStringLiteral("io-%1").arg(i));
+		thread->start();
+		ioThreads.append(thread);
+	}
+	qDebug() << "Running with" << ioThreads.size() << "I/O threads";
+
 	connect(database, &DatabaseController::notifyChanged,
 			this, &ClientConnector::notifyChanged,
 			Qt::QueuedConnection);
+
+	//proofs and disconnects for devices that are connected to other servers
+	connect(cluster, &ClusterBus::proofReceived,
+			this, &ClientConnector::remoteProofRequested);
+	connect(cluster, &ClusterBus::proofDelivered,
+			this, &ClientConnector::remoteProofDelivered);
+	connect(cluster, &ClusterBus::proofDone,
+			this, &ClientConnector::remoteProofDone);
+	connect(cluster, &ClusterBus::acceptDone,
+			this, &ClientConnector::remoteAcceptDone);
+	connect(cluster, &ClusterBus::disconnectRequested,
+			this, &ClientConnector::dropClient);
+
+	//scraped on the main thread, just like the clients are changed
+	qApp->metrics()->addGauge("qdsapp_clients_active", "Number of logged in devices", [this](){
+		return clients.size();
+	});
+}
+
+ClientConnector::~ClientConnector()
+{
+	//deletes all clients that are still open
+	for(auto thread : ioThreads)
+		thread->quit();
+	for(auto thread : ioThreads)
+		thread->wait();
 }
 
 bool ClientConnector::setupWss()
@@ -122,8 +172,10 @@ void ClientConnector::setPaused(bool paused)
 void ClientConnector::notifyChanged(const QUuid &deviceId)
 {
 	auto client = clients.value(deviceId);
-	if(client)
+	if(client) {
+		wakeups->add();
 		client->notifyChanged();
+	}
 }
 
 void ClientConnector::verifySecret(QWebSocketCorsAuthenticator *authenticator)
@@ -138,11 +190,30 @@ void ClientConnector::newConnection()
 {
 	while (server->hasPendingConnections()) {
 		auto socket = server->nextPendingConnection();
-		auto client = new Client(database, socket, this);
+		auto ioThread = ioThreads.isEmpty() ? nullptr : ioThreads[nextIoThread++ % ioThreads.size()];
+		auto client = new Client(database, tickets.data(), socket, ioThread ? nullptr : this);
+		openClients.insert(client, nextSerial++);
+		if(ioThread) {
+			//moves the socket and the timers of the client as well. This is safe, even though the socket comes from
+			//the server of this thread: the client took it over as parent, so the server has no reference to it
+			//anymore, and the handshake is already done. Nothing uses the socket on this thread after the move, and
+			//moveToThread moves its socket notifiers to the event loop of the I/O thread
+			client->moveToThread(ioThread);
+			connect(ioThread, &QThread::finished,
+					client, &Client::deleteLater);
+		}
+		connectionCount->add();
+		activeConnections->add();
+		connect(client, &Client::destroyed, this, [this](){
+			activeConnections->sub();
+		}, Qt::DirectConnection);
 		//queued is needed because they are emitted from threads
 		connect(client, &Client::connected,
 				this, &ClientConnector::clientConnected,
 				Qt::QueuedConnection);
+		connect(client, &Client::closed,
+				this, &ClientConnector::clientClosed,
+				Qt::QueuedConnection);
 		connect(client, &Client::proofRequested,
 				this, &ClientConnector::proofRequested,
 				Qt::QueuedConnection);
@@ -175,9 +246,21 @@ void ClientConnector::clientConnected(const QUuid &deviceId)
 	connect(client, &Client::forceDisconnect,
 			this, &ClientConnector::forceDisconnect,
 			Qt::QueuedConnection);
-	connect(client, &Client::destroyed, this, [this, deviceId](){
+}
+
+void ClientConnector::clientClosed(const QUuid &deviceId)
+{
+	auto client = qobject_cast<Client*>(sender());
+	if(!client)
+		return;
+
+	//only deleted from here, as the client may live in an I/O thread, but is looked up on the main thread
+	openClients.remove(client);
+	if(!deviceId.isNull() && clients.value(deviceId) == client)
 		clients.remove(deviceId);
-	});
+	if(!deviceId.isNull() && remoteProofs.value(deviceId).client == client)
+		remoteProofs.remove(deviceId);
+	client->deleteLater();
 }
 
 void ClientConnector::proofRequested(const QUuid &partner, const QtDataSync::ProofMessage &message)
@@ -186,26 +269,51 @@ void ClientConnector::proofRequested(const QUuid &partner, const QtDataSync::Pro
 	if(!client)
 		return;
 
-	QPointer<Client> pClient = clients.value(partner);
-	if(!pClient)
-		client->proofResult(false);
-	else {
+	auto pClient = clients.value(partner);
+	auto serial = openClients.value(client);
+	if(!pClient) {
+		//the partner may be connected to another server of the cluster
+		auto devId = message.deviceId;
+		if(cluster->sendProof(partner, message)) {
+			remoteProofs.insert(devId, {client, serial, partner, false});
+			QTimer::singleShot(clusterTimeout, this, [this, devId]() {
+				auto it = remoteProofs.find(devId);
+				if(it != remoteProofs.end() && !it->delivered) {
+					auto pending = *it;
+					remoteProofs.erase(it);
+					if(isOpen(pending.client, pending.serial))
+						pending.client->proofResult(false);
+				}
+			});
+		} else
+			client->proofResult(false);
+	} else {
+		// handled on the main thread, like remote proofs. The context is deleted once the proof is done, or with either client
 		auto devId = message.deviceId;
+		auto pending = client;
+		auto context = new QObject(this);
+		connect(client, &Client::destroyed,
+				context, &QObject::deleteLater);
+		connect(pClient, &Client::destroyed,
+				context, &QObject::deleteLater);
 		connect(pClient, &Client::proofDone,
-				client, [devId, pClient, client](const QUuid &partner, bool success, const QtDataSync::AcceptMessage &message) {
-			if(devId == partner) {
-				if(pClient) {
-					// remove this connections
-					pClient->disconnect(client);
-					// once client was added, notify pClient so he can ack the accept
-					connect(client, &Client::connected,
-							pClient, [pClient](const QUuid &accPartner) {
-						pClient->acceptDone(accPartner);
+				context, [this, context, devId, partner, pending, serial](const QUuid &proofPartner, bool success, const QtDataSync::AcceptMessage &message) {
+			if(devId == proofPartner) {
+				context->deleteLater();
+				if(!isOpen(pending, serial))
+					return;
+				if(success) {
+					// once client was added, notify the partner so he can ack the accept
+					connect(pending, &Client::connected,
+							this, [this, partner](const QUuid &accPartner) {
+						auto partnerClient = clients.value(partner);
+						if(partnerClient)
+							partnerClient->acceptDone(accPartner);
 						//no disconnect needed, single time emit
 					}, Qt::QueuedConnection);
 				}
 				// pass message on to client
-				client->proofResult(success, message);
+				pending->proofResult(success, message);
 			}
 		}, Qt::QueuedConnection);
 		pClient->sendProof(message);
@@ -214,7 +322,75 @@ void ClientConnector::proofRequested(const QUuid &partner, const QtDataSync::Pro
 
 void ClientConnector::forceDisconnect(const QUuid &partner)
 {
-	auto client = clients.value(partner);
+	dropClient(partner);
+	//the device may be connected to another server of the cluster
+	cluster->sendDisconnect(partner);
+}
+
+void ClientConnector::remoteProofRequested(const QUuid &node, const QUuid &partner, const QtDataSync::ProofMessage &message)
+{
+	auto pClient = clients.value(partner);
+	if(!pClient)
+		return; //connected to another server, or not at all
+	cluster->sendProofDelivered(node, message.deviceId);
+
+	// the context is deleted once the proof is done, or with the partner
+	auto devId = message.deviceId;
+	auto context = new QObject(this);
+	connect(pClient, &Client::destroyed,
+			context, &QObject::deleteLater);
+	connect(pClient, &Client::proofDone,
+			context, [this, context, node, devId](const QUuid &partner, bool success, const QtDataSync::AcceptMessage &message) {
+		if(devId == partner) {
+			context->deleteLater();
+			cluster->sendProofDone(node, devId, success, message);
+		}
+	}, Qt::QueuedConnection);
+	pClient->sendProof(message);
+}
+
+void ClientConnector::remoteProofDelivered(const QUuid &deviceId)
+{
+	auto it = remoteProofs.find(deviceId);
+	if(it != remoteProofs.end())
+		it->delivered = true;
+}
+
+void ClientConnector::remoteProofDone(const QUuid &node, const QUuid &deviceId, bool success, const QtDataSync::AcceptMessage &message)
+{
+	if(!remoteProofs.contains(deviceId))
+		return;
+	auto proof = remoteProofs.take(deviceId);
+	if(!isOpen(proof.client, proof.serial))
+		return;
+
+	if(success) {
+		// once client was added, notify the server of the partner so he can ack the accept
+		auto partner = proof.partner;
+		connect(proof.client, &Client::connected,
+				this, [this, node, partner](const QUuid &accPartner) {
+			cluster->sendAcceptDone(node, partner, accPartner);
+			//no disconnect needed, single time emit
+		}, Qt::QueuedConnection);
+	}
+	proof.client->proofResult(success, message);
+}
+
+void ClientConnector::remoteAcceptDone(const QUuid &partner, const QUuid &deviceId)
+{
+	auto pClient = clients.value(partner);
+	if(pClient)
+		pClient->acceptDone(deviceId);
+}
+
+void ClientConnector::dropClient(const QUuid &deviceId)
+{
+	auto client = clients.value(deviceId);
 	if(client)
-		client->dropConnection();
+		QMetaObject::invokeMethod(client, "dropConnection");
+}
+
+bool ClientConnector::isOpen(Client *client, quint64 serial) const
+{
+	return serial != 0 && openClients.value(client) == serial;
 }
@@ -2,9 +2,13 @@
 #define CLIENTCONNECTOR_H
 
 #include "client.h"
+#include "clusterbus.h"
 #include "databasecontroller.h"
+#include "sessiontickets.h"
+#include "metrics.h"
 
 #include <QObject>
+#include <QThread>
 #include <QWebSocketServer>
 
 class ClientConnector : public QObject
@@ -12,6 +16,7 @@ class ClientConnector : public QObject
 	Q_OBJECT
 public:
 	explicit ClientConnector(DatabaseController *database, QObject *parent = nullptr);
+	~ClientConnector() override;
 
 	bool setupWss();
 	bool listen();
@@ -32,15 +37,46 @@ private Q_SLOTS:
 	void sslErrors(const QList<QSslError> &errors);
 
 	void clientConnected(const QUuid &deviceId);
+	void clientClosed(const QUuid &deviceId);
 	void proofRequested(const QUuid &partner, const QtDataSync::ProofMessage &message);
 	void forceDisconnect(const QUuid &partner);
 
+	void remoteProofRequested(const QUuid &node, const QUuid &partner, const QtDataSync::ProofMessage &message);
+	void remoteProofDelivered(const QUuid &deviceId);
+	void remoteProofDone(const QUuid &node, const QUuid &deviceId, bool success, const QtDataSync::AcceptMessage &message);
+	void remoteAcceptDone(const QUuid &partner, const QUuid &deviceId);
+	void dropClient(const QUuid &deviceId);
+
 private:
+	//a proof of a local client, that was sent to a partner on another server
+	struct RemoteProof {
+		Client *client;
+		quint64 serial;
+		QUuid partner;
+		bool delivered;
+	};
+
 	DatabaseController *database;
 	QWebSocketServer *server;
 	QString secret;
+	QScopedPointer<SessionTickets> tickets;
+	QList<QThread*> ioThreads;
+	int nextIoThread;
 
 	QHash<QUuid, Client*> clients;
+	//all clients that were not closed yet, with a serial to detect reused addresses
+	//clients are deleted on their I/O threads, but only after clientClosed removed them, so the main thread can rely on it
+	QHash<Client*, quint64> openClients;
+	quint64 nextSerial;
+	ClusterBus *cluster;
+	int clusterTimeout;
+	QHash<QUuid, RemoteProof> remoteProofs; //by the id of the new device
+
+	Metrics::Counter *connectionCount;
+	Metrics::Gauge *activeConnections;
+	Metrics::Counter *wakeups;
+
+	bool isOpen(Client *client, quint64 serial) const;
 };
 
 #endif // CLIENTCONNECTOR_H
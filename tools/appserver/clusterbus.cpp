@@ -0,0 +1,157 @@
+#include "clusterbus.h"
+#include "app.h"
+
+using namespace QtDataSync;
+
+ClusterBus::ClusterBus(DatabaseController *database, QObject *parent) :
+	QObject(parent),
+	_database(database),
+	_enabled(qApp->configuration()->value(QStringLiteral("cluster"), false).toBool()),
+	_nodeId(QUuid::createUuid()),
+	_sentEvents(qApp->metrics()->counter("qdsapp_cluster_events_total", "Number of events exchanged with other servers", {{"direction", "sent"}})),
+	_receivedEvents(qApp->metrics()->counter("qdsapp_cluster_events_total", "Number of events exchanged with other servers", {{"direction", "received"}}))
+{
+	if(_enabled) {
+		connect(_database, &DatabaseController::eventReceived,
+				this, &ClusterBus::eventReceived,
+				Qt::QueuedConnection);
+		qInfo() << "Cluster enabled as node" << _nodeId;
+	} else
+		qInfo() << "Cluster disabled";
+}
+
+bool ClusterBus::isEnabled() const
+{
+	return _enabled;
+}
+
+QUuid ClusterBus::nodeId() const
+{
+	return _nodeId;
+}
+
+bool ClusterBus::sendProof(const QUuid &partner, const ProofMessage &message)
+{
+	return publish(ProofEvent, {}, [&](QDataStream &stream) {
+		stream << partner;
+		message.serializeTo(stream, false);
+	});
+}
+
+bool ClusterBus::sendProofDelivered(const QUuid &node, const QUuid &deviceId)
+{
+	return publish(ProofDeliveredEvent, node, [&](QDataStream &stream) {
+		stream << deviceId;
+	});
+}
+
+bool ClusterBus::sendProofDone(const QUuid &node, const QUuid &deviceId, bool success, const AcceptMessage &message)
+{
+	return publish(ProofDoneEvent, node, [&](QDataStream &stream) {
+		stream << deviceId << success;
+		message.serializeTo(stream, false);
+	});
+}
+
+bool ClusterBus::sendAcceptDone(const QUuid &node, const QUuid &partner, const QUuid &deviceId)
+{
+	return publish(AcceptDoneEvent, node, [&](QDataStream &stream) {
+		stream << partner << deviceId;
+	});
+}
+
+bool ClusterBus::sendDisconnect(const QUuid &deviceId)
+{
+	return publish(DisconnectEvent, {}, [&](QDataStream &stream) {
+		stream << deviceId;
+	});
+}
+
+void ClusterBus::eventReceived(const QByteArray &event)
+{
+	QDataStream stream(event);
+	Message::setupStream(stream);
+
+	quint8 type;
+	QUuid from;
+	QUuid to;
+	stream >> type >> from >> to;
+	if(stream.status() != QDataStream::Ok) {
+		qWarning() << "Received invalid cluster event";
+		return;
+	}
+	//every server receives all events, including it's own
+	if(from == _nodeId || (!to.isNull() && to != _nodeId))
+		return;
+	_receivedEvents->add();
+
+	try {
+		switch(static_cast<EventType>(type)) {
+		case ProofEvent:
+		{
+			QUuid partner;
+			stream >> partner;
+			auto message = Message::deserializeMessage<ProofMessage>(stream);
+			emit proofReceived(from, partner, message);
+			break;
+		}
+		case ProofDeliveredEvent:
+		{
+			QUuid deviceId;
+			stream >> deviceId;
+			if(stream.status() == QDataStream::Ok)
+				emit proofDelivered(deviceId);
+			break;
+		}
+		case ProofDoneEvent:
+		{
+			QUuid deviceId;
+			bool success;
+			stream >> deviceId >> success;
+			auto message = Message::deserializeMessage<AcceptMessage>(stream);
+			emit proofDone(from, deviceId, success, message);
+			break;
+		}
+		case AcceptDoneEvent:
+		{
+			QUuid partner;
+			QUuid deviceId;
+			stream >> partner >> deviceId;
+			if(stream.status() == QDataStream::Ok)
+				emit acceptDone(partner, deviceId);
+			break;
+		}
+		case DisconnectEvent:
+		{
+			QUuid deviceId;
+			stream >> deviceId;
+			if(stream.status() == QDataStream::Ok)
+				emit disconnectRequested(deviceId);
+			break;
+		}
+		default:
+			qWarning() << "Received cluster event of unknown type" << type;
+			break;
+		}
+	} catch(DataStreamException &e) {
+		qWarning() << "Received invalid cluster event of type" << type
+				   << "with error:" << e.what();
+	}
+}
+
+bool ClusterBus::publish(EventType type, const QUuid &node, const std::function<void (QDataStream &)> &writePayload)
+{
+	if(!_enabled)
+		return false;
+
+	QByteArray event;
+	QDataStream stream(&event, QIODevice::WriteOnly);
+	Message::setupStream(stream);
+	stream << static_cast<quint8>(type) << _nodeId << node;
+	writePayload(stream);
+
+	if(!_database->publishEvent(event))
+		return false;
+	_sentEvents->add();
+	return true;
+}
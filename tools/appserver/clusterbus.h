@@ -0,0 +1,63 @@
+#ifndef CLUSTERBUS_H
+#define CLUSTERBUS_H
+
+#include <functional>
+
+#include <QtCore/QObject>
+#include <QtCore/QUuid>
+#include <QtCore/QDataStream>
+
+#include "databasecontroller.h"
+#include "metrics.h"
+
+#include "proofmessage_p.h"
+
+//! Routes the events between clients of all servers that share a database, so partners may be connected to different servers. Must only be used from the main thread
+class ClusterBus : public QObject
+{
+	Q_OBJECT
+
+public:
+	explicit ClusterBus(DatabaseController *database, QObject *parent = nullptr);
+
+	bool isEnabled() const;
+	QUuid nodeId() const;
+
+	//all return false if the event could not be published. Each is a synchronous database round-trip
+	bool sendProof(const QUuid &partner, const QtDataSync::ProofMessage &message);
+	bool sendProofDelivered(const QUuid &node, const QUuid &deviceId);
+	bool sendProofDone(const QUuid &node, const QUuid &deviceId, bool success, const QtDataSync::AcceptMessage &message);
+	bool sendAcceptDone(const QUuid &node, const QUuid &partner, const QUuid &deviceId);
+	bool sendDisconnect(const QUuid &deviceId);
+
+Q_SIGNALS:
+	void proofReceived(const QUuid &node, const QUuid &partner, const QtDataSync::ProofMessage &message);
+	void proofDelivered(const QUuid &deviceId);
+	void proofDone(const QUuid &node, const QUuid &deviceId, bool success, const QtDataSync::AcceptMessage &message);
+	void acceptDone(const QUuid &partner, const QUuid &deviceId);
+	void disconnectRequested(const QUuid &deviceId);
+
+private Q_SLOTS:
+	void eventReceived(const QByteArray &event);
+
+private:
+	enum EventType : quint8 {
+		ProofEvent = 0,
+		ProofDeliveredEvent = 1,
+		ProofDoneEvent = 2,
+		AcceptDoneEvent = 3,
+		DisconnectEvent = 4
+	};
+
+	DatabaseController *_database;
+	bool _enabled;
+	QUuid _nodeId;
+
+	Metrics::Counter *_sentEvents;
+	Metrics::Counter *_receivedEvents;
+
+	//a null node sends the event to all servers
+	bool publish(EventType type, const QUuid &node, const std::function<void(QDataStream&)> &writePayload);
+};
+
+#endif // CLUSTERBUS_H
@@ -4,19 +4,20 @@
 #include <tuple>
 
 #include <QtCore/QObject>
-#include <QtCore/QSharedPointer>
-#include <QtCore/QThreadPool>
-#include <QtCore/QThreadStorage>
+#include <QtCore/QScopedPointer>
 #include <QtCore/QUuid>
-#include <QtCore/QJsonObject>
 #include <QtCore/QException>
 #include <QtCore/QTimer>
+#include <QtCore/QSet>
+#include <QtCore/QElapsedTimer>
 
 #include <QtSql/QSqlDatabase>
 #include <QtSql/QSqlError>
-#include <QtSql/QSqlDriver>
+#include <QtSql/QSqlQuery>
 
 #include "asymmetriccrypto_p.h"
+#include "databasepool.h"
+#include "metrics.h"
 
 class DatabaseException : public QException
 {
@@ -36,91 +37,139 @@ private:
 	const QByteArray _msg;
 };
 
+//! The storage of the appserver. All operations are threadsafe and throw a DatabaseException on errors
 class DatabaseController : public QObject
 {
 	Q_OBJECT
 
 public:
-	explicit DatabaseController(QObject *parent = nullptr);
+	//! Creates the controller for the database/driver of the configuration
+	static DatabaseController *create(QObject *parent = nullptr);
 
 	void initialize();
 
+	//! Starts removing inactive devices and empty accounts in small batches, unless a cleanup is already running
 	void cleanupDevices();
 
-	QUuid addNewDevice(const QString &name,
-					   const QByteArray &signScheme,
-					   const QByteArray &signKey,
-					   const QByteArray &cryptScheme,
-					   const QByteArray &cryptKey,
-					   const QByteArray &fingerprint,
-					   const QByteArray &keyCmac);
-	void addNewDeviceToUser(const QUuid &newDeviceId,
-							const QUuid &partnerDeviceId,
-							const QString &name,
-							const QByteArray &signScheme,
-							const QByteArray &signKey,
-							const QByteArray &cryptScheme,
-							const QByteArray &cryptKey,
-							const QByteArray &fingerprint);
-	QtDataSync::AsymmetricCryptoInfo *loadCrypto(const QUuid &deviceId,
-												 CryptoPP::RandomNumberGenerator &rng,
-												 QObject *parent = nullptr);
-	void updateLogin(const QUuid &deviceId, const QString &name);
-	bool updateCmac(const QUuid &deviceId, quint32 keyIndex, const QByteArray &cmac);
-	QList<std::tuple<QUuid, QString, QByteArray>> listDevices(const QUuid &deviceId); // (deviceid, name, fingerprint)
-	void removeDevice(const QUuid &deviceId, const QUuid &deleteId);
-
-	bool addChange(const QUuid &deviceId,
-				   const QByteArray &dataId,
-				   const quint32 keyIndex,
-				   const QByteArray &salt,
-				   const QByteArray &data);
-	bool addDeviceChange(const QUuid &deviceId,
-						 const QUuid &targetId,
-						 const QByteArray &dataId,
-						 const quint32 keyIndex,
-						 const QByteArray &salt,
-						 const QByteArray &data);
-
-	quint32 changeCount(const QUuid &deviceId);
-	QList<std::tuple<quint64, quint32, QByteArray, QByteArray>> loadNextChanges(const QUuid &deviceId, quint32 count, quint32 skip); // (dataid, keyindex, salt, data)
-	void completeChange(const QUuid &deviceId, quint64 dataIndex);
-
-	QList<std::tuple<QUuid, QByteArray, QByteArray, QByteArray>> tryKeyChange(const QUuid &deviceId, quint32 proposedIndex, int &offset); //(deviceid, scheme, key, cmac)
-	bool updateExchangeKey(const QUuid &deviceId,
-						   quint32 keyIndex,
-						   const QByteArray &scheme, const QByteArray &cmac,
-						   const QList<std::tuple<QUuid, QByteArray, QByteArray>> &deviceKeys);// (deviceId, key, cmac)
-	std::tuple<quint32, QByteArray, QByteArray, QByteArray> loadKeyChanges(const QUuid &deviceId);// (keyIndex, scheme, key, cmac)
+	virtual QUuid addNewDevice(const QString &name,
+							   const QByteArray &signScheme,
+							   const QByteArray &signKey,
+							   const QByteArray &cryptScheme,
+							   const QByteArray &cryptKey,
+							   const QByteArray &fingerprint,
+							   const QByteArray &keyCmac) = 0;
+	virtual void addNewDeviceToUser(const QUuid &newDeviceId,
+									const QUuid &partnerDeviceId,
+									const QString &name,
+									const QByteArray &signScheme,
+									const QByteArray &signKey,
+									const QByteArray &cryptScheme,
+									const QByteArray &cryptKey,
+									const QByteArray &fingerprint) = 0;
+	virtual QtDataSync::AsymmetricCryptoInfo *loadCrypto(const QUuid &deviceId,
+														 CryptoPP::RandomNumberGenerator &rng,
+														 QObject *parent = nullptr) = 0;
+	virtual bool updateLogin(const QUuid &deviceId, const QString &name) = 0;
+	virtual bool updateCmac(const QUuid &deviceId, quint32 keyIndex, const QByteArray &cmac) = 0;
+	virtual QList<std::tuple<QUuid, QString, QByteArray>> listDevices(const QUuid &deviceId) = 0; // (deviceid, name, fingerprint)
+	virtual void removeDevice(const QUuid &deviceId, const QUuid &deleteId) = 0;
+
+	virtual bool addChange(const QUuid &deviceId,
+						   const QByteArray &dataId,
+						   const quint32 keyIndex,
+						   const QByteArray &salt,
+						   const QByteArray &data) = 0;
+	virtual bool addDeviceChange(const QUuid &deviceId,
+								 const QUuid &targetId,
+								 const QByteArray &dataId,
+								 const quint32 keyIndex,
+								 const QByteArray &salt,
+								 const QByteArray &data) = 0;
+
+	virtual quint32 changeCount(const QUuid &deviceId) = 0;
+	virtual QList<std::tuple<quint64, quint32, QByteArray, QByteArray>> loadNextChanges(const QUuid &deviceId, quint32 count, quint64 lastIndex) = 0; // (dataid, keyindex, salt, data)
+	virtual void completeChanges(const QUuid &deviceId, const QList<quint64> &dataIndexes) = 0;
+
+	virtual QList<std::tuple<QUuid, QByteArray, QByteArray, QByteArray>> tryKeyChange(const QUuid &deviceId, quint32 proposedIndex, int &offset) = 0; //(deviceid, scheme, key, cmac)
+	virtual bool updateExchangeKey(const QUuid &deviceId,
+								   quint32 keyIndex,
+								   const QByteArray &scheme, const QByteArray &cmac,
+								   const QList<std::tuple<QUuid, QByteArray, QByteArray>> &deviceKeys) = 0;// (deviceId, key, cmac)
+	virtual std::tuple<quint32, QByteArray, QByteArray, QByteArray> loadKeyChanges(const QUuid &deviceId) = 0;// (keyIndex, scheme, key, cmac)
+
+	//! Sends the event to all servers that share the database, including this one. Must be called on the main thread, which is blocked until the database replied. Returns false if not possible
+	virtual bool publishEvent(const QByteArray &event);
 
 Q_SIGNALS:
 	void notifyChanged(const QUuid &deviceId);
+	void eventReceived(const QByteArray &event);
 
 	void databaseInitDone(bool success);
 
-private Q_SLOTS:
-	void dbInitDone(bool success);
-	void onNotify(const QString &name, QSqlDriver::NotificationSource source, const QVariant &payload);
-	void timeout();
-
-private:
-	class DatabaseWrapper
+protected:
+	//! A query that throws a DatabaseException if preparing or executing it fails
+	class Query : public QSqlQuery
 	{
 	public:
-		DatabaseWrapper();
-		~DatabaseWrapper();
+		explicit Query(QSqlDatabase db);
 
-		QSqlDatabase database() const;
-	private:
-		QString dbName;
+		void prepare(const QString &query);
+		void exec();
 	};
 
-	static QThreadStorage<DatabaseWrapper> _threadStore; //must be static
-	QTimer *_keepAliveTimer;
-	QTimer *_cleanupTimer;
+	struct CleanupProgress {
+		quint64 changes = 0;
+		quint64 devices = 0;
+		quint64 users = 0;
+	};
+
+	explicit DatabaseController(QObject *parent = nullptr);
+
+	DatabasePool *pool() const;
+	bool isLiveSync() const;
 
-	void initDatabase(quint64 quota, bool forceQuota);
-	void updateQuotaLimit(quint64 quota, bool forceQuota);
+	//! Is called on a background thread, and must invoke dbInitDone once done
+	virtual void initDatabase(quint64 quota, bool forceQuota) = 0;
+	//! Queries to set up each new connection with
+	virtual QStringList connectionSetup() const;
+	virtual bool startLiveSync() = 0;
+	//! Is called on a background thread, and removes at most batchSize rows of the cleanup in a short transaction
+	//! Devices are marked before their data is removed, so an interrupted cleanup can finish them after a restart.
+	//! If offlineSinceDays is 0, only those marked devices are removed. Returns false once nothing is left to remove
+	virtual bool cleanupBatch(quint64 offlineSinceDays, int batchSize, CleanupProgress &progress) = 0;
+
+	//! Collects the event for the device, to notify it about changes. Is threadsafe
+	void deviceChanged(const QUuid &deviceId);
+
+	static Metrics::Histogram *operationLatency(const QByteArray &operation);
+	static void countError();
+
+protected Q_SLOTS:
+	virtual void dbInitDone(bool success);
+
+private Q_SLOTS:
+	void onDeviceEvent(const QUuid &deviceId);
+	void notifyTimeout();
+	void runCleanupBatch();
+	void cleanupBatchDone(bool ok, bool more, quint64 changes, quint64 devices, quint64 users, qint64 duration);
+
+private:
+	QScopedPointer<DatabasePool> _pool;
+	bool _liveSync;
+	QTimer *_cleanupTimer;
+	QTimer *_cleanupBatchTimer;
+	bool _cleanupRunning;
+	quint64 _cleanupDays;
+	int _cleanupBatch;
+	int _cleanupPause;
+	int _cleanupRate;
+	CleanupProgress _cleanupProgress;
+	QElapsedTimer _cleanupClock;
+	qint64 _cleanupReported;
+
+	void startCleanup(quint64 offlineSinceDays);
+	QTimer *_notifyTimer;
+	QSet<QUuid> _pendingNotifies;
 };
 
 #endif // DATABASECONTROLLER_H
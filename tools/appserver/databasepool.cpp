@@ -0,0 +1,310 @@
+#include "databasepool.h"
+#include "databasecontroller.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QUuid>
+#include <QtCore/QWaitCondition>
+
+#include <QtSql/QSqlQuery>
+
+class DatabasePool::State
+{
+public:
+	State(const QSettings *configuration, const QStringList &setupQueries);
+
+	QString driver;
+	QString name;
+	QString host;
+	int port;
+	QString username;
+	QString password;
+	QString options;
+	QStringList setupQueries;
+
+	int minConnections;
+	int maxConnections;
+	bool keepOneFree;
+	qint64 idleTimeout;
+	qint64 healthInterval;
+
+	QMutex mutex;
+	QWaitCondition condition;
+	int open;
+	int leased;
+	int waiting;
+	int peak;
+	QElapsedTimer peakTimer;
+
+	QSqlDatabase addDatabase(const QString &connectionName) const;
+	void setupDatabase(QSqlDatabase db) const;
+};
+
+class DatabasePool::ThreadConnection
+{
+public:
+	ThreadConnection(const QSharedPointer<State> &state);
+	~ThreadConnection();
+
+	QSqlDatabase database() const;
+
+	void acquire();
+	void release();
+
+private:
+	const QSharedPointer<State> _state;
+	const QString _name;
+	int _leases;
+	bool _hasPermit;
+	QElapsedTimer _idleTimer;
+
+	void open();
+	void close();
+	bool isHealthy() const;
+};
+
+QThreadStorage<DatabasePool::ThreadConnection*> DatabasePool::_threadStore;
+
+DatabasePool::DatabasePool(const QSettings *configuration, const QStringList &setupQueries) :
+	_state(QSharedPointer<State>::create(configuration, setupQueries))
+{}
+
+DatabasePool::Connection DatabasePool::acquire()
+{
+	if(!_threadStore.hasLocalData())
+		_threadStore.setLocalData(new ThreadConnection(_state));
+	auto connection = _threadStore.localData();
+	connection->acquire();
+	return Connection(connection);
+}
+
+QSqlDatabase DatabasePool::createConnection(const QString &connectionName) const
+{
+	return _state->addDatabase(connectionName);
+}
+
+int DatabasePool::minConnections() const
+{
+	return _state->minConnections;
+}
+
+int DatabasePool::maxConnections() const
+{
+	return _state->maxConnections;
+}
+
+int DatabasePool::openConnections() const
+{
+	QMutexLocker lock(&_state->mutex);
+	return _state->open;
+}
+
+int DatabasePool::usedConnections() const
+{
+	QMutexLocker lock(&_state->mutex);
+	return _state->leased;
+}
+
+
+
+DatabasePool::Connection::Connection(ThreadConnection *connection) :
+	_connection(connection)
+{}
+
+DatabasePool::Connection::Connection(Connection &&other) :
+	_connection(other._connection)
+{
+	other._connection = nullptr;
+}
+
+DatabasePool::Connection::~Connection()
+{
+	if(_connection)
+		_connection->release();
+}
+
+QSqlDatabase DatabasePool::Connection::database() const
+{
+	return _connection->database();
+}
+
+
+
+DatabasePool::State::State(const QSettings *configuration, const QStringList &setupQueries) :
+	driver(configuration->value(QStringLiteral("database/driver"), QStringLiteral("QPSQL")).toString()),
+	name(configuration->value(QStringLiteral("database/name"), QCoreApplication::applicationName()).toString()),
+	host(configuration->value(QStringLiteral("database/host"), QStringLiteral("localhost")).toString()),
+	port(configuration->value(QStringLiteral("database/port"), 5432).toInt()),
+	username(configuration->value(QStringLiteral("database/username")).toString()),
+	password(configuration->value(QStringLiteral("database/password")).toString()),
+	options(configuration->value(QStringLiteral("database/options")).toString()),
+	setupQueries(setupQueries),
+	minConnections(configuration->value(QStringLiteral("database/pool/min"), 1).toInt()),
+	maxConnections(0),
+	keepOneFree(false),
+	idleTimeout(configuration->value(QStringLiteral("database/pool/idleTimeout"), 60).toLongLong() * 1000),
+	healthInterval(configuration->value(QStringLiteral("database/pool/healthCheck"), 30).toLongLong() * 1000),
+	mutex(),
+	condition(),
+	open(0),
+	leased(0),
+	waiting(0),
+	peak(0),
+	peakTimer()
+{
+	//the client threads and the background threads (same count) both use the database
+	auto threadCount = 2 * configuration->value(QStringLiteral("threads/count"), QThread::idealThreadCount()).toInt();
+	maxConnections = qMax(1, configuration->value(QStringLiteral("database/pool/max"), threadCount).toInt());
+	minConnections = qBound(0, minConnections, maxConnections);
+	//with fewer connections than threads, idle threads must not keep all of them
+	keepOneFree = maxConnections < threadCount;
+	peakTimer.start();
+}
+
+QSqlDatabase DatabasePool::State::addDatabase(const QString &connectionName) const
+{
+	auto db = QSqlDatabase::addDatabase(driver, connectionName);
+	db.setDatabaseName(name);
+	db.setHostName(host);
+	db.setPort(port);
+	db.setUserName(username);
+	db.setPassword(password);
+	db.setConnectOptions(options);
+	return db;
+}
+
+void DatabasePool::State::setupDatabase(QSqlDatabase db) const
+{
+	for(const auto &setupQuery : setupQueries) {
+		QSqlQuery query(db);
+		if(!query.exec(setupQuery)) {
+			qCritical() << "Failed to set up database connection with error:"
+						<< qPrintable(query.lastError().text());
+			throw DatabaseException(query);
+		}
+	}
+}
+
+
+
+DatabasePool::ThreadConnection::ThreadConnection(const QSharedPointer<State> &state) :
+	_state(state),
+	_name(QUuid::createUuid().toString()),
+	_leases(0),
+	_hasPermit(false),
+	_idleTimer()
+{
+	_state->addDatabase(_name);
+}
+
+DatabasePool::ThreadConnection::~ThreadConnection()
+{
+	close();
+	QSqlDatabase::removeDatabase(_name);
+}
+
+QSqlDatabase DatabasePool::ThreadConnection::database() const
+{
+	return QSqlDatabase::database(_name, false);
+}
+
+void DatabasePool::ThreadConnection::acquire()
+{
+	if(_leases++ > 0) //already borrowed further up the stack
+		return;
+
+	try {
+		QMutexLocker lock(&_state->mutex);
+		if(!_hasPermit) {
+			_state->waiting++;
+			while(_state->open >= _state->maxConnections)
+				_state->condition.wait(&_state->mutex);
+			_state->waiting--;
+			_state->open++;
+			_hasPermit = true;
+		}
+		_state->leased++;
+		_state->peak = qMax(_state->peak, _state->leased);
+		lock.unlock();
+
+		if(!database().isOpen())
+			open();
+		else if(_idleTimer.hasExpired(_state->healthInterval) && !isHealthy()) {
+			qWarning() << "Database connection broken. Reconnecting for thread" << QThread::currentThreadId();
+			database().close();
+			open();
+		}
+	} catch(...) {
+		release();
+		throw;
+	}
+}
+
+void DatabasePool::ThreadConnection::release()
+{
+	if(--_leases > 0)
+		return;
+	_idleTimer.start();
+
+	QMutexLocker lock(&_state->mutex);
+	_state->leased--;
+	//keep as many connections open as were recently used at the same time
+	if(_state->peakTimer.hasExpired(_state->idleTimeout)) {
+		_state->peak = _state->leased;
+		_state->peakTimer.restart();
+	}
+	auto keep = qMax(_state->minConnections, _state->peak);
+	if(_state->keepOneFree)
+		keep = qMin(keep, _state->maxConnections - 1);
+	//connections belong to the thread that opened them, so a waiting thread can only get the permit, not the connection.
+	//with fewer connections than threads, contended threads therefore reconnect for every lease
+	auto surplus = _state->waiting > 0 || _state->open > keep;
+	lock.unlock();
+
+	if(surplus || !database().isOpen())
+		close();
+}
+
+void DatabasePool::ThreadConnection::open()
+{
+	auto db = database();
+	if(!db.open()) {
+		qCritical() << "Failed to open database with error:"
+					<< qPrintable(db.lastError().text());
+		throw DatabaseException(db);
+	}
+
+	try {
+		_state->setupDatabase(db);
+	} catch(...) {
+		db.close();
+		throw;
+	}
+	qDebug() << "DB connected for thread" << QThread::currentThreadId();
+}
+
+void DatabasePool::ThreadConnection::close()
+{
+	if(!_hasPermit)
+		return;
+
+	auto db = database();
+	if(db.isOpen()) {
+		db.close();
+		qDebug() << "DB disconnected for thread" << QThread::currentThreadId();
+	}
+
+	QMutexLocker lock(&_state->mutex);
+	_hasPermit = false;
+	_state->open--;
+	_state->condition.wakeOne();
+}
+
+bool DatabasePool::ThreadConnection::isHealthy() const
+{
+	QSqlQuery query(database());
+	return query.exec(QStringLiteral("SELECT NULL"));
+}
@@ -0,0 +1,54 @@
+#ifndef DATABASEPOOL_H
+#define DATABASEPOOL_H
+
+#include <QtCore/QSettings>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QStringList>
+#include <QtCore/QThreadStorage>
+
+#include <QtSql/QSqlDatabase>
+
+//! A bounded pool of database connections. Is threadsafe
+class DatabasePool
+{
+	class State;
+	class ThreadConnection;
+
+public:
+	//! A borrowed connection, returned to the pool once destroyed. Must stay on the acquiring thread
+	class Connection
+	{
+		Q_DISABLE_COPY(Connection)
+		friend class DatabasePool;
+
+	public:
+		Connection(Connection &&other);
+		~Connection();
+
+		QSqlDatabase database() const;
+
+	private:
+		ThreadConnection *_connection;
+
+		Connection(ThreadConnection *connection);
+	};
+
+	//! The setup queries are run on every connection once it was opened
+	explicit DatabasePool(const QSettings *configuration, const QStringList &setupQueries = {});
+
+	//! Blocks until a connection is available. Throws a DatabaseException if it cannot be opened
+	Connection acquire();
+	//! Creates a connection outside of the pool, e.g. for a connection that must stay open
+	QSqlDatabase createConnection(const QString &connectionName) const;
+
+	int minConnections() const;
+	int maxConnections() const;
+	int openConnections() const;
+	int usedConnections() const;
+
+private:
+	static QThreadStorage<ThreadConnection*> _threadStore; //must be static
+	QSharedPointer<State> _state;
+};
+
+#endif // DATABASEPOOL_H
@@ -0,0 +1,233 @@
+#include "metrics.h"
+
+namespace {
+
+//bucket bounds of the histograms, in seconds
+const double Bounds[] = {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+const int BoundCount = sizeof(Bounds) / sizeof(double);
+
+QByteArray escapeLabel(QByteArray value)
+{
+	return value.replace('\\', "\\\\")
+			.replace('"', "\\\"")
+			.replace('\n', "\\n");
+}
+
+void writeLine(QByteArray &out, const QByteArray &name, const QByteArray &labels, const QByteArray &value)
+{
+	out += name;
+	if(!labels.isEmpty())
+		out += '{' + labels + '}';
+	out += ' ' + value + '\n';
+}
+
+}
+
+class Metrics::CallbackGauge : public Metric
+{
+public:
+	CallbackGauge(const Callback &callback);
+
+	void write(QByteArray &out, const QByteArray &name, const QByteArray &labels) const override;
+private:
+	const Callback _callback;
+};
+
+Metrics::Metrics(QObject *parent) :
+	QObject(parent),
+	_lock(),
+	_families()
+{}
+
+Metrics::~Metrics()
+{
+	for(const auto &family : _families)
+		qDeleteAll(family.metrics);
+}
+
+Metrics::Counter *Metrics::counter(const QByteArray &name, const QByteArray &help, const Labels &labels)
+{
+	return find<Counter>(name, "counter", help, labels, [](){
+		return new Counter();
+	});
+}
+
+Metrics::Gauge *Metrics::gauge(const QByteArray &name, const QByteArray &help, const Labels &labels)
+{
+	return find<Gauge>(name, "gauge", help, labels, [](){
+		return new Gauge();
+	});
+}
+
+Metrics::Histogram *Metrics::histogram(const QByteArray &name, const QByteArray &help, const Labels &labels)
+{
+	return find<Histogram>(name, "histogram", help, labels, [](){
+		return new Histogram();
+	});
+}
+
+void Metrics::addGauge(const QByteArray &name, const QByteArray &help, const Callback &callback, const Labels &labels)
+{
+	find<CallbackGauge>(name, "gauge", help, labels, [callback](){
+		return new CallbackGauge(callback);
+	});
+}
+
+QByteArray Metrics::scrape() const
+{
+	QReadLocker lock(&_lock);
+	QByteArray out;
+	for(auto it = _families.constBegin(); it != _families.constEnd(); it++) {
+		out += "# HELP " + it.key() + ' ' + it->help + '\n';
+		out += "# TYPE " + it.key() + ' ' + it->type + '\n';
+		for(auto mIt = it->metrics.constBegin(); mIt != it->metrics.constEnd(); mIt++)
+			mIt.value()->write(out, it.key(), mIt.key());
+	}
+	return out;
+}
+
+template<typename TMetric>
+TMetric *Metrics::find(const QByteArray &name, const QByteArray &type, const QByteArray &help, const Labels &labels, const std::function<TMetric*()> &create)
+{
+	auto labelStr = formatLabels(labels);
+	{
+		QReadLocker lock(&_lock);
+		auto it = _families.constFind(name);
+		if(it != _families.constEnd()) {
+			auto metric = it->metrics.value(labelStr);
+			if(metric)
+				return static_cast<TMetric*>(metric);
+		}
+	}
+
+	QWriteLocker lock(&_lock);
+	auto &family = _families[name];
+	if(family.type.isNull()) {
+		family.type = type;
+		family.help = help;
+	} else
+		Q_ASSERT_X(family.type == type, Q_FUNC_INFO, "Metrics of the same name must have the same type");
+	auto &metric = family.metrics[labelStr];
+	if(!metric) //may have been created in between
+		metric = create();
+	return static_cast<TMetric*>(metric);
+}
+
+QByteArray Metrics::formatLabels(const Labels &labels)
+{
+	QByteArrayList parts;
+	parts.reserve(labels.size());
+	for(auto it = labels.constBegin(); it != labels.constEnd(); it++)
+		parts.append(it.key() + "=\"" + escapeLabel(it.value()) + '"');
+	return parts.join(',');
+}
+
+
+
+Metrics::Metric::~Metric() = default;
+
+Metrics::Counter::Counter() :
+	_value(0)
+{}
+
+void Metrics::Counter::add(quint64 value)
+{
+	_value.fetchAndAddRelaxed(value);
+}
+
+quint64 Metrics::Counter::value() const
+{
+	return _value.load();
+}
+
+void Metrics::Counter::write(QByteArray &out, const QByteArray &name, const QByteArray &labels) const
+{
+	writeLine(out, name, labels, QByteArray::number(value()));
+}
+
+Metrics::Gauge::Gauge() :
+	_value(0)
+{}
+
+void Metrics::Gauge::add(qint64 value)
+{
+	_value.fetchAndAddRelaxed(value);
+}
+
+void Metrics::Gauge::sub(qint64 value)
+{
+	_value.fetchAndSubRelaxed(value);
+}
+
+void Metrics::Gauge::set(qint64 value)
+{
+	_value.store(value);
+}
+
+qint64 Metrics::Gauge::value() const
+{
+	return _value.load();
+}
+
+void Metrics::Gauge::write(QByteArray &out, const QByteArray &name, const QByteArray &labels) const
+{
+	writeLine(out, name, labels, QByteArray::number(value()));
+}
+
+Metrics::Histogram::Histogram() :
+	_buckets(new QAtomicInteger<quint64>[BoundCount + 1]),
+	_sum(0)
+{
+	for(auto i = 0; i <= BoundCount; i++)
+		_buckets[i].store(0);
+}
+
+Metrics::Histogram::~Histogram()
+{
+	delete[] _buckets;
+}
+
+void Metrics::Histogram::observe(qint64 nsecs)
+{
+	auto secs = nsecs / 1000000000.0;
+	auto index = 0;
+	while(index < BoundCount && secs > Bounds[index])
+		index++;
+	_buckets[index].fetchAndAddRelaxed(1);
+	_sum.fetchAndAddRelaxed(static_cast<quint64>(qMax<qint64>(0, nsecs)));
+}
+
+void Metrics::Histogram::write(QByteArray &out, const QByteArray &name, const QByteArray &labels) const
+{
+	auto prefix = labels.isEmpty() ? QByteArray() : labels + ',';
+	quint64 count = 0;
+	for(auto i = 0; i < BoundCount; i++) {
+		count += _buckets[i].load();
+		writeLine(out, name + "_bucket", prefix + "le=\"" + QByteArray::number(Bounds[i]) + '"', QByteArray::number(count));
+	}
+	count += _buckets[BoundCount].load();
+	writeLine(out, name + "_bucket", prefix + "le=\"+Inf\"", QByteArray::number(count));
+	writeLine(out, name + "_sum", labels, QByteArray::number(_sum.load() / 1000000000.0, 'g', 12));
+	writeLine(out, name + "_count", labels, QByteArray::number(count));
+}
+
+Metrics::Timer::Timer(Histogram *histogram) :
+	_histogram(histogram),
+	_timer()
+{
+	_timer.start();
+}
+
+Metrics::Timer::~Timer()
+{
+	_histogram->observe(_timer.nsecsElapsed());
+}
+
+Metrics::CallbackGauge::CallbackGauge(const Callback &callback) :
+	_callback(callback)
+{}
+
+void Metrics::CallbackGauge::write(QByteArray &out, const QByteArray &name, const QByteArray &labels) const
+{
+	writeLine(out, name, labels, QByteArray::number(_callback()));
+}
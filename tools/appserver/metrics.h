@@ -0,0 +1,111 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <functional>
+
+#include <QtCore/QObject>
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMap>
+#include <QtCore/QReadWriteLock>
+
+//! A registry of counters, gauges and histograms, that can be scraped in the prometheus text format. Is threadsafe
+class Metrics : public QObject
+{
+	Q_OBJECT
+
+public:
+	typedef QMap<QByteArray, QByteArray> Labels;
+	typedef std::function<qint64()> Callback;
+
+	class Metric
+	{
+		Q_DISABLE_COPY(Metric)
+	public:
+		Metric() = default;
+		virtual ~Metric();
+		virtual void write(QByteArray &out, const QByteArray &name, const QByteArray &labels) const = 0;
+	};
+
+	class Counter : public Metric
+	{
+	public:
+		Counter();
+		void add(quint64 value = 1);
+		quint64 value() const;
+
+		void write(QByteArray &out, const QByteArray &name, const QByteArray &labels) const override;
+	private:
+		QAtomicInteger<quint64> _value;
+	};
+
+	class Gauge : public Metric
+	{
+	public:
+		Gauge();
+		void add(qint64 value = 1);
+		void sub(qint64 value = 1);
+		void set(qint64 value);
+		qint64 value() const;
+
+		void write(QByteArray &out, const QByteArray &name, const QByteArray &labels) const override;
+	private:
+		QAtomicInteger<qint64> _value;
+	};
+
+	//! A histogram of durations, with buckets from 0.5ms to 10s
+	class Histogram : public Metric
+	{
+	public:
+		Histogram();
+		~Histogram() override;
+		void observe(qint64 nsecs);
+
+		void write(QByteArray &out, const QByteArray &name, const QByteArray &labels) const override;
+	private:
+		QAtomicInteger<quint64> *_buckets; //one more than bounds, for +Inf
+		QAtomicInteger<quint64> _sum;
+	};
+
+	//! Measures the time until it is destroyed
+	class Timer
+	{
+		Q_DISABLE_COPY(Timer)
+	public:
+		explicit Timer(Histogram *histogram);
+		~Timer();
+	private:
+		Histogram *_histogram;
+		QElapsedTimer _timer;
+	};
+
+	explicit Metrics(QObject *parent = nullptr);
+	~Metrics() override;
+
+	//the returned metrics stay valid as long as the registry exists
+	Counter *counter(const QByteArray &name, const QByteArray &help, const Labels &labels = {});
+	Gauge *gauge(const QByteArray &name, const QByteArray &help, const Labels &labels = {});
+	Histogram *histogram(const QByteArray &name, const QByteArray &help, const Labels &labels = {});
+	//! A gauge that is read from the callback on the scraping thread
+	void addGauge(const QByteArray &name, const QByteArray &help, const Callback &callback, const Labels &labels = {});
+
+	QByteArray scrape() const;
+
+private:
+	class CallbackGauge;
+
+	struct Family {
+		QByteArray type;
+		QByteArray help;
+		QMap<QByteArray, Metric*> metrics;
+	};
+
+	mutable QReadWriteLock _lock;
+	QMap<QByteArray, Family> _families;
+
+	template <typename TMetric>
+	TMetric *find(const QByteArray &name, const QByteArray &type, const QByteArray &help, const Labels &labels, const std::function<TMetric*()> &create);
+	static QByteArray formatLabels(const Labels &labels);
+};
+
+#endif // METRICS_H
@@ -0,0 +1,110 @@
+#include "metricsserver.h"
+#include "app.h"
+
+#include <QtCore/QTimer>
+
+#include <QtNetwork/QTcpSocket>
+
+namespace {
+
+//requests are tiny, anything bigger is not a scrape
+const int MaxRequestSize = 8192;
+
+void sendResponse(QTcpSocket *socket, const QByteArray &status, const QByteArray &contentType, const QByteArray &body)
+{
+	socket->write("HTTP/1.1 " + status + "\r\n"
+				  "Content-Type: " + contentType + "\r\n"
+				  "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+				  "Connection: close\r\n"
+				  "\r\n" +
+				  body);
+	socket->disconnectFromHost();
+}
+
+}
+
+MetricsServer::MetricsServer(const Metrics *metrics, QObject *parent) :
+	QObject(parent),
+	_metrics(metrics),
+	_server(new QTcpServer(this)),
+	_timeout(10)
+{
+	connect(_server, &QTcpServer::newConnection,
+			this, &MetricsServer::newConnection);
+}
+
+bool MetricsServer::listen()
+{
+	QHostAddress host {
+		qApp->configuration()->value(QStringLiteral("metrics/host"),
+									 QHostAddress(QHostAddress::LocalHost).toString())
+				.toString()
+	};
+
+	_timeout = qApp->configuration()->value(QStringLiteral("metrics/timeout"), _timeout).toInt();
+	auto port = static_cast<quint16>(qApp->configuration()->value(QStringLiteral("metrics/port"), 0).toUInt());
+	if(port == 0) {
+		qDebug() << "Metrics endpoint disabled";
+		return true;
+	}
+
+	if(_server->listen(host, port)) {
+		qInfo() << "Serving metrics on port" << port;
+		return true;
+	} else {
+		qCritical() << "Failed to listen for metrics as"
+					<< host
+					<< "on port"
+					<< port
+					<< "with error:"
+					<< _server->errorString();
+		return false;
+	}
+}
+
+void MetricsServer::newConnection()
+{
+	while(_server->hasPendingConnections()) {
+		auto socket = _server->nextPendingConnection();
+		connect(socket, &QTcpSocket::disconnected,
+				socket, &QTcpSocket::deleteLater);
+		connect(socket, &QTcpSocket::readyRead, this, [this, socket](){
+			handleRequest(socket);
+		});
+
+		//drop connections that are not done in time, so idle or stalled sockets do not pile up
+		if(_timeout > 0) {
+			auto timer = new QTimer(socket);
+			timer->setInterval(_timeout * 1000);
+			timer->setSingleShot(true);
+			connect(timer, &QTimer::timeout,
+					socket, &QTcpSocket::abort);
+			connect(socket, &QTcpSocket::disconnected,
+					timer, &QTimer::stop);
+			timer->start();
+		}
+	}
+}
+
+void MetricsServer::handleRequest(QTcpSocket *socket)
+{
+	//wait for the complete header, the body of a GET is ignored
+	auto data = socket->peek(MaxRequestSize);
+	if(!data.contains("\r\n\r\n")) {
+		if(data.size() >= MaxRequestSize)
+			sendResponse(socket, "431 Request Header Fields Too Large", "text/plain", {});
+		return;
+	}
+	socket->readAll();
+	disconnect(socket, &QTcpSocket::readyRead, this, nullptr);
+
+	auto request = data.left(data.indexOf("\r\n")).split(' ');
+	if(request.size() != 3)
+		sendResponse(socket, "400 Bad Request", "text/plain", {});
+	else if(request[0] != "GET")
+		sendResponse(socket, "405 Method Not Allowed", "text/plain", {});
+	else if(request[1] != "/metrics")
+		sendResponse(socket, "404 Not Found", "text/plain", {});
+	else
+		sendResponse(socket, "200 OK", "text/plain; version=0.0.4; charset=utf-8", _metrics->scrape());
+}
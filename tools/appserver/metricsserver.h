@@ -0,0 +1,31 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <QtCore/QObject>
+
+#include <QtNetwork/QTcpServer>
+
+#include "metrics.h"
+
+//! A minimal HTTP server that serves the metrics for prometheus on GET /metrics
+class MetricsServer : public QObject
+{
+	Q_OBJECT
+
+public:
+	explicit MetricsServer(const Metrics *metrics, QObject *parent = nullptr);
+
+	bool listen();
+
+private Q_SLOTS:
+	void newConnection();
+
+private:
+	const Metrics *_metrics;
+	QTcpServer *_server;
+	int _timeout;
+
+	void handleRequest(QTcpSocket *socket);
+};
+
+#endif // METRICSSERVER_H
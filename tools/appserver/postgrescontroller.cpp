@@ -0,0 +1,2142 @@
+#include "postgrescontroller.h"
+#include "app.h"
+
+#include <QtCore/QJsonDocument>
+
+#include <QtSql/QSqlQuery>
+
+#include <QtConcurrent/QtConcurrentRun>
+
+#if QT_HAS_INCLUDE(<chrono>)
+#define scdtime(x) x
+#else
+#define scdtime(x) duration_cast<milliseconds>(x).count()
+#endif
+
+using namespace QtDataSync;
+using namespace std::chrono;
+using std::tuple;
+using std::make_tuple;
+using std::get;
+
+namespace {
+
+//the number of users, whose devices are cached at most
+const int DeviceCacheLimit = 10000;
+//blobs of uploads that are not committed yet are not referenced, so only older ones are removed
+const int BlobGracePeriod = 3600; //1 hour
+const int BlobSweepBatch = 1000;
+//changes are moved into partitions in batches, to report the progress
+const int PartitionBatch = 10000;
+//events of the cluster are base64 encoded, as notification payloads must be text of less than 8000 bytes
+const int ClusterPayloadLimit = 8000;
+
+//relative to the configuration, or empty if blobs are disabled
+QString blobPath()
+{
+	auto path = qApp->configuration()->value(QStringLiteral("blobs/path")).toString();
+	return path.isEmpty() ? path : qApp->absolutePath(path);
+}
+
+//offloaded data only keeps a reference in the table, but counts into the quota with it's full size
+QString dataSize(const QString &row)
+{
+	return QStringLiteral("(octet_length(%1.data) + COALESCE(%1.blobsize, 0))").arg(row);
+}
+
+}
+
+PostgresController::PostgresController(QObject *parent) :
+	DatabaseController(parent),
+	_notifyDbName(),
+	_keepAliveTimer(nullptr),
+	_quotaTimer(nullptr),
+	_quotaSlack(qApp->configuration()->value(QStringLiteral("quota/slack"), 0).toULongLong()),
+	_partitions(qApp->configuration()->value(QStringLiteral("database/partitions"), 0).toInt()),
+	_partitioned(false),
+	_blobs(blobPath(),
+		   qMax(qApp->configuration()->value(QStringLiteral("blobs/threshold"), 65536).toLongLong(), 0ll)), //64 KB
+	_blobTimer(nullptr),
+	_deviceCacheLock(),
+	_deviceUsers(),
+	_userDevices(),
+	_deviceCacheGeneration(0),
+	_deviceCacheTtl(qApp->configuration()->value(QStringLiteral("database/deviceCache"), 60).toLongLong() * 1000), //1 minute
+	_deviceCacheClock()
+{
+	_deviceCacheClock.start();
+}
+
+void PostgresController::foldQuota()
+{
+	QtConcurrent::run(qApp->threadPool(), [this]() {
+		try {
+			Metrics::Timer timer(operationLatency("foldQuota"));
+			auto connection = pool()->acquire();
+			auto db = connection.database();
+			foldQuotaLedger(db);
+		} catch (DatabaseException &e) {
+			qWarning() << "Folding the quota ledger failed with error:" << e.what();
+		}
+	});
+}
+
+void PostgresController::sweepBlobs()
+{
+	QtConcurrent::run(qApp->threadPool(), [this]() {
+		static auto removedBlobs = qApp->metrics()->counter("qdsapp_blobs_removed_total",
+															"Number of blobs removed, because no change referenced them anymore");
+		try {
+			Metrics::Timer timer(operationLatency("sweepBlobs"));
+			auto storedBefore = QDateTime::currentDateTimeUtc().addSecs(-BlobGracePeriod);
+			auto keys = _blobs.keys(storedBefore);
+			if(keys.isEmpty())
+				return;
+
+			auto connection = pool()->acquire();
+			auto db = connection.database();
+			quint64 removed = 0;
+			for(auto offset = 0; offset < keys.size(); offset += BlobSweepBatch) {
+				auto batch = keys.mid(offset, BlobSweepBatch);
+				QStringList hexKeys;
+				for(const auto &key : batch)
+					hexKeys.append(QString::fromLatin1(key.toHex()));
+
+				Query usedQuery(db);
+				usedQuery.prepare(QStringLiteral("SELECT DISTINCT encode(blob, 'hex') FROM datachanges "
+												 "WHERE blob IN (SELECT decode(unnest(?::TEXT[]), 'hex'))"));
+				usedQuery.addBindValue(QLatin1Char('{') + hexKeys.join(QLatin1Char(',')) + QLatin1Char('}'));
+				usedQuery.exec();
+				QSet<QByteArray> used;
+				while(usedQuery.next())
+					used.insert(QByteArray::fromHex(usedQuery.value(0).toString().toLatin1()));
+
+				for(const auto &key : batch) {
+					if(!used.contains(key) && _blobs.remove(key, storedBefore))
+						removed++;
+				}
+			}
+
+			removedBlobs->add(removed);
+			if(removed > 0)
+				qDebug() << "Removed" << removed << "unused blobs";
+		} catch (DatabaseException &e) {
+			qWarning() << "Removing unused blobs failed with error:" << e.what();
+		}
+	});
+}
+
+QUuid PostgresController::addNewDevice(const QString &name, const QByteArray &signScheme, const QByteArray &signKey, const QByteArray &cryptScheme, const QByteArray &cryptKey, const QByteArray &fingerprint, const QByteArray &keyCmac)
+{
+	Metrics::Timer timer(operationLatency("addNewDevice"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		//create a new user
+		Query createIdentityQuery(db);
+		createIdentityQuery.prepare(QStringLiteral("INSERT INTO users DEFAULT VALUES "
+												   "RETURNING id"));
+		createIdentityQuery.exec();
+		if(!createIdentityQuery.first())
+			throw DatabaseException(db);
+		auto userId = createIdentityQuery.value(0).toLongLong();
+
+		//create a device entry
+		auto deviceId = QUuid::createUuid();
+		Query createDeviceQuery(db);
+		createDeviceQuery.prepare(QStringLiteral("INSERT INTO devices "
+												 "(id, userid, name, signscheme, signkey, cryptscheme, cryptkey, fingerprint, keymac) "
+												 "VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?)"));
+		createDeviceQuery.addBindValue(deviceId);
+		createDeviceQuery.addBindValue(userId);
+		createDeviceQuery.addBindValue(name);
+		createDeviceQuery.addBindValue(QString::fromUtf8(signScheme));
+		createDeviceQuery.addBindValue(signKey);
+		createDeviceQuery.addBindValue(QString::fromUtf8(cryptScheme));
+		createDeviceQuery.addBindValue(cryptKey);
+		createDeviceQuery.addBindValue(fingerprint);
+		createDeviceQuery.addBindValue(keyCmac);
+		createDeviceQuery.exec();
+
+		if(!db.commit())
+			throw DatabaseException(db);
+
+		return deviceId;
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+void PostgresController::addNewDeviceToUser(const QUuid &newDeviceId, const QUuid &partnerDeviceId, const QString &name, const QByteArray &signScheme, const QByteArray &signKey, const QByteArray &cryptScheme, const QByteArray &cryptKey, const QByteArray &fingerprint)
+{
+	Metrics::Timer timer(operationLatency("addNewDeviceToUser"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+
+	Query createDeviceQuery(db);
+	createDeviceQuery.prepare(QStringLiteral("INSERT INTO devices "
+											 "(id, userid, name, signscheme, signkey, cryptscheme, cryptkey, fingerprint) "
+											 "VALUES(?, deviceUserId(?), ?, ?, ?, ?, ?, ?) "
+											 "RETURNING userid"));
+	createDeviceQuery.addBindValue(newDeviceId);
+	createDeviceQuery.addBindValue(partnerDeviceId);
+	createDeviceQuery.addBindValue(name);
+	createDeviceQuery.addBindValue(QString::fromUtf8(signScheme));
+	createDeviceQuery.addBindValue(signKey);
+	createDeviceQuery.addBindValue(QString::fromUtf8(cryptScheme));
+	createDeviceQuery.addBindValue(cryptKey);
+	createDeviceQuery.addBindValue(fingerprint);
+	createDeviceQuery.exec();
+	if(createDeviceQuery.first()) {
+		auto userId = createDeviceQuery.value(0).toULongLong();
+		publishDevicesChanged(db, userId);
+		invalidateDevices(userId);
+	}
+}
+
+AsymmetricCryptoInfo *PostgresController::loadCrypto(const QUuid &deviceId, CryptoPP::RandomNumberGenerator &rng, QObject *parent)
+{
+	Metrics::Timer timer(operationLatency("loadCrypto"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+
+	Query loadCryptoQuery(db);
+	loadCryptoQuery.prepare(QStringLiteral("SELECT signscheme, signkey, cryptscheme, cryptkey "
+										   "FROM devices "
+										   "WHERE id = ?"));
+	loadCryptoQuery.addBindValue(deviceId);
+	loadCryptoQuery.exec();
+	if(!loadCryptoQuery.first())
+		return nullptr;
+
+	return new AsymmetricCryptoInfo(rng,
+									loadCryptoQuery.value(0).toString().toUtf8(),
+									loadCryptoQuery.value(1).toByteArray(),
+									loadCryptoQuery.value(2).toString().toUtf8(),
+									loadCryptoQuery.value(3).toByteArray(),
+									parent);
+}
+
+bool PostgresController::updateLogin(const QUuid &deviceId, const QString &name)
+{
+	Metrics::Timer timer(operationLatency("updateLogin"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+
+	Query updateNameQuery(db);
+	//devices marked by the cleanup are about to be removed
+	updateNameQuery.prepare(QStringLiteral("UPDATE devices SET name = ?, lastlogin = current_date "
+										   "WHERE id = ? AND lastlogin != '-infinity'"));
+	updateNameQuery.addBindValue(name);
+	updateNameQuery.addBindValue(deviceId);
+	updateNameQuery.exec();
+	return updateNameQuery.numRowsAffected() > 0;
+}
+
+bool PostgresController::updateCmac(const QUuid &deviceId, quint32 keyIndex, const QByteArray &cmac)
+{
+	Metrics::Timer timer(operationLatency("updateCmac"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		Query updateCmacQuery(db);
+		updateCmacQuery.prepare(QStringLiteral("UPDATE devices SET keymac = ? "
+											   "WHERE id = ? AND ( "
+											   "	SELECT keycount FROM users "
+											   "	WHERE id = deviceUserId(?) "
+											   ") = ?"));
+		updateCmacQuery.addBindValue(cmac);
+		updateCmacQuery.addBindValue(deviceId);
+		updateCmacQuery.addBindValue(deviceId);
+		updateCmacQuery.addBindValue(keyIndex);
+		updateCmacQuery.exec();
+
+		if(updateCmacQuery.numRowsAffected() > 0) {
+			Query removeChangesQuery(db);
+			removeChangesQuery.prepare(QStringLiteral("DELETE FROM keychanges "
+													  "WHERE deviceid = ? "
+													  "AND keyindex = ?"));
+			removeChangesQuery.addBindValue(deviceId);
+			removeChangesQuery.addBindValue(keyIndex);
+			removeChangesQuery.exec();
+
+			if(!db.commit())
+				throw DatabaseException(db);
+			return true;
+		} else {
+			db.rollback();
+			return false;
+		}
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+QList<tuple<QUuid, QString, QByteArray>> PostgresController::listDevices(const QUuid &deviceId)
+{
+	Metrics::Timer timer(operationLatency("listDevices"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	Query loadDevicesQuery(db);
+	loadDevicesQuery.prepare(QStringLiteral("SELECT devices.id, name, fingerprint "
+											"FROM devices "
+											"INNER JOIN users ON devices.userid = users.id "
+											"WHERE devices.id != ? "
+											"AND devices.userid = deviceUserId(?)"));
+	loadDevicesQuery.addBindValue(deviceId);
+	loadDevicesQuery.addBindValue(deviceId);
+	loadDevicesQuery.exec();
+
+	QList<tuple<QUuid, QString, QByteArray>> resList;
+	while(loadDevicesQuery.next()) {
+		resList.append(make_tuple(
+						   loadDevicesQuery.value(0).toUuid(),
+						   loadDevicesQuery.value(1).toString(),
+						   loadDevicesQuery.value(2).toByteArray()
+					   ));
+	}
+	return resList;
+}
+
+void PostgresController::removeDevice(const QUuid &deviceId, const QUuid &deleteId)
+{
+	Metrics::Timer timer(operationLatency("removeDevice"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		Query userIdQuery(db);
+		userIdQuery.prepare(QStringLiteral("SELECT deviceUserId(?)"));
+		userIdQuery.addBindValue(deviceId);
+		userIdQuery.exec();
+		if(!userIdQuery.first()) {
+			if(!db.commit())
+				throw DatabaseException(db);
+			return;
+		}
+
+		auto userId = userIdQuery.value(0).toULongLong();
+		Query deleteDeviceQuery(db);
+		deleteDeviceQuery.prepare(QStringLiteral("DELETE FROM devices "
+												 "WHERE id = ? AND userid = ?"));
+		deleteDeviceQuery.addBindValue(deleteId);
+		deleteDeviceQuery.addBindValue(userId);
+		deleteDeviceQuery.exec();
+
+		Query deleteUserQuery(db);
+		deleteUserQuery.prepare(QStringLiteral("DELETE FROM users WHERE id = ? "
+											   "AND NOT EXISTS ( "
+											   "	SELECT 1 FROM devices "
+											   "	WHERE userid = ? "
+											   ")"));
+		deleteUserQuery.addBindValue(userId);
+		deleteUserQuery.addBindValue(userId);
+		deleteUserQuery.exec();
+
+		publishDevicesChanged(db, userId);
+		if(!db.commit())
+			throw DatabaseException(db);
+		invalidateDevices(userId);
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+bool PostgresController::addChange(const QUuid &deviceId, const QByteArray &dataId, const quint32 keyIndex, const QByteArray &salt, const QByteArray &data)
+{
+	Metrics::Timer timer(operationLatency("addChange"));
+	QByteArray blob;
+	if(!storeBlob(deviceId, data, blob)) {
+		qWarning() << "Device" << deviceId << "hit quota limit";
+		return false;
+	}
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		QStringList targets;
+		for(const auto &device : userDevices(db, deviceId)) {
+			if(device != deviceId)
+				targets.append(device.toString().mid(1, 36)); //without the braces, as they delimit the array
+		}
+
+		if(targets.isEmpty()) { //no devices to be notified -> only remove the previous version
+			Query removeChangeQuery(db);
+			removeChangeQuery.prepare(QStringLiteral("DELETE FROM datachanges WHERE deviceid = ? AND dataid = ?"));
+			removeChangeQuery.addBindValue(deviceId);
+			removeChangeQuery.addBindValue(dataId);
+			removeChangeQuery.exec();
+		} else {
+			// replace the data change in place. The new id moves the pending device changes along
+			// and keeps acks of the previous version from completing this one
+			Query addChangeQuery(db);
+			addChangeQuery.prepare(QStringLiteral("INSERT INTO datachanges (deviceid, dataid, keyid, salt, data, blob, blobsize) "
+												  "VALUES(?, ?, ?, ?, ?, ?, ?) "
+												  "ON CONFLICT (deviceid, dataid) DO UPDATE SET "
+												  "	id = nextval(pg_get_serial_sequence('datachanges', 'id')), "
+												  "	keyid = EXCLUDED.keyid, "
+												  "	salt = EXCLUDED.salt, "
+												  "	data = EXCLUDED.data, "
+												  "	blob = EXCLUDED.blob, "
+												  "	blobsize = EXCLUDED.blobsize "
+												  "RETURNING id"));
+			addChangeQuery.addBindValue(deviceId);
+			addChangeQuery.addBindValue(dataId);
+			addChangeQuery.addBindValue(keyIndex);
+			addChangeQuery.addBindValue(salt);
+			bindData(addChangeQuery, data, blob);
+			addChangeQuery.exec();
+			if(!addChangeQuery.first())
+				throw DatabaseException(QSqlError(QString(), QStringLiteral("Unable to get id of last inserted data change")));
+			auto nId = addChangeQuery.value(0);
+
+			// add the change for all other devices at once. Devices removed since they were cached are skipped
+			Query updateDevicesQuery(db);
+			if(_partitioned) {
+				updateDevicesQuery.prepare(QStringLiteral("INSERT INTO devicechanges(dataid, deviceid, sourceid) "
+														  "SELECT ?, devices.id, ? FROM devices "
+														  "WHERE devices.id = ANY(?::UUID[]) "
+														  "ON CONFLICT DO NOTHING"));
+				updateDevicesQuery.addBindValue(nId);
+				updateDevicesQuery.addBindValue(deviceId);
+			} else {
+				updateDevicesQuery.prepare(QStringLiteral("INSERT INTO devicechanges(dataid, deviceid) "
+														  "SELECT ?, devices.id FROM devices "
+														  "WHERE devices.id = ANY(?::UUID[]) "
+														  "ON CONFLICT DO NOTHING"));
+				updateDevicesQuery.addBindValue(nId);
+			}
+			updateDevicesQuery.addBindValue(QLatin1Char('{') + targets.join(QLatin1Char(',')) + QLatin1Char('}'));
+			updateDevicesQuery.exec();
+
+			if(updateDevicesQuery.numRowsAffected() == 0) { //the cached devices are gone (or already had it) -> remove the data if unused
+				Query removeChangeQuery(db);
+				removeChangeQuery.prepare(QStringLiteral("DELETE FROM datachanges "
+														 "WHERE deviceid = ? AND id = ? "
+														 "AND NOT EXISTS ( "
+														 "	SELECT 1 FROM devicechanges "
+														 "	WHERE devicechanges.dataid = datachanges.id "
+														 ")"));
+				removeChangeQuery.addBindValue(deviceId);
+				removeChangeQuery.addBindValue(nId);
+				removeChangeQuery.exec();
+			}
+		}
+
+		if(_quotaSlack > 0 && !checkQuotaLedger(db, deviceId)) {
+			db.rollback();
+			qWarning() << "Device" << deviceId << "hit quota limit";
+			return false;
+		}
+
+		if(!db.commit())
+			throw DatabaseException(db);
+		return true;
+	} catch(DatabaseException &e) {
+		//check_violation from https://www.postgresql.org/docs/current/static/errcodes-appendix.html
+		auto isCheck = (e.error().nativeErrorCode() == QStringLiteral("23514"));
+		db.rollback();
+		if(isCheck) {
+			qWarning() << "Device" << deviceId << "hit quota limit";
+			return false;
+		} else
+			throw;
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+bool PostgresController::addDeviceChange(const QUuid &deviceId, const QUuid &targetId, const QByteArray &dataId, const quint32 keyIndex, const QByteArray &salt, const QByteArray &data)
+{
+	Metrics::Timer timer(operationLatency("addDeviceChange"));
+	QByteArray blob;
+	if(!storeBlob(deviceId, data, blob)) {
+		qWarning() << "Device" << deviceId << "hit quota limit";
+		return false;
+	}
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		// add the data change (or ignore, if already existing)
+		Query addChangeQuery(db);
+		addChangeQuery.prepare(QStringLiteral("INSERT INTO datachanges (deviceid, dataid, keyid, salt, data, blob, blobsize) "
+											  "VALUES(?, ?, ?, ?, ?, ?, ?) "
+											  "ON CONFLICT(deviceid, dataid) DO NOTHING "
+											  "RETURNING id"));
+		addChangeQuery.addBindValue(deviceId);
+		addChangeQuery.addBindValue(dataId);
+		addChangeQuery.addBindValue(keyIndex);
+		addChangeQuery.addBindValue(salt);
+		bindData(addChangeQuery, data, blob);
+		addChangeQuery.exec();
+
+		//get the id of the data
+		QVariant nId;
+		if(addChangeQuery.first())
+			nId = addChangeQuery.value(0);
+		else {//insert was ignored, as data already exists
+			Query getIdQuery(db);
+			getIdQuery.prepare(QStringLiteral("SELECT id FROM datachanges WHERE deviceid = ? AND dataid = ?"));
+			getIdQuery.addBindValue(deviceId);
+			getIdQuery.addBindValue(dataId);
+			getIdQuery.exec();
+			if(!getIdQuery.first()){
+				db.rollback();
+				throw DatabaseException(QSqlError(QString(), QStringLiteral("Unable to get id of last inserted data change")));
+			} else
+				nId = getIdQuery.value(0);
+		}
+
+		// add a change for the device (or ignore)
+		Query updateDevicesQuery(db);
+		if(_partitioned) {
+			updateDevicesQuery.prepare(QStringLiteral("INSERT INTO devicechanges(dataid, deviceid, sourceid) "
+													  "VALUES(?, ?, ?) "
+													  "ON CONFLICT DO NOTHING"));
+		} else {
+			updateDevicesQuery.prepare(QStringLiteral("INSERT INTO devicechanges(dataid, deviceid) "
+													  "VALUES(?, ?) "
+													  "ON CONFLICT DO NOTHING"));
+		}
+		updateDevicesQuery.addBindValue(nId);
+		updateDevicesQuery.addBindValue(targetId);
+		if(_partitioned)
+			updateDevicesQuery.addBindValue(deviceId);
+		updateDevicesQuery.exec();
+
+		if(_quotaSlack > 0 && !checkQuotaLedger(db, deviceId)) {
+			db.rollback();
+			qWarning() << "Device" << deviceId << "hit quota limit";
+			return false;
+		}
+
+		if(!db.commit())
+			throw DatabaseException(db);
+		return true;
+	} catch(DatabaseException &e) {
+		//check_violation from https://www.postgresql.org/docs/current/static/errcodes-appendix.html
+		auto isCheck = (e.error().nativeErrorCode() == QStringLiteral("23514"));
+		db.rollback();
+		if(isCheck) {
+			qWarning() << "Device" << deviceId << "hit quota limit";
+			return false;
+		} else
+			throw;
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+quint32 PostgresController::changeCount(const QUuid &deviceId)
+{
+	Metrics::Timer timer(operationLatency("changeCount"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	Query countChangesQuery(db);
+	countChangesQuery.prepare(QStringLiteral("SELECT COUNT(*) FROM devicechanges WHERE deviceid = ?"));
+	countChangesQuery.addBindValue(deviceId);
+	countChangesQuery.exec();
+	if(countChangesQuery.first())
+		return countChangesQuery.value(0).toUInt();
+	else
+		return 0;
+}
+
+QList<tuple<quint64, quint32, QByteArray, QByteArray>> PostgresController::loadNextChanges(const QUuid &deviceId, quint32 count, quint64 lastIndex)
+{
+	Metrics::Timer timer(operationLatency("loadNextChanges"));
+	QList<tuple<quint64, quint32, QByteArray, QByteArray>> resList;
+	QHash<int, QByteArray> blobs; //index in the result -> key
+	{
+		auto connection = pool()->acquire();
+		auto db = connection.database();
+
+		//continue after the last index instead of skipping rows, uses the (deviceid, dataid) primary key
+		Query loadChangesQuery(db);
+		if(_partitioned) {
+			//the uploading device selects the partition of the data
+			loadChangesQuery.prepare(QStringLiteral("SELECT id, keyid, salt, data, blob FROM devicechanges "
+													"INNER JOIN datachanges ON datachanges.deviceid = devicechanges.sourceid "
+													"AND datachanges.id = devicechanges.dataid "
+													"WHERE devicechanges.deviceid = ? "
+													"AND devicechanges.dataid > ? "
+													"ORDER BY devicechanges.dataid "
+													"LIMIT ?"));
+		} else {
+			loadChangesQuery.prepare(QStringLiteral("SELECT id, keyid, salt, data, blob FROM devicechanges "
+													"INNER JOIN datachanges ON datachanges.id = devicechanges.dataid "
+													"WHERE devicechanges.deviceid = ? "
+													"AND devicechanges.dataid > ? "
+													"ORDER BY devicechanges.dataid "
+													"LIMIT ?"));
+		}
+		loadChangesQuery.addBindValue(deviceId);
+		loadChangesQuery.addBindValue(lastIndex);
+		loadChangesQuery.addBindValue(count);
+		loadChangesQuery.exec();
+
+		while(loadChangesQuery.next()) {
+			if(!loadChangesQuery.isNull(4))
+				blobs.insert(resList.size(), loadChangesQuery.value(4).toByteArray());
+			resList.append(make_tuple(
+							   (quint64)loadChangesQuery.value(0).toULongLong(),
+							   (quint32)loadChangesQuery.value(1).toUInt(),
+							   loadChangesQuery.value(2).toByteArray(),
+							   loadChangesQuery.value(3).toByteArray()
+						   ));
+		}
+	}
+
+	//offloaded data is read from the blob store, after the connection was given back
+	QList<quint64> missing;
+	for(auto it = blobs.constBegin(); it != blobs.constEnd(); ++it) {
+		auto data = _blobs.load(it.value());
+		if(data.isNull()) {
+			qWarning() << "Unable to load blob" << it.value().toHex()
+					   << "- skipping the change for device" << deviceId;
+			missing.append(get<0>(resList[it.key()]));
+		} else
+			get<3>(resList[it.key()]) = data;
+	}
+
+	//a lost blob can never be delivered, so it is completed instead of blocking the device forever
+	if(!missing.isEmpty()) {
+		static auto missingBlobs = qApp->metrics()->counter("qdsapp_blobs_missing_total",
+															"Number of downloads skipped, because their blob could not be loaded");
+		missingBlobs->add(static_cast<quint64>(missing.size()));
+		completeChanges(deviceId, missing);
+		for(auto it = resList.begin(); it != resList.end();) {
+			if(missing.contains(get<0>(*it)))
+				it = resList.erase(it);
+			else
+				++it;
+		}
+	}
+	return resList;
+}
+
+void PostgresController::completeChanges(const QUuid &deviceId, const QList<quint64> &dataIndexes)
+{
+	if(dataIndexes.isEmpty())
+		return;
+
+	//pass all indexes as one array, so any number of changes is completed in a single statement
+	QStringList indexList;
+	indexList.reserve(dataIndexes.size());
+	for(auto dataIndex : dataIndexes)
+		indexList.append(QString::number(dataIndex));
+
+	Metrics::Timer timer(operationLatency("completeChanges"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	Query completeQuery(db);
+	//the main statement does not see the rows deleted by the CTE, so it must ignore them explicitly
+	if(_partitioned) {
+		completeQuery.prepare(QStringLiteral("WITH completed AS ( "
+											 "	DELETE FROM devicechanges "
+											 "	WHERE deviceid = ? AND dataid = ANY(?::BIGINT[]) "
+											 "	RETURNING sourceid, dataid "
+											 ") "
+											 "DELETE FROM datachanges "
+											 "WHERE (deviceid, id) IN (SELECT sourceid, dataid FROM completed) "
+											 "AND NOT EXISTS ( "
+											 "	SELECT 1 FROM devicechanges "
+											 "	WHERE devicechanges.dataid = datachanges.id "
+											 "	AND devicechanges.deviceid != ? "
+											 ")"));
+	} else {
+		completeQuery.prepare(QStringLiteral("WITH completed AS ( "
+											 "	DELETE FROM devicechanges "
+											 "	WHERE deviceid = ? AND dataid = ANY(?::BIGINT[]) "
+											 "	RETURNING dataid "
+											 ") "
+											 "DELETE FROM datachanges "
+											 "WHERE id IN (SELECT dataid FROM completed) "
+											 "AND NOT EXISTS ( "
+											 "	SELECT 1 FROM devicechanges "
+											 "	WHERE devicechanges.dataid = datachanges.id "
+											 "	AND devicechanges.deviceid != ? "
+											 ")"));
+	}
+	completeQuery.addBindValue(deviceId);
+	completeQuery.addBindValue(QStringLiteral("{%1}").arg(indexList.join(QLatin1Char(','))));
+	completeQuery.addBindValue(deviceId);
+	completeQuery.exec();
+}
+
+QList<tuple<QUuid, QByteArray, QByteArray, QByteArray>> PostgresController::tryKeyChange(const QUuid &deviceId, quint32 proposedIndex, int &offset)
+{
+	offset = -1;
+
+	Metrics::Timer timer(operationLatency("tryKeyChange"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		//load current key index
+		Query readIndexQuery(db);
+		readIndexQuery.prepare(QStringLiteral("SELECT keycount, id FROM users "
+											  "WHERE id = deviceUserId(?)"));
+		readIndexQuery.addBindValue(deviceId);
+		readIndexQuery.exec();
+		if(!readIndexQuery.first())
+			throw DatabaseException(db);
+		auto currentIndex = readIndexQuery.value(0).toUInt();
+		auto userId = readIndexQuery.value(1).toULongLong();
+		offset = proposedIndex - currentIndex;
+		if(offset != 1) { //only when 1 the rest is needed
+			if(!db.commit())
+				throw DatabaseException(db);
+			return {};
+		}
+
+		//check if any device still has keychanges
+		Query hasKeyChangesQuery(db);
+		hasKeyChangesQuery.prepare(QStringLiteral("SELECT 1 FROM keychanges "
+												  "INNER JOIN devices ON keychanges.deviceid = devices.id "
+												  "INNER JOIN users ON devices.userid = users.id "
+												  "WHERE users.id = ?"));
+		hasKeyChangesQuery.addBindValue(userId);
+		hasKeyChangesQuery.exec();
+		if(hasKeyChangesQuery.first()) {
+			offset = -1;
+			if(!db.commit())
+				throw DatabaseException(db);
+			return {};
+		}
+
+		//load device keys
+		Query deviceKeysQuery(db);
+		deviceKeysQuery.prepare(QStringLiteral("SELECT id, cryptscheme, cryptkey, keymac FROM devices "
+											   "WHERE id != ? "
+											   "AND userid = ?"));
+		deviceKeysQuery.addBindValue(deviceId);
+		deviceKeysQuery.addBindValue(userId);
+		deviceKeysQuery.exec();
+
+		QList<tuple<QUuid, QByteArray, QByteArray, QByteArray>> result;
+		while(deviceKeysQuery.next()) {
+			result.append(make_tuple(
+							  deviceKeysQuery.value(0).toUuid(),
+							  deviceKeysQuery.value(1).toByteArray(),
+							  deviceKeysQuery.value(2).toByteArray(),
+							  deviceKeysQuery.value(3).toByteArray()
+						  ));
+		}
+
+		if(!db.commit())
+			throw DatabaseException(db);
+		return result;
+	} catch(...) {
+		offset = -1;
+		db.rollback();
+		throw;
+	}
+}
+
+bool PostgresController::updateExchangeKey(const QUuid &deviceId, quint32 keyIndex, const QByteArray &scheme, const QByteArray &cmac, const QList<tuple<QUuid, QByteArray, QByteArray>> &deviceKeys)
+{
+	Metrics::Timer timer(operationLatency("updateExchangeKey"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		Query updateKeyCountQuery(db);
+		updateKeyCountQuery.prepare(QStringLiteral("UPDATE users SET keycount = keycount + 1"
+												   "WHERE id = deviceUserId(?) "
+												   "AND (keycount + 1) = ? "
+												   "RETURNING id"));
+		updateKeyCountQuery.addBindValue(deviceId);
+		updateKeyCountQuery.addBindValue(keyIndex);
+		updateKeyCountQuery.exec();
+		if(updateKeyCountQuery.numRowsAffected() != 1) {
+			db.rollback();
+			return false;
+		}
+		if(!updateKeyCountQuery.first())
+			throw DatabaseException(db);
+		auto userId = updateKeyCountQuery.value(0).toULongLong();
+
+		for(auto device : deviceKeys) {
+			//check if the device belongs to the same user
+			Query checkAllowedQuery(db);
+			checkAllowedQuery.prepare(QStringLiteral("SELECT 1 FROM devices "
+													 "WHERE id = ? "
+													 "AND userid = ?"));
+			checkAllowedQuery.addBindValue(get<0>(device));
+			checkAllowedQuery.addBindValue(userId);
+			checkAllowedQuery.exec();
+			if(!checkAllowedQuery.first())
+				throw DatabaseException(db);
+
+			//add the keychange
+			Query addKeyQuery(db);
+			addKeyQuery.prepare(QStringLiteral("INSERT INTO keychanges "
+											   "(deviceid, keyindex, scheme, key, verifymac) "
+											   "VALUES(?, ?, ?, ?, ?)"));
+			addKeyQuery.addBindValue(get<0>(device));
+			addKeyQuery.addBindValue(keyIndex);
+			addKeyQuery.addBindValue(QString::fromUtf8(scheme));
+			addKeyQuery.addBindValue(get<1>(device));
+			addKeyQuery.addBindValue(get<2>(device));
+			addKeyQuery.exec();
+		}
+
+		//update the cmac
+		Query updateCmacQuery(db);
+		updateCmacQuery.prepare(QStringLiteral("UPDATE devices SET keymac = ? "
+											   "WHERE id = ?"));
+		updateCmacQuery.addBindValue(cmac);
+		updateCmacQuery.addBindValue(deviceId);
+		updateCmacQuery.exec();
+
+		if(!db.commit())
+			throw DatabaseException(db);
+		return true;
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+tuple<quint32, QByteArray, QByteArray, QByteArray> PostgresController::loadKeyChanges(const QUuid &deviceId)
+{
+	Metrics::Timer timer(operationLatency("loadKeyChanges"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+
+	Query keyChangesQuery(db);
+	keyChangesQuery.prepare(QStringLiteral("SELECT keyindex, scheme, key, verifymac FROM keychanges "
+										   "WHERE deviceid = ? "
+										   "ORDER BY keyindex ASC"));
+	keyChangesQuery.addBindValue(deviceId);
+	keyChangesQuery.exec();
+
+	QList<tuple<quint32, QByteArray, QByteArray, QByteArray>> result;
+	if(keyChangesQuery.first()) {
+		return make_tuple(
+			(quint32)keyChangesQuery.value(0).toUInt(),
+			keyChangesQuery.value(1).toByteArray(),
+			keyChangesQuery.value(2).toByteArray(),
+			keyChangesQuery.value(3).toByteArray()
+		);
+	} else
+		return make_tuple((quint32)0, QByteArray(), QByteArray(), QByteArray());
+}
+
+bool PostgresController::cleanupBatch(quint64 offlineSinceDays, int batchSize, CleanupProgress &progress)
+{
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		//continue with a marked device, or mark the next inactive one. Marked devices cannot log in anymore
+		Query markedQuery(db);
+		markedQuery.prepare(QStringLiteral("SELECT id, userid FROM devices "
+										   "WHERE lastlogin = '-infinity' "
+										   "LIMIT 1"));
+		markedQuery.exec();
+		auto hasDevice = markedQuery.first();
+		auto deviceId = hasDevice ? markedQuery.value(0).toUuid() : QUuid();
+		auto userId = hasDevice ? markedQuery.value(1).toULongLong() : 0;
+		if(!hasDevice && offlineSinceDays > 0) {
+			Query markQuery(db);
+			markQuery.prepare(QStringLiteral("UPDATE devices SET lastlogin = '-infinity' "
+											 "WHERE id = ( "
+											 "	SELECT id FROM devices "
+											 "	WHERE lastlogin < current_date - CAST(? AS INT) "
+											 "	LIMIT 1 "
+											 "	FOR UPDATE SKIP LOCKED "
+											 ") "
+											 "RETURNING id, userid"));
+			markQuery.addBindValue(offlineSinceDays);
+			markQuery.exec();
+			hasDevice = markQuery.first();
+			if(hasDevice) {
+				deviceId = markQuery.value(0).toUuid();
+				userId = markQuery.value(1).toULongLong();
+			}
+		}
+
+		auto more = true;
+		auto removedDevice = false;
+		if(hasDevice) {
+			//first the pending changes of the device, then it's own data (and the changes of other devices for it)
+			Query deleteDeviceChangesQuery(db);
+			deleteDeviceChangesQuery.prepare(QStringLiteral("DELETE FROM devicechanges "
+															"WHERE deviceid = ? AND dataid IN ( "
+															"	SELECT dataid FROM devicechanges "
+															"	WHERE deviceid = ? "
+															"	LIMIT ? "
+															")"));
+			deleteDeviceChangesQuery.addBindValue(deviceId);
+			deleteDeviceChangesQuery.addBindValue(deviceId);
+			deleteDeviceChangesQuery.addBindValue(batchSize);
+			deleteDeviceChangesQuery.exec();
+			auto rows = deleteDeviceChangesQuery.numRowsAffected();
+
+			if(rows == 0) {
+				Query deleteDataQuery(db);
+				deleteDataQuery.prepare(QStringLiteral("DELETE FROM datachanges "
+													   "WHERE deviceid = ? AND id IN ( "
+													   "	SELECT id FROM datachanges "
+													   "	WHERE deviceid = ? "
+													   "	LIMIT ? "
+													   ")"));
+				deleteDataQuery.addBindValue(deviceId);
+				deleteDataQuery.addBindValue(deviceId);
+				deleteDataQuery.addBindValue(batchSize);
+				deleteDataQuery.exec();
+				rows = deleteDataQuery.numRowsAffected();
+			}
+
+			if(rows == 0) {
+				Query deleteDeviceQuery(db);
+				deleteDeviceQuery.prepare(QStringLiteral("DELETE FROM devices WHERE id = ?"));
+				deleteDeviceQuery.addBindValue(deviceId);
+				deleteDeviceQuery.exec();
+				removedDevice = deleteDeviceQuery.numRowsAffected() > 0;
+				if(removedDevice) {
+					publishDevicesChanged(db, userId);
+					progress.devices++;
+				}
+			} else
+				progress.changes += static_cast<quint64>(rows);
+		} else {
+			Query deleteUsersQuery(db);
+			deleteUsersQuery.prepare(QStringLiteral("DELETE FROM users "
+													"WHERE id IN ( "
+													"	SELECT id FROM users "
+													"	WHERE NOT EXISTS ( "
+													"		SELECT 1 FROM devices "
+													"		WHERE userid = users.id "
+													"	) "
+													"	LIMIT ? "
+													")"));
+			deleteUsersQuery.addBindValue(batchSize);
+			deleteUsersQuery.exec();
+			auto rows = deleteUsersQuery.numRowsAffected();
+			progress.users += static_cast<quint64>(qMax(rows, 0));
+			more = rows > 0;
+		}
+
+		if(!db.commit())
+			throw DatabaseException(db);
+		if(removedDevice)
+			invalidateDevices(userId);
+		return more;
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+bool PostgresController::startLiveSync()
+{
+	//the listening connection must stay open, so it is not borrowed from the pool
+	_notifyDbName = QUuid::createUuid().toString();
+	pool()->createConnection(_notifyDbName);
+	if(!subscribeNotify())
+		return false;
+
+	auto delay = qApp->configuration()->value(QStringLiteral("database/keepaliveInterval"), 5).toInt();
+	if(delay > 0) {
+		_keepAliveTimer = new QTimer(this);
+		_keepAliveTimer->setInterval(scdtime(minutes(delay)));
+		_keepAliveTimer->setTimerType(Qt::VeryCoarseTimer);
+		connect(_keepAliveTimer, &QTimer::timeout,
+				this, &PostgresController::timeout);
+		_keepAliveTimer->start();
+		qInfo() << "Keepalives enabled";
+	} else
+		qInfo() << "Keepalives disabled";
+	return true;
+}
+
+void PostgresController::dbInitDone(bool success)
+{
+	if(success && _quotaSlack > 0) {
+		_quotaTimer = new QTimer(this);
+		_quotaTimer->setInterval(scdtime(minutes(1)));
+		_quotaTimer->setTimerType(Qt::VeryCoarseTimer);
+		connect(_quotaTimer, &QTimer::timeout,
+				this, &PostgresController::foldQuota);
+		_quotaTimer->start();
+		qInfo() << "Quota ledger enabled with a slack of" << _quotaSlack << "bytes";
+	}
+
+	if(success && _blobs.isEnabled()) {
+		_blobTimer = new QTimer(this);
+		_blobTimer->setInterval(scdtime(hours(1)));
+		_blobTimer->setTimerType(Qt::VeryCoarseTimer);
+		connect(_blobTimer, &QTimer::timeout,
+				this, &PostgresController::sweepBlobs);
+		_blobTimer->start();
+		qInfo() << "Blob store enabled for changes of at least"
+				<< qApp->configuration()->value(QStringLiteral("blobs/threshold"), 65536).toLongLong() << "bytes";
+	}
+
+	DatabaseController::dbInitDone(success);
+}
+
+void PostgresController::onNotify(const QString &name, QSqlDriver::NotificationSource source, const QVariant &payload)
+{
+	Q_UNUSED(source)
+	if(name == QStringLiteral("deviceDataEvent")) {
+		auto device = payload.toUuid();
+		if(device.isNull())
+			qWarning() << "Invalid event data for deviceDataEvent:" << payload;
+		else
+			deviceChanged(device);
+	} else if(name == QStringLiteral("devicesEvent")) {
+		auto ok = false;
+		auto userId = payload.toULongLong(&ok);
+		if(!ok)
+			qWarning() << "Invalid event data for devicesEvent:" << payload;
+		else
+			invalidateDevices(userId);
+	} else if(name == QStringLiteral("clusterEvent"))
+		emit eventReceived(QByteArray::fromBase64(payload.toString().toLatin1()));
+}
+
+bool PostgresController::publishEvent(const QByteArray &event)
+{
+	if(_notifyDbName.isNull())
+		return false;
+
+	auto payload = QString::fromLatin1(event.toBase64());
+	if(payload.size() >= ClusterPayloadLimit) {
+		qWarning() << "Cluster event of" << event.size() << "bytes is too large to be published";
+		return false;
+	}
+
+	//sent via the listening connection, so the events of this server stay in order
+	auto db = QSqlDatabase::database(_notifyDbName, false);
+	QSqlQuery notifyQuery(db);
+	notifyQuery.prepare(QStringLiteral("SELECT pg_notify('clusterEvent', ?)"));
+	notifyQuery.addBindValue(payload);
+	if(!notifyQuery.exec()) {
+		qWarning().noquote() << "Failed to publish cluster event."
+								"\nDatabase Error:"
+							 << notifyQuery.lastError().text();
+		return false;
+	}
+	return true;
+}
+
+void PostgresController::timeout()
+{
+	if(_notifyDbName.isNull())
+		return;
+
+	auto db = QSqlDatabase::database(_notifyDbName, false);
+	QSqlQuery query(db);
+	if(!query.exec(QStringLiteral("SELECT NULL"))) {
+		qWarning().noquote() << "Keepalive query failed! Reconnecting for live updates."
+								"\nDatabase Error:"
+							 << query.lastError().text();
+		db.close();
+		if(!subscribeNotify()) {
+			qCritical() << "Unabled to reconnect for change events. Devices will not receive updates until the next keepalive!";
+		}
+	} else
+		qDebug() << "Keepalive succeeded";
+}
+
+bool PostgresController::subscribeNotify()
+{
+	auto db = QSqlDatabase::database(_notifyDbName, false);
+	if(!db.isOpen() && !db.open()) {
+		qCritical() << "Failed to open database with error:"
+					<< qPrintable(db.lastError().text());
+		return false;
+	}
+
+	//reopening the connection creates a new driver
+	auto driver = db.driver();
+	connect(driver, QOverload<const QString &, QSqlDriver::NotificationSource, const QVariant &>::of(&QSqlDriver::notification),
+			this, &PostgresController::onNotify,
+			Qt::UniqueConnection);
+	return driver->subscribeToNotification(QStringLiteral("deviceDataEvent")) &&
+			driver->subscribeToNotification(QStringLiteral("devicesEvent")) &&
+			driver->subscribeToNotification(QStringLiteral("clusterEvent"));
+}
+
+bool PostgresController::tableExists(QSqlDatabase &db, const QString &table)
+{
+	Query existsQuery(db);
+	existsQuery.prepare(QStringLiteral("SELECT EXISTS(SELECT 1 FROM pg_class "
+									   "WHERE relname = ? AND relkind IN ('r', 'p') AND pg_table_is_visible(oid))"));
+	existsQuery.addBindValue(table);
+	existsQuery.exec();
+	return existsQuery.first() && existsQuery.value(0).toBool();
+}
+
+void PostgresController::initDatabase(quint64 quota, bool forceQuota)
+{
+	try {
+		Metrics::Timer timer(operationLatency("initDatabase"));
+		auto connection = pool()->acquire();
+		auto db = connection.database();
+
+//#define AUTO_DROP_TABLES
+#ifdef AUTO_DROP_TABLES
+		QSqlQuery dropQuery(db);
+		if(!dropQuery.exec(QStringLiteral("DROP TABLE IF EXISTS devicechanges, datachanges, devices, users CASCADE"))) {
+			qWarning() << "Failed to drop tables with error:"
+					   << qPrintable(dropQuery.lastError().text());
+		} else
+			qInfo() << "Dropped all existing tables";
+#endif
+
+		static const auto features = {
+			QSqlDriver::Transactions,
+			QSqlDriver::BLOB,
+			QSqlDriver::PreparedQueries,
+			QSqlDriver::PositionalPlaceholders,
+			QSqlDriver::LastInsertId,
+			QSqlDriver::EventNotifications
+		};
+		auto driver = db.driver();
+		for(auto feature : features) {
+			if(!driver->hasFeature(feature))
+				throw DatabaseException(QSqlError(QStringLiteral("Driver does not support feature %1").arg(feature)));
+		}
+
+		if(!db.tables().contains(QStringLiteral("users"))) {
+			QSqlQuery createUsers(db);
+			if(!createUsers.exec(QStringLiteral("CREATE TABLE users ( "
+											   "	id			BIGSERIAL PRIMARY KEY NOT NULL, "
+											   "	keycount	INT NOT NULL DEFAULT 0, "
+											   "	quota		BIGINT NOT NULL DEFAULT 0, "
+											   "	quotalimit	BIGINT NOT NULL DEFAULT %1, "
+											   "	CHECK(quota < quotalimit) " //10 MB
+											   ")")
+								 .arg(quota))) {
+				throw DatabaseException(createUsers);
+			}
+
+			qDebug() << "Created table users (+ functions and triggers)";
+		} else {
+			//the limits are checked against the quota, so it must be up to date
+			if(db.tables().contains(QStringLiteral("quotaledger")))
+				foldQuotaLedger(db);
+			updateQuotaLimit(quota, forceQuota);
+		}
+
+		if(!db.tables().contains(QStringLiteral("devices"))) {
+			QSqlQuery createDevices(db);
+			if(!createDevices.exec(QStringLiteral("CREATE TABLE devices ( "
+												  "		id			UUID PRIMARY KEY NOT NULL, "
+												  "		userid		BIGINT NOT NULL REFERENCES users(id), "
+												  "		name		TEXT NOT NULL, "
+												  "		signscheme	TEXT NOT NULL, "
+												  "		signkey		BYTEA NOT NULL, "
+												  "		cryptscheme	TEXT NOT NULL, "
+												  "		cryptkey	BYTEA NOT NULL, "
+												  "		fingerprint	BYTEA NOT NULL, "
+												  "		keymac		BYTEA, "
+												  "		lastlogin	DATE NOT NULL DEFAULT current_date "
+												  ")"))) {
+				throw DatabaseException(createDevices);
+			}
+
+			QSqlQuery createUserIdFn(db);
+			if(!createUserIdFn.exec(QStringLiteral("CREATE OR REPLACE FUNCTION deviceUserId(device UUID) "
+												   "RETURNS BIGINT AS $BODY$ "
+												   "DECLARE "
+												   "	uid BIGINT; "
+												   "BEGIN "
+												   "	SELECT devices.userid INTO uid FROM devices WHERE id = device; "
+												   "	RETURN uid; "
+												   "END; "
+												   "$BODY$ LANGUAGE plpgsql;"))) {
+				throw DatabaseException(createUserIdFn);
+			}
+
+			qDebug() << "Created table devices (+ functions and triggers)";
+		}
+
+		//partitioned tables are not listed by the driver
+		if(!tableExists(db, QStringLiteral("datachanges"))) {
+			QSqlQuery createDataChanges(db);
+			if(!createDataChanges.exec(QStringLiteral("CREATE TABLE datachanges ( "
+													  "		id			BIGSERIAL PRIMARY KEY NOT NULL, "
+													  "		deviceid	UUID NOT NULL REFERENCES devices(id) ON DELETE CASCADE, "
+													  "		dataid		BYTEA NOT NULL, "
+													  "		keyid		INT NOT NULL, "
+													  "		salt		BYTEA NOT NULL, "
+													  "		data		BYTEA NOT NULL, "
+													  "		blob		BYTEA, "
+													  "		blobsize	BIGINT, "
+													  "		UNIQUE(deviceid, dataid) "
+													  ")"))) {
+				throw DatabaseException(createDataChanges);
+			}
+
+			initQuotaFunctions(db);
+
+			//the quota triggers are created by initQuotaLedger, depending on the accounting mode
+			qDebug() << "Created table datachanges (+ functions and triggers)";
+		}
+
+		if(!tableExists(db, QStringLiteral("devicechanges"))) {
+			QSqlQuery createDeviceChanges(db);
+			if(!createDeviceChanges.exec(QStringLiteral("CREATE TABLE devicechanges ( "
+														"	deviceid	UUID NOT NULL REFERENCES devices(id) ON DELETE CASCADE, "
+														"	dataid		BIGINT NOT NULL REFERENCES datachanges(id) ON DELETE CASCADE ON UPDATE CASCADE, "
+														"	PRIMARY KEY(deviceid, dataid) "
+														")"))) {
+				throw DatabaseException(createDeviceChanges);
+			}
+
+			QSqlQuery createNotifyFn(db);
+			if(!createNotifyFn.exec(QStringLiteral("CREATE OR REPLACE FUNCTION notifyDeviceChange() RETURNS TRIGGER AS $BODY$ "
+												   "BEGIN "
+												   "	PERFORM pg_notify('deviceDataEvent', NEW.deviceid::text); "
+												   "	RETURN NEW; "
+												   "END; "
+												   "$BODY$ LANGUAGE plpgsql VOLATILE;"))) {
+				throw DatabaseException(createNotifyFn);
+			}
+
+			QSqlQuery createNotifyTrigger(db);
+			if(!createNotifyTrigger.exec(QStringLiteral("CREATE TRIGGER device_change_trigger "
+														"AFTER INSERT "
+														"ON devicechanges "
+														"FOR EACH ROW "
+														"EXECUTE PROCEDURE notifyDeviceChange();"))) {
+				throw DatabaseException(createNotifyTrigger);
+			}
+
+			qDebug() << "Created table devicechanges (+ functions and triggers)";
+		}
+
+		initBlobColumns(db);
+		initPartitions(db);
+		initNotifyTrigger(db);
+		initChangeUpserts(db);
+		initQuotaLedger(db);
+
+		//the primary key only covers lookups by device - completing changes searches by data
+		QSqlQuery createDataIndex(db);
+		if(!createDataIndex.exec(QStringLiteral("CREATE INDEX IF NOT EXISTS devicechanges_dataid_idx "
+												"ON devicechanges (dataid)"))) {
+			throw DatabaseException(createDataIndex);
+		}
+
+		//the blob sweep searches for references
+		QSqlQuery createBlobIndex(db);
+		if(!createBlobIndex.exec(QStringLiteral("CREATE INDEX IF NOT EXISTS datachanges_blob_idx "
+												"ON datachanges (blob) WHERE blob IS NOT NULL"))) {
+			throw DatabaseException(createBlobIndex);
+		}
+
+		//uploaded changes are fanned out to all devices of the user
+		QSqlQuery createUserIndex(db);
+		if(!createUserIndex.exec(QStringLiteral("CREATE INDEX IF NOT EXISTS devices_userid_idx "
+												"ON devices (userid)"))) {
+			throw DatabaseException(createUserIndex);
+		}
+
+		//the cleanup searches for inactive devices
+		QSqlQuery createLoginIndex(db);
+		if(!createLoginIndex.exec(QStringLiteral("CREATE INDEX IF NOT EXISTS devices_lastlogin_idx "
+												 "ON devices (lastlogin)"))) {
+			throw DatabaseException(createLoginIndex);
+		}
+
+		if(!db.tables().contains(QStringLiteral("keychanges"))) {
+			QSqlQuery createKeyChanges(db);
+			if(!createKeyChanges.exec(QStringLiteral("CREATE TABLE keychanges ( "
+														"	deviceid	UUID PRIMARY KEY NOT NULL REFERENCES devices(id) ON DELETE CASCADE, "
+														"	keyindex	INT NOT NULL, "
+														"	scheme		TEXT NOT NULL, "
+														"	key			BYTEA NOT NULL, "
+														"	verifymac	BYTEA NOT NULL "
+														")"))) {
+				throw DatabaseException(createKeyChanges);
+			}
+
+			qDebug() << "Created table keychanges (+ functions and triggers)";
+		}
+
+		QMetaObject::invokeMethod(this, "dbInitDone", Qt::QueuedConnection,
+								  Q_ARG(bool, true));
+	} catch(DatabaseException &e) {
+		qCritical() << "Failed to setup database:" << e.what();
+		QMetaObject::invokeMethod(this, "dbInitDone", Qt::QueuedConnection,
+								  Q_ARG(bool, false));
+	}
+}
+
+void PostgresController::initBlobColumns(QSqlDatabase &db)
+{
+	Query columnStateQuery(db);
+	columnStateQuery.prepare(QStringLiteral("SELECT EXISTS(SELECT 1 FROM information_schema.columns "
+											"WHERE table_name = 'datachanges' AND column_name = 'blobsize')"));
+	columnStateQuery.exec();
+	if(columnStateQuery.first() && columnStateQuery.value(0).toBool())
+		return;
+
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		//nullable columns without a default do not rewrite the table
+		QSqlQuery addColumns(db);
+		if(!addColumns.exec(QStringLiteral("ALTER TABLE datachanges "
+										   "ADD COLUMN blob BYTEA, "
+										   "ADD COLUMN blobsize BIGINT"))) {
+			throw DatabaseException(addColumns);
+		}
+
+		//the quota must count the size of the blobs as well
+		initQuotaFunctions(db);
+
+		if(!db.commit())
+			throw DatabaseException(db);
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+
+	qDebug() << "Added blob references to datachanges";
+}
+
+void PostgresController::initPartitions(QSqlDatabase &db)
+{
+	QSqlQuery partitionStateQuery(db);
+	if(!partitionStateQuery.exec(QStringLiteral("SELECT current_setting('server_version_num')::INT >= 120000, "
+												"EXISTS(SELECT 1 FROM pg_class WHERE oid = 'datachanges'::regclass AND relkind = 'p'), "
+												"pg_get_serial_sequence('datachanges', 'id')")) ||
+	   !partitionStateQuery.first()) {
+		throw DatabaseException(partitionStateQuery);
+	}
+	auto canPartition = partitionStateQuery.value(0).toBool();
+	_partitioned = partitionStateQuery.value(1).toBool();
+	auto sequence = partitionStateQuery.value(2).toString();
+
+	//the number of partitions is fixed once created, as changing it would move all data again
+	if(_partitioned || _partitions <= 0)
+		return;
+	//foreign keys that reference partitioned tables need PostgreSQL 12
+	if(!canPartition) {
+		qWarning() << "Partitioned change tables require PostgreSQL 12 or newer. Using plain tables instead";
+		return;
+	}
+
+	//moving is done in one transaction and blocks all uploads, so large databases must be moved on purpose
+	QSqlQuery sizeQuery(db);
+	if(!sizeQuery.exec(QStringLiteral("SELECT COUNT(*), pg_total_relation_size('datachanges') + pg_total_relation_size('devicechanges') "
+									  "FROM datachanges")) ||
+	   !sizeQuery.first()) {
+		throw DatabaseException(sizeQuery);
+	}
+	auto total = sizeQuery.value(0).toLongLong();
+	auto maxRows = qApp->configuration()->value(QStringLiteral("database/partitions/maxRows"), 1000000).toLongLong();
+	if(maxRows > 0 && total > maxRows) {
+		qWarning() << "Not moving" << total << "changes (" << sizeQuery.value(1).toLongLong() / 1048576
+				   << "MB) into partitions, as it exceeds database/partitions/maxRows. Set it to 0 and restart "
+					  "during a maintenance window to move them. Using plain tables instead";
+		return;
+	}
+
+	qInfo() << "Moving" << total << "changes (" << sizeQuery.value(1).toLongLong() / 1048576
+			<< "MB) into" << _partitions << "partitions. This can take a while for large databases";
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		//other servers of the cluster must not change the tables between the batches
+		QSqlQuery lockQuery(db);
+		if(!lockQuery.exec(QStringLiteral("LOCK TABLE datachanges, devicechanges IN SHARE MODE")))
+			throw DatabaseException(lockQuery);
+
+		//the data is partitioned by the uploading device, the pending changes by the downloading device.
+		//Constraints are added after copying the data, which is faster than checking every row
+		QStringList statements {
+			QStringLiteral("CREATE TABLE datachanges_partitioned ( "
+						   "	id			BIGINT NOT NULL DEFAULT nextval('%1'::regclass), "
+						   "	deviceid	UUID NOT NULL, "
+						   "	dataid		BYTEA NOT NULL, "
+						   "	keyid		INT NOT NULL, "
+						   "	salt		BYTEA NOT NULL, "
+						   "	data		BYTEA NOT NULL, "
+						   "	blob		BYTEA, "
+						   "	blobsize	BIGINT "
+						   ") PARTITION BY HASH (deviceid)").arg(sequence),
+			QStringLiteral("CREATE TABLE devicechanges_partitioned ( "
+						   "	deviceid	UUID NOT NULL, "
+						   "	dataid		BIGINT NOT NULL, "
+						   "	sourceid	UUID NOT NULL "
+						   ") PARTITION BY HASH (deviceid)")
+		};
+		for(auto i = 0; i < _partitions; i++) {
+			statements.append(QStringLiteral("CREATE TABLE datachanges_p%1 PARTITION OF datachanges_partitioned "
+											 "FOR VALUES WITH (MODULUS %2, REMAINDER %1)")
+							  .arg(i).arg(_partitions));
+			statements.append(QStringLiteral("CREATE TABLE devicechanges_p%1 PARTITION OF devicechanges_partitioned "
+											 "FOR VALUES WITH (MODULUS %2, REMAINDER %1)")
+							  .arg(i).arg(_partitions));
+		}
+		for(const auto &statement : statements) {
+			QSqlQuery partitionQuery(db);
+			if(!partitionQuery.exec(statement))
+				throw DatabaseException(partitionQuery);
+		}
+
+		//copy the data with it's pending changes, ordered by id
+		qint64 moved = 0;
+		qint64 lastId = 0;
+		forever {
+			QSqlQuery moveDataQuery(db);
+			if(!moveDataQuery.prepare(QStringLiteral("WITH moved AS ( "
+													 "	INSERT INTO datachanges_partitioned (id, deviceid, dataid, keyid, salt, data, blob, blobsize) "
+													 "	SELECT id, deviceid, dataid, keyid, salt, data, blob, blobsize FROM datachanges "
+													 "	WHERE id > ? "
+													 "	ORDER BY id "
+													 "	LIMIT ? "
+													 "	RETURNING id "
+													 ") "
+													 "SELECT COUNT(*), MAX(id) FROM moved"))) {
+				throw DatabaseException(moveDataQuery);
+			}
+			moveDataQuery.addBindValue(lastId);
+			moveDataQuery.addBindValue(PartitionBatch);
+			if(!moveDataQuery.exec() || !moveDataQuery.first())
+				throw DatabaseException(moveDataQuery);
+			auto count = moveDataQuery.value(0).toLongLong();
+			if(count == 0)
+				break;
+			auto maxId = moveDataQuery.value(1).toLongLong();
+
+			QSqlQuery moveChangesQuery(db);
+			if(!moveChangesQuery.prepare(QStringLiteral("INSERT INTO devicechanges_partitioned (deviceid, dataid, sourceid) "
+														"SELECT devicechanges.deviceid, devicechanges.dataid, datachanges.deviceid FROM devicechanges "
+														"INNER JOIN datachanges ON datachanges.id = devicechanges.dataid "
+														"WHERE datachanges.id > ? AND datachanges.id <= ?"))) {
+				throw DatabaseException(moveChangesQuery);
+			}
+			moveChangesQuery.addBindValue(lastId);
+			moveChangesQuery.addBindValue(maxId);
+			if(!moveChangesQuery.exec())
+				throw DatabaseException(moveChangesQuery);
+
+			lastId = maxId;
+			moved += count;
+			qInfo() << "Moved" << moved << "of" << total << "changes into partitions";
+		}
+
+		statements = QStringList {
+			//the sequence would be dropped with the old table
+			QStringLiteral("ALTER SEQUENCE %1 OWNED BY datachanges_partitioned.id").arg(sequence),
+			//the triggers are dropped as well, and recreated afterwards
+			QStringLiteral("DROP TABLE devicechanges"),
+			QStringLiteral("DROP TABLE datachanges"),
+			QStringLiteral("ALTER TABLE datachanges_partitioned RENAME TO datachanges"),
+			QStringLiteral("ALTER TABLE devicechanges_partitioned RENAME TO devicechanges"),
+			QStringLiteral("ALTER TABLE datachanges "
+						   "ADD CONSTRAINT datachanges_pkey PRIMARY KEY (deviceid, id), "
+						   "ADD CONSTRAINT datachanges_deviceid_dataid_key UNIQUE (deviceid, dataid), "
+						   "ADD CONSTRAINT datachanges_deviceid_fkey FOREIGN KEY (deviceid) "
+						   "REFERENCES devices(id) ON DELETE CASCADE"),
+			QStringLiteral("ALTER TABLE devicechanges "
+						   "ADD CONSTRAINT devicechanges_pkey PRIMARY KEY (deviceid, dataid), "
+						   "ADD CONSTRAINT devicechanges_deviceid_fkey FOREIGN KEY (deviceid) "
+						   "REFERENCES devices(id) ON DELETE CASCADE, "
+						   "ADD CONSTRAINT devicechanges_dataid_fkey FOREIGN KEY (sourceid, dataid) "
+						   "REFERENCES datachanges(deviceid, id) ON DELETE CASCADE ON UPDATE CASCADE")
+		};
+
+		for(const auto &statement : statements) {
+			QSqlQuery partitionQuery(db);
+			if(!partitionQuery.exec(statement))
+				throw DatabaseException(partitionQuery);
+		}
+
+		if(!db.commit())
+			throw DatabaseException(db);
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+
+	_partitioned = true;
+	qInfo() << "Moved the changes into" << _partitions << "partitions";
+}
+
+void PostgresController::initNotifyTrigger(QSqlDatabase &db)
+{
+	QSqlQuery triggerStateQuery(db);
+	if(!triggerStateQuery.exec(QStringLiteral("SELECT current_setting('server_version_num')::INT >= 100000, "
+											  "EXISTS(SELECT 1 FROM pg_trigger WHERE tgname = 'device_changes_trigger')")) ||
+	   !triggerStateQuery.first()) {
+		throw DatabaseException(triggerStateQuery);
+	}
+
+	//statement triggers with transition tables need PostgreSQL 10 - older ones keep the row trigger
+	if(!triggerStateQuery.value(0).toBool() || triggerStateQuery.value(1).toBool())
+		return;
+
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		//notify each device once per statement, instead of once per inserted row
+		QSqlQuery createNotifyFn(db);
+		if(!createNotifyFn.exec(QStringLiteral("CREATE OR REPLACE FUNCTION notifyDeviceChanges() RETURNS TRIGGER AS $BODY$ "
+											   "DECLARE "
+											   "	device UUID; "
+											   "BEGIN "
+											   "	FOR device IN SELECT DISTINCT deviceid FROM inserted LOOP "
+											   "		PERFORM pg_notify('deviceDataEvent', device::text); "
+											   "	END LOOP; "
+											   "	RETURN NULL; "
+											   "END; "
+											   "$BODY$ LANGUAGE plpgsql VOLATILE;"))) {
+			throw DatabaseException(createNotifyFn);
+		}
+
+		QSqlQuery dropRowTrigger(db);
+		if(!dropRowTrigger.exec(QStringLiteral("DROP TRIGGER IF EXISTS device_change_trigger ON devicechanges")))
+			throw DatabaseException(dropRowTrigger);
+
+		QSqlQuery createNotifyTrigger(db);
+		if(!createNotifyTrigger.exec(QStringLiteral("CREATE TRIGGER device_changes_trigger "
+													"AFTER INSERT "
+													"ON devicechanges "
+													"REFERENCING NEW TABLE AS inserted "
+													"FOR EACH STATEMENT "
+													"EXECUTE PROCEDURE notifyDeviceChanges();"))) {
+			throw DatabaseException(createNotifyTrigger);
+		}
+
+		if(!db.commit())
+			throw DatabaseException(db);
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+
+	qDebug() << "Switched devicechanges notifications to statement level";
+}
+
+void PostgresController::initChangeUpserts(QSqlDatabase &db)
+{
+	QSqlQuery upsertStateQuery(db);
+	if(!upsertStateQuery.exec(QStringLiteral("SELECT "
+											 "EXISTS(SELECT 1 FROM pg_constraint WHERE conname = 'devicechanges_dataid_fkey' AND confupdtype = 'c'), "
+											 "EXISTS(SELECT 1 FROM pg_trigger WHERE tgname = 'device_changes_trigger'), "
+											 "EXISTS(SELECT 1 FROM pg_trigger WHERE tgname = 'device_changes_update_trigger'), "
+											 "EXISTS(SELECT 1 FROM pg_trigger WHERE tgname = 'device_change_update_trigger')")) ||
+	   !upsertStateQuery.first()) {
+		throw DatabaseException(upsertStateQuery);
+	}
+	auto hasCascade = upsertStateQuery.value(0).toBool();
+	auto statementNotify = upsertStateQuery.value(1).toBool();
+	auto hasUpdateNotify = upsertStateQuery.value(statementNotify ? 2 : 3).toBool();
+	if(hasCascade && hasUpdateNotify)
+		return;
+
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		//replaced changes get a new id, which the pending device changes must follow
+		if(!hasCascade) {
+			QSqlQuery updateForeignKey(db);
+			if(!updateForeignKey.exec(QStringLiteral("ALTER TABLE devicechanges "
+													 "DROP CONSTRAINT IF EXISTS devicechanges_dataid_fkey, "
+													 "ADD CONSTRAINT devicechanges_dataid_fkey FOREIGN KEY (dataid) "
+													 "REFERENCES datachanges(id) ON DELETE CASCADE ON UPDATE CASCADE"))) {
+				throw DatabaseException(updateForeignKey);
+			}
+		}
+
+		//devices that still had the previous version only get their entry moved, and must be notified as well
+		QSqlQuery dropUpdateTriggers(db);
+		if(!dropUpdateTriggers.exec(QStringLiteral("DROP TRIGGER IF EXISTS device_change_update_trigger ON devicechanges; "
+												   "DROP TRIGGER IF EXISTS device_changes_update_trigger ON devicechanges;"))) {
+			throw DatabaseException(dropUpdateTriggers);
+		}
+
+		QSqlQuery createUpdateTrigger(db);
+		if(statementNotify) {
+			if(!createUpdateTrigger.exec(QStringLiteral("CREATE TRIGGER device_changes_update_trigger "
+														"AFTER UPDATE "
+														"ON devicechanges "
+														"REFERENCING NEW TABLE AS inserted "
+														"FOR EACH STATEMENT "
+														"EXECUTE PROCEDURE notifyDeviceChanges();"))) {
+				throw DatabaseException(createUpdateTrigger);
+			}
+		} else {
+			if(!createUpdateTrigger.exec(QStringLiteral("CREATE TRIGGER device_change_update_trigger "
+														"AFTER UPDATE "
+														"ON devicechanges "
+														"FOR EACH ROW "
+														"EXECUTE PROCEDURE notifyDeviceChange();"))) {
+				throw DatabaseException(createUpdateTrigger);
+			}
+		}
+
+		if(!db.commit())
+			throw DatabaseException(db);
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+
+	qDebug() << "Prepared datachanges to be replaced in place";
+}
+
+void PostgresController::initQuotaFunctions(QSqlDatabase &db)
+{
+	//the functions of both accounting modes, the triggers are created by initQuotaLedger
+	QStringList functions {
+		QStringLiteral("CREATE OR REPLACE FUNCTION upquota() "
+					   "RETURNS TRIGGER AS $BODY$ "
+					   "BEGIN "
+					   "	UPDATE users SET quota = quota + %1 "
+					   "	WHERE id = deviceUserId(NEW.deviceid); "
+					   "	RETURN NEW; "
+					   "END; "
+					   "$BODY$ LANGUAGE plpgsql;")
+		.arg(dataSize(QStringLiteral("NEW"))),
+		QStringLiteral("CREATE OR REPLACE FUNCTION downquota() "
+					   "RETURNS TRIGGER AS $BODY$ "
+					   "BEGIN "
+					   "	UPDATE users SET quota = GREATEST(quota - %1, 0) "
+					   "	WHERE id = deviceUserId(OLD.deviceid); "
+					   "	RETURN OLD; "
+					   "END; "
+					   "$BODY$ LANGUAGE plpgsql;")
+		.arg(dataSize(QStringLiteral("OLD"))),
+		QStringLiteral("CREATE OR REPLACE FUNCTION updatequota() "
+					   "RETURNS TRIGGER AS $BODY$ "
+					   "BEGIN "
+					   "	UPDATE users SET quota = GREATEST(quota + %1 - %2, 0) "
+					   "	WHERE id = deviceUserId(NEW.deviceid); "
+					   "	RETURN NEW; "
+					   "END; "
+					   "$BODY$ LANGUAGE plpgsql;")
+		.arg(dataSize(QStringLiteral("NEW")), dataSize(QStringLiteral("OLD"))),
+		QStringLiteral("CREATE OR REPLACE FUNCTION ledgerUpquota() "
+					   "RETURNS TRIGGER AS $BODY$ "
+					   "BEGIN "
+					   "	INSERT INTO quotaledger (deviceid, userid, delta) "
+					   "	SELECT inserted.deviceid, devices.userid, SUM(%1) "
+					   "	FROM inserted INNER JOIN devices ON devices.id = inserted.deviceid "
+					   "	GROUP BY inserted.deviceid, devices.userid "
+					   "	ON CONFLICT (deviceid) DO UPDATE SET delta = quotaledger.delta + EXCLUDED.delta; "
+					   "	RETURN NULL; "
+					   "END; "
+					   "$BODY$ LANGUAGE plpgsql;")
+		.arg(dataSize(QStringLiteral("inserted"))),
+		QStringLiteral("CREATE OR REPLACE FUNCTION ledgerDownquota() "
+					   "RETURNS TRIGGER AS $BODY$ "
+					   "BEGIN "
+					   "	INSERT INTO quotaledger (deviceid, userid, delta) "
+					   "	SELECT deleted.deviceid, COALESCE(quotaledger.userid, devices.userid), -SUM(%1) "
+					   "	FROM deleted "
+					   "	LEFT JOIN quotaledger ON quotaledger.deviceid = deleted.deviceid "
+					   "	LEFT JOIN devices ON devices.id = deleted.deviceid "
+					   "	WHERE quotaledger.userid IS NOT NULL OR devices.userid IS NOT NULL "
+					   "	GROUP BY deleted.deviceid, COALESCE(quotaledger.userid, devices.userid) "
+					   "	ON CONFLICT (deviceid) DO UPDATE SET delta = quotaledger.delta + EXCLUDED.delta; "
+					   "	RETURN NULL; "
+					   "END; "
+					   "$BODY$ LANGUAGE plpgsql;")
+		.arg(dataSize(QStringLiteral("deleted"))),
+		QStringLiteral("CREATE OR REPLACE FUNCTION ledgerUpdatequota() "
+					   "RETURNS TRIGGER AS $BODY$ "
+					   "BEGIN "
+					   "	INSERT INTO quotaledger (deviceid, userid, delta) "
+					   "	SELECT inserted.deviceid, devices.userid, SUM(%1 - %2) "
+					   "	FROM inserted "
+					   "	INNER JOIN deleted ON deleted.deviceid = inserted.deviceid AND deleted.dataid = inserted.dataid "
+					   "	INNER JOIN devices ON devices.id = inserted.deviceid "
+					   "	GROUP BY inserted.deviceid, devices.userid "
+					   "	ON CONFLICT (deviceid) DO UPDATE SET delta = quotaledger.delta + EXCLUDED.delta; "
+					   "	RETURN NULL; "
+					   "END; "
+					   "$BODY$ LANGUAGE plpgsql;")
+		.arg(dataSize(QStringLiteral("inserted")), dataSize(QStringLiteral("deleted")))
+	};
+
+	for(const auto &function : functions) {
+		QSqlQuery createFunction(db);
+		if(!createFunction.exec(function))
+			throw DatabaseException(createFunction);
+	}
+}
+
+void PostgresController::initQuotaLedger(QSqlDatabase &db)
+{
+	QSqlQuery ledgerStateQuery(db);
+	if(!ledgerStateQuery.exec(QStringLiteral("SELECT current_setting('server_version_num')::INT >= 100000, "
+											 "EXISTS(SELECT 1 FROM pg_trigger WHERE tgname = 'ledger_add_data_trigger'), "
+											 "EXISTS(SELECT 1 FROM pg_trigger WHERE tgname IN ('update_data_trigger', 'ledger_update_data_trigger'))")) ||
+	   !ledgerStateQuery.first()) {
+		throw DatabaseException(ledgerStateQuery);
+	}
+	auto canUseLedger = ledgerStateQuery.value(0).toBool();
+	auto hasLedger = ledgerStateQuery.value(1).toBool();
+	auto hasUpdate = ledgerStateQuery.value(2).toBool();
+
+	//the ledger triggers use transition tables, which need PostgreSQL 10
+	if(_quotaSlack > 0 && !canUseLedger) {
+		qWarning() << "The quota ledger requires PostgreSQL 10 or newer. Using exact quota accounting instead";
+		_quotaSlack = 0;
+	}
+	if((_quotaSlack > 0) == hasLedger && hasUpdate)
+		return;
+
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		//the triggers of both modes are dropped, and those of the current one recreated
+		QSqlQuery dropTriggers(db);
+		if(!dropTriggers.exec(QStringLiteral("DROP TRIGGER IF EXISTS add_data_trigger ON datachanges; "
+											 "DROP TRIGGER IF EXISTS remove_data_trigger ON datachanges; "
+											 "DROP TRIGGER IF EXISTS update_data_trigger ON datachanges; "
+											 "DROP TRIGGER IF EXISTS ledger_add_data_trigger ON datachanges; "
+											 "DROP TRIGGER IF EXISTS ledger_remove_data_trigger ON datachanges; "
+											 "DROP TRIGGER IF EXISTS ledger_update_data_trigger ON datachanges;"))) {
+			throw DatabaseException(dropTriggers);
+		}
+
+		if(_quotaSlack > 0) {
+			//the ledger keeps one row per device, so uploads of different devices do not lock the same row
+			QSqlQuery createLedger(db);
+			if(!createLedger.exec(QStringLiteral("CREATE TABLE IF NOT EXISTS quotaledger ( "
+												 "	deviceid	UUID PRIMARY KEY NOT NULL, "
+												 "	userid		BIGINT NOT NULL REFERENCES users(id) ON DELETE CASCADE, "
+												 "	delta		BIGINT NOT NULL DEFAULT 0 "
+												 ")"))) {
+				throw DatabaseException(createLedger);
+			}
+
+			QSqlQuery createLedgerIndex(db);
+			if(!createLedgerIndex.exec(QStringLiteral("CREATE INDEX IF NOT EXISTS quotaledger_userid_idx "
+													  "ON quotaledger (userid)"))) {
+				throw DatabaseException(createLedgerIndex);
+			}
+
+			//existing devices need a row, in case their data gets removed before they upload again
+			if(!hasLedger) {
+				QSqlQuery fillLedger(db);
+				if(!fillLedger.exec(QStringLiteral("INSERT INTO quotaledger (deviceid, userid) "
+												   "SELECT id, userid FROM devices "
+												   "ON CONFLICT DO NOTHING"))) {
+					throw DatabaseException(fillLedger);
+				}
+			}
+
+			QSqlQuery createUpquotaTrigger(db);
+			if(!createUpquotaTrigger.exec(QStringLiteral("CREATE TRIGGER ledger_add_data_trigger "
+														 "AFTER INSERT "
+														 "ON datachanges "
+														 "REFERENCING NEW TABLE AS inserted "
+														 "FOR EACH STATEMENT "
+														 "EXECUTE PROCEDURE ledgerUpquota();"))) {
+				throw DatabaseException(createUpquotaTrigger);
+			}
+
+			QSqlQuery createDownquotaTrigger(db);
+			if(!createDownquotaTrigger.exec(QStringLiteral("CREATE TRIGGER ledger_remove_data_trigger "
+														   "AFTER DELETE "
+														   "ON datachanges "
+														   "REFERENCING OLD TABLE AS deleted "
+														   "FOR EACH STATEMENT "
+														   "EXECUTE PROCEDURE ledgerDownquota();"))) {
+				throw DatabaseException(createDownquotaTrigger);
+			}
+
+			QSqlQuery createUpdatequotaTrigger(db);
+			if(!createUpdatequotaTrigger.exec(QStringLiteral("CREATE TRIGGER ledger_update_data_trigger "
+															 "AFTER UPDATE "
+															 "ON datachanges "
+															 "REFERENCING OLD TABLE AS deleted NEW TABLE AS inserted "
+															 "FOR EACH STATEMENT "
+															 "EXECUTE PROCEDURE ledgerUpdatequota();"))) {
+				throw DatabaseException(createUpdatequotaTrigger);
+			}
+		} else {
+			QSqlQuery createUpquotaTrigger(db);
+			if(!createUpquotaTrigger.exec(QStringLiteral("CREATE TRIGGER add_data_trigger "
+														 "AFTER INSERT "
+														 "ON datachanges "
+														 "FOR EACH ROW "
+														 "EXECUTE PROCEDURE upquota();"))) {
+				throw DatabaseException(createUpquotaTrigger);
+			}
+
+			QSqlQuery createDownquotaTrigger(db);
+			if(!createDownquotaTrigger.exec(QStringLiteral("CREATE TRIGGER remove_data_trigger "
+														   "AFTER DELETE "
+														   "ON datachanges "
+														   "FOR EACH ROW "
+														   "EXECUTE PROCEDURE downquota();"))) {
+				throw DatabaseException(createDownquotaTrigger);
+			}
+
+			QSqlQuery createUpdatequotaTrigger(db);
+			if(!createUpdatequotaTrigger.exec(QStringLiteral("CREATE TRIGGER update_data_trigger "
+															 "AFTER UPDATE "
+															 "ON datachanges "
+															 "FOR EACH ROW "
+															 "EXECUTE PROCEDURE updatequota();"))) {
+				throw DatabaseException(createUpdatequotaTrigger);
+			}
+		}
+
+		if(!db.commit())
+			throw DatabaseException(db);
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+
+	if(_quotaSlack > 0)
+		qDebug() << "Using the quota ledger for quota accounting";
+	else
+		qDebug() << "Using exact row triggers for quota accounting";
+
+	//the ledger does not change anymore, so whatever is left can be moved into the quota
+	if(_quotaSlack == 0 && hasLedger)
+		foldQuotaLedger(db);
+}
+
+void PostgresController::foldQuotaLedger(QSqlDatabase &db)
+{
+	Query pendingQuery(db);
+	pendingQuery.prepare(QStringLiteral("SELECT DISTINCT userid FROM quotaledger WHERE delta != 0"));
+	pendingQuery.exec();
+
+	auto folded = 0;
+	while(pendingQuery.next()) {
+		//each user on it's own, so one that is over the limit does not block the others
+		Query foldQuery(db);
+		foldQuery.prepare(QStringLiteral("WITH folded AS ( "
+										 "	UPDATE quotaledger SET delta = 0 "
+										 "	FROM ( "
+										 "		SELECT deviceid, delta FROM quotaledger "
+										 "		WHERE userid = ? AND delta != 0 "
+										 "		FOR UPDATE "
+										 "	) AS pending "
+										 "	WHERE quotaledger.deviceid = pending.deviceid "
+										 "	RETURNING pending.delta "
+										 ") "
+										 "UPDATE users SET quota = GREATEST(quota + COALESCE((SELECT SUM(delta) FROM folded), 0), 0) "
+										 "WHERE id = ?"));
+		foldQuery.addBindValue(pendingQuery.value(0));
+		foldQuery.addBindValue(pendingQuery.value(0));
+		try {
+			foldQuery.exec();
+			folded++;
+		} catch(DatabaseException &e) {
+			//check_violation: the user is over the limit - the delta stays in the ledger, where it is counted as well
+			if(e.error().nativeErrorCode() != QStringLiteral("23514"))
+				throw;
+		}
+	}
+
+	Query cleanupQuery(db);
+	cleanupQuery.prepare(QStringLiteral("DELETE FROM quotaledger "
+										"WHERE delta = 0 "
+										"AND NOT EXISTS ( "
+										"	SELECT 1 FROM devices "
+										"	WHERE devices.id = quotaledger.deviceid "
+										")"));
+	cleanupQuery.exec();
+
+	if(folded > 0)
+		qDebug() << "Folded the quota ledger of" << folded << "users";
+}
+
+bool PostgresController::checkQuotaLedger(QSqlDatabase &db, const QUuid &deviceId)
+{
+	//includes the changes of the running transaction, but only the committed ones of other devices
+	Query checkQuery(db);
+	checkQuery.prepare(QStringLiteral("SELECT users.quota + COALESCE(SUM(quotaledger.delta), 0) < users.quotalimit "
+									  "FROM users "
+									  "LEFT JOIN quotaledger ON quotaledger.userid = users.id "
+									  "WHERE users.id = deviceUserId(?) "
+									  "GROUP BY users.id"));
+	checkQuery.addBindValue(deviceId);
+	checkQuery.exec();
+	if(!checkQuery.first() || !checkQuery.value(0).toBool())
+		return false;
+
+	//only once the device collected more than the slack, the delta is moved into the users row
+	Query foldQuery(db);
+	foldQuery.prepare(QStringLiteral("WITH folded AS ( "
+									 "	UPDATE quotaledger SET delta = 0 "
+									 "	FROM ( "
+									 "		SELECT deviceid, delta FROM quotaledger "
+									 "		WHERE deviceid = ? AND ABS(delta) >= ? "
+									 "		FOR UPDATE "
+									 "	) AS pending "
+									 "	WHERE quotaledger.deviceid = pending.deviceid "
+									 "	RETURNING quotaledger.userid, pending.delta "
+									 ") "
+									 "UPDATE users SET quota = GREATEST(users.quota + folded.delta, 0) "
+									 "FROM folded "
+									 "WHERE users.id = folded.userid"));
+	foldQuery.addBindValue(deviceId);
+	foldQuery.addBindValue(_quotaSlack);
+
+	//the negative deltas of other devices are not folded (to not lock their rows), so this one alone can
+	//exceed the limit. The account is within the quota, as checked above - the delta then stays in the ledger
+	Query savepointQuery(db);
+	savepointQuery.prepare(QStringLiteral("SAVEPOINT quotafold"));
+	savepointQuery.exec();
+	try {
+		foldQuery.exec();
+	} catch(DatabaseException &e) {
+		//check_violation from https://www.postgresql.org/docs/current/static/errcodes-appendix.html
+		if(e.error().nativeErrorCode() != QStringLiteral("23514"))
+			throw;
+		Query rollbackQuery(db);
+		rollbackQuery.prepare(QStringLiteral("ROLLBACK TO SAVEPOINT quotafold"));
+		rollbackQuery.exec();
+	}
+	Query releaseQuery(db);
+	releaseQuery.prepare(QStringLiteral("RELEASE SAVEPOINT quotafold"));
+	releaseQuery.exec();
+	return true;
+}
+
+void PostgresController::updateQuotaLimit(quint64 quota, bool forceQuota)
+{
+	Metrics::Timer timer(operationLatency("updateQuotaLimit"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		if(forceQuota) {
+			Query deleteOverQuotaDevicesQuery(db);
+			deleteOverQuotaDevicesQuery.prepare(QStringLiteral("DELETE FROM devices "
+															   "WHERE userid IN ( "
+															   "	SELECT id FROM users "
+															   "	WHERE quotalimit != ? "
+															   "	AND quota >= ? "
+															   ")"));
+			deleteOverQuotaDevicesQuery.addBindValue(quota);
+			deleteOverQuotaDevicesQuery.addBindValue(quota);
+			deleteOverQuotaDevicesQuery.exec();
+			auto devNum = deleteOverQuotaDevicesQuery.numRowsAffected();
+
+			Query deleteOverQuotaUsersQuery(db);
+			deleteOverQuotaUsersQuery.prepare(QStringLiteral("DELETE FROM users "
+															 "WHERE quotalimit != ? "
+															 "AND quota >= ?"));
+			deleteOverQuotaUsersQuery.addBindValue(quota);
+			deleteOverQuotaUsersQuery.addBindValue(quota);
+			deleteOverQuotaUsersQuery.exec();
+			auto usrNum = deleteOverQuotaUsersQuery.numRowsAffected();
+
+			if(usrNum == 0 && devNum == 0)
+				qDebug() << "No users or devices deleted that exceed quota limit";
+			else {
+				qInfo() << "Deleted" << devNum << "devices and" << usrNum
+						<< "users because their quota exceeded the limit of" << quota;
+			}
+		}
+
+		Query updateQuotaLimitQuery(db);
+		updateQuotaLimitQuery.prepare(QStringLiteral("UPDATE users SET quotalimit = ? "
+													 "WHERE quotalimit != ? "
+													 "AND quota < ?"));
+		updateQuotaLimitQuery.addBindValue(quota);
+		updateQuotaLimitQuery.addBindValue(quota);
+		updateQuotaLimitQuery.addBindValue(quota);
+		updateQuotaLimitQuery.exec();
+		auto quotaChanged = updateQuotaLimitQuery.numRowsAffected();
+		if(quotaChanged > 0) {
+			qInfo() << "Updated quota limit of" << quotaChanged
+					<< "users to the new limit" << quota;
+		} else
+			qDebug() << "No quota changed for any user";
+
+		if(!forceQuota) {
+			Query checkQuotaLimitQuery(db);
+			checkQuotaLimitQuery.prepare(QStringLiteral("SELECT Count(*) FROM users "
+														"WHERE quotalimit != ? "));
+			checkQuotaLimitQuery.addBindValue(quota);
+			checkQuotaLimitQuery.exec();
+
+			if(!checkQuotaLimitQuery.first())
+				throw DatabaseException(db);
+			else {
+				auto unmatching = checkQuotaLimitQuery.value(0).toULongLong();
+				if(unmatching > 0) {
+					qWarning() << "Currently" << unmatching << "users cannot be update to new quota"
+							   << quota << "because they would exceed that limit.";
+				}
+			}
+		}
+
+		if(!db.commit())
+			throw DatabaseException(db);
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+bool PostgresController::storeBlob(const QUuid &deviceId, const QByteArray &data, QByteArray &key)
+{
+	static auto storedBlobs = qApp->metrics()->counter("qdsapp_blobs_stored_total",
+													   "Number of changes whose data was stored as blob outside of the database");
+	key.clear();
+	if(!_blobs.shouldOffload(data))
+		return true;
+
+	//the quota is only enforced by the transaction, so accounts that are full could still fill the disk
+	{
+		auto connection = pool()->acquire();
+		auto db = connection.database();
+		Query quotaQuery(db);
+		if(_quotaSlack > 0) {
+			quotaQuery.prepare(QStringLiteral("SELECT users.quota + COALESCE(SUM(quotaledger.delta), 0) + ? < users.quotalimit "
+											  "FROM users "
+											  "LEFT JOIN quotaledger ON quotaledger.userid = users.id "
+											  "WHERE users.id = deviceUserId(?) "
+											  "GROUP BY users.id"));
+		} else {
+			quotaQuery.prepare(QStringLiteral("SELECT quota + ? < quotalimit FROM users "
+											  "WHERE id = deviceUserId(?)"));
+		}
+		quotaQuery.addBindValue(static_cast<qint64>(data.size()));
+		quotaQuery.addBindValue(deviceId);
+		quotaQuery.exec();
+		if(!quotaQuery.first() || !quotaQuery.value(0).toBool())
+			return false;
+	}
+
+	//written before the transaction, to not keep the connection busy meanwhile
+	key = _blobs.store(data);
+	if(key.isEmpty())
+		throw DatabaseException(QSqlError(QString(), QStringLiteral("Unable to store data change as blob")));
+	storedBlobs->add();
+	return true;
+}
+
+void PostgresController::bindData(QSqlQuery &query, const QByteArray &data, const QByteArray &blob)
+{
+	//binds data, blob and blobsize
+	if(blob.isEmpty()) {
+		query.addBindValue(data);
+		query.addBindValue(QVariant(QVariant::ByteArray));
+		query.addBindValue(QVariant(QVariant::LongLong));
+	} else {
+		query.addBindValue(QByteArray("")); //not null, but empty
+		query.addBindValue(blob);
+		query.addBindValue(static_cast<qint64>(data.size()));
+	}
+}
+
+QList<QUuid> PostgresController::userDevices(QSqlDatabase &db, const QUuid &deviceId)
+{
+	quint64 generation = 0;
+	if(_deviceCacheTtl > 0) {
+		QReadLocker lock(&_deviceCacheLock);
+		auto userIt = _deviceUsers.constFind(deviceId);
+		if(userIt != _deviceUsers.constEnd()) {
+			auto devIt = _userDevices.constFind(userIt.value());
+			if(devIt != _userDevices.constEnd() &&
+			   _deviceCacheClock.elapsed() - devIt->loaded < _deviceCacheTtl)
+				return devIt->devices;
+		}
+		generation = _deviceCacheGeneration;
+	}
+
+	Query loadDevicesQuery(db);
+	loadDevicesQuery.prepare(QStringLiteral("SELECT id, userid FROM devices "
+											"WHERE userid = deviceUserId(?)"));
+	loadDevicesQuery.addBindValue(deviceId);
+	loadDevicesQuery.exec();
+
+	UserDevices entry;
+	entry.loaded = _deviceCacheClock.elapsed();
+	quint64 userId = 0;
+	while(loadDevicesQuery.next()) {
+		entry.devices.append(loadDevicesQuery.value(0).toUuid());
+		userId = loadDevicesQuery.value(1).toULongLong();
+	}
+
+	if(_deviceCacheTtl > 0 && !entry.devices.isEmpty()) {
+		QWriteLocker lock(&_deviceCacheLock);
+		//devices were added or removed while loading - the result might already be outdated
+		if(generation == _deviceCacheGeneration) {
+			if(_userDevices.size() >= DeviceCacheLimit) {
+				_deviceUsers.clear();
+				_userDevices.clear();
+			} else {
+				for(const auto &device : _userDevices.value(userId).devices)
+					_deviceUsers.remove(device);
+			}
+			for(const auto &device : entry.devices)
+				_deviceUsers.insert(device, userId);
+			_userDevices.insert(userId, entry);
+		}
+	}
+
+	return entry.devices;
+}
+
+void PostgresController::invalidateDevices(quint64 userId)
+{
+	QWriteLocker lock(&_deviceCacheLock);
+	_deviceCacheGeneration++;
+	for(const auto &device : _userDevices.take(userId).devices)
+		_deviceUsers.remove(device);
+}
+
+void PostgresController::publishDevicesChanged(QSqlDatabase &db, quint64 userId)
+{
+	//delivered once the transaction commits, so other servers do not reload the old list
+	Query notifyQuery(db);
+	notifyQuery.prepare(QStringLiteral("SELECT pg_notify('devicesEvent', ?)"));
+	notifyQuery.addBindValue(QString::number(userId));
+	notifyQuery.exec();
+}
+
+void PostgresController::clearDeviceCache()
+{
+	QWriteLocker lock(&_deviceCacheLock);
+	_deviceCacheGeneration++;
+	_deviceUsers.clear();
+	_userDevices.clear();
+}
+
@@ -0,0 +1,130 @@
+#ifndef POSTGRESCONTROLLER_H
+#define POSTGRESCONTROLLER_H
+
+#include <QtCore/QHash>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QElapsedTimer>
+
+#include <QtSql/QSqlDriver>
+
+#include "databasecontroller.h"
+#include "blobstore.h"
+
+//! The PostgreSQL storage, with quota accounting in triggers and live sync via LISTEN/NOTIFY
+class PostgresController : public DatabaseController
+{
+	Q_OBJECT
+
+public:
+	explicit PostgresController(QObject *parent = nullptr);
+
+	void foldQuota();
+	//! Removes the blobs that are no longer referenced by any change
+	void sweepBlobs();
+
+	QUuid addNewDevice(const QString &name,
+					   const QByteArray &signScheme,
+					   const QByteArray &signKey,
+					   const QByteArray &cryptScheme,
+					   const QByteArray &cryptKey,
+					   const QByteArray &fingerprint,
+					   const QByteArray &keyCmac) override;
+	void addNewDeviceToUser(const QUuid &newDeviceId,
+							const QUuid &partnerDeviceId,
+							const QString &name,
+							const QByteArray &signScheme,
+							const QByteArray &signKey,
+							const QByteArray &cryptScheme,
+							const QByteArray &cryptKey,
+							const QByteArray &fingerprint) override;
+	QtDataSync::AsymmetricCryptoInfo *loadCrypto(const QUuid &deviceId,
+												 CryptoPP::RandomNumberGenerator &rng,
+												 QObject *parent = nullptr) override;
+	bool updateLogin(const QUuid &deviceId, const QString &name) override;
+	bool updateCmac(const QUuid &deviceId, quint32 keyIndex, const QByteArray &cmac) override;
+	QList<std::tuple<QUuid, QString, QByteArray>> listDevices(const QUuid &deviceId) override;
+	void removeDevice(const QUuid &deviceId, const QUuid &deleteId) override;
+
+	bool addChange(const QUuid &deviceId,
+				   const QByteArray &dataId,
+				   const quint32 keyIndex,
+				   const QByteArray &salt,
+				   const QByteArray &data) override;
+	bool addDeviceChange(const QUuid &deviceId,
+						 const QUuid &targetId,
+						 const QByteArray &dataId,
+						 const quint32 keyIndex,
+						 const QByteArray &salt,
+						 const QByteArray &data) override;
+
+	quint32 changeCount(const QUuid &deviceId) override;
+	QList<std::tuple<quint64, quint32, QByteArray, QByteArray>> loadNextChanges(const QUuid &deviceId, quint32 count, quint64 lastIndex) override;
+	void completeChanges(const QUuid &deviceId, const QList<quint64> &dataIndexes) override;
+
+	QList<std::tuple<QUuid, QByteArray, QByteArray, QByteArray>> tryKeyChange(const QUuid &deviceId, quint32 proposedIndex, int &offset) override;
+	bool updateExchangeKey(const QUuid &deviceId,
+						   quint32 keyIndex,
+						   const QByteArray &scheme, const QByteArray &cmac,
+						   const QList<std::tuple<QUuid, QByteArray, QByteArray>> &deviceKeys) override;
+	std::tuple<quint32, QByteArray, QByteArray, QByteArray> loadKeyChanges(const QUuid &deviceId) override;
+
+	bool publishEvent(const QByteArray &event) override;
+
+protected:
+	void initDatabase(quint64 quota, bool forceQuota) override;
+	bool startLiveSync() override;
+	bool cleanupBatch(quint64 offlineSinceDays, int batchSize, CleanupProgress &progress) override;
+
+protected Q_SLOTS:
+	void dbInitDone(bool success) override;
+
+private Q_SLOTS:
+	void onNotify(const QString &name, QSqlDriver::NotificationSource source, const QVariant &payload);
+	void timeout();
+
+private:
+	struct UserDevices {
+		QList<QUuid> devices;
+		qint64 loaded;
+	};
+
+	QString _notifyDbName;
+	QTimer *_keepAliveTimer;
+	QTimer *_quotaTimer;
+	quint64 _quotaSlack;
+	int _partitions;
+	bool _partitioned; //devicechanges reference their data by (sourceid, dataid)
+	BlobStore _blobs;
+	QTimer *_blobTimer;
+
+	//caches the devices of each user, as every uploaded change is fanned out to them
+	QReadWriteLock _deviceCacheLock;
+	QHash<QUuid, quint64> _deviceUsers;
+	QHash<quint64, UserDevices> _userDevices;
+	quint64 _deviceCacheGeneration;
+	qint64 _deviceCacheTtl;
+	QElapsedTimer _deviceCacheClock;
+
+	bool subscribeNotify();
+	bool tableExists(QSqlDatabase &db, const QString &table);
+	void initBlobColumns(QSqlDatabase &db);
+	void initPartitions(QSqlDatabase &db);
+	void initNotifyTrigger(QSqlDatabase &db);
+	void initChangeUpserts(QSqlDatabase &db);
+	void initQuotaFunctions(QSqlDatabase &db);
+	void initQuotaLedger(QSqlDatabase &db);
+	void foldQuotaLedger(QSqlDatabase &db);
+	bool checkQuotaLedger(QSqlDatabase &db, const QUuid &deviceId);
+	void updateQuotaLimit(quint64 quota, bool forceQuota);
+
+	bool storeBlob(const QUuid &deviceId, const QByteArray &data, QByteArray &key); //returns false if the quota would be exceeded
+	void bindData(QSqlQuery &query, const QByteArray &data, const QByteArray &blob);
+
+	QList<QUuid> userDevices(QSqlDatabase &db, const QUuid &deviceId);
+	void invalidateDevices(quint64 userId);
+	//! Makes all servers that share the database invalidate the cached devices of the user
+	void publishDevicesChanged(QSqlDatabase &db, quint64 userId);
+	void clearDeviceCache();
+};
+
+#endif // POSTGRESCONTROLLER_H
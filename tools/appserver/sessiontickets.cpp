@@ -0,0 +1,107 @@
+#include "sessiontickets.h"
+
+#include <chrono>
+
+#include <QtCore/QDateTime>
+#include <QtCore/QtEndian>
+
+#include <cryptopp/hmac.h>
+#include <cryptopp/sha3.h>
+
+#if CRYPTOPP_VERSION >= 600
+using byte = CryptoPP::byte;
+#endif
+using namespace std::chrono;
+
+typedef CryptoPP::HMAC<CryptoPP::SHA3_256> TicketMac;
+
+SessionTickets::SessionTickets(const QSettings *configuration, CryptoPP::RandomNumberGenerator &rng) :
+	_masterKey(),
+	_lifetime(0)
+{
+	auto lifetime = configuration->value(QStringLiteral("server/tickets/lifetime"), 24).toLongLong();
+	_lifetime = duration_cast<milliseconds>(hours(lifetime)).count();
+
+	// a shared secret allows multiple server instances (and restarts) to accept each others tickets
+	auto secret = configuration->value(QStringLiteral("server/tickets/secret")).toString().toUtf8();
+	if(secret.isEmpty()) {
+		_masterKey.resize(TicketMac::DIGESTSIZE);
+		rng.GenerateBlock(_masterKey.data(), _masterKey.size());
+	} else
+		_masterKey.Assign(reinterpret_cast<const byte*>(secret.constData()), secret.size());
+}
+
+bool SessionTickets::isEnabled() const
+{
+	return _lifetime > 0;
+}
+
+std::tuple<QByteArray, QByteArray> SessionTickets::issue(const QUuid &deviceId) const
+{
+	auto keyIndex = currentIndex();
+	auto key = deriveKey(keyIndex);
+	auto data = ticketData(deviceId, keyIndex);
+	return std::make_tuple(data + createMac(key, "ticket", data),
+						   createMac(key, "secret", data));
+}
+
+QByteArray SessionTickets::verify(const QByteArray &ticket, const QUuid &deviceId) const
+{
+	const auto dataSize = 20; //uuid + keyIndex
+	if(!isEnabled() || ticket.size() != dataSize + static_cast<int>(TicketMac::DIGESTSIZE))
+		return {};
+
+	auto data = ticket.left(dataSize);
+	if(QUuid::fromRfc4122(data.left(16)) != deviceId)
+		return {};
+
+	// tickets are valid for the current and the previous key period
+	auto keyIndex = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(data.constData() + 16));
+	auto cIndex = currentIndex();
+	if(keyIndex != cIndex && keyIndex + 1 != cIndex)
+		return {};
+
+	auto key = deriveKey(keyIndex);
+	TicketMac mac(key.data(), key.size());
+	auto macData = QByteArray("ticket") + data;
+	if(!mac.VerifyDigest(reinterpret_cast<const byte*>(ticket.constData() + dataSize),
+						 reinterpret_cast<const byte*>(macData.constData()),
+						 macData.size()))
+		return {};
+
+	return createMac(key, "secret", data);
+}
+
+quint32 SessionTickets::currentIndex() const
+{
+	return static_cast<quint32>(QDateTime::currentMSecsSinceEpoch() / _lifetime);
+}
+
+CryptoPP::SecByteBlock SessionTickets::deriveKey(quint32 keyIndex) const
+{
+	TicketMac mac(_masterKey.data(), _masterKey.size());
+	auto bIndex = qToBigEndian(keyIndex);
+	mac.Update(reinterpret_cast<const byte*>(&bIndex), sizeof(bIndex));
+	CryptoPP::SecByteBlock key(TicketMac::DIGESTSIZE);
+	mac.Final(key.data());
+	return key;
+}
+
+QByteArray SessionTickets::ticketData(const QUuid &deviceId, quint32 keyIndex) const
+{
+	auto data = deviceId.toRfc4122();
+	data.resize(20);
+	qToBigEndian(keyIndex, reinterpret_cast<uchar*>(data.data() + 16));
+	return data;
+}
+
+QByteArray SessionTickets::createMac(const CryptoPP::SecByteBlock &key, const QByteArray &purpose, const QByteArray &data) const
+{
+	TicketMac mac(key.data(), key.size());
+	auto macData = purpose + data;
+	QByteArray result(static_cast<int>(TicketMac::DIGESTSIZE), Qt::Uninitialized);
+	mac.CalculateDigest(reinterpret_cast<byte*>(result.data()),
+						reinterpret_cast<const byte*>(macData.constData()),
+						macData.size());
+	return result;
+}
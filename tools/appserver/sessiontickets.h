@@ -0,0 +1,34 @@
+#ifndef SESSIONTICKETS_H
+#define SESSIONTICKETS_H
+
+#include <tuple>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QSettings>
+#include <QtCore/QUuid>
+
+#include <cryptopp/secblock.h>
+#include <cryptopp/rng.h>
+
+//! Issues and verifies resumption tickets. Is threadsafe, as all methods are const
+class SessionTickets
+{
+public:
+	explicit SessionTickets(const QSettings *configuration, CryptoPP::RandomNumberGenerator &rng);
+
+	bool isEnabled() const;
+
+	std::tuple<QByteArray, QByteArray> issue(const QUuid &deviceId) const; // (ticket, secret)
+	QByteArray verify(const QByteArray &ticket, const QUuid &deviceId) const; // returns the secret, or an empty array if invalid
+
+private:
+	CryptoPP::SecByteBlock _masterKey;
+	qint64 _lifetime;
+
+	quint32 currentIndex() const;
+	CryptoPP::SecByteBlock deriveKey(quint32 keyIndex) const;
+	QByteArray ticketData(const QUuid &deviceId, quint32 keyIndex) const;
+	QByteArray createMac(const CryptoPP::SecByteBlock &key, const QByteArray &purpose, const QByteArray &data) const;
+};
+
+#endif // SESSIONTICKETS_H
@@ -0,0 +1,997 @@
+#include "sqlitecontroller.h"
+#include "app.h"
+
+#include <QtSql/QSqlDriver>
+
+using namespace QtDataSync;
+using std::tuple;
+using std::make_tuple;
+using std::get;
+
+namespace {
+
+//the time (in ms) a connection waits for the write lock of another one
+const int BusyTimeout = 30000;
+
+}
+
+SqliteController::SqliteController(QObject *parent) :
+	DatabaseController(parent)
+{}
+
+QUuid SqliteController::addNewDevice(const QString &name, const QByteArray &signScheme, const QByteArray &signKey, const QByteArray &cryptScheme, const QByteArray &cryptKey, const QByteArray &fingerprint, const QByteArray &keyCmac)
+{
+	Metrics::Timer timer(operationLatency("addNewDevice"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	beginWrite(db);
+
+	try {
+		//create a new user
+		Query createIdentityQuery(db);
+		createIdentityQuery.prepare(QStringLiteral("INSERT INTO users DEFAULT VALUES"));
+		createIdentityQuery.exec();
+		auto userId = createIdentityQuery.lastInsertId();
+		if(!userId.isValid())
+			throw DatabaseException(QSqlError(QString(), QStringLiteral("Unable to get id of last inserted user")));
+
+		//create a device entry
+		auto deviceId = QUuid::createUuid();
+		Query createDeviceQuery(db);
+		createDeviceQuery.prepare(QStringLiteral("INSERT INTO devices "
+												 "(id, userid, name, signscheme, signkey, cryptscheme, cryptkey, fingerprint, keymac) "
+												 "VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?)"));
+		createDeviceQuery.addBindValue(deviceId);
+		createDeviceQuery.addBindValue(userId);
+		createDeviceQuery.addBindValue(name);
+		createDeviceQuery.addBindValue(QString::fromUtf8(signScheme));
+		createDeviceQuery.addBindValue(signKey);
+		createDeviceQuery.addBindValue(QString::fromUtf8(cryptScheme));
+		createDeviceQuery.addBindValue(cryptKey);
+		createDeviceQuery.addBindValue(fingerprint);
+		createDeviceQuery.addBindValue(keyCmac);
+		createDeviceQuery.exec();
+
+		if(!db.commit())
+			throw DatabaseException(db);
+
+		return deviceId;
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+void SqliteController::addNewDeviceToUser(const QUuid &newDeviceId, const QUuid &partnerDeviceId, const QString &name, const QByteArray &signScheme, const QByteArray &signKey, const QByteArray &cryptScheme, const QByteArray &cryptKey, const QByteArray &fingerprint)
+{
+	Metrics::Timer timer(operationLatency("addNewDeviceToUser"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+
+	Query createDeviceQuery(db);
+	createDeviceQuery.prepare(QStringLiteral("INSERT INTO devices "
+											 "(id, userid, name, signscheme, signkey, cryptscheme, cryptkey, fingerprint) "
+											 "VALUES(?, (SELECT userid FROM devices WHERE id = ?), ?, ?, ?, ?, ?, ?)"));
+	createDeviceQuery.addBindValue(newDeviceId);
+	createDeviceQuery.addBindValue(partnerDeviceId);
+	createDeviceQuery.addBindValue(name);
+	createDeviceQuery.addBindValue(QString::fromUtf8(signScheme));
+	createDeviceQuery.addBindValue(signKey);
+	createDeviceQuery.addBindValue(QString::fromUtf8(cryptScheme));
+	createDeviceQuery.addBindValue(cryptKey);
+	createDeviceQuery.addBindValue(fingerprint);
+	createDeviceQuery.exec();
+}
+
+AsymmetricCryptoInfo *SqliteController::loadCrypto(const QUuid &deviceId, CryptoPP::RandomNumberGenerator &rng, QObject *parent)
+{
+	Metrics::Timer timer(operationLatency("loadCrypto"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+
+	Query loadCryptoQuery(db);
+	loadCryptoQuery.prepare(QStringLiteral("SELECT signscheme, signkey, cryptscheme, cryptkey "
+										   "FROM devices "
+										   "WHERE id = ?"));
+	loadCryptoQuery.addBindValue(deviceId);
+	loadCryptoQuery.exec();
+	if(!loadCryptoQuery.first())
+		return nullptr;
+
+	return new AsymmetricCryptoInfo(rng,
+									loadCryptoQuery.value(0).toString().toUtf8(),
+									loadCryptoQuery.value(1).toByteArray(),
+									loadCryptoQuery.value(2).toString().toUtf8(),
+									loadCryptoQuery.value(3).toByteArray(),
+									parent);
+}
+
+bool SqliteController::updateLogin(const QUuid &deviceId, const QString &name)
+{
+	Metrics::Timer timer(operationLatency("updateLogin"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+
+	Query updateNameQuery(db);
+	//devices marked by the cleanup are about to be removed
+	updateNameQuery.prepare(QStringLiteral("UPDATE devices SET name = ?, lastlogin = date('now') "
+										   "WHERE id = ? AND lastlogin != '0000-00-00'"));
+	updateNameQuery.addBindValue(name);
+	updateNameQuery.addBindValue(deviceId);
+	updateNameQuery.exec();
+	return updateNameQuery.numRowsAffected() > 0;
+}
+
+bool SqliteController::updateCmac(const QUuid &deviceId, quint32 keyIndex, const QByteArray &cmac)
+{
+	Metrics::Timer timer(operationLatency("updateCmac"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	beginWrite(db);
+
+	try {
+		Query updateCmacQuery(db);
+		updateCmacQuery.prepare(QStringLiteral("UPDATE devices SET keymac = ? "
+											   "WHERE id = ? AND ( "
+											   "	SELECT keycount FROM users "
+											   "	WHERE id = devices.userid "
+											   ") = ?"));
+		updateCmacQuery.addBindValue(cmac);
+		updateCmacQuery.addBindValue(deviceId);
+		updateCmacQuery.addBindValue(keyIndex);
+		updateCmacQuery.exec();
+
+		if(updateCmacQuery.numRowsAffected() > 0) {
+			Query removeChangesQuery(db);
+			removeChangesQuery.prepare(QStringLiteral("DELETE FROM keychanges "
+													  "WHERE deviceid = ? "
+													  "AND keyindex = ?"));
+			removeChangesQuery.addBindValue(deviceId);
+			removeChangesQuery.addBindValue(keyIndex);
+			removeChangesQuery.exec();
+
+			if(!db.commit())
+				throw DatabaseException(db);
+			return true;
+		} else {
+			db.rollback();
+			return false;
+		}
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+QList<tuple<QUuid, QString, QByteArray>> SqliteController::listDevices(const QUuid &deviceId)
+{
+	Metrics::Timer timer(operationLatency("listDevices"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	Query loadDevicesQuery(db);
+	loadDevicesQuery.prepare(QStringLiteral("SELECT id, name, fingerprint "
+											"FROM devices "
+											"WHERE id != ? "
+											"AND userid = (SELECT userid FROM devices WHERE id = ?)"));
+	loadDevicesQuery.addBindValue(deviceId);
+	loadDevicesQuery.addBindValue(deviceId);
+	loadDevicesQuery.exec();
+
+	QList<tuple<QUuid, QString, QByteArray>> resList;
+	while(loadDevicesQuery.next()) {
+		resList.append(make_tuple(
+						   loadDevicesQuery.value(0).toUuid(),
+						   loadDevicesQuery.value(1).toString(),
+						   loadDevicesQuery.value(2).toByteArray()
+					   ));
+	}
+	return resList;
+}
+
+void SqliteController::removeDevice(const QUuid &deviceId, const QUuid &deleteId)
+{
+	Metrics::Timer timer(operationLatency("removeDevice"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	beginWrite(db);
+
+	try {
+		auto userId = deviceUserId(db, deviceId);
+		if(userId < 0) {
+			if(!db.commit())
+				throw DatabaseException(db);
+			return;
+		}
+
+		//the data of the device is removed with it
+		Query dataSizeQuery(db);
+		dataSizeQuery.prepare(QStringLiteral("SELECT COALESCE(SUM(length(datachanges.data)), 0) FROM datachanges "
+											 "INNER JOIN devices ON devices.id = datachanges.deviceid "
+											 "WHERE devices.id = ? AND devices.userid = ?"));
+		dataSizeQuery.addBindValue(deleteId);
+		dataSizeQuery.addBindValue(userId);
+		dataSizeQuery.exec();
+		auto dataSize = dataSizeQuery.first() ? dataSizeQuery.value(0).toLongLong() : 0;
+
+		Query deleteDeviceQuery(db);
+		deleteDeviceQuery.prepare(QStringLiteral("DELETE FROM devices "
+												 "WHERE id = ? AND userid = ?"));
+		deleteDeviceQuery.addBindValue(deleteId);
+		deleteDeviceQuery.addBindValue(userId);
+		deleteDeviceQuery.exec();
+		if(deleteDeviceQuery.numRowsAffected() > 0)
+			updateQuota(db, userId, -dataSize);
+
+		Query deleteUserQuery(db);
+		deleteUserQuery.prepare(QStringLiteral("DELETE FROM users WHERE id = ? "
+											   "AND NOT EXISTS ( "
+											   "	SELECT 1 FROM devices "
+											   "	WHERE userid = ? "
+											   ")"));
+		deleteUserQuery.addBindValue(userId);
+		deleteUserQuery.addBindValue(userId);
+		deleteUserQuery.exec();
+
+		if(!db.commit())
+			throw DatabaseException(db);
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+bool SqliteController::addChange(const QUuid &deviceId, const QByteArray &dataId, const quint32 keyIndex, const QByteArray &salt, const QByteArray &data)
+{
+	Metrics::Timer timer(operationLatency("addChange"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	beginWrite(db);
+
+	try {
+		auto userId = deviceUserId(db, deviceId);
+		if(userId < 0)
+			throw DatabaseException(QSqlError(QString(), QStringLiteral("Unable to find the user of device %1").arg(deviceId.toString())));
+
+		// delete the entry, in case it already exists. Will do nothing if nothing exists
+		Query oldSizeQuery(db);
+		oldSizeQuery.prepare(QStringLiteral("SELECT length(data) FROM datachanges WHERE deviceid = ? AND dataid = ?"));
+		oldSizeQuery.addBindValue(deviceId);
+		oldSizeQuery.addBindValue(dataId);
+		oldSizeQuery.exec();
+		qint64 delta = oldSizeQuery.first() ? -oldSizeQuery.value(0).toLongLong() : 0;
+
+		Query deleteOldQuery(db);
+		deleteOldQuery.prepare(QStringLiteral("DELETE FROM datachanges WHERE deviceid = ? AND dataid = ?"));
+		deleteOldQuery.addBindValue(deviceId);
+		deleteOldQuery.addBindValue(dataId);
+		deleteOldQuery.exec();
+
+		Query targetsQuery(db);
+		targetsQuery.prepare(QStringLiteral("SELECT id FROM devices WHERE userid = ? AND id != ?"));
+		targetsQuery.addBindValue(userId);
+		targetsQuery.addBindValue(deviceId);
+		targetsQuery.exec();
+		QList<QUuid> targets;
+		while(targetsQuery.next())
+			targets.append(targetsQuery.value(0).toUuid());
+
+		// only add the data change if there are devices to be notified
+		if(!targets.isEmpty()) {
+			Query addChangeQuery(db);
+			addChangeQuery.prepare(QStringLiteral("INSERT INTO datachanges (deviceid, dataid, keyid, salt, data) "
+												  "VALUES(?, ?, ?, ?, ?)"));
+			addChangeQuery.addBindValue(deviceId);
+			addChangeQuery.addBindValue(dataId);
+			addChangeQuery.addBindValue(keyIndex);
+			addChangeQuery.addBindValue(salt);
+			addChangeQuery.addBindValue(data);
+			addChangeQuery.exec();
+			auto nId = addChangeQuery.lastInsertId();
+			if(!nId.isValid())
+				throw DatabaseException(QSqlError(QString(), QStringLiteral("Unable to get id of last inserted data change")));
+			delta += data.size();
+
+			Query updateDevicesQuery(db);
+			updateDevicesQuery.prepare(QStringLiteral("INSERT INTO devicechanges(dataid, deviceid) "
+													  "VALUES(?, ?)"));
+			for(const auto &target : targets) {
+				updateDevicesQuery.addBindValue(nId);
+				updateDevicesQuery.addBindValue(target);
+				updateDevicesQuery.exec();
+			}
+		}
+
+		if(!updateQuota(db, userId, delta)) {
+			db.rollback();
+			qWarning() << "Device" << deviceId << "hit quota limit";
+			return false;
+		}
+
+		if(!db.commit())
+			throw DatabaseException(db);
+		notifyDevices(targets);
+		return true;
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+bool SqliteController::addDeviceChange(const QUuid &deviceId, const QUuid &targetId, const QByteArray &dataId, const quint32 keyIndex, const QByteArray &salt, const QByteArray &data)
+{
+	Metrics::Timer timer(operationLatency("addDeviceChange"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	beginWrite(db);
+
+	try {
+		auto userId = deviceUserId(db, deviceId);
+		if(userId < 0)
+			throw DatabaseException(QSqlError(QString(), QStringLiteral("Unable to find the user of device %1").arg(deviceId.toString())));
+
+		// get the id of the data, or add it if not existing yet
+		QVariant nId;
+		qint64 delta = 0;
+		Query getIdQuery(db);
+		getIdQuery.prepare(QStringLiteral("SELECT id FROM datachanges WHERE deviceid = ? AND dataid = ?"));
+		getIdQuery.addBindValue(deviceId);
+		getIdQuery.addBindValue(dataId);
+		getIdQuery.exec();
+		if(getIdQuery.first())
+			nId = getIdQuery.value(0);
+		else {
+			Query addChangeQuery(db);
+			addChangeQuery.prepare(QStringLiteral("INSERT INTO datachanges (deviceid, dataid, keyid, salt, data) "
+												  "VALUES(?, ?, ?, ?, ?)"));
+			addChangeQuery.addBindValue(deviceId);
+			addChangeQuery.addBindValue(dataId);
+			addChangeQuery.addBindValue(keyIndex);
+			addChangeQuery.addBindValue(salt);
+			addChangeQuery.addBindValue(data);
+			addChangeQuery.exec();
+			nId = addChangeQuery.lastInsertId();
+			if(!nId.isValid())
+				throw DatabaseException(QSqlError(QString(), QStringLiteral("Unable to get id of last inserted data change")));
+			delta = data.size();
+		}
+
+		// add a change for the device (or ignore)
+		Query updateDevicesQuery(db);
+		updateDevicesQuery.prepare(QStringLiteral("INSERT OR IGNORE INTO devicechanges(dataid, deviceid) "
+												  "VALUES(?, ?)"));
+		updateDevicesQuery.addBindValue(nId);
+		updateDevicesQuery.addBindValue(targetId);
+		updateDevicesQuery.exec();
+		auto added = updateDevicesQuery.numRowsAffected() > 0;
+
+		if(!updateQuota(db, userId, delta)) {
+			db.rollback();
+			qWarning() << "Device" << deviceId << "hit quota limit";
+			return false;
+		}
+
+		if(!db.commit())
+			throw DatabaseException(db);
+		if(added)
+			notifyDevices({targetId});
+		return true;
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+quint32 SqliteController::changeCount(const QUuid &deviceId)
+{
+	Metrics::Timer timer(operationLatency("changeCount"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	Query countChangesQuery(db);
+	countChangesQuery.prepare(QStringLiteral("SELECT COUNT(*) FROM devicechanges WHERE deviceid = ?"));
+	countChangesQuery.addBindValue(deviceId);
+	countChangesQuery.exec();
+	if(countChangesQuery.first())
+		return countChangesQuery.value(0).toUInt();
+	else
+		return 0;
+}
+
+QList<tuple<quint64, quint32, QByteArray, QByteArray>> SqliteController::loadNextChanges(const QUuid &deviceId, quint32 count, quint64 lastIndex)
+{
+	Metrics::Timer timer(operationLatency("loadNextChanges"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+
+	Query loadChangesQuery(db);
+	loadChangesQuery.prepare(QStringLiteral("SELECT id, keyid, salt, data FROM devicechanges "
+											"INNER JOIN datachanges ON datachanges.id = devicechanges.dataid "
+											"WHERE devicechanges.deviceid = ? "
+											"AND devicechanges.dataid > ? "
+											"ORDER BY devicechanges.dataid "
+											"LIMIT ?"));
+	loadChangesQuery.addBindValue(deviceId);
+	loadChangesQuery.addBindValue(lastIndex);
+	loadChangesQuery.addBindValue(count);
+	loadChangesQuery.exec();
+
+	QList<tuple<quint64, quint32, QByteArray, QByteArray>> resList;
+	while(loadChangesQuery.next()) {
+		resList.append(make_tuple(
+						   (quint64)loadChangesQuery.value(0).toULongLong(),
+						   (quint32)loadChangesQuery.value(1).toUInt(),
+						   loadChangesQuery.value(2).toByteArray(),
+						   loadChangesQuery.value(3).toByteArray()
+					   ));
+	}
+	return resList;
+}
+
+void SqliteController::completeChanges(const QUuid &deviceId, const QList<quint64> &dataIndexes)
+{
+	if(dataIndexes.isEmpty())
+		return;
+
+	//the indexes are plain numbers, so they can be part of the statement
+	QStringList indexList;
+	indexList.reserve(dataIndexes.size());
+	for(auto dataIndex : dataIndexes)
+		indexList.append(QString::number(dataIndex));
+	auto indexes = indexList.join(QLatin1Char(','));
+
+	Metrics::Timer timer(operationLatency("completeChanges"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	beginWrite(db);
+
+	try {
+		Query completeQuery(db);
+		completeQuery.prepare(QStringLiteral("DELETE FROM devicechanges "
+											 "WHERE deviceid = ? AND dataid IN (%1)")
+							  .arg(indexes));
+		completeQuery.addBindValue(deviceId);
+		completeQuery.exec();
+
+		//data that no device needs anymore is removed, and no longer counts into the quota
+		Query unusedSizeQuery(db);
+		unusedSizeQuery.prepare(QStringLiteral("SELECT devices.userid, SUM(length(datachanges.data)) FROM datachanges "
+											   "INNER JOIN devices ON devices.id = datachanges.deviceid "
+											   "WHERE datachanges.id IN (%1) "
+											   "AND NOT EXISTS ( "
+											   "	SELECT 1 FROM devicechanges "
+											   "	WHERE devicechanges.dataid = datachanges.id "
+											   ") "
+											   "GROUP BY devices.userid")
+								.arg(indexes));
+		unusedSizeQuery.exec();
+		QList<QPair<qint64, qint64>> freed;
+		while(unusedSizeQuery.next())
+			freed.append({unusedSizeQuery.value(0).toLongLong(), unusedSizeQuery.value(1).toLongLong()});
+
+		Query removeUnusedQuery(db);
+		removeUnusedQuery.prepare(QStringLiteral("DELETE FROM datachanges "
+												 "WHERE id IN (%1) "
+												 "AND NOT EXISTS ( "
+												 "	SELECT 1 FROM devicechanges "
+												 "	WHERE devicechanges.dataid = datachanges.id "
+												 ")")
+								  .arg(indexes));
+		removeUnusedQuery.exec();
+		for(const auto &user : freed)
+			updateQuota(db, user.first, -user.second);
+
+		if(!db.commit())
+			throw DatabaseException(db);
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+QList<tuple<QUuid, QByteArray, QByteArray, QByteArray>> SqliteController::tryKeyChange(const QUuid &deviceId, quint32 proposedIndex, int &offset)
+{
+	offset = -1;
+
+	Metrics::Timer timer(operationLatency("tryKeyChange"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	if(!db.transaction())
+		throw DatabaseException(db);
+
+	try {
+		//load current key index
+		Query readIndexQuery(db);
+		readIndexQuery.prepare(QStringLiteral("SELECT keycount, id FROM users "
+											  "WHERE id = (SELECT userid FROM devices WHERE id = ?)"));
+		readIndexQuery.addBindValue(deviceId);
+		readIndexQuery.exec();
+		if(!readIndexQuery.first())
+			throw DatabaseException(db);
+		auto currentIndex = readIndexQuery.value(0).toUInt();
+		auto userId = readIndexQuery.value(1).toLongLong();
+		offset = proposedIndex - currentIndex;
+		if(offset != 1) { //only when 1 the rest is needed
+			if(!db.commit())
+				throw DatabaseException(db);
+			return {};
+		}
+
+		//check if any device still has keychanges
+		Query hasKeyChangesQuery(db);
+		hasKeyChangesQuery.prepare(QStringLiteral("SELECT 1 FROM keychanges "
+												  "INNER JOIN devices ON keychanges.deviceid = devices.id "
+												  "WHERE devices.userid = ?"));
+		hasKeyChangesQuery.addBindValue(userId);
+		hasKeyChangesQuery.exec();
+		if(hasKeyChangesQuery.first()) {
+			offset = -1;
+			if(!db.commit())
+				throw DatabaseException(db);
+			return {};
+		}
+
+		//load device keys
+		Query deviceKeysQuery(db);
+		deviceKeysQuery.prepare(QStringLiteral("SELECT id, cryptscheme, cryptkey, keymac FROM devices "
+											   "WHERE id != ? "
+											   "AND userid = ?"));
+		deviceKeysQuery.addBindValue(deviceId);
+		deviceKeysQuery.addBindValue(userId);
+		deviceKeysQuery.exec();
+
+		QList<tuple<QUuid, QByteArray, QByteArray, QByteArray>> result;
+		while(deviceKeysQuery.next()) {
+			result.append(make_tuple(
+							  deviceKeysQuery.value(0).toUuid(),
+							  deviceKeysQuery.value(1).toByteArray(),
+							  deviceKeysQuery.value(2).toByteArray(),
+							  deviceKeysQuery.value(3).toByteArray()
+						  ));
+		}
+
+		if(!db.commit())
+			throw DatabaseException(db);
+		return result;
+	} catch(...) {
+		offset = -1;
+		db.rollback();
+		throw;
+	}
+}
+
+bool SqliteController::updateExchangeKey(const QUuid &deviceId, quint32 keyIndex, const QByteArray &scheme, const QByteArray &cmac, const QList<tuple<QUuid, QByteArray, QByteArray>> &deviceKeys)
+{
+	Metrics::Timer timer(operationLatency("updateExchangeKey"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	beginWrite(db);
+
+	try {
+		auto userId = deviceUserId(db, deviceId);
+		Query updateKeyCountQuery(db);
+		updateKeyCountQuery.prepare(QStringLiteral("UPDATE users SET keycount = keycount + 1 "
+												   "WHERE id = ? "
+												   "AND (keycount + 1) = ?"));
+		updateKeyCountQuery.addBindValue(userId);
+		updateKeyCountQuery.addBindValue(keyIndex);
+		updateKeyCountQuery.exec();
+		if(updateKeyCountQuery.numRowsAffected() != 1) {
+			db.rollback();
+			return false;
+		}
+
+		for(auto device : deviceKeys) {
+			//check if the device belongs to the same user
+			Query checkAllowedQuery(db);
+			checkAllowedQuery.prepare(QStringLiteral("SELECT 1 FROM devices "
+													 "WHERE id = ? "
+													 "AND userid = ?"));
+			checkAllowedQuery.addBindValue(get<0>(device));
+			checkAllowedQuery.addBindValue(userId);
+			checkAllowedQuery.exec();
+			if(!checkAllowedQuery.first())
+				throw DatabaseException(db);
+
+			//add the keychange
+			Query addKeyQuery(db);
+			addKeyQuery.prepare(QStringLiteral("INSERT INTO keychanges "
+											   "(deviceid, keyindex, scheme, key, verifymac) "
+											   "VALUES(?, ?, ?, ?, ?)"));
+			addKeyQuery.addBindValue(get<0>(device));
+			addKeyQuery.addBindValue(keyIndex);
+			addKeyQuery.addBindValue(QString::fromUtf8(scheme));
+			addKeyQuery.addBindValue(get<1>(device));
+			addKeyQuery.addBindValue(get<2>(device));
+			addKeyQuery.exec();
+		}
+
+		//update the cmac
+		Query updateCmacQuery(db);
+		updateCmacQuery.prepare(QStringLiteral("UPDATE devices SET keymac = ? "
+											   "WHERE id = ?"));
+		updateCmacQuery.addBindValue(cmac);
+		updateCmacQuery.addBindValue(deviceId);
+		updateCmacQuery.exec();
+
+		if(!db.commit())
+			throw DatabaseException(db);
+		return true;
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+tuple<quint32, QByteArray, QByteArray, QByteArray> SqliteController::loadKeyChanges(const QUuid &deviceId)
+{
+	Metrics::Timer timer(operationLatency("loadKeyChanges"));
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+
+	Query keyChangesQuery(db);
+	keyChangesQuery.prepare(QStringLiteral("SELECT keyindex, scheme, key, verifymac FROM keychanges "
+										   "WHERE deviceid = ? "
+										   "ORDER BY keyindex ASC"));
+	keyChangesQuery.addBindValue(deviceId);
+	keyChangesQuery.exec();
+
+	if(keyChangesQuery.first()) {
+		return make_tuple(
+			(quint32)keyChangesQuery.value(0).toUInt(),
+			keyChangesQuery.value(1).toByteArray(),
+			keyChangesQuery.value(2).toByteArray(),
+			keyChangesQuery.value(3).toByteArray()
+		);
+	} else
+		return make_tuple((quint32)0, QByteArray(), QByteArray(), QByteArray());
+}
+
+void SqliteController::initDatabase(quint64 quota, bool forceQuota)
+{
+	try {
+		Metrics::Timer timer(operationLatency("initDatabase"));
+		auto connection = pool()->acquire();
+		auto db = connection.database();
+
+		static const auto features = {
+			QSqlDriver::Transactions,
+			QSqlDriver::BLOB,
+			QSqlDriver::PreparedQueries,
+			QSqlDriver::PositionalPlaceholders,
+			QSqlDriver::LastInsertId
+		};
+		auto driver = db.driver();
+		for(auto feature : features) {
+			if(!driver->hasFeature(feature))
+				throw DatabaseException(QSqlError(QStringLiteral("Driver does not support feature %1").arg(feature)));
+		}
+
+		//readers do not block the writer, and vice versa. Is stored in the database file
+		QSqlQuery walQuery(db);
+		if(!walQuery.exec(QStringLiteral("PRAGMA journal_mode = WAL")) || !walQuery.first())
+			throw DatabaseException(walQuery);
+		if(walQuery.value(0).toString().toLower() != QStringLiteral("wal"))
+			qWarning() << "Unable to enable WAL mode, using journal mode" << walQuery.value(0).toString();
+		walQuery.finish();
+
+		beginWrite(db);
+		try {
+			static const QStringList schema {
+				QStringLiteral("CREATE TABLE IF NOT EXISTS users ( "
+							   "	id			INTEGER PRIMARY KEY AUTOINCREMENT, "
+							   "	keycount	INTEGER NOT NULL DEFAULT 0, "
+							   "	quota		INTEGER NOT NULL DEFAULT 0, "
+							   "	quotalimit	INTEGER NOT NULL DEFAULT %1 "
+							   ")"),
+				QStringLiteral("CREATE TABLE IF NOT EXISTS devices ( "
+							   "	id			TEXT PRIMARY KEY NOT NULL, "
+							   "	userid		INTEGER NOT NULL REFERENCES users(id), "
+							   "	name		TEXT NOT NULL, "
+							   "	signscheme	TEXT NOT NULL, "
+							   "	signkey		BLOB NOT NULL, "
+							   "	cryptscheme	TEXT NOT NULL, "
+							   "	cryptkey	BLOB NOT NULL, "
+							   "	fingerprint	BLOB NOT NULL, "
+							   "	keymac		BLOB, "
+							   "	lastlogin	TEXT NOT NULL DEFAULT (date('now')) "
+							   ")"),
+				QStringLiteral("CREATE INDEX IF NOT EXISTS devices_userid_idx "
+							   "ON devices (userid)"),
+				QStringLiteral("CREATE INDEX IF NOT EXISTS devices_lastlogin_idx "
+							   "ON devices (lastlogin)"),
+				//ids are never reused, as devices continue downloading after the last one
+				QStringLiteral("CREATE TABLE IF NOT EXISTS datachanges ( "
+							   "	id			INTEGER PRIMARY KEY AUTOINCREMENT, "
+							   "	deviceid	TEXT NOT NULL REFERENCES devices(id) ON DELETE CASCADE, "
+							   "	dataid		BLOB NOT NULL, "
+							   "	keyid		INTEGER NOT NULL, "
+							   "	salt		BLOB NOT NULL, "
+							   "	data		BLOB NOT NULL, "
+							   "	UNIQUE(deviceid, dataid) "
+							   ")"),
+				QStringLiteral("CREATE TABLE IF NOT EXISTS devicechanges ( "
+							   "	deviceid	TEXT NOT NULL REFERENCES devices(id) ON DELETE CASCADE, "
+							   "	dataid		INTEGER NOT NULL REFERENCES datachanges(id) ON DELETE CASCADE, "
+							   "	PRIMARY KEY(deviceid, dataid) "
+							   ") WITHOUT ROWID"),
+				QStringLiteral("CREATE INDEX IF NOT EXISTS devicechanges_dataid_idx "
+							   "ON devicechanges (dataid)"),
+				QStringLiteral("CREATE TABLE IF NOT EXISTS keychanges ( "
+							   "	deviceid	TEXT PRIMARY KEY NOT NULL REFERENCES devices(id) ON DELETE CASCADE, "
+							   "	keyindex	INTEGER NOT NULL, "
+							   "	scheme		TEXT NOT NULL, "
+							   "	key			BLOB NOT NULL, "
+							   "	verifymac	BLOB NOT NULL "
+							   ")")
+			};
+			for(const auto &statement : schema) {
+				QSqlQuery createQuery(db);
+				if(!createQuery.exec(statement.arg(quota)))
+					throw DatabaseException(createQuery);
+			}
+
+			updateQuotaLimit(db, quota, forceQuota);
+
+			if(!db.commit())
+				throw DatabaseException(db);
+		} catch(...) {
+			db.rollback();
+			throw;
+		}
+
+		qDebug() << "Opened SQLite database" << db.databaseName();
+		QMetaObject::invokeMethod(this, "dbInitDone", Qt::QueuedConnection,
+								  Q_ARG(bool, true));
+	} catch(DatabaseException &e) {
+		qCritical() << "Failed to setup database:" << e.what();
+		QMetaObject::invokeMethod(this, "dbInitDone", Qt::QueuedConnection,
+								  Q_ARG(bool, false));
+	}
+}
+
+QStringList SqliteController::connectionSetup() const
+{
+	return {
+		QStringLiteral("PRAGMA foreign_keys = ON"),
+		QStringLiteral("PRAGMA busy_timeout = %1").arg(BusyTimeout),
+		//with WAL, only a power loss can lose the latest transactions, but never corrupts the database
+		QStringLiteral("PRAGMA synchronous = NORMAL")
+	};
+}
+
+bool SqliteController::startLiveSync()
+{
+	//all writes go through this controller, so it reports the changes itself after committing them
+	return true;
+}
+
+bool SqliteController::cleanupBatch(quint64 offlineSinceDays, int batchSize, CleanupProgress &progress)
+{
+	auto connection = pool()->acquire();
+	auto db = connection.database();
+	beginWrite(db);
+
+	try {
+		//continue with a marked device, or mark the next inactive one. Marked devices cannot log in anymore
+		Query markedQuery(db);
+		markedQuery.prepare(QStringLiteral("SELECT id, userid FROM devices "
+										   "WHERE lastlogin = '0000-00-00' "
+										   "LIMIT 1"));
+		markedQuery.exec();
+		auto hasDevice = markedQuery.first();
+		auto deviceId = hasDevice ? markedQuery.value(0).toUuid() : QUuid();
+		auto userId = hasDevice ? markedQuery.value(1).toLongLong() : -1;
+		if(!hasDevice && offlineSinceDays > 0) {
+			Query inactiveQuery(db);
+			inactiveQuery.prepare(QStringLiteral("SELECT id, userid FROM devices "
+												 "WHERE lastlogin < date('now', ?) "
+												 "LIMIT 1"));
+			inactiveQuery.addBindValue(QStringLiteral("-%1 days").arg(offlineSinceDays));
+			inactiveQuery.exec();
+			hasDevice = inactiveQuery.first();
+			if(hasDevice) {
+				deviceId = inactiveQuery.value(0).toUuid();
+				userId = inactiveQuery.value(1).toLongLong();
+
+				Query markQuery(db);
+				markQuery.prepare(QStringLiteral("UPDATE devices SET lastlogin = '0000-00-00' "
+												 "WHERE id = ?"));
+				markQuery.addBindValue(deviceId);
+				markQuery.exec();
+			}
+		}
+
+		auto more = true;
+		if(hasDevice) {
+			//first the pending changes of the device, then it's own data (and the changes of other devices for it)
+			Query deleteDeviceChangesQuery(db);
+			deleteDeviceChangesQuery.prepare(QStringLiteral("DELETE FROM devicechanges "
+															"WHERE deviceid = ? AND dataid IN ( "
+															"	SELECT dataid FROM devicechanges "
+															"	WHERE deviceid = ? "
+															"	LIMIT ? "
+															")"));
+			deleteDeviceChangesQuery.addBindValue(deviceId);
+			deleteDeviceChangesQuery.addBindValue(deviceId);
+			deleteDeviceChangesQuery.addBindValue(batchSize);
+			deleteDeviceChangesQuery.exec();
+			auto rows = deleteDeviceChangesQuery.numRowsAffected();
+
+			if(rows == 0) {
+				Query dataSizeQuery(db);
+				dataSizeQuery.prepare(QStringLiteral("SELECT COALESCE(SUM(length(data)), 0) FROM ( "
+													 "	SELECT data FROM datachanges "
+													 "	WHERE deviceid = ? "
+													 "	ORDER BY id "
+													 "	LIMIT ? "
+													 ")"));
+				dataSizeQuery.addBindValue(deviceId);
+				dataSizeQuery.addBindValue(batchSize);
+				dataSizeQuery.exec();
+				auto dataSize = dataSizeQuery.first() ? dataSizeQuery.value(0).toLongLong() : 0;
+
+				Query deleteDataQuery(db);
+				deleteDataQuery.prepare(QStringLiteral("DELETE FROM datachanges "
+													   "WHERE id IN ( "
+													   "	SELECT id FROM datachanges "
+													   "	WHERE deviceid = ? "
+													   "	ORDER BY id "
+													   "	LIMIT ? "
+													   ")"));
+				deleteDataQuery.addBindValue(deviceId);
+				deleteDataQuery.addBindValue(batchSize);
+				deleteDataQuery.exec();
+				rows = deleteDataQuery.numRowsAffected();
+				if(rows > 0)
+					updateQuota(db, userId, -dataSize);
+			}
+
+			if(rows == 0) {
+				Query deleteDeviceQuery(db);
+				deleteDeviceQuery.prepare(QStringLiteral("DELETE FROM devices WHERE id = ?"));
+				deleteDeviceQuery.addBindValue(deviceId);
+				deleteDeviceQuery.exec();
+				if(deleteDeviceQuery.numRowsAffected() > 0)
+					progress.devices++;
+			} else
+				progress.changes += static_cast<quint64>(rows);
+		} else {
+			Query deleteUsersQuery(db);
+			deleteUsersQuery.prepare(QStringLiteral("DELETE FROM users "
+													"WHERE id IN ( "
+													"	SELECT id FROM users "
+													"	WHERE NOT EXISTS ( "
+													"		SELECT 1 FROM devices "
+													"		WHERE userid = users.id "
+													"	) "
+													"	LIMIT ? "
+													")"));
+			deleteUsersQuery.addBindValue(batchSize);
+			deleteUsersQuery.exec();
+			auto rows = deleteUsersQuery.numRowsAffected();
+			progress.users += static_cast<quint64>(qMax(rows, 0));
+			more = rows > 0;
+		}
+
+		if(!db.commit())
+			throw DatabaseException(db);
+		return more;
+	} catch(...) {
+		db.rollback();
+		throw;
+	}
+}
+
+void SqliteController::beginWrite(QSqlDatabase &db)
+{
+	//takes the write lock right away, instead of failing to upgrade a read transaction later
+	QSqlQuery beginQuery(db);
+	if(!beginQuery.exec(QStringLiteral("BEGIN IMMEDIATE"))) {
+		countError();
+		throw DatabaseException(beginQuery);
+	}
+}
+
+qint64 SqliteController::deviceUserId(QSqlDatabase &db, const QUuid &deviceId)
+{
+	Query userIdQuery(db);
+	userIdQuery.prepare(QStringLiteral("SELECT userid FROM devices WHERE id = ?"));
+	userIdQuery.addBindValue(deviceId);
+	userIdQuery.exec();
+	if(userIdQuery.first())
+		return userIdQuery.value(0).toLongLong();
+	else
+		return -1;
+}
+
+bool SqliteController::updateQuota(QSqlDatabase &db, qint64 userId, qint64 delta)
+{
+	if(delta == 0)
+		return true;
+
+	Query updateQuotaQuery(db);
+	updateQuotaQuery.prepare(QStringLiteral("UPDATE users SET quota = MAX(quota + ?, 0) "
+											"WHERE id = ?"));
+	updateQuotaQuery.addBindValue(delta);
+	updateQuotaQuery.addBindValue(userId);
+	updateQuotaQuery.exec();
+	if(delta < 0)
+		return true;
+
+	//same as the CHECK constraint of PostgreSQL, only growing is limited
+	Query checkQuotaQuery(db);
+	checkQuotaQuery.prepare(QStringLiteral("SELECT quota < quotalimit FROM users WHERE id = ?"));
+	checkQuotaQuery.addBindValue(userId);
+	checkQuotaQuery.exec();
+	return checkQuotaQuery.first() && checkQuotaQuery.value(0).toBool();
+}
+
+void SqliteController::updateQuotaLimit(QSqlDatabase &db, quint64 quota, bool forceQuota)
+{
+	if(forceQuota) {
+		Query deleteOverQuotaDevicesQuery(db);
+		deleteOverQuotaDevicesQuery.prepare(QStringLiteral("DELETE FROM devices "
+														   "WHERE userid IN ( "
+														   "	SELECT id FROM users "
+														   "	WHERE quotalimit != ? "
+														   "	AND quota >= ? "
+														   ")"));
+		deleteOverQuotaDevicesQuery.addBindValue(quota);
+		deleteOverQuotaDevicesQuery.addBindValue(quota);
+		deleteOverQuotaDevicesQuery.exec();
+		auto devNum = deleteOverQuotaDevicesQuery.numRowsAffected();
+
+		Query deleteOverQuotaUsersQuery(db);
+		deleteOverQuotaUsersQuery.prepare(QStringLiteral("DELETE FROM users "
+														 "WHERE quotalimit != ? "
+														 "AND quota >= ?"));
+		deleteOverQuotaUsersQuery.addBindValue(quota);
+		deleteOverQuotaUsersQuery.addBindValue(quota);
+		deleteOverQuotaUsersQuery.exec();
+		auto usrNum = deleteOverQuotaUsersQuery.numRowsAffected();
+
+		if(usrNum == 0 && devNum == 0)
+			qDebug() << "No users or devices deleted that exceed quota limit";
+		else {
+			qInfo() << "Deleted" << devNum << "devices and" << usrNum
+					<< "users because their quota exceeded the limit of" << quota;
+		}
+	}
+
+	Query updateQuotaLimitQuery(db);
+	updateQuotaLimitQuery.prepare(QStringLiteral("UPDATE users SET quotalimit = ? "
+												 "WHERE quotalimit != ? "
+												 "AND quota < ?"));
+	updateQuotaLimitQuery.addBindValue(quota);
+	updateQuotaLimitQuery.addBindValue(quota);
+	updateQuotaLimitQuery.addBindValue(quota);
+	updateQuotaLimitQuery.exec();
+	auto quotaChanged = updateQuotaLimitQuery.numRowsAffected();
+	if(quotaChanged > 0) {
+		qInfo() << "Updated quota limit of" << quotaChanged
+				<< "users to the new limit" << quota;
+	} else
+		qDebug() << "No quota changed for any user";
+
+	if(!forceQuota) {
+		Query checkQuotaLimitQuery(db);
+		checkQuotaLimitQuery.prepare(QStringLiteral("SELECT Count(*) FROM users "
+													"WHERE quotalimit != ?"));
+		checkQuotaLimitQuery.addBindValue(quota);
+		checkQuotaLimitQuery.exec();
+		if(checkQuotaLimitQuery.first()) {
+			auto unmatching = checkQuotaLimitQuery.value(0).toULongLong();
+			if(unmatching > 0) {
+				qWarning() << "Currently" << unmatching << "users cannot be update to new quota"
+						   << quota << "because they would exceed that limit.";
+			}
+		}
+	}
+}
+
+void SqliteController::notifyDevices(const QList<QUuid> &devices)
+{
+	if(!isLiveSync())
+		return;
+	for(const auto &device : devices)
+		deviceChanged(device);
+}
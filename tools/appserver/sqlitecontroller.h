@@ -0,0 +1,74 @@
+#ifndef SQLITECONTROLLER_H
+#define SQLITECONTROLLER_H
+
+#include "databasecontroller.h"
+
+//! An embedded SQLite storage in WAL mode. Quota accounting and live sync events are done by the controller itself
+class SqliteController : public DatabaseController
+{
+	Q_OBJECT
+
+public:
+	explicit SqliteController(QObject *parent = nullptr);
+
+	QUuid addNewDevice(const QString &name,
+					   const QByteArray &signScheme,
+					   const QByteArray &signKey,
+					   const QByteArray &cryptScheme,
+					   const QByteArray &cryptKey,
+					   const QByteArray &fingerprint,
+					   const QByteArray &keyCmac) override;
+	void addNewDeviceToUser(const QUuid &newDeviceId,
+							const QUuid &partnerDeviceId,
+							const QString &name,
+							const QByteArray &signScheme,
+							const QByteArray &signKey,
+							const QByteArray &cryptScheme,
+							const QByteArray &cryptKey,
+							const QByteArray &fingerprint) override;
+	QtDataSync::AsymmetricCryptoInfo *loadCrypto(const QUuid &deviceId,
+												 CryptoPP::RandomNumberGenerator &rng,
+												 QObject *parent = nullptr) override;
+	bool updateLogin(const QUuid &deviceId, const QString &name) override;
+	bool updateCmac(const QUuid &deviceId, quint32 keyIndex, const QByteArray &cmac) override;
+	QList<std::tuple<QUuid, QString, QByteArray>> listDevices(const QUuid &deviceId) override;
+	void removeDevice(const QUuid &deviceId, const QUuid &deleteId) override;
+
+	bool addChange(const QUuid &deviceId,
+				   const QByteArray &dataId,
+				   const quint32 keyIndex,
+				   const QByteArray &salt,
+				   const QByteArray &data) override;
+	bool addDeviceChange(const QUuid &deviceId,
+						 const QUuid &targetId,
+						 const QByteArray &dataId,
+						 const quint32 keyIndex,
+						 const QByteArray &salt,
+						 const QByteArray &data) override;
+
+	quint32 changeCount(const QUuid &deviceId) override;
+	QList<std::tuple<quint64, quint32, QByteArray, QByteArray>> loadNextChanges(const QUuid &deviceId, quint32 count, quint64 lastIndex) override;
+	void completeChanges(const QUuid &deviceId, const QList<quint64> &dataIndexes) override;
+
+	QList<std::tuple<QUuid, QByteArray, QByteArray, QByteArray>> tryKeyChange(const QUuid &deviceId, quint32 proposedIndex, int &offset) override;
+	bool updateExchangeKey(const QUuid &deviceId,
+						   quint32 keyIndex,
+						   const QByteArray &scheme, const QByteArray &cmac,
+						   const QList<std::tuple<QUuid, QByteArray, QByteArray>> &deviceKeys) override;
+	std::tuple<quint32, QByteArray, QByteArray, QByteArray> loadKeyChanges(const QUuid &deviceId) override;
+
+protected:
+	void initDatabase(quint64 quota, bool forceQuota) override;
+	QStringList connectionSetup() const override;
+	bool startLiveSync() override;
+	bool cleanupBatch(quint64 offlineSinceDays, int batchSize, CleanupProgress &progress) override;
+
+private:
+	void beginWrite(QSqlDatabase &db);
+	qint64 deviceUserId(QSqlDatabase &db, const QUuid &deviceId);
+	bool updateQuota(QSqlDatabase &db, qint64 userId, qint64 delta);
+	void updateQuotaLimit(QSqlDatabase &db, quint64 quota, bool forceQuota);
+	void notifyDevices(const QList<QUuid> &devices);
+};
+
+#endif // SQLITECONTROLLER_H
@@ -0,0 +1,317 @@
+#include "strandexecutor.h"
+
+#include <QtCore/QQueue>
+#include <QtCore/QThread>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QVector>
+
+namespace {
+
+//the number of tasks a strand can run, before other strands of the same worker get their turn
+const int BatchSize = 32;
+
+}
+
+class StrandExecutor::State
+{
+public:
+	struct Current {
+		inline Current(State *state = nullptr, int index = -1) :
+			state(state),
+			index(index)
+		{}
+
+		State *state;
+		int index;
+	};
+	static QThreadStorage<Current> current;
+
+	QVector<Worker*> workers;
+	QAtomicInt queued;
+	QAtomicInt sleeping;
+	QAtomicInteger<quint32> nextWorker;
+	QAtomicInt stopped;
+
+	QMutex idleMutex;
+	QWaitCondition idleCondition;
+	bool stopping; //guarded by idleMutex
+
+	State();
+
+	void schedule(const QSharedPointer<Strand> &strand);
+	QSharedPointer<Strand> take(int index);
+	bool waitForWork();
+};
+
+class StrandExecutor::Worker : public QThread
+{
+public:
+	Worker(State *state, int index);
+
+	QMutex mutex;
+	QQueue<QSharedPointer<Strand>> queue;
+
+protected:
+	void run() override;
+
+private:
+	State * const _state;
+	const int _index;
+};
+
+QThreadStorage<StrandExecutor::State::Current> StrandExecutor::State::current;
+
+StrandExecutor::StrandExecutor(int threadCount, QObject *parent) :
+	QObject(parent),
+	_state(QSharedPointer<State>::create())
+{
+	threadCount = qMax(1, threadCount);
+	_state->workers.reserve(threadCount);
+	for(auto i = 0; i < threadCount; i++)
+		_state->workers.append(new Worker(_state.data(), i));
+	for(auto worker : _state->workers)
+		worker->start();
+}
+
+StrandExecutor::~StrandExecutor()
+{
+	stop();
+	qDeleteAll(_state->workers);
+	_state->workers.clear();
+}
+
+QSharedPointer<StrandExecutor::Strand> StrandExecutor::createStrand()
+{
+	return QSharedPointer<Strand>(new Strand(_state));
+}
+
+int StrandExecutor::threadCount() const
+{
+	return _state->workers.size();
+}
+
+int StrandExecutor::queuedStrands() const
+{
+	return qMax(0, _state->queued.load());
+}
+
+void StrandExecutor::stop()
+{
+	{
+		QMutexLocker lock(&_state->idleMutex);
+		if(_state->stopping)
+			return;
+		_state->stopping = true;
+		_state->idleCondition.wakeAll();
+	}
+
+	for(auto worker : _state->workers)
+		worker->wait();
+	_state->stopped.storeRelease(1);
+}
+
+
+
+StrandExecutor::Strand::Strand(const QSharedPointer<State> &state) :
+	_state(state),
+	_head(&_stub),
+	_tail(&_stub),
+	_stub(),
+	_pending(0),
+	_closed(0),
+	_doneMutex(),
+	_doneCondition()
+{}
+
+StrandExecutor::Strand::~Strand()
+{
+	//only left if the executor was stopped before they could run
+	while(auto node = pop())
+		delete node;
+}
+
+void StrandExecutor::Strand::enqueue(const Task &task)
+{
+	if(_closed.loadAcquire())
+		return;
+	push(new Node(task));
+}
+
+void StrandExecutor::Strand::close(const Task &onDone)
+{
+	if(_closed.testAndSetOrdered(0, 1))
+		push(new Node(onDone, true));
+}
+
+bool StrandExecutor::Strand::isFinished() const
+{
+	return _pending.loadAcquire() == 0;
+}
+
+void StrandExecutor::Strand::waitForDone()
+{
+	QMutexLocker lock(&_doneMutex);
+	while(_pending.loadAcquire() != 0 && !_state->stopped.loadAcquire())
+		_doneCondition.wait(&_doneMutex);
+}
+
+void StrandExecutor::Strand::push(Node *node)
+{
+	link(node);
+	//only the first pending task schedules the strand, the worker keeps it until all are done
+	if(_pending.fetchAndAddOrdered(1) == 0)
+		_state->schedule(sharedFromThis());
+}
+
+void StrandExecutor::Strand::link(Node *node)
+{
+	node->next.storeRelease(nullptr);
+	auto prev = _head.fetchAndStoreOrdered(node);
+	prev->next.storeRelease(node);
+}
+
+StrandExecutor::Strand::Node *StrandExecutor::Strand::pop()
+{
+	auto tail = _tail;
+	auto next = tail->next.loadAcquire();
+	if(tail == &_stub) {
+		if(!next)
+			return nullptr;
+		_tail = next;
+		tail = next;
+		next = next->next.loadAcquire();
+	}
+
+	if(next) {
+		_tail = next;
+		return tail;
+	}
+
+	if(tail != _head.loadAcquire()) //a producer has not yet linked its node
+		return nullptr;
+
+	//requeue the stub, so the last node can be taken
+	link(&_stub);
+	next = tail->next.loadAcquire();
+	if(next) {
+		_tail = next;
+		return tail;
+	} else
+		return nullptr;
+}
+
+bool StrandExecutor::Strand::runBatch()
+{
+	for(auto i = 0; i < BatchSize; i++) {
+		Node *node;
+		while(!(node = pop())) //the task is counted, but not linked yet
+			QThread::yieldCurrentThread();
+
+		if(node->task && (node->always || !_closed.loadAcquire()))
+			node->task();
+		delete node;
+
+		if(_pending.fetchAndSubOrdered(1) == 1) {
+			QMutexLocker lock(&_doneMutex);
+			_doneCondition.wakeAll();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+StrandExecutor::Strand::Node::Node(const Task &task, bool always) :
+	next(nullptr),
+	task(task),
+	always(always)
+{}
+
+
+
+StrandExecutor::State::State() :
+	workers(),
+	queued(0),
+	sleeping(0),
+	nextWorker(0),
+	stopped(0),
+	idleMutex(),
+	idleCondition(),
+	stopping(false)
+{}
+
+void StrandExecutor::State::schedule(const QSharedPointer<Strand> &strand)
+{
+	if(stopped.loadAcquire())
+		return;
+
+	//workers keep their strands, others are distributed. Idle workers steal from the busy ones
+	int index;
+	const auto &cur = current.localData();
+	if(cur.state == this)
+		index = cur.index;
+	else
+		index = static_cast<int>(nextWorker.fetchAndAddRelaxed(1) % static_cast<quint32>(workers.size()));
+
+	auto worker = workers[index];
+	{
+		QMutexLocker lock(&worker->mutex);
+		worker->queue.enqueue(strand);
+	}
+	queued.fetchAndAddOrdered(1);
+
+	if(sleeping.loadAcquire() > 0) {
+		QMutexLocker lock(&idleMutex);
+		idleCondition.wakeOne();
+	}
+}
+
+QSharedPointer<StrandExecutor::Strand> StrandExecutor::State::take(int index)
+{
+	for(auto i = 0; i < workers.size(); i++) {
+		auto worker = workers[(index + i) % workers.size()];
+		QMutexLocker lock(&worker->mutex);
+		if(!worker->queue.isEmpty()) {
+			queued.fetchAndSubOrdered(1);
+			//steal from the back, to not compete with the owner
+			return i == 0 ? worker->queue.dequeue() : worker->queue.takeLast();
+		}
+	}
+	return {};
+}
+
+bool StrandExecutor::State::waitForWork()
+{
+	QMutexLocker lock(&idleMutex);
+	sleeping.fetchAndAddOrdered(1);
+	while(queued.loadAcquire() <= 0 && !stopping)
+		idleCondition.wait(&idleMutex);
+	sleeping.fetchAndSubOrdered(1);
+	//when stopping, the remaining work is done first
+	return queued.loadAcquire() > 0 || !stopping;
+}
+
+
+
+StrandExecutor::Worker::Worker(State *state, int index) :
+	QThread(),
+	mutex(),
+	queue(),
+	_state(state),
+	_index(index)
+{
+	setObjectName(QStringLiteral("StrandWorker-%1").arg(index));
+}
+
+void StrandExecutor::Worker::run()
+{
+	State::current.setLocalData(State::Current(_state, _index));
+	forever {
+		auto strand = _state->take(_index);
+		if(strand) {
+			if(strand->runBatch())
+				_state->schedule(strand);
+		} else if(!_state->waitForWork())
+			break;
+	}
+}
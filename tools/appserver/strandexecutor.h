@@ -0,0 +1,85 @@
+#ifndef STRANDEXECUTOR_H
+#define STRANDEXECUTOR_H
+
+#include <functional>
+
+#include <QtCore/QObject>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QSharedPointer>
+
+//! Runs tasks on a fixed set of worker threads, that steal work from each other once idle
+class StrandExecutor : public QObject
+{
+	Q_OBJECT
+
+	class State;
+	class Worker;
+
+public:
+	typedef std::function<void()> Task;
+
+	//! A task queue that runs its tasks in order and never in parallel. Is threadsafe
+	class Strand : public QEnableSharedFromThis<Strand>
+	{
+		Q_DISABLE_COPY(Strand)
+		friend class StrandExecutor;
+
+	public:
+		~Strand();
+
+		//! Runs the task after all previously enqueued ones. Does nothing once closed
+		void enqueue(const Task &task);
+		//! Drops all tasks that have not been started yet. onDone is run once the current task finished
+		void close(const Task &onDone = {});
+
+		bool isFinished() const;
+		//! Blocks until all tasks are done, or the executor was stopped
+		void waitForDone();
+
+	private:
+		struct Node {
+			Node(const Task &task = {}, bool always = false);
+
+			QAtomicPointer<Node> next;
+			const Task task;
+			const bool always;
+		};
+
+		const QSharedPointer<State> _state;
+		//lock free MPSC queue: producers push to the head, the running worker pops from the tail
+		QAtomicPointer<Node> _head;
+		Node *_tail;
+		Node _stub;
+		QAtomicInt _pending;
+		QAtomicInt _closed;
+
+		QMutex _doneMutex;
+		QWaitCondition _doneCondition;
+
+		Strand(const QSharedPointer<State> &state);
+
+		void push(Node *node);
+		void link(Node *node);
+		Node *pop();
+		bool runBatch();
+	};
+
+	explicit StrandExecutor(int threadCount, QObject *parent = nullptr);
+	~StrandExecutor() override;
+
+	QSharedPointer<Strand> createStrand();
+	int threadCount() const;
+	//! The number of strands with pending tasks, that wait for a worker
+	int queuedStrands() const;
+
+	//! Runs all remaining tasks and then stops the workers
+	void stop();
+
+private:
+	QSharedPointer<State> _state;
+};
+
+#endif // STRANDEXECUTOR_H